@@ -10,23 +10,71 @@ INCLUDEPATH += ./include
 SOURCES += src/Logger.cpp \
            src/AbstractAppender.cpp \
            src/AbstractStringAppender.cpp \
+           src/AsyncAppender.cpp \
+           src/BinaryFileAppender.cpp \
            src/ConsoleAppender.cpp \
+           src/DedupAppender.cpp \
            src/FileAppender.cpp \
+           src/JsonAppender.cpp \
+           src/MmapFileAppender.cpp \
+           src/RingBufferAppender.cpp \
            src/RollingFileAppender.cpp
 
 HEADERS += include/Logger.h \
+           include/LoggerStatistics.h \
            include/CuteLogger_global.h \
            include/AbstractAppender.h \
            include/AbstractStringAppender.h \
+           include/AsyncAppender.h \
+           include/BinaryFileAppender.h \
            include/ConsoleAppender.h \
+           include/DedupAppender.h \
            include/FileAppender.h \
-           include/RollingFileAppender.h
+           include/JsonAppender.h \
+           include/MmapFileAppender.h \
+           include/RingBufferAppender.h \
+           include/RollingFileAppender.h \
+           src/StripedCounter.h \
+           src/ThreadBufferPool.h \
+           src/Utf8Encoder.h
 
 win32 {
     SOURCES += src/OutputDebugAppender.cpp
     HEADERS += include/OutputDebugAppender.h
 }
 
+# Compression of the rolled over files in RollingFileAppender, enabled with CONFIG+=cutelogger_zlib cutelogger_zstd
+cutelogger_zlib {
+    DEFINES += CUTELOGGER_ZLIB
+    LIBS += -lz
+}
+
+cutelogger_zstd {
+    DEFINES += CUTELOGGER_ZSTD
+    LIBS += -lzstd
+}
+
+# NetworkAppender is only built with QtNetwork
+qtHaveModule(network) {
+    QT += network
+    SOURCES += src/NetworkAppender.cpp
+    HEADERS += include/NetworkAppender.h
+}
+
+# SharedMemoryAppender needs the POSIX shared memory
+unix:!android {
+    SOURCES += src/SharedMemoryAppender.cpp
+    HEADERS += include/SharedMemoryAppender.h
+    linux: LIBS += -lrt
+}
+
+# JournaldAppender, enabled with CONFIG+=cutelogger_journald on the systemd hosts
+cutelogger_journald {
+    SOURCES += src/JournaldAppender.cpp
+    HEADERS += include/JournaldAppender.h
+    LIBS += -lsystemd
+}
+
 android {
     SOURCES += src/AndroidAppender.cpp
     HEADERS += include/AndroidAppender.h
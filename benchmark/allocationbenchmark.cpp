@@ -0,0 +1,157 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Counts the heap allocations made by a single log record in the steady state, after the per-thread buffers have
+// grown to their working size
+
+// Local
+#include <Logger.h>
+#include <FileAppender.h>
+
+// Qt
+#include <QCoreApplication>
+#include <QTemporaryDir>
+
+// STL
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+
+typedef std::function<void()> RecordFunction;
+
+
+static std::atomic<quint64> allocationCount(0);
+static std::atomic<quint64> allocationBytes(0);
+
+// Only the allocations of the benchmark thread are counted. Trivial thread_local doesn't allocate on access.
+static thread_local bool countAllocations = false;
+
+
+static inline void countAllocation(size_t size)
+{
+  if (countAllocations)
+  {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+  }
+}
+
+
+#if defined(__GLIBC__)
+// Qt containers allocate with malloc() directly, so the C allocator itself is replaced. glibc exports the original
+// functions under the __libc_ names.
+extern "C"
+{
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t count, size_t size);
+  void* __libc_realloc(void* pointer, size_t size);
+  void __libc_free(void* pointer);
+
+  void* malloc(size_t size)
+  {
+    countAllocation(size);
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t count, size_t size)
+  {
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+  }
+
+  void* realloc(void* pointer, size_t size)
+  {
+    countAllocation(size);
+    return __libc_realloc(pointer, size);
+  }
+
+  void free(void* pointer)
+  {
+    __libc_free(pointer);
+  }
+}
+
+static const char* allocatorName = "malloc";
+#else
+// Only operator new is seen here, the Qt containers data allocated with malloc() is not counted
+void* operator new(size_t size)
+{
+  countAllocation(size);
+  if (void* pointer = std::malloc(size ? size : 1))
+    return pointer;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+  std::free(pointer);
+}
+
+static const char* allocatorName = "operator new";
+#endif
+
+
+static void runScenario(const char* name, const RecordFunction& record, int records)
+{
+  // Let the thread buffers, the caches and the log file grow
+  for (int i = 0; i < 1000; ++i)
+    record();
+
+  allocationCount.store(0);
+  allocationBytes.store(0);
+
+  countAllocations = true;
+  for (int i = 0; i < records; ++i)
+    record();
+  countAllocations = false;
+
+  std::printf("%-24s %16.2f %16.1f\n", name, double(allocationCount.load()) / records,
+              double(allocationBytes.load()) / records);
+  std::fflush(stdout);
+}
+
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  const int records = argc > 1 ? QByteArray(argv[1]).toInt() : 100000;
+
+  QTemporaryDir dir;
+  if (!dir.isValid())
+  {
+    std::fprintf(stderr, "Cannot create the temporary directory\n");
+    return 1;
+  }
+
+  FileAppender* appender = new FileAppender(dir.path() + QStringLiteral("/file.log"));
+  cuteLogger->registerAppender(appender);
+
+  std::printf("Counting %s calls\n", allocatorName);
+  std::printf("%-24s %16s %16s\n", "scenario", "allocs/record", "bytes/record");
+
+  int x = 42;
+  runScenario("printf %d", [&x]() { LOG_INFO("x=%d", x); }, records);
+  runScenario("printf %s %d", [&x]() { LOG_INFO("name=%s x=%d", "value", x); }, records);
+  runScenario("QString", []() { LOG_INFO(QStringLiteral("Benchmark message")); }, records);
+  runScenario("printf %f (fallback)", []() { LOG_INFO("value=%f", 4.2); }, records);
+  runScenario("QDebug", [&x]() { LOG_INFO() << "x =" << x; }, records);
+
+  cuteLogger->removeAppender(appender);
+  delete appender;
+
+  return 0;
+}
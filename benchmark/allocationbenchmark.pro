@@ -0,0 +1,5 @@
+include(benchmark.pri)
+
+TARGET = allocationbenchmark
+
+SOURCES += allocationbenchmark.cpp
@@ -0,0 +1,8 @@
+QT       -= gui
+
+TEMPLATE = app
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+INCLUDEPATH += $$PWD/../include
+LIBS += -L$$OUT_PWD/.. -lCuteLogger
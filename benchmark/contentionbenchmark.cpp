@@ -0,0 +1,161 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Measures how the logging throughput scales with the number of the threads writing to the same logger. The second
+// pass keeps registering and removing the appender meanwhile, so the writers read the routing snapshots being replaced
+// and the removal waits for the writers to leave the replaced ones.
+
+// Local
+#include <Logger.h>
+#include <AbstractAppender.h>
+
+// Qt
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QAtomicInt>
+#include <QList>
+
+// STL
+#include <cstdio>
+
+
+// Appender doing nothing, so only the logger overhead is measured
+class NullAppender : public AbstractAppender
+{
+  public:
+    NullAppender()
+    {
+      setAppendSerialized(false);
+    }
+
+  protected:
+    virtual void append(const QDateTime&, Logger::LogLevel, const char*, int, const char*, const QString&,
+                        const QString&)
+    {}
+};
+
+
+class WriterThread : public QThread
+{
+  public:
+    explicit WriterThread(int records)
+      : m_records(records)
+    {}
+
+  protected:
+    virtual void run()
+    {
+      const QString message = QStringLiteral("Benchmark message");
+      for (int i = 0; i < m_records; ++i)
+        LOG_INFO(message);
+    }
+
+  private:
+    int m_records;
+};
+
+
+// Registers and removes the appender until stopped, every change publishes the new routing snapshot
+class ReconfigureThread : public QThread
+{
+  public:
+    ReconfigureThread()
+      : m_changes(0)
+    {}
+
+    void stop()
+    {
+      m_stopped.storeRelease(1);
+    }
+
+    int changes() const
+    {
+      return m_changes;
+    }
+
+  protected:
+    virtual void run()
+    {
+      NullAppender appender;
+      while (!m_stopped.loadAcquire())
+      {
+        cuteLogger->registerAppender(&appender);
+        cuteLogger->removeAppender(&appender);
+        m_changes += 2;
+      }
+    }
+
+  private:
+    QAtomicInt m_stopped;
+    int m_changes;
+};
+
+
+static void runPass(int recordsPerThread, int maxThreads, bool reconfigure)
+{
+  if (reconfigure)
+    std::printf("\n%8s %14s %16s %16s\n", "threads", "records/s", "ns per record", "changes/s");
+  else
+    std::printf("%8s %14s %16s\n", "threads", "records/s", "ns per record");
+
+  // Powers of two, ending with exactly maxThreads
+  for (int threads = 1; threads <= maxThreads;
+       threads = threads < maxThreads ? qMin(threads * 2, maxThreads) : threads + 1)
+  {
+    QList<WriterThread*> writers;
+    for (int i = 0; i < threads; ++i)
+      writers.append(new WriterThread(recordsPerThread));
+
+    ReconfigureThread reconfigureThread;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (reconfigure)
+      reconfigureThread.start();
+    foreach (WriterThread* writer, writers)
+      writer->start();
+    foreach (WriterThread* writer, writers)
+      writer->wait();
+
+    const qint64 elapsed = qMax(timer.nsecsElapsed(), qint64(1));
+    qDeleteAll(writers);
+
+    reconfigureThread.stop();
+    reconfigureThread.wait();
+
+    const double records = double(recordsPerThread) * threads;
+    if (reconfigure)
+      std::printf("%8d %14.0f %16.1f %16.0f\n", threads, records * 1e9 / elapsed, double(elapsed) / records,
+                  reconfigureThread.changes() * 1e9 / elapsed);
+    else
+      std::printf("%8d %14.0f %16.1f\n", threads, records * 1e9 / elapsed, double(elapsed) / records);
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  const int recordsPerThread = argc > 1 ? QByteArray(argv[1]).toInt() : 200000;
+  const int maxThreads = argc > 2 ? QByteArray(argv[2]).toInt() : QThread::idealThreadCount();
+
+  cuteLogger->registerAppender(new NullAppender);
+
+  runPass(recordsPerThread, maxThreads, false);
+  runPass(recordsPerThread, maxThreads, true);
+
+  return 0;
+}
@@ -0,0 +1,5 @@
+include(benchmark.pri)
+
+TARGET = contentionbenchmark
+
+SOURCES += contentionbenchmark.cpp
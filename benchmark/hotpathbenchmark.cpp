@@ -0,0 +1,246 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Measures the cost of the single log record on the hot path: the throughput and the latency percentiles for the
+// different appenders, from one thread up to the given number of threads
+
+// Local
+#include <Logger.h>
+#include <AbstractAppender.h>
+#include <AbstractStringAppender.h>
+#include <ConsoleAppender.h>
+#include <FileAppender.h>
+#include <RollingFileAppender.h>
+
+// Qt
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QVector>
+
+// STL
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+
+#if defined(Q_OS_UNIX)
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+
+typedef std::function<void()> RecordFunction;
+
+
+// Appender doing nothing, so only the logger overhead is measured
+class NullAppender : public AbstractAppender
+{
+  public:
+    NullAppender()
+    {
+      setAppendSerialized(false);
+    }
+
+  protected:
+    virtual void append(const QDateTime&, Logger::LogLevel, const char*, int, const char*, const QString&,
+                        const QString&)
+    {}
+};
+
+
+class FormatAppender : public AbstractStringAppender
+{
+  public:
+    using AbstractStringAppender::formattedString;
+
+  protected:
+    virtual void append(const QDateTime&, Logger::LogLevel, const char*, int, const char*, const QString&,
+                        const QString&)
+    {}
+};
+
+
+class BenchmarkThread : public QThread
+{
+  public:
+    BenchmarkThread(const RecordFunction& record, int records, bool measureLatency)
+      : m_record(record),
+        m_records(records),
+        m_measureLatency(measureLatency)
+    {}
+
+    QVector<qint64> latencies;
+
+  protected:
+    virtual void run()
+    {
+      if (!m_measureLatency)
+      {
+        for (int i = 0; i < m_records; ++i)
+          m_record();
+        return;
+      }
+
+      latencies.resize(m_records);
+
+      QElapsedTimer timer;
+      timer.start();
+      for (int i = 0; i < m_records; ++i)
+      {
+        const qint64 start = timer.nsecsElapsed();
+        m_record();
+        latencies[i] = timer.nsecsElapsed() - start;
+      }
+    }
+
+  private:
+    RecordFunction m_record;
+    int m_records;
+    bool m_measureLatency;
+};
+
+
+// Runs the threads and returns the elapsed time in nanoseconds
+static qint64 runThreads(const RecordFunction& record, int threads, int records, bool measureLatency,
+                         QVector<qint64>* latencies)
+{
+  QVector<BenchmarkThread*> workers;
+  for (int i = 0; i < threads; ++i)
+    workers.append(new BenchmarkThread(record, records, measureLatency));
+
+  QElapsedTimer timer;
+  timer.start();
+
+  foreach (BenchmarkThread* worker, workers)
+    worker->start();
+  foreach (BenchmarkThread* worker, workers)
+    worker->wait();
+
+  const qint64 elapsed = qMax(timer.nsecsElapsed(), qint64(1));
+
+  foreach (BenchmarkThread* worker, workers)
+  {
+    if (latencies)
+      *latencies += worker->latencies;
+    delete worker;
+  }
+
+  return elapsed;
+}
+
+
+static qint64 percentile(const QVector<qint64>& sorted, double fraction)
+{
+  if (sorted.isEmpty())
+    return 0;
+
+  const int index = qMin(int(sorted.size() * fraction), sorted.size() - 1);
+  return sorted.at(index);
+}
+
+
+static void runScenario(const char* name, const RecordFunction& record, int records, int maxThreads)
+{
+  // Powers of two, ending with exactly maxThreads
+  for (int threads = 1; threads <= maxThreads;
+       threads = threads < maxThreads ? qMin(threads * 2, maxThreads) : threads + 1)
+  {
+    // Throughput is measured separately, so the clock reads don't distort it
+    const qint64 elapsed = runThreads(record, threads, records, false, nullptr);
+
+    QVector<qint64> latencies;
+    runThreads(record, threads, records, true, &latencies);
+    std::sort(latencies.begin(), latencies.end());
+
+    const double total = double(records) * threads;
+    std::printf("%-24s %8d %14.0f %12.1f %10lld %10lld %10lld\n", name, threads, total * 1e9 / elapsed,
+                double(elapsed) * threads / total, percentile(latencies, 0.5), percentile(latencies, 0.99),
+                percentile(latencies, 0.999));
+    std::fflush(stdout);
+  }
+}
+
+
+// Registers the appender for the duration of the scenario
+static void runAppenderScenario(const char* name, AbstractAppender* appender, const RecordFunction& record, int records,
+                                int maxThreads)
+{
+  cuteLogger->registerAppender(appender);
+  runScenario(name, record, records, maxThreads);
+  cuteLogger->removeAppender(appender);
+  delete appender;
+}
+
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  const int records = argc > 1 ? QByteArray(argv[1]).toInt() : 100000;
+  const int maxThreads = argc > 2 ? QByteArray(argv[2]).toInt() : QThread::idealThreadCount();
+
+  QTemporaryDir dir;
+  if (!dir.isValid())
+  {
+    std::fprintf(stderr, "Cannot create the temporary directory\n");
+    return 1;
+  }
+
+  const RecordFunction logInfo = []() { LOG_INFO("Benchmark message %d", 42); };
+
+  std::printf("%-24s %8s %14s %12s %10s %10s %10s\n", "scenario", "threads", "records/s", "ns/record",
+              "p50 ns", "p99 ns", "p99.9 ns");
+
+  // The logger only accepts Info and higher, so the debug records are rejected by the level gate
+  NullAppender* infoAppender = new NullAppender;
+  infoAppender->setDetailsLevel(Logger::Info);
+  runAppenderScenario("disabled level", infoAppender, []() { LOG_DEBUG("Benchmark message %d", 42); }, records,
+                      maxThreads);
+
+  runAppenderScenario("null appender", new NullAppender, logInfo, records, maxThreads);
+
+  FormatAppender formatAppender;
+  const QString message = QStringLiteral("Benchmark message 42");
+  runScenario("formattedString", [&formatAppender, &message]() {
+    formatAppender.formattedString(QDateTime::currentDateTime(), Logger::Info, __FILE__, __LINE__, Q_FUNC_INFO,
+                                   QString(), message);
+  }, records, maxThreads);
+
+  runAppenderScenario("FileAppender", new FileAppender(dir.path() + QStringLiteral("/file.log")), logInfo, records,
+                      maxThreads);
+
+  RollingFileAppender* rollingAppender = new RollingFileAppender(dir.path() + QStringLiteral("/rolling.log"));
+  rollingAppender->setMaxFileSize(64 * 1024 * 1024);
+  rollingAppender->setLogFilesLimit(3);
+  runAppenderScenario("RollingFileAppender", rollingAppender, logInfo, records, maxThreads);
+
+#if defined(Q_OS_UNIX)
+  // ConsoleAppender writes to stderr, redirect it to /dev/null for the time of the scenario
+  const int savedStderr = ::dup(STDERR_FILENO);
+  const int devNull = ::open("/dev/null", O_WRONLY);
+  if (savedStderr >= 0 && devNull >= 0)
+  {
+    ::dup2(devNull, STDERR_FILENO);
+    runAppenderScenario("ConsoleAppender", new ConsoleAppender, logInfo, records, maxThreads);
+    ::dup2(savedStderr, STDERR_FILENO);
+  }
+
+  if (devNull >= 0)
+    ::close(devNull);
+  if (savedStderr >= 0)
+    ::close(savedStderr);
+#endif
+
+  return 0;
+}
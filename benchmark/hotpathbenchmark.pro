@@ -0,0 +1,5 @@
+include(benchmark.pri)
+
+TARGET = hotpathbenchmark
+
+SOURCES += hotpathbenchmark.cpp
@@ -17,9 +17,28 @@
 // Local
 #include "CuteLogger_global.h"
 #include <Logger.h>
+#include <LoggerStatistics.h>
 
 // Qt
 #include <QMutex>
+#include <QAtomicInt>
+
+struct AbstractAppenderCounters;
+
+
+//! Single log record passed to AbstractAppender::writeBatch()
+struct LogRecord
+{
+  QDateTime timeStamp;
+  Logger::LogLevel logLevel;
+  const char* file;
+  int line;
+  const char* function;
+  const LogSite* site;      //!< Call site of the logging macro, may be null
+  QString category;
+  QString message;
+  LogFields fields;         //!< Key-value fields of the structured record, usually empty
+};
 
 
 class CUTELOGGERSHARED_EXPORT AbstractAppender
@@ -33,17 +52,54 @@ class CUTELOGGERSHARED_EXPORT AbstractAppender
     void setDetailsLevel(const QString& level);
 
     void write(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line, const char* function,
-               const QString& category, const QString& message);
+               const QString& category, const QString& message, const LogFields* fields = nullptr);
+    void write(const QDateTime& timeStamp, const LogSite& site, const QString& category, const QString& message,
+               const LogFields* fields = nullptr);
+    void writeBatch(const LogRecord* records, size_t count);
+
+    virtual bool flush();
+
+    AppenderStatistics statistics() const;
+
+    static bool isTimingEnabled();
+    static void setTimingEnabled(bool enabled);
 
   protected:
     virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
                         const char* function, const QString& category, const QString& message) = 0;
+    virtual void appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                            const QString& message);
+    virtual void appendBatch(const LogRecord* records, size_t count);
+
+    static const LogFields* recordFields();
+
+    bool isAppendSerialized() const;
+    void setAppendSerialized(bool serialized);
+
+    void addBytesWritten(quint64 bytes);
+    void addFlushTime(quint64 nsecs);
+    virtual void updateStatistics(AppenderStatistics& statistics) const;
 
   private:
+    friend class Logger;
+    static QAtomicInt s_detailsLevelGeneration;
+    static QAtomicInt s_timingEnabled;
+
+    void lockWrite();
+    void timedAppendBatch(const LogRecord* records, size_t count);
+    void writeRecord(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                     const char* function, const LogSite* site, const QString& category, const QString& message,
+                     const LogFields* fields);
+    void timedAppend(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                     const char* function, const LogSite* site, const QString& category, const QString& message,
+                     const LogFields* fields);
+
+    AbstractAppenderCounters* m_counters;
+
     QMutex m_writeMutex;
+    bool m_appendSerialized;
 
-    Logger::LogLevel m_detailsLevel;
-    mutable QMutex m_detailsLevelMutex;
+    QAtomicInt m_detailsLevel;
 };
 
 #endif // ABSTRACTAPPENDER_H
@@ -21,26 +21,98 @@
 // Qt
 #include <QReadWriteLock>
 
+// STL
+#include <memory>
+
 
 class CUTELOGGERSHARED_EXPORT AbstractStringAppender : public AbstractAppender
 {
   public:
     AbstractStringAppender();
+    ~AbstractStringAppender();
 
     virtual QString format() const;
     void setFormat(const QString&);
 
     static QString stripFunctionName(const char*);
+    static QString cachedFunctionName(const char* function);
+
+    static quint64 functionNameCacheHits();
+    static quint64 functionNameCacheMisses();
+
+    static void appendUtf8(QByteArray& buffer, const QString& string);
+    static void appendJsonString(QByteArray& buffer, const QString& string);
+    static void appendJsonString(QByteArray& buffer, const char* string);
 
   protected:
     QString formattedString(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
                             const char* function, const QString& category, const QString& message) const;
+    QString formattedString(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                            const QString& message) const;
+    QString formattedString(const LogRecord& record) const;
+
+    void formatTo(QString& result, const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                  const char* function, const LogSite* site, const QString& category, const QString& message) const;
+    void formatTo(QString& result, const LogRecord& record) const;
+
+    QByteArray formattedUtf8(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                             const char* function, const QString& category, const QString& message) const;
+    void formatUtf8To(QByteArray& result, const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file,
+                      int line, const char* function, const LogSite* site, const QString& category,
+                      const QString& message) const;
+    void formatUtf8To(QByteArray& result, const LogRecord& record) const;
+
+    struct FormatBufferData
+    {
+      QString string;
+      QByteArray bytes;
+    };
+
+    //! Reusable buffers of the current thread to format the records into
+    class FormatBuffer
+    {
+      Q_DISABLE_COPY(FormatBuffer)
+
+      public:
+        FormatBuffer()
+          : m_buffer(acquireFormatBuffer())
+        {}
+
+        ~FormatBuffer() { releaseFormatBuffer(m_buffer); }
+
+        QString& string() { return m_buffer ? m_buffer->string : m_local.string; }
+        QByteArray& bytes() { return m_buffer ? m_buffer->bytes : m_local.bytes; }
+
+      private:
+        FormatBufferData* m_buffer;
+        FormatBufferData m_local; //!< Used if the thread buffers are busy, e.g. when a record is written while formatting another
+    };
+
+    static FormatBufferData* acquireFormatBuffer();
+    static void releaseFormatBuffer(FormatBufferData* buffer);
+
+    void updateFormat();
 
   private:
+    struct FormatProgram;
+    struct TimeCache;
+
     static QByteArray qCleanupFuncinfo(const char*);
+    static TimeCache* threadTimeCache(const std::shared_ptr<const FormatProgram>& program);
+
+    template <typename Buffer>
+    void formatRecord(Buffer& result, const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                      const char* function, const LogSite* site, const QString& category, const QString& message,
+                      const LogFields* fields) const;
+    template <typename Buffer>
+    void appendTimeStamp(Buffer& result, const std::shared_ptr<const FormatProgram>& program, int tokenIndex,
+                         const QDateTime& timeStamp) const;
 
     QString m_format;
     mutable QReadWriteLock m_formatLock;
+
+    // Compiled format(), always accessed using the std::atomic_load()/std::atomic_store()
+    std::shared_ptr<const FormatProgram> m_formatProgram;
 };
 
 #endif // ABSTRACTSTRINGAPPENDER_H
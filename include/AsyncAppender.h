@@ -0,0 +1,103 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef ASYNCAPPENDER_H
+#define ASYNCAPPENDER_H
+
+// Local
+#include "CuteLogger_global.h"
+#include <AbstractAppender.h>
+
+// Qt
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QWaitCondition>
+
+class AsyncAppenderThread;
+
+
+class CUTELOGGERSHARED_EXPORT AsyncAppender : public AbstractAppender
+{
+  public:
+    //! Describes what to do with a log record when the queue is full
+    enum OverflowPolicy
+    {
+      Block,         //!< Wait until the writer thread frees some space in the queue (default)
+      DropNewest,    //!< Silently drop the record
+      DropBelowLevel //!< Drop the record if its log level is lower than dropLevel(), otherwise wait
+    };
+
+    explicit AsyncAppender(AbstractAppender* appender, int queueSize = 8192);
+    ~AsyncAppender();
+
+    AbstractAppender* appender() const;
+    int queueSize() const;
+
+    OverflowPolicy overflowPolicy() const;
+    void setOverflowPolicy(OverflowPolicy policy);
+
+    Logger::LogLevel dropLevel() const;
+    void setDropLevel(Logger::LogLevel level);
+
+    quint64 droppedRecords() const;
+
+    virtual bool flush();
+
+  protected:
+    virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                        const char* function, const QString& category, const QString& message);
+    virtual void appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                            const QString& message);
+    virtual void updateStatistics(AppenderStatistics& statistics) const;
+
+  private:
+    friend class AsyncAppenderThread;
+
+    struct Slot
+    {
+      QAtomicInteger<quint64> sequence;
+      LogRecord record;
+    };
+
+    void queueRecord(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                     const char* function, const LogSite* site, const QString& category, const QString& message,
+                     const LogFields* fields);
+    bool enqueue(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                 const char* function, const LogSite* site, const QString& category, const QString& message,
+                 const LogFields* fields);
+    bool dequeue(LogRecord& record);
+    void wakeWriter();
+    void processQueue();
+
+    AbstractAppender* m_appender;
+    AsyncAppenderThread* m_thread;
+
+    Slot* m_slots;
+    quint64 m_mask;
+    QAtomicInteger<quint64> m_tail;   //!< Next slot to be claimed by the logging threads
+    quint64 m_head;                   //!< Next slot to be read by the writer thread
+    QAtomicInteger<quint64> m_written;
+    QAtomicInteger<quint64> m_dropped;
+
+    QAtomicInt m_overflowPolicy;
+    QAtomicInt m_dropLevel;
+
+    QAtomicInt m_writerSleeping;
+    QAtomicInt m_stopRequested;
+    QMutex m_wakeMutex;
+    QWaitCondition m_wakeCondition;
+    QWaitCondition m_writtenCondition;
+};
+
+#endif // ASYNCAPPENDER_H
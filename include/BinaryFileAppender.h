@@ -0,0 +1,85 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef BINARYFILEAPPENDER_H
+#define BINARYFILEAPPENDER_H
+
+// Local
+#include "CuteLogger_global.h"
+#include <AbstractAppender.h>
+
+// Qt
+#include <QFile>
+#include <QHash>
+
+
+class CUTELOGGERSHARED_EXPORT BinaryFileAppender : public AbstractAppender
+{
+  public:
+    //! Types of the entries in the binary log file
+    enum EntryType
+    {
+      CallSiteEntry = 'S',  //!< Call site dictionary entry: id, line, file and function names
+      CategoryEntry = 'C',  //!< Category dictionary entry: id and name
+      RecordEntry = 'R'     //!< Log record: timestamp, level, call site id, category id and message
+    };
+
+    static const char* const fileMagic;
+    static const quint32 fileVersion = 1;
+
+    explicit BinaryFileAppender(const QString& fileName = QString());
+    ~BinaryFileAppender();
+
+    QString fileName() const;
+    void setFileName(const QString& fileName);
+
+    virtual bool flush();
+
+  protected:
+    virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                        const char* function, const QString& category, const QString& message);
+
+  private:
+    // Call site key: the line and function alone don't identify it, e.g. for the same inline function in the headers
+    struct CallSite
+    {
+      const char* file;
+      const char* function;
+      int line;
+
+      bool operator==(const CallSite& other) const
+      {
+        return line == other.line && file == other.file && function == other.function;
+      }
+    };
+
+    friend uint qHash(const CallSite& site, uint seed = 0)
+    {
+      return qHash(quint64(quintptr(site.file)), seed) ^ qHash(quint64(quintptr(site.function)), seed)
+             ^ uint(site.line);
+    }
+
+    bool openFile();
+    void closeFile();
+
+    QFile m_file;
+    mutable QMutex m_fileMutex;
+
+    // Dictionaries of the current file
+    QHash<CallSite, quint32> m_callSites;
+    QHash<QString, quint32> m_categories;
+
+    QByteArray m_buffer;
+};
+
+#endif // BINARYFILEAPPENDER_H
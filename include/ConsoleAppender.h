@@ -17,20 +17,64 @@
 #include "CuteLogger_global.h"
 #include <AbstractStringAppender.h>
 
+// Qt
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+
+class ConsoleAppenderFlusher;
+
 
 class CUTELOGGERSHARED_EXPORT ConsoleAppender : public AbstractStringAppender
 {
   public:
     ConsoleAppender();
+    ~ConsoleAppender();
+
     virtual QString format() const;
     void ignoreEnvironmentPattern(bool ignore);
 
+    int bufferSize() const;
+    void setBufferSize(int size);
+
+    int maxLatency() const;
+    void setMaxLatency(int msecs);
+
+    Logger::LogLevel immediateFlushLevel() const;
+    void setImmediateFlushLevel(Logger::LogLevel level);
+
+    virtual bool flush();
+
   protected:
     virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
                         const char* function, const QString& category, const QString& message);
+    virtual void appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                            const QString& message);
+    virtual void appendBatch(const LogRecord* records, size_t count);
 
   private:
+    friend class ConsoleAppenderFlusher;
+
+    void writeFormatted(const QByteArray& formatted, Logger::LogLevel logLevel);
+    void writeBuffer();
+    void writeData(const char* data, qint64 remaining);
+    void startFlusher();
+    void runFlusher();
+
     bool m_ignoreEnvPattern;
+    QString m_envPattern;        //!< QT_MESSAGE_PATTERN value read in the constructor
+
+    mutable QMutex m_bufferMutex;
+    QByteArray m_buffer;         //!< UTF-8 encoded records waiting to be written
+    int m_bufferSize;
+    int m_maxLatency;
+    Logger::LogLevel m_immediateFlushLevel;
+    QElapsedTimer m_bufferTimer; //!< Started when the first record is put to the empty buffer
+
+    ConsoleAppenderFlusher* m_flusher;
+    QWaitCondition m_flusherCondition;
+    bool m_stopFlusher;
 };
 
 #endif // CONSOLEAPPENDER_H
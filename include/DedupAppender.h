@@ -0,0 +1,71 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef DEDUPAPPENDER_H
+#define DEDUPAPPENDER_H
+
+// Local
+#include "CuteLogger_global.h"
+#include <AbstractAppender.h>
+
+// Qt
+#include <QByteArray>
+#include <QDateTime>
+#include <QMutex>
+
+
+class CUTELOGGERSHARED_EXPORT DedupAppender : public AbstractAppender
+{
+  public:
+    explicit DedupAppender(AbstractAppender* appender, int window = 10000);
+    ~DedupAppender();
+
+    AbstractAppender* appender() const;
+
+    int window() const;
+    void setWindow(int msecs);
+
+    quint64 suppressedRecords() const;
+
+    virtual bool flush();
+
+  protected:
+    virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                        const char* function, const QString& category, const QString& message);
+
+  private:
+    void writeRepeats();
+
+    AbstractAppender* m_appender;
+    int m_window;
+    mutable QMutex m_mutex;
+
+    // The last record written to the wrapped appender
+    bool m_hasLast;
+    uint m_lastHash;
+    Logger::LogLevel m_lastLevel;
+    QByteArray m_lastFile;
+    int m_lastLine;
+    QByteArray m_lastFunction;
+    QString m_lastCategory;
+    QString m_lastMessage;
+    LogFields m_lastFields;
+
+    int m_repeats;                //!< Number of the repeats of the last record suppressed so far
+    QDateTime m_firstRepeatTime;  //!< Time stamp of the first suppressed repeat, the window is measured from it
+    QDateTime m_lastRepeatTime;   //!< Time stamp of the last suppressed repeat
+    QDateTime m_lastTime;         //!< Time stamp of the last record written to the wrapped appender
+    quint64 m_suppressed;
+};
+
+#endif // DEDUPAPPENDER_H
@@ -20,12 +20,23 @@
 
 // Qt
 #include <QFile>
-#include <QTextStream>
+#include <QElapsedTimer>
+#include <QWaitCondition>
+
+class FileAppenderFlusher;
 
 
 class CUTELOGGERSHARED_EXPORT FileAppender : public AbstractStringAppender
 {
   public:
+    //! Describes when the written data is synchronized to the storage device (using \c fsync())
+    enum SyncPolicy
+    {
+      NeverSync,        //!< Leave it to the operating system (default)
+      SyncOnRollover,   //!< Synchronize when the file is closed or rolled over
+      SyncPeriodically  //!< Synchronize every syncInterval() milliseconds and when the file is closed
+    };
+
     FileAppender(const QString& fileName = QString());
     ~FileAppender();
 
@@ -35,21 +46,62 @@ class CUTELOGGERSHARED_EXPORT FileAppender : public AbstractStringAppender
     bool flushOnWrite() const;
     void setFlushOnWrite(bool);
 
-    bool flush();
+    int bufferSize() const;
+    void setBufferSize(int size);
+
+    int maxLatency() const;
+    void setMaxLatency(int msecs);
+
+    Logger::LogLevel immediateFlushLevel() const;
+    void setImmediateFlushLevel(Logger::LogLevel level);
+
+    SyncPolicy syncPolicy() const;
+    void setSyncPolicy(SyncPolicy policy);
+
+    int syncInterval() const;
+    void setSyncInterval(int msecs);
+
+    virtual bool flush();
 
     bool reopenFile();
 
   protected:
     virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
                         const char* function, const QString& category, const QString& message);
+    virtual void appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                            const QString& message);
+    virtual void appendBatch(const LogRecord* records, size_t count);
+    virtual void writeFormatted(const QByteArray& formatted, Logger::LogLevel logLevel);
     bool openFile();
     void closeFile();
+    qint64 fileSize() const;
 
   private:
+    friend class FileAppenderFlusher;
+
+    void flushBuffer();
+    void syncFile();
+    void startFlusher();
+    void runFlusher();
+
     QFile m_logFile;
     bool m_flushOnWrite;
-    QTextStream m_logStream;
     mutable QMutex m_logFileMutex;
+
+    int m_bufferSize;
+    int m_maxLatency;
+    Logger::LogLevel m_immediateFlushLevel;
+    QByteArray m_buffer;
+    QElapsedTimer m_bufferTimer; //!< Started when the first record is put to the empty buffer
+
+    SyncPolicy m_syncPolicy;
+    int m_syncInterval;
+    bool m_syncNeeded;
+    QElapsedTimer m_syncTimer;
+
+    FileAppenderFlusher* m_flusher;
+    QWaitCondition m_flusherCondition;
+    bool m_stopFlusher;
 };
 
 #endif // FILEAPPENDER_H
@@ -0,0 +1,42 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef JSONAPPENDER_H
+#define JSONAPPENDER_H
+
+// Local
+#include "CuteLogger_global.h"
+#include <FileAppender.h>
+
+
+class CUTELOGGERSHARED_EXPORT JsonAppender : public FileAppender
+{
+  public:
+    JsonAppender(const QString& fileName = QString());
+
+    static void encodeRecord(QByteArray& result, const LogRecord& record);
+
+  protected:
+    virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                        const char* function, const QString& category, const QString& message);
+    virtual void appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                            const QString& message);
+    virtual void appendBatch(const LogRecord* records, size_t count);
+
+  private:
+    static void encode(QByteArray& result, const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file,
+                       int line, const QString& functionName, const QString& category, const QString& message,
+                       const LogFields* fields);
+};
+
+#endif // JSONAPPENDER_H
@@ -15,55 +15,129 @@
 #define LOGGER_H
 
 // Qt
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QList>
 #include <QString>
 #include <QDebug>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QVector>
+
+// STL
+#include <type_traits>
 
 // Local
 #include "CuteLogger_global.h"
+#include "LoggerStatistics.h"
 class AbstractAppender;
 
 
 class Logger;
 CUTELOGGERSHARED_EXPORT Logger* cuteLoggerInstance();
+inline Logger* cuteLoggerGlobalInstance();
 #define cuteLogger cuteLoggerInstance()
 
 
-#define LOG_TRACE            CuteMessageLogger(cuteLoggerInstance(), Logger::Trace,   __FILE__, __LINE__, Q_FUNC_INFO).write
-#define LOG_DEBUG            CuteMessageLogger(cuteLoggerInstance(), Logger::Debug,   __FILE__, __LINE__, Q_FUNC_INFO).write
-#define LOG_INFO             CuteMessageLogger(cuteLoggerInstance(), Logger::Info,    __FILE__, __LINE__, Q_FUNC_INFO).write
-#define LOG_WARNING          CuteMessageLogger(cuteLoggerInstance(), Logger::Warning, __FILE__, __LINE__, Q_FUNC_INFO).write
-#define LOG_ERROR            CuteMessageLogger(cuteLoggerInstance(), Logger::Error,   __FILE__, __LINE__, Q_FUNC_INFO).write
-#define LOG_FATAL            CuteMessageLogger(cuteLoggerInstance(), Logger::Fatal,   __FILE__, __LINE__, Q_FUNC_INFO).write
-
-#define LOG_CTRACE(category)   CuteMessageLogger(cuteLoggerInstance(), Logger::Trace,   __FILE__, __LINE__, Q_FUNC_INFO, category).write()
-#define LOG_CDEBUG(category)   CuteMessageLogger(cuteLoggerInstance(), Logger::Debug,   __FILE__, __LINE__, Q_FUNC_INFO, category).write()
-#define LOG_CINFO(category)    CuteMessageLogger(cuteLoggerInstance(), Logger::Info,    __FILE__, __LINE__, Q_FUNC_INFO, category).write()
-#define LOG_CWARNING(category) CuteMessageLogger(cuteLoggerInstance(), Logger::Warning, __FILE__, __LINE__, Q_FUNC_INFO, category).write()
-#define LOG_CERROR(category)   CuteMessageLogger(cuteLoggerInstance(), Logger::Error,   __FILE__, __LINE__, Q_FUNC_INFO, category).write()
-#define LOG_CFATAL(category)   CuteMessageLogger(cuteLoggerInstance(), Logger::Fatal,   __FILE__, __LINE__, Q_FUNC_INFO, category).write()
+#define CUTELOGGER_ENABLED_FOR(level) \
+  for (Logger* cuteLoggerEnabledInstance = cuteLoggerInstance(); \
+       cuteLoggerEnabledInstance && cuteLoggerEnabledInstance->isEnabledFor(level); cuteLoggerEnabledInstance = nullptr)
+
+// Every call site gets its own static LogSite. Q_FUNC_INFO is passed as an argument, inside the lambda it would name
+// the lambda itself.
+#define CUTELOGGER_SITE(level) \
+  for (LogSite* cuteLoggerSite = &[](const char* function) -> LogSite& { \
+         static LogSite s(level, __FILE__, __LINE__, function); return s; }(Q_FUNC_INFO); \
+       cuteLoggerSite && cuteLoggerSite->isEnabled(); cuteLoggerSite = nullptr)
+
+#define LOG_TRACE            CUTELOGGER_ENABLED_FOR(Logger::Trace)   CUTELOGGER_SITE(Logger::Trace)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).write
+#define LOG_DEBUG            CUTELOGGER_ENABLED_FOR(Logger::Debug)   CUTELOGGER_SITE(Logger::Debug)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).write
+#define LOG_INFO             CUTELOGGER_ENABLED_FOR(Logger::Info)    CUTELOGGER_SITE(Logger::Info)    CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).write
+#define LOG_WARNING          CUTELOGGER_ENABLED_FOR(Logger::Warning) CUTELOGGER_SITE(Logger::Warning) CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).write
+#define LOG_ERROR            CUTELOGGER_ENABLED_FOR(Logger::Error)   CUTELOGGER_SITE(Logger::Error)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).write
+#define LOG_FATAL            CUTELOGGER_ENABLED_FOR(Logger::Fatal)   CUTELOGGER_SITE(Logger::Fatal)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).write
+
+// Every call site gets its own static LoggerCategoryCache, constant initialized, so the category name literal is only
+// looked up by the first record
+#define CUTELOGGER_CATEGORY(category) \
+  []() -> LoggerCategoryCache& { static LoggerCategoryCache c; return c; }().resolve(category)
+
+#define LOG_CTRACE(category)   CUTELOGGER_ENABLED_FOR(Logger::Trace)   CUTELOGGER_SITE(Logger::Trace)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite, CUTELOGGER_CATEGORY(category)).write()
+#define LOG_CDEBUG(category)   CUTELOGGER_ENABLED_FOR(Logger::Debug)   CUTELOGGER_SITE(Logger::Debug)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite, CUTELOGGER_CATEGORY(category)).write()
+#define LOG_CINFO(category)    CUTELOGGER_ENABLED_FOR(Logger::Info)    CUTELOGGER_SITE(Logger::Info)    CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite, CUTELOGGER_CATEGORY(category)).write()
+#define LOG_CWARNING(category) CUTELOGGER_ENABLED_FOR(Logger::Warning) CUTELOGGER_SITE(Logger::Warning) CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite, CUTELOGGER_CATEGORY(category)).write()
+#define LOG_CERROR(category)   CUTELOGGER_ENABLED_FOR(Logger::Error)   CUTELOGGER_SITE(Logger::Error)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite, CUTELOGGER_CATEGORY(category)).write()
+#define LOG_CFATAL(category)   CUTELOGGER_ENABLED_FOR(Logger::Fatal)   CUTELOGGER_SITE(Logger::Fatal)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite, CUTELOGGER_CATEGORY(category)).write()
+
+#define LOG_TRACE_KV   CUTELOGGER_ENABLED_FOR(Logger::Trace)   CUTELOGGER_SITE(Logger::Trace)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).writeFields
+#define LOG_DEBUG_KV   CUTELOGGER_ENABLED_FOR(Logger::Debug)   CUTELOGGER_SITE(Logger::Debug)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).writeFields
+#define LOG_INFO_KV    CUTELOGGER_ENABLED_FOR(Logger::Info)    CUTELOGGER_SITE(Logger::Info)    CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).writeFields
+#define LOG_WARNING_KV CUTELOGGER_ENABLED_FOR(Logger::Warning) CUTELOGGER_SITE(Logger::Warning) CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).writeFields
+#define LOG_ERROR_KV   CUTELOGGER_ENABLED_FOR(Logger::Error)   CUTELOGGER_SITE(Logger::Error)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).writeFields
+#define LOG_FATAL_KV   CUTELOGGER_ENABLED_FOR(Logger::Fatal)   CUTELOGGER_SITE(Logger::Fatal)   CuteMessageLogger(cuteLoggerEnabledInstance, cuteLoggerSite).writeFields
 
 #define LOG_TRACE_TIME  LoggerTimingHelper loggerTimingHelper(cuteLoggerInstance(), Logger::Trace, __FILE__, __LINE__, Q_FUNC_INFO); loggerTimingHelper.start
 #define LOG_DEBUG_TIME  LoggerTimingHelper loggerTimingHelper(cuteLoggerInstance(), Logger::Debug, __FILE__, __LINE__, Q_FUNC_INFO); loggerTimingHelper.start
 #define LOG_INFO_TIME   LoggerTimingHelper loggerTimingHelper(cuteLoggerInstance(), Logger::Info,  __FILE__, __LINE__, Q_FUNC_INFO); loggerTimingHelper.start
 
+// Every call site gets its own static LoggerTimingStats, constant initialized, so no guard is needed to access it
+#define CUTELOGGER_TIME_STATS(level) \
+  LoggerTimingScope loggerTimingScope(&[]() -> LoggerTimingStats& { static LoggerTimingStats s; return s; }(), \
+                                      cuteLoggerInstance(), level, __FILE__, __LINE__, Q_FUNC_INFO); \
+  loggerTimingScope.start
+
+#define LOG_TRACE_TIME_STATS CUTELOGGER_TIME_STATS(Logger::Trace)
+#define LOG_DEBUG_TIME_STATS CUTELOGGER_TIME_STATS(Logger::Debug)
+#define LOG_INFO_TIME_STATS  CUTELOGGER_TIME_STATS(Logger::Info)
+
 #define LOG_ASSERT(cond)        ((!(cond)) ? cuteLoggerInstance()->writeAssert(__FILE__, __LINE__, Q_FUNC_INFO, #cond) : qt_noop())
 #define LOG_ASSERT_X(cond, msg) ((!(cond)) ? cuteLoggerInstance()->writeAssert(__FILE__, __LINE__, Q_FUNC_INFO, msg) : qt_noop())
 
+// Every call site gets its own static LoggerRateLimiter, constant initialized, so no guard is needed to access it
+#define CUTELOGGER_LIMITED(level, check) \
+  CUTELOGGER_ENABLED_FOR(level) \
+  for (LoggerRateLimiter* cuteLoggerLimiter = &[]() -> LoggerRateLimiter& { static LoggerRateLimiter l; return l; }(); \
+       cuteLoggerLimiter && cuteLoggerLimiter->check; cuteLoggerLimiter = nullptr) \
+    CuteMessageLogger(cuteLoggerEnabledInstance, level, __FILE__, __LINE__, Q_FUNC_INFO, \
+                      CuteMessageLogger::Suppressed(cuteLoggerLimiter->takeSuppressed())).write
+
+#define LOG_TRACE_EVERY_N(n)                     CUTELOGGER_LIMITED(Logger::Trace, everyN(n))
+#define LOG_DEBUG_EVERY_N(n)                     CUTELOGGER_LIMITED(Logger::Debug, everyN(n))
+#define LOG_INFO_EVERY_N(n)                      CUTELOGGER_LIMITED(Logger::Info, everyN(n))
+#define LOG_WARNING_EVERY_N(n)                   CUTELOGGER_LIMITED(Logger::Warning, everyN(n))
+#define LOG_ERROR_EVERY_N(n)                     CUTELOGGER_LIMITED(Logger::Error, everyN(n))
+#define LOG_FATAL_EVERY_N(n)                     CUTELOGGER_LIMITED(Logger::Fatal, everyN(n))
+
+#define LOG_TRACE_FIRST_N(n)                     CUTELOGGER_LIMITED(Logger::Trace, firstN(n))
+#define LOG_DEBUG_FIRST_N(n)                     CUTELOGGER_LIMITED(Logger::Debug, firstN(n))
+#define LOG_INFO_FIRST_N(n)                      CUTELOGGER_LIMITED(Logger::Info, firstN(n))
+#define LOG_WARNING_FIRST_N(n)                   CUTELOGGER_LIMITED(Logger::Warning, firstN(n))
+#define LOG_ERROR_FIRST_N(n)                     CUTELOGGER_LIMITED(Logger::Error, firstN(n))
+#define LOG_FATAL_FIRST_N(n)                     CUTELOGGER_LIMITED(Logger::Fatal, firstN(n))
+
+#define LOG_TRACE_EVERY_MS(msecs)                CUTELOGGER_LIMITED(Logger::Trace, everyMs(msecs))
+#define LOG_DEBUG_EVERY_MS(msecs)                CUTELOGGER_LIMITED(Logger::Debug, everyMs(msecs))
+#define LOG_INFO_EVERY_MS(msecs)                 CUTELOGGER_LIMITED(Logger::Info, everyMs(msecs))
+#define LOG_WARNING_EVERY_MS(msecs)              CUTELOGGER_LIMITED(Logger::Warning, everyMs(msecs))
+#define LOG_ERROR_EVERY_MS(msecs)                CUTELOGGER_LIMITED(Logger::Error, everyMs(msecs))
+#define LOG_FATAL_EVERY_MS(msecs)                CUTELOGGER_LIMITED(Logger::Fatal, everyMs(msecs))
+
+#define LOG_TRACE_RATE(perSecond, burst)         CUTELOGGER_LIMITED(Logger::Trace, rate(perSecond, burst))
+#define LOG_DEBUG_RATE(perSecond, burst)         CUTELOGGER_LIMITED(Logger::Debug, rate(perSecond, burst))
+#define LOG_INFO_RATE(perSecond, burst)          CUTELOGGER_LIMITED(Logger::Info, rate(perSecond, burst))
+#define LOG_WARNING_RATE(perSecond, burst)       CUTELOGGER_LIMITED(Logger::Warning, rate(perSecond, burst))
+#define LOG_ERROR_RATE(perSecond, burst)         CUTELOGGER_LIMITED(Logger::Error, rate(perSecond, burst))
+#define LOG_FATAL_RATE(perSecond, burst)         CUTELOGGER_LIMITED(Logger::Fatal, rate(perSecond, burst))
+
 #if (__cplusplus >= 201103L)
-#include <functional>
 
 #define LOG_CATEGORY(category) \
   Logger customCuteLoggerInstance{category};\
-  std::function<Logger*()> cuteLoggerInstance = [&customCuteLoggerInstance]() {\
-    return &customCuteLoggerInstance;\
-  };\
+  CuteLoggerInstanceAccessor cuteLoggerInstance{&customCuteLoggerInstance};\
 
 #define LOG_GLOBAL_CATEGORY(category) \
   Logger customCuteLoggerInstance{category, true};\
-  std::function<Logger*()> cuteLoggerInstance = [&customCuteLoggerInstance]() {\
-    return &customCuteLoggerInstance;\
-  };\
+  CuteLoggerInstanceAccessor cuteLoggerInstance{&customCuteLoggerInstance};\
 
 #else
 
@@ -85,7 +159,165 @@ CUTELOGGERSHARED_EXPORT Logger* cuteLoggerInstance();
 #endif
 
 
+//! Handle of the log category name interned by Logger::category()
+class CUTELOGGERSHARED_EXPORT LoggerCategory
+{
+  public:
+    LoggerCategory()
+      : m_id(-1)
+    {}
+
+    bool isValid() const { return m_id >= 0; }
+    int id() const { return m_id; }
+    const QString& name() const;
+
+    bool operator==(const LoggerCategory& other) const { return m_id == other.m_id; }
+    bool operator!=(const LoggerCategory& other) const { return m_id != other.m_id; }
+
+  private:
+    friend class Logger;
+    friend class LoggerCategoryCache;
+    explicit LoggerCategory(int id)
+      : m_id(id)
+    {}
+
+    int m_id;
+};
+
+
+//! Per call site interned category of the LOG_CDEBUG() and the similar macros
+class CUTELOGGERSHARED_EXPORT LoggerCategoryCache
+{
+  Q_DISABLE_COPY(LoggerCategoryCache)
+
+  public:
+    Q_DECL_CONSTEXPR LoggerCategoryCache()
+      : m_name(nullptr),
+        m_internedName(nullptr),
+        m_id(-1),
+        m_claimed(0)
+    {}
+
+    LoggerCategory resolve(const char* name)
+    {
+      // The literal has the same address every time the call site is reached. The names are still compared, as the
+      // dynamically allocated name (like qPrintable() one) may be freed and its memory reused for another one.
+      if (name && m_name.loadAcquire() == name && qstrcmp(name, m_internedName) == 0)
+        return LoggerCategory(m_id);
+      return intern(name);
+    }
+
+    LoggerCategory resolve(LoggerCategory category) const { return category; }
+
+  private:
+    LoggerCategory intern(const char* name);
+
+    QAtomicPointer<const char> m_name;
+    char* m_internedName;                //!< Copy of the name, written once before m_name is published, never freed
+    int m_id;                            //!< Written once, before m_name is published
+    QAtomicInt m_claimed;
+};
+
+
+//! Typed key-value field of the structured log record, see LOG_INFO_KV()
+/**
+ * The value is stored as is, without formatting. The key is not copied, so it should be a string literal.
+ */
+class CUTELOGGERSHARED_EXPORT LogField
+{
+  public:
+    //! Type of the field value
+    enum Type
+    {
+      Bool,   //!< Boolean value
+      Int,    //!< Signed integer value
+      UInt,   //!< Unsigned integer value
+      Double, //!< Floating point value
+      String  //!< String value
+    };
+
+    LogField()
+      : m_key(""),
+        m_type(Int),
+        m_int(0)
+    {}
+
+    LogField(const char* key, bool value)
+      : m_key(key),
+        m_type(Bool),
+        m_int(value ? 1 : 0)
+    {}
+
+    template <typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+    LogField(const char* key, T value)
+      : m_key(key),
+        m_type(Int),
+        m_int(qint64(value))
+    {}
+
+    template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, int>::type = 0>
+    LogField(const char* key, T value)
+      : m_key(key),
+        m_type(UInt),
+        m_uint(quint64(value))
+    {}
+
+    template <typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+    LogField(const char* key, T value)
+      : m_key(key),
+        m_type(Double),
+        m_double(double(value))
+    {}
+
+    LogField(const char* key, const char* value)
+      : m_key(key),
+        m_type(String),
+        m_int(0),
+        m_string(QString::fromUtf8(value))
+    {}
+
+    LogField(const char* key, const QString& value)
+      : m_key(key),
+        m_type(String),
+        m_int(0),
+        m_string(value)
+    {}
+
+    const char* key() const { return m_key; }
+    Type type() const { return m_type; }
+
+    bool toBool() const { return m_int != 0; }
+    qint64 toInt() const { return m_int; }
+    quint64 toUInt() const { return m_uint; }
+    double toDouble() const { return m_double; }
+    const QString& string() const { return m_string; }
+
+    QString toString() const;
+
+    bool operator==(const LogField& other) const;
+    bool operator!=(const LogField& other) const { return !operator==(other); }
+
+  private:
+    const char* m_key;
+    Type m_type;
+    union
+    {
+      qint64 m_int;
+      quint64 m_uint;
+      double m_double;
+    };
+    QString m_string;
+};
+
+Q_DECLARE_TYPEINFO(LogField, Q_MOVABLE_TYPE);
+
+//! Fields of the structured log record
+typedef QVector<LogField> LogFields;
+
+
+class LogSite;
 class LoggerPrivate;
+class QLoggingCategory;
 class CUTELOGGERSHARED_EXPORT Logger
 {
   Q_DISABLE_COPY(Logger)
@@ -109,14 +341,42 @@ class CUTELOGGERSHARED_EXPORT Logger
     //! Sets the timing display mode for the LOG_TRACE_TIME, LOG_DEBUG_TIME and LOG_INFO_TIME macros
     enum TimingMode
     {
-      TimingAuto, //!< Show time in seconds, if it exceeds 10s (default)
-      TimingMs    //!< Always use milliseconds to display
+      TimingAuto,   //!< Show time in seconds, if it exceeds 10s (default)
+      TimingMs,     //!< Always use milliseconds to display
+      TimingPrecise //!< Show time in nanoseconds, microseconds, milliseconds or seconds, whichever is below 10000
+    };
+
+    //! Describes how the timestamps of the log records are obtained
+    enum TimestampMode
+    {
+      LocalTimestamps,    //!< Local time from QDateTime::currentDateTime() (default)
+      CoarseUtcTimestamps //!< UTC time from the fast coarse system clock, converted to the local time by the appenders
     };
 
     static QString levelToString(LogLevel logLevel);
     static LogLevel levelFromString(const QString& s);
 
-    static Logger* globalInstance();
+    static void setTimestampMode(TimestampMode mode);
+    static TimestampMode timestampMode();
+    static QDateTime currentTimestamp();
+
+    static Logger* globalInstance()
+    {
+      Logger* instance = s_globalInstance.loadAcquire();
+      return instance ? instance : createGlobalInstance();
+    }
+
+    Logger* parent() const;
+    void setParent(Logger* parent);
+
+    static LoggerCategory category(const char* name);
+    static LoggerCategory category(const QString& name);
+
+    static void updateQtCategoryFilter();
+
+    bool isEnabledFor(LogLevel logLevel) const;
+
+    LoggerStatistics statistics() const;
 
     void registerAppender(AbstractAppender* appender);
     void registerCategoryAppender(const QString& category, AbstractAppender* appender);
@@ -132,13 +392,85 @@ class CUTELOGGERSHARED_EXPORT Logger
                const QString& message);
     void write(LogLevel logLevel, const char* file, int line, const char* function, const char* category, const QString& message);
 
+    void write(const QDateTime& timeStamp, LogLevel logLevel, const char* file, int line, const char* function,
+               LoggerCategory category, const QString& message);
+    void write(LogLevel logLevel, const char* file, int line, const char* function, LoggerCategory category,
+               const QString& message);
+
+    void write(const QDateTime& timeStamp, const LogSite& site, LoggerCategory category, const QString& message);
+    void write(const LogSite& site, LoggerCategory category, const QString& message);
+    void write(const LogSite& site, LoggerCategory category, const QString& message, const LogFields& fields);
+
     void writeAssert(const char* file, int line, const char* function, const char* condition);
 
   private:
-    void write(const QDateTime& timeStamp, LogLevel logLevel, const char* file, int line, const char* function, const char* category,
-               const QString& message, bool fromLocalInstance);
+    void write(const QDateTime& timeStamp, LogLevel logLevel, const char* file, int line, const char* function,
+               LoggerCategory category, const QString& message, bool fromLocalInstance, const LogSite* site,
+               const LogFields* fields, const QString* recordCategoryName = nullptr);
+    void updateMinimumLevel(int generation) const;
+
+    bool isCategoryEnabledFor(LoggerCategory category, LogLevel logLevel) const;
+    static void qtCategoryFilter(QLoggingCategory* category);
+
+    static Logger* createGlobalInstance();
+    static void destroyGlobalInstance();
+    static QAtomicPointer<Logger> s_globalInstance;
+
     Q_DECLARE_PRIVATE(Logger)
     LoggerPrivate* d_ptr;
+    friend class LoggerPrivate;
+};
+
+
+//! Returns the global instance without the library call, unlike cuteLoggerInstance() it is not replaced by LOG_CATEGORY()
+inline Logger* cuteLoggerGlobalInstance()
+{
+  return Logger::globalInstance();
+}
+
+
+//! Replacement of cuteLoggerInstance() declared by the LOG_CATEGORY() and LOG_GLOBAL_CATEGORY() macros
+struct CuteLoggerInstanceAccessor
+{
+  Logger* instance;
+
+  Logger* operator()() const { return instance; }
+};
+
+
+//! Static metadata of the logging macro call site
+class CUTELOGGERSHARED_EXPORT LogSite
+{
+  Q_DISABLE_COPY(LogSite)
+
+  public:
+    LogSite(Logger::LogLevel level, const char* file, int line, const char* function);
+    ~LogSite();
+
+    Logger::LogLevel level() const { return m_level; }
+    const char* file() const { return m_file; }
+    int line() const { return m_line; }
+    const char* function() const { return m_function; }
+
+    const char* fileName() const;
+    const QString& functionName() const;
+
+    bool isEnabled() const { return m_enabled.load(); }
+    void setEnabled(bool enabled);
+
+    static QList<LogSite*> registeredSites();
+    static void setSitesEnabled(const QString& file, int line, bool enabled);
+
+  private:
+    Logger::LogLevel m_level;
+    const char* m_file;
+    int m_line;
+    const char* m_function;
+    QAtomicInt m_enabled;
+
+    // Computed when first needed, the function name is freed by the destructor
+    mutable QAtomicPointer<const char> m_fileName;
+    mutable QAtomicPointer<QString> m_functionName;
 };
 
 
@@ -147,16 +479,35 @@ class CUTELOGGERSHARED_EXPORT CuteMessageLogger
   Q_DISABLE_COPY(CuteMessageLogger)
 
   public:
+    //! Number of the records suppressed by the rate limited macro, distinct from the literal category or 0
+    struct Suppressed
+    {
+      explicit Suppressed(quint64 c)
+        : count(c)
+      {}
+
+      quint64 count;
+    };
+
     CuteMessageLogger(Logger* l, Logger::LogLevel level, const char* file, int line, const char* function)
         : m_l(l),
           m_level(level),
           m_file(file),
           m_line(line),
-          m_function(function),
-          m_category(nullptr)
+          m_function(function)
     {}
 
     CuteMessageLogger(Logger* l, Logger::LogLevel level, const char* file, int line, const char* function, const char* category)
+        : m_l(l),
+          m_level(level),
+          m_file(file),
+          m_line(line),
+          m_function(function),
+          m_category(Logger::category(category))
+    {}
+
+    CuteMessageLogger(Logger* l, Logger::LogLevel level, const char* file, int line, const char* function,
+                      LoggerCategory category)
         : m_l(l),
           m_level(level),
           m_file(file),
@@ -165,6 +516,45 @@ class CUTELOGGERSHARED_EXPORT CuteMessageLogger
           m_category(category)
     {}
 
+    CuteMessageLogger(Logger* l, Logger::LogLevel level, const char* file, int line, const char* function,
+                      Suppressed suppressed)
+        : m_l(l),
+          m_level(level),
+          m_file(file),
+          m_line(line),
+          m_function(function),
+          m_suppressed(suppressed.count)
+    {}
+
+    CuteMessageLogger(Logger* l, const LogSite* site)
+        : m_l(l),
+          m_level(site->level()),
+          m_file(site->file()),
+          m_line(site->line()),
+          m_function(site->function()),
+          m_site(site)
+    {}
+
+    CuteMessageLogger(Logger* l, const LogSite* site, const char* category)
+        : m_l(l),
+          m_level(site->level()),
+          m_file(site->file()),
+          m_line(site->line()),
+          m_function(site->function()),
+          m_category(Logger::category(category)),
+          m_site(site)
+    {}
+
+    CuteMessageLogger(Logger* l, const LogSite* site, LoggerCategory category)
+        : m_l(l),
+          m_level(site->level()),
+          m_file(site->file()),
+          m_line(site->line()),
+          m_function(site->function()),
+          m_category(category),
+          m_site(site)
+    {}
+
     ~CuteMessageLogger();
 
     void write(const char* msg, ...)
@@ -181,14 +571,69 @@ class CUTELOGGERSHARED_EXPORT CuteMessageLogger
 
     QDebug write();
 
+    //! Writes the \a msg with the key-value pairs following it, like LOG_INFO_KV("Done", "ms", elapsed, "status", code)
+    template <typename... Fields>
+    void writeFields(const QString& msg, const Fields&... fields)
+    {
+      static_assert(sizeof...(Fields) % 2 == 0, "The message should be followed by the key-value pairs");
+      m_fields.reserve(int(sizeof...(Fields) / 2));
+      addFields(fields...);
+      write(msg);
+    }
+
+    template <typename... Fields>
+    void writeFields(const char* msg, const Fields&... fields)
+    {
+      writeFields(QString::fromUtf8(msg), fields...);
+    }
+
   private:
+    void addFields() {}
+
+    template <typename Value, typename... Fields>
+    void addFields(const char* key, const Value& value, const Fields&... fields)
+    {
+      m_fields.append(LogField(key, value));
+      addFields(fields...);
+    }
+
     Logger* m_l;
     Logger::LogLevel m_level;
     const char* m_file;
     int m_line;
     const char* m_function;
-    const char* m_category;
+    LoggerCategory m_category;
+    quint64 m_suppressed = 0;
+    const LogSite* m_site = nullptr;
     QString m_message;
+    QString* m_pooledMessage = nullptr; //!< Reused buffer of the current thread, replaces m_message if taken
+    LogFields m_fields;
+};
+
+
+//! Per call site state of the rate limited logging macros (like LOG_WARNING_EVERY_N())
+class CUTELOGGERSHARED_EXPORT LoggerRateLimiter
+{
+  Q_DISABLE_COPY(LoggerRateLimiter)
+
+  public:
+    Q_DECL_CONSTEXPR LoggerRateLimiter()
+      : m_state(0),
+        m_suppressed(0)
+    {}
+
+    bool everyN(int n);
+    bool firstN(int n);
+    bool everyMs(int msecs);
+    bool rate(double perSecond, int burst);
+
+    quint64 takeSuppressed() { return m_suppressed.fetchAndStoreRelaxed(0); }
+
+  private:
+    bool suppress();
+
+    QAtomicInteger<qint64> m_state;
+    QAtomicInteger<quint64> m_suppressed;
 };
 
 
@@ -224,7 +669,7 @@ class CUTELOGGERSHARED_EXPORT LoggerTimingHelper
 
   private:
     Logger* m_logger;
-    QTime m_time;
+    QElapsedTimer m_timer;
     Logger::LogLevel m_logLevel;
     Logger::TimingMode m_timingMode;
     const char* m_file;
@@ -234,4 +679,65 @@ class CUTELOGGERSHARED_EXPORT LoggerTimingHelper
 };
 
 
+class LoggerTimingStatsData;
+
+//! Per call site aggregated timing of the LOG_TRACE_TIME_STATS(), LOG_DEBUG_TIME_STATS() and LOG_INFO_TIME_STATS() macros
+class CUTELOGGERSHARED_EXPORT LoggerTimingStats
+{
+  Q_DISABLE_COPY(LoggerTimingStats)
+
+  public:
+    Q_DECL_CONSTEXPR LoggerTimingStats()
+      : m_data(nullptr),
+        m_lastSummary(0)
+    {}
+
+    void add(Logger* logger, Logger::LogLevel logLevel, const char* file, int line, const char* function,
+             const char* block, qint64 nsecs);
+    bool writeSummary(Logger* logger = nullptr);
+
+    static int summaryInterval();
+    static void setSummaryInterval(int msecs);
+    static void writeSummaries();
+
+  private:
+    QAtomicPointer<LoggerTimingStatsData> m_data; //!< Allocated by the first measurement and never freed
+    QAtomicInteger<qint64> m_lastSummary;
+};
+
+
+//! Measures the scope for LoggerTimingStats
+class CUTELOGGERSHARED_EXPORT LoggerTimingScope
+{
+  Q_DISABLE_COPY(LoggerTimingScope)
+
+  public:
+    LoggerTimingScope(LoggerTimingStats* stats, Logger* l, Logger::LogLevel logLevel, const char* file, int line,
+                      const char* function)
+      : m_stats(stats),
+        m_logger(l),
+        m_logLevel(logLevel),
+        m_file(file),
+        m_line(line),
+        m_function(function),
+        m_block(nullptr),
+        m_start(-1)
+    {}
+
+    void start(const char* block = nullptr);
+
+    ~LoggerTimingScope();
+
+  private:
+    LoggerTimingStats* m_stats;
+    Logger* m_logger;
+    Logger::LogLevel m_logLevel;
+    const char* m_file;
+    int m_line;
+    const char* m_function;
+    const char* m_block;
+    qint64 m_start;
+};
+
+
 #endif // LOGGER_H
@@ -0,0 +1,55 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef LOGGERSTATISTICS_H
+#define LOGGERSTATISTICS_H
+
+// Qt
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+class AbstractAppender;
+
+
+//! Snapshot of the appender self-metrics returned by AbstractAppender::statistics()
+struct AppenderStatistics
+{
+  const AbstractAppender* appender = nullptr;
+
+  quint64 accepted = 0;        //!< Records passed to append()
+  quint64 filtered = 0;        //!< Records rejected by the details level
+  quint64 bytesWritten = 0;    //!< Bytes written to the log target by the appenders reporting it
+  quint64 appendTime = 0;      //!< Total time spent in append(), in nanoseconds (see AbstractAppender::setTimingEnabled())
+  quint64 maxAppendTime = 0;   //!< Longest append() call, in nanoseconds (see AbstractAppender::setTimingEnabled())
+  quint64 lockWaitTime = 0;    //!< Total time spent waiting for the append() lock, in nanoseconds
+
+  // Reported by the queuing appenders (like AsyncAppender) only
+  qint64 queueDepth = 0;       //!< Records waiting in the queue at the moment of the snapshot
+  quint64 dropped = 0;         //!< Records dropped because of the queue overflow
+  quint64 flushes = 0;         //!< Number of the flush() calls
+  quint64 flushTime = 0;       //!< Total time spent in flush(), in nanoseconds
+  quint64 maxFlushTime = 0;    //!< Longest flush() call, in nanoseconds
+};
+
+
+//! Snapshot of the logger self-metrics returned by Logger::statistics()
+struct LoggerStatistics
+{
+  quint64 records[6] = {};                  //!< Records written, indexed by Logger::LogLevel
+  QHash<QString, quint64> categoryRecords;  //!< Records written to every category, by all the loggers
+  quint64 lockWaitTime = 0;                 //!< Time spent waiting for the appender locks, in nanoseconds
+  QVector<AppenderStatistics> appenders;    //!< Statistics of every appender registered in the logger
+};
+
+#endif // LOGGERSTATISTICS_H
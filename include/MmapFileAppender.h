@@ -0,0 +1,71 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef MMAPFILEAPPENDER_H
+#define MMAPFILEAPPENDER_H
+
+// Local
+#include "CuteLogger_global.h"
+#include <AbstractStringAppender.h>
+
+// Qt
+#include <QAtomicPointer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+
+
+class CUTELOGGERSHARED_EXPORT MmapFileAppender : public AbstractStringAppender
+{
+  public:
+    explicit MmapFileAppender(const QString& fileName = QString());
+    ~MmapFileAppender();
+
+    QString fileName() const;
+    void setFileName(const QString& fileName);
+
+    qint64 regionSize() const;
+    void setRegionSize(qint64 size);
+
+    qint64 maxFileSize() const;
+    void setMaxFileSize(qint64 size);
+
+    virtual bool flush();
+
+  protected:
+    virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                        const char* function, const QString& category, const QString& message);
+
+  private:
+    struct Region;
+
+    bool switchRegion(qint64 recordSize);
+    void retireRegion();
+    bool mapRegion(qint64 recordSize);
+    bool openFile();
+    void closeFile();
+    void rollOver();
+    static void syncRegion(const Region* region, qint64 length);
+
+    QFile m_file;
+    mutable QMutex m_fileMutex;  //!< Protects everything except the current region used by the writers
+    qint64 m_dataEnd;            //!< File offset the valid data ends at
+
+    QAtomicPointer<Region> m_region;
+    QList<Region*> m_retiredRegions;
+
+    qint64 m_regionSize;
+    qint64 m_maxFileSize;
+};
+
+#endif // MMAPFILEAPPENDER_H
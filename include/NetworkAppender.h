@@ -0,0 +1,103 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef NETWORKAPPENDER_H
+#define NETWORKAPPENDER_H
+
+// Local
+#include "CuteLogger_global.h"
+#include <AbstractStringAppender.h>
+
+// Qt
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+
+class NetworkAppenderThread;
+class QTcpSocket;
+
+
+class CUTELOGGERSHARED_EXPORT NetworkAppender : public AbstractStringAppender
+{
+  public:
+    //! Wire format and transport of the records
+    enum Protocol
+    {
+      SyslogUdp, //!< RFC 5424 syslog message per datagram (RFC 5426)
+      SyslogTcp, //!< RFC 5424 syslog messages with the octet-counting framing (RFC 6587)
+      GelfUdp,   //!< GELF message per datagram, chunked if it is too long
+      GelfTcp    //!< Null-terminated GELF messages
+    };
+
+    NetworkAppender(const QString& host, quint16 port, Protocol protocol = SyslogUdp, int spoolSize = 4 * 1024 * 1024);
+    ~NetworkAppender();
+
+    QString host() const;
+    quint16 port() const;
+    Protocol protocol() const;
+    int spoolSize() const;
+
+    int facility() const;
+    void setFacility(int facility);
+
+    quint64 droppedRecords() const;
+    bool isCollectorDown() const;
+
+    virtual bool flush();
+
+    static int syslogSeverity(Logger::LogLevel logLevel);
+
+  protected:
+    virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                        const char* function, const QString& category, const QString& message);
+    virtual void appendBatch(const LogRecord* records, size_t count);
+    virtual void updateStatistics(AppenderStatistics& statistics) const;
+
+  private:
+    friend class NetworkAppenderThread;
+
+    void encodeRecord(QByteArray& result, const LogRecord& record) const;
+    void encodeSyslog(QByteArray& result, const LogRecord& record) const;
+    void encodeGelf(QByteArray& result, const LogRecord& record) const;
+    void spool(const QByteArray* frames, int count);
+    void processSpool();
+    bool isStopRequested() const;
+    bool waitForConnected(QTcpSocket* socket) const;
+
+    QString m_host;
+    quint16 m_port;
+    Protocol m_protocol;
+    int m_spoolSize;
+    QByteArray m_syslogIdentity;  //!< Host name, application name and pid, precomposed for every wire format
+    QByteArray m_gelfIdentity;
+
+    QAtomicInt m_facility;
+    QAtomicInteger<quint64> m_dropped;
+    QAtomicInt m_collectorDown;
+
+    NetworkAppenderThread* m_thread;
+
+    // Encoded records waiting to be sent, guarded by m_spoolMutex
+    mutable QMutex m_spoolMutex;
+    QWaitCondition m_wakeCondition;
+    QWaitCondition m_sentCondition;
+    QList<QByteArray> m_spool;
+    qint64 m_spoolBytes;
+    quint64 m_spooled;            //!< Records ever put to the spool
+    quint64 m_processed;          //!< Records ever taken from the spool, either sent or dropped
+    bool m_stopRequested;
+};
+
+#endif // NETWORKAPPENDER_H
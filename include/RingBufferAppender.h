@@ -0,0 +1,76 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef RINGBUFFERAPPENDER_H
+#define RINGBUFFERAPPENDER_H
+
+// Local
+#include "CuteLogger_global.h"
+#include <AbstractAppender.h>
+
+// Qt
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QMutex>
+
+
+class CUTELOGGERSHARED_EXPORT RingBufferAppender : public AbstractAppender
+{
+  public:
+    explicit RingBufferAppender(AbstractAppender* dumpAppender = nullptr, int capacity = 4096, int recordSize = 256);
+    ~RingBufferAppender();
+
+    int capacity() const;
+    int recordSize() const;
+
+    AbstractAppender* dumpAppender() const;
+    void setDumpAppender(AbstractAppender* appender);
+
+    quint64 droppedRecords() const;
+
+    void dump();
+    void dump(AbstractAppender* appender);
+    void dumpTo(int fd);
+    void clear();
+
+    static void installCrashHandler(int fd = 2);
+
+  protected:
+    virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                        const char* function, const QString& category, const QString& message);
+    virtual void updateStatistics(AppenderStatistics& statistics) const;
+
+  private:
+    struct Slot;
+
+    Slot* slot(quint64 position) const;
+    bool readSlot(quint64 position, Slot* copy) const;
+    quint64 firstPosition(quint64 head) const;
+
+    static void dumpCrashRings();
+
+    char* m_storage;
+    quint64 m_mask;
+    int m_recordSize;
+    QAtomicInteger<quint64> m_head;  //!< Position of the next record to be written
+    QAtomicInteger<quint64> m_first; //!< Oldest position the dump starts from, moved by clear()
+    QAtomicInteger<quint64> m_dropped;
+    QAtomicInteger<quint64> m_fatalDumpHead;  //!< m_head at the Logger::Fatal dump, the crash handler skips the
+                                              //!< repeated dump after abort() unless newer records came
+
+    QAtomicPointer<AbstractAppender> m_dumpAppender;
+    QMutex m_dumpMutex;
+};
+
+#endif // RINGBUFFERAPPENDER_H
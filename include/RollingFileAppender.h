@@ -2,9 +2,14 @@
 #define ROLLINGFILEAPPENDER_H
 
 #include <QDateTime>
+#include <QList>
+#include <QSet>
+#include <QStringList>
 
 #include <FileAppender.h>
 
+class RollingFileAppenderWorker;
+
 /*!
  * \brief The RollingFileAppender class extends FileAppender so that the underlying file is rolled over at a user chosen frequency.
  *
@@ -16,8 +21,16 @@
  * until it rolls over the next day.
  *
  * The logFilesLimit parameter is used to automatically delete the oldest log files in the directory during rollover
- * (so no more than logFilesLimit recent log files exist in the directory at any moment).
- * \sa setDatePattern(DatePattern), setLogFilesLimit(int)
+ * (so no more than logFilesLimit recent log files exist in the directory at any moment). The rolled over files may
+ * also be limited by their total size and by their age (see setLogFilesSizeLimit() and setLogFilesAgeLimit()). The log
+ * directory is scanned only once, then the appender keeps track of the files it rolls over by itself.
+ *
+ * The file is also rolled over when it grows larger than maxFileSize. The files rolled over by size within the same
+ * date pattern period get the sequence number after the date suffix (e.g. /foo/bar.2014-02-16.log.1, .2 and so on).
+ *
+ * The rolled over files may be compressed (see setCompression()). Compression and removing the old files are
+ * performed by the low priority background thread, so the logging thread only renames the file and opens the new one.
+ * \sa setDatePattern(DatePattern), setLogFilesLimit(int), setMaxFileSize(qint64)
  */
 class CUTELOGGERSHARED_EXPORT RollingFileAppender : public FileAppender
 {
@@ -43,7 +56,22 @@ class CUTELOGGERSHARED_EXPORT RollingFileAppender : public FileAppender
     };
     Q_ENUMS(DatePattern)
 
+    /*!
+     * The enum Compression defines how the rolled over files are compressed.
+     * \sa setCompression(Compression)
+     */
+    enum Compression
+    {
+      /*! The rolled over files are left as is. */
+      NoCompression = 0,
+      /*! The rolled over files are compressed to the gzip format (".gz" is appended to the file name). */
+      GzipCompression,
+      /*! The rolled over files are compressed to the zstd format (".zst" is appended to the file name). */
+      ZstdCompression
+    };
+
     RollingFileAppender(const QString& fileName = QString());
+    ~RollingFileAppender();
 
     DatePattern datePattern() const;
     void setDatePattern(DatePattern datePattern);
@@ -54,24 +82,77 @@ class CUTELOGGERSHARED_EXPORT RollingFileAppender : public FileAppender
     void setLogFilesLimit(int limit);
     int logFilesLimit() const;
 
+    void setLogFilesSizeLimit(qint64 size);
+    qint64 logFilesSizeLimit() const;
+
+    void setLogFilesAgeLimit(int seconds);
+    int logFilesAgeLimit() const;
+
+    void setMaxFileSize(qint64 size);
+    qint64 maxFileSize() const;
+
+    void setCompression(Compression compression);
+    Compression compression() const;
+    static bool isCompressionSupported(Compression compression);
+
+    void waitForBackgroundTasks();
+
   protected:
-    virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
-                        const char* function, const QString& category, const QString& message);
+    virtual void writeFormatted(const QByteArray& formatted, Logger::LogLevel logLevel);
 
   private:
-    void rollOver();
+    friend class RollingFileAppenderWorker;
+
+    struct RolledFile
+    {
+      QString fileName;
+      qint64 size;
+      QDateTime rolledOver;
+    };
+
+    void checkRollOver();
+    void rollOver(bool sizeExceeded);
+    bool renameFile(const QString& targetFileName);
     void computeRollOverTime();
     void computeFrequency();
+    void indexRolledFiles();
+    void addRolledFile(const QString& rolledFileName, const QString& fileName);
     void removeOldFiles();
     void setDatePatternString(const QString& datePatternString);
 
+    void scheduleBackgroundTasks(const QString& rolledFileName);
+    void runWorker();
+    static bool compressFile(const QString& fileName, Compression compression);
+
     QString m_datePatternString;
     DatePattern m_frequency;
 
     QDateTime m_rollOverTime;
     QString m_rollOverSuffix;
+    int m_rollOverIndex;                //!< Number of the last file rolled over by size in the current period
     int m_logFilesLimit;
+    qint64 m_logFilesSizeLimit;
+    int m_logFilesAgeLimit;
+    qint64 m_maxFileSize;
+    Compression m_compression;
     mutable QMutex m_rollingMutex;
+    QMutex m_rollOverMutex;             //!< Serializes the writes, so the file is not written while rolled over
+
+    RollingFileAppenderWorker* m_worker;
+    QMutex m_workerMutex;
+    QWaitCondition m_workerCondition;
+    QWaitCondition m_workerIdleCondition;
+    QStringList m_pendingFiles;         //!< Rolled over files waiting for the background thread
+    bool m_workerBusy;
+    bool m_stopWorker;
+
+    // Index of the rolled over files, only used by the background thread
+    QList<RolledFile> m_rolledFiles;    //!< Sorted from the oldest to the newest
+    QSet<QString> m_rolledFileNames;
+    qint64 m_rolledFilesSize;
+    bool m_indexValid;
+    QString m_indexedFileName;
+    QString m_indexedDatePattern;
 };
 
 #endif // ROLLINGFILEAPPENDER_H
@@ -0,0 +1,97 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef SHAREDMEMORYAPPENDER_H
+#define SHAREDMEMORYAPPENDER_H
+
+// Local
+#include "CuteLogger_global.h"
+#include <AbstractAppender.h>
+
+// Qt
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+
+class CUTELOGGERSHARED_EXPORT SharedMemoryAppender : public AbstractAppender
+{
+  public:
+    explicit SharedMemoryAppender(const QString& prefix = defaultPrefix(), int capacity = 8192,
+                                  int recordSize = 512);
+    ~SharedMemoryAppender();
+
+    QString segmentName() const;
+    bool isValid() const;
+
+    int capacity() const;
+    int recordSize() const;
+
+    quint64 droppedRecords() const;
+
+    static QString defaultPrefix();
+
+  protected:
+    virtual void append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                        const char* function, const QString& category, const QString& message);
+    virtual void updateStatistics(AppenderStatistics& statistics) const;
+
+  private:
+    friend class SharedMemoryCollector;
+
+    struct Header;
+    struct Slot;
+
+    Slot* slot(quint64 position) const;
+
+    QString m_segmentName;
+    Header* m_header;
+    char* m_slots;
+    size_t m_segmentSize;
+    quint64 m_mask;
+    int m_recordSize;
+};
+
+
+class CUTELOGGERSHARED_EXPORT SharedMemoryCollector
+{
+  public:
+    explicit SharedMemoryCollector(AbstractAppender* target, const QString& prefix = SharedMemoryAppender::defaultPrefix());
+    ~SharedMemoryCollector();
+
+    AbstractAppender* target() const;
+    QString prefix() const;
+
+    bool addSegment(const QString& name);
+    void scanSegments();
+    int segmentCount() const;
+
+    int collect(int maxBatchSize = 1024);
+
+    quint64 droppedRecords() const;
+
+  private:
+    struct Segment;
+
+    int drain(Segment* segment, int maxBatchSize);
+    const char* internedString(const char* data, int size);
+
+    AbstractAppender* m_target;
+    QString m_prefix;
+    QList<Segment*> m_segments;
+    QHash<QByteArray, QByteArray> m_strings;  //!< The file and function names, never freed (see cachedFunctionName())
+    quint64 m_dropped;
+};
+
+#endif // SHAREDMEMORYAPPENDER_H
@@ -13,6 +13,7 @@
 */
 // Local
 #include "AbstractAppender.h"
+#include "StripedCounter.h"
 
 // Qt
 #include <QMutexLocker>
@@ -41,20 +42,57 @@
  * like to subclass the AbstractStringAppender instead of AbstractAppender, which will give you a more convinient way to
  * control the format of the log output.
  *
+ * Every appender collects the self-metrics: how many records were written and filtered, how much time was spent
+ * writing them and so on. They are available through the statistics() function. Measuring the append() time reads
+ * the clock twice per record, so it is only done after setTimingEnabled() is called.
+ *
  * \sa AbstractStringAppender
  * \sa Logger::registerAppender()
  */
 
 
+/**
+ * \internal
+ *
+ * Self-metrics of the appender. Updated by all the threads writing to the appender without any locking.
+ */
+struct AbstractAppenderCounters
+{
+  StripedCounter accepted;
+  StripedCounter filtered;
+  StripedCounter bytesWritten;
+  StripedCounter appendTime;
+  StripedCounter maxAppendTime;
+  StripedCounter lockWaitTime;
+  StripedCounter flushes;
+  StripedCounter flushTime;
+  StripedCounter maxFlushTime;
+};
+
+
+// Bumped on every details level change, so the loggers know their cached minimum level is outdated
+QAtomicInt AbstractAppender::s_detailsLevelGeneration;
+
+// Set by setTimingEnabled(), the append() time is not measured by default
+QAtomicInt AbstractAppender::s_timingEnabled;
+
+// Fields of the record being appended by the current thread, see recordFields()
+static thread_local const LogFields* currentRecordFields = nullptr;
+
+
 //! Constructs a AbstractAppender object.
 AbstractAppender::AbstractAppender()
-  : m_detailsLevel(Logger::Debug)
+  : m_counters(new AbstractAppenderCounters),
+    m_appendSerialized(true),
+    m_detailsLevel(Logger::Debug)
 {}
 
 
 //! Destructs the AbstractAppender object.
 AbstractAppender::~AbstractAppender()
-{}
+{
+  delete m_counters;
+}
 
 
 //! Returns the current details level of appender.
@@ -72,8 +110,7 @@ AbstractAppender::~AbstractAppender()
  */
 Logger::LogLevel AbstractAppender::detailsLevel() const
 {
-  QMutexLocker locker(&m_detailsLevelMutex);
-  return m_detailsLevel;
+  return Logger::LogLevel(m_detailsLevel.loadAcquire());
 }
 
 
@@ -81,6 +118,9 @@ Logger::LogLevel AbstractAppender::detailsLevel() const
 /**
  * Default details level is Logger::Debug
  *
+ * Changing the details level also updates the minimum level cached by the loggers this appender is registered in (see
+ * Logger::isEnabledFor()) and the Qt logging categories (see Logger::updateQtCategoryFilter()).
+ *
  * \note This function is thread safe.
  *
  * \sa detailsLevel()
@@ -88,8 +128,10 @@ Logger::LogLevel AbstractAppender::detailsLevel() const
  */
 void AbstractAppender::setDetailsLevel(Logger::LogLevel level)
 {
-  QMutexLocker locker(&m_detailsLevelMutex);
-  m_detailsLevel = level;
+  m_detailsLevel.storeRelease(level);
+  s_detailsLevelGeneration.ref();
+
+  Logger::updateQtCategoryFilter();
 }
 
 
@@ -109,7 +151,8 @@ void AbstractAppender::setDetailsLevel(const QString& level)
 
 //! Tries to write the log record to this logger
 /**
- * This is the function called by Logger object to write a log message to the appender.
+ * This is the function called by Logger object to write a log message to the appender. The key-value \a fields of
+ * the structured record (if any) are available to append() through recordFields().
  *
  * \note This function is thread safe.
  *
@@ -117,16 +160,255 @@ void AbstractAppender::setDetailsLevel(const QString& level)
  * \sa detailsLevel()
  */
 void AbstractAppender::write(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
-                             const char* function, const QString& category, const QString& message)
+                             const char* function, const QString& category, const QString& message,
+                             const LogFields* fields)
 {
-  if (logLevel >= detailsLevel())
+  writeRecord(timeStamp, logLevel, file, line, function, nullptr, category, message, fields);
+}
+
+
+/**
+ * This is the overloaded function provided for the convinience. It takes the level, the source file, the line and
+ * the function of the record from the call site \a site and passes the record to appendSite().
+ *
+ * \sa LogSite
+ */
+void AbstractAppender::write(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                             const QString& message, const LogFields* fields)
+{
+  writeRecord(timeStamp, site.level(), site.file(), site.line(), site.function(), &site, category, message, fields);
+}
+
+
+void AbstractAppender::writeRecord(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                                   const char* function, const LogSite* site, const QString& category,
+                                   const QString& message, const LogFields* fields)
+{
+  if (logLevel < detailsLevel())
+  {
+    m_counters->filtered.add(1);
+    return;
+  }
+
+  if (m_appendSerialized)
+  {
+    lockWrite();
+    timedAppend(timeStamp, logLevel, file, line, function, site, category, message, fields);
+    m_writeMutex.unlock();
+  }
+  else
   {
-    QMutexLocker locker(&m_writeMutex);
+    timedAppend(timeStamp, logLevel, file, line, function, site, category, message, fields);
+  }
+}
+
+
+void AbstractAppender::timedAppend(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                                   const char* function, const LogSite* site, const QString& category,
+                                   const QString& message, const LogFields* fields)
+{
+  // Appenders may write to other appenders from append(), so the fields of the outer record are restored afterwards
+  const LogFields* outerFields = currentRecordFields;
+  currentRecordFields = fields && !fields->isEmpty() ? fields : nullptr;
+
+  const bool timed = s_timingEnabled.loadAcquire();
+  const qint64 start = timed ? monotonicNSecs() : 0;
+  if (site)
+    appendSite(timeStamp, *site, category, message);
+  else
     append(timeStamp, logLevel, file, line, function, category, message);
+
+  currentRecordFields = outerFields;
+
+  m_counters->accepted.add(1);
+  if (timed)
+  {
+    const quint64 elapsed = quint64(monotonicNSecs() - start);
+    m_counters->appendTime.add(elapsed);
+    m_counters->maxAppendTime.updateMax(elapsed);
   }
 }
 
 
+void AbstractAppender::lockWrite()
+{
+  // The time is only measured when the lock is really contended
+  if (!m_writeMutex.tryLock())
+  {
+    const qint64 waitStart = monotonicNSecs();
+    m_writeMutex.lock();
+    m_counters->lockWaitTime.add(quint64(monotonicNSecs() - waitStart));
+  }
+}
+
+
+//! Tries to write the \a count log records to this appender at once
+/**
+ * Works like write() called for every record, but the details level is checked and the internal mutex is taken only
+ * once and the accepted records are passed to appendBatch() together. Used by the queuing appenders (like
+ * AsyncAppender), which have lots of records to write at a time.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa write(), appendBatch()
+ */
+void AbstractAppender::writeBatch(const LogRecord* records, size_t count)
+{
+  const Logger::LogLevel level = detailsLevel();
+
+  if (m_appendSerialized)
+    lockWrite();
+
+  // Filtered records split the batch into the runs of the accepted ones
+  size_t first = 0;
+  while (first < count)
+  {
+    size_t last = first;
+    while (last < count && records[last].logLevel >= level)
+      ++last;
+
+    if (last > first)
+      timedAppendBatch(records + first, last - first);
+
+    first = last;
+    while (first < count && records[first].logLevel < level)
+    {
+      m_counters->filtered.add(1);
+      ++first;
+    }
+  }
+
+  if (m_appendSerialized)
+    m_writeMutex.unlock();
+}
+
+
+void AbstractAppender::timedAppendBatch(const LogRecord* records, size_t count)
+{
+  // The batch records carry their own fields
+  const LogFields* outerFields = currentRecordFields;
+  currentRecordFields = nullptr;
+
+  const bool timed = s_timingEnabled.loadAcquire();
+  const qint64 start = timed ? monotonicNSecs() : 0;
+  appendBatch(records, count);
+
+  currentRecordFields = outerFields;
+
+  m_counters->accepted.add(count);
+  if (timed)
+  {
+    // The maximum append time is accounted per record, not per the whole batch
+    const quint64 elapsed = quint64(monotonicNSecs() - start);
+    m_counters->appendTime.add(elapsed);
+    m_counters->maxAppendTime.updateMax(elapsed / count);
+  }
+}
+
+
+//! Writes the log record coming from the logging macro call site \a site
+/**
+ * Called by write() instead of append() for the records written with the LOG_TRACE(), LOG_DEBUG() etc. macros. The
+ * site stays valid until the end of the application and keeps the values derived from the record location, like
+ * LogSite::fileName() and LogSite::functionName(), so they are computed only once.
+ *
+ * Default implementation calls append(). Reimplement it along with append() if the appender can make use of these
+ * cached values.
+ *
+ * \sa append()
+ */
+void AbstractAppender::appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                                  const QString& message)
+{
+  append(timeStamp, site.level(), site.file(), site.line(), site.function(), category, message);
+}
+
+
+//! Writes the \a count log records at once
+/**
+ * Called by writeBatch() with the records passing the details level check. Default implementation calls append()
+ * (or appendSite() for the records having the call site) for every record, recordFields() returns the fields of the
+ * record during the call.
+ *
+ * Reimplement this function if the appender can write several records cheaper than one by one, for example, using
+ * a single system call.
+ *
+ * \note Like append(), this function is protected from concurrent access by writeBatch() (unless the appender
+ * disables it using setAppendSerialized()).
+ *
+ * \sa writeBatch()
+ */
+void AbstractAppender::appendBatch(const LogRecord* records, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    const LogRecord& record = records[i];
+    currentRecordFields = record.fields.isEmpty() ? nullptr : &record.fields;
+    if (record.site)
+      appendSite(record.timeStamp, *record.site, record.category, record.message);
+    else
+      append(record.timeStamp, record.logLevel, record.file, record.line, record.function, record.category,
+             record.message);
+  }
+  currentRecordFields = nullptr;
+}
+
+
+//! Returns the key-value fields of the record being appended by the current thread.
+/**
+ * The structured records (see LOG_INFO_KV()) carry the typed fields along with the message. The append() and
+ * appendSite() signatures don't include them, so the appender may obtain the fields of the record it is appending
+ * using this function. Returns null if the record has no fields or if called outside of append(), appendSite() or the
+ * default appendBatch() implementation. The records passed to appendBatch() carry their fields in LogRecord::fields.
+ *
+ * \sa LogField
+ */
+const LogFields* AbstractAppender::recordFields()
+{
+  return currentRecordFields;
+}
+
+
+//! Forces the appender to write out any records it buffers. Returns true if successful, otherwise returns false.
+/**
+ * Logger calls this function for all of its appenders before aborting the application on the Logger::Fatal record, so
+ * the buffering appenders (like AsyncAppender) wouldn't lose the last records. Default implementation does nothing.
+ *
+ * \note Implementations of this function must be thread safe.
+ */
+bool AbstractAppender::flush()
+{
+  return true;
+}
+
+
+//! Returns true if the append() calls are serialized by the appender internal mutex.
+/**
+ * \sa setAppendSerialized()
+ */
+bool AbstractAppender::isAppendSerialized() const
+{
+  return m_appendSerialized;
+}
+
+
+//! Allows the append() function to be called concurrently from several threads.
+/**
+ * By default write() protects append() with an internal mutex, so the append() implementation doesn't have to be
+ * thread safe. Appenders doing their own synchronization (or not needing any) may disable it to avoid serializing all
+ * the logging threads on this mutex.
+ *
+ * \note This function should be called from the constructor of the derived class, before the appender is registered in
+ * any Logger.
+ *
+ * \sa isAppendSerialized()
+ */
+void AbstractAppender::setAppendSerialized(bool serialized)
+{
+  m_appendSerialized = serialized;
+}
+
+
 /**
  * \fn virtual void AbstractAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file,
  *                                           int line, const char* function, const QString& message)
@@ -140,8 +422,98 @@ void AbstractAppender::write(const QDateTime& timeStamp, Logger::LogLevel logLev
  * Overload this function when you are implementing a custom appender.
  *
  * \note This function is not needed to be thread safe because it is never called directly by Logger object. The
- * write() function works as a proxy and protects this function from concurrent access.
+ * write() function works as a proxy and protects this function from concurrent access (unless the appender disables
+ * it using setAppendSerialized()).
  *
  * \sa Logger::write()
  */
 
+
+//! Returns the snapshot of the appender self-metrics.
+/**
+ * The counters are updated by the writing threads without any locking and summed up when this function is called,
+ * so the snapshot is not atomic: the counters may be read at the slightly different moments.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa Logger::statistics()
+ */
+AppenderStatistics AbstractAppender::statistics() const
+{
+  AppenderStatistics result;
+  result.appender = this;
+  result.accepted = m_counters->accepted.sum();
+  result.filtered = m_counters->filtered.sum();
+  result.bytesWritten = m_counters->bytesWritten.sum();
+  result.appendTime = m_counters->appendTime.sum();
+  result.maxAppendTime = m_counters->maxAppendTime.max();
+  result.lockWaitTime = m_counters->lockWaitTime.sum();
+  result.flushes = m_counters->flushes.sum();
+  result.flushTime = m_counters->flushTime.sum();
+  result.maxFlushTime = m_counters->maxFlushTime.max();
+
+  updateStatistics(result);
+  return result;
+}
+
+
+//! Returns true if the time spent in append() is measured for the statistics().
+/**
+ * \sa setTimingEnabled()
+ */
+bool AbstractAppender::isTimingEnabled()
+{
+  return s_timingEnabled.loadAcquire();
+}
+
+
+//! Enables measuring the time spent in append() by all the appenders.
+/**
+ * The AppenderStatistics::appendTime and AppenderStatistics::maxAppendTime stay zero by default, as the measurement
+ * reads the clock twice for every record written.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa statistics()
+ */
+void AbstractAppender::setTimingEnabled(bool enabled)
+{
+  s_timingEnabled.storeRelease(enabled ? 1 : 0);
+}
+
+
+//! Adds the \a bytes written to the log target to the appender statistics.
+/**
+ * Should be called by the appender implementations which know how many bytes they write.
+ *
+ * \sa statistics()
+ */
+void AbstractAppender::addBytesWritten(quint64 bytes)
+{
+  m_counters->bytesWritten.add(bytes);
+}
+
+
+//! Adds the flush() call taking \a nsecs nanoseconds to the appender statistics.
+/**
+ * Should be called by the queuing appenders, for which the flush latency matters.
+ *
+ * \sa statistics()
+ */
+void AbstractAppender::addFlushTime(quint64 nsecs)
+{
+  m_counters->flushes.add(1);
+  m_counters->flushTime.add(nsecs);
+  m_counters->maxFlushTime.updateMax(nsecs);
+}
+
+
+//! Fills the appender specific fields of the statistics snapshot.
+/**
+ * Called by statistics(). Reimplement this function to report the queue depth, the number of the dropped records etc.
+ * Default implementation does nothing.
+ */
+void AbstractAppender::updateStatistics(AppenderStatistics& statistics) const
+{
+  Q_UNUSED(statistics);
+}
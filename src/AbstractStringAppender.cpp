@@ -16,6 +16,9 @@
 // Local
 #include "AbstractStringAppender.h"
 
+#include "ThreadBufferPool.h"
+#include "Utf8Encoder.h"
+
 // Qt
 #include <QReadLocker>
 #include <QWriteLocker>
@@ -23,6 +26,19 @@
 #include <QRegExp>
 #include <QCoreApplication>
 #include <QThread>
+#include <QVector>
+#include <QAtomicPointer>
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+
 
 
 /**
@@ -47,9 +63,284 @@
 const char formattingMarker = '%';
 
 
+// Format string compiled by setFormat(). formattedString() only executes its tokens, so the format is never parsed
+// while writing the log records.
+struct AbstractStringAppender::FormatProgram
+{
+  struct Token
+  {
+    enum Opcode
+    {
+      Literal,
+      Time,
+      Type,
+      TypeUpper,
+      TypeOne,
+      TypeOneUpper,
+      File,
+      FileName,
+      Line,
+      Function,
+      StrippedFunction,
+      Message,
+      Category,
+      Pid,
+      AppName,
+      ThreadId
+    };
+
+    //! Describes how the formatted timestamps may be reused by the following records
+    enum TimeCaching
+    {
+      NotCached,      //!< Time format is too complex, format every timestamp
+      PerSecond,      //!< Time format doesn't show milliseconds, reuse the string while the second is the same
+      PerMillisecond  //!< Only the "zzz" part (between timePrefix and timeSuffix) changes during the second
+    };
+
+    Opcode opcode;
+    int fieldWidth;
+    QString text;       //!< Literal text or the time format
+    QByteArray utf8Text; //!< Literal text encoded to UTF-8
+
+    TimeCaching timeCaching;
+    QString timePrefix;
+    QString timeSuffix;
+  };
+
+  explicit FormatProgram(const QString& format);
+
+  QVector<Token> tokens;
+  int literalSize;
+
+  private:
+    void appendLiteral(const QString& literal);
+};
+
+
+AbstractStringAppender::FormatProgram::FormatProgram(const QString& f)
+  : literalSize(0)
+{
+  const int size = f.size();
+  QString literal;
+
+  int i = 0;
+  while (i < size)
+  {
+    QChar c = f.at(i);
+
+    // We will silently ignore the broken % marker at the end of string
+    if (c != QLatin1Char(formattingMarker) || (i + 2) >= size)
+    {
+      literal.append(c);
+    }
+    else
+    {
+      i += 2;
+      QChar currentChar = f.at(i);
+      QString command;
+      int fieldWidth = 0;
+
+      if (currentChar.isLetter())
+      {
+        command.append(currentChar);
+        int j = 1;
+        while ((i + j) < size && f.at(i + j).isLetter())
+        {
+          command.append(f.at(i+j));
+          j++;
+        }
+
+        i+=j;
+        currentChar = i < size ? f.at(i) : QChar();
+
+        // Check for the padding instruction
+        if (currentChar == QLatin1Char(':'))
+        {
+          ++i;
+          currentChar = i < size ? f.at(i) : QChar();
+          if (currentChar.isDigit() || currentChar.category() == QChar::Punctuation_Dash)
+          {
+            int j = 1;
+            while ((i + j) < size && f.at(i + j).isDigit())
+              j++;
+            fieldWidth = f.mid(i, j).toInt();
+
+            i += j;
+          }
+        }
+      }
+
+      Token token;
+      token.fieldWidth = fieldWidth;
+      token.timeCaching = Token::NotCached;
+
+      // Time stamp
+      if (command == QLatin1String("time"))
+      {
+        token.opcode = Token::Time;
+
+        if ((i + 1) < size && f.at(i + 1) == QLatin1Char('{'))
+        {
+          int j = 1;
+          while ((i + 2 + j) < size && f.at(i + 2 + j) != QLatin1Char('}'))
+            j++;
+
+          if ((i + 2 + j) < size)
+          {
+            token.text = f.mid(i + 2, j);
+
+            i += j;
+            i += 2;
+          }
+        }
+
+        if (token.text.isEmpty())
+          token.text = QLatin1String("HH:mm:ss.zzz");
+
+        // The prefix and the suffix are formatted separately, so the format can't be split when one of its parts
+        // depends on another: the "AP" marker switches the hours to the 12-hour clock, the quotes may span the parts
+        const int msecIndex = token.text.indexOf(QLatin1String("zzz"));
+        const bool splittable = !token.text.contains(QLatin1Char('\'')) && !token.text.contains(QLatin1Char('a'))
+                                && !token.text.contains(QLatin1Char('A'));
+        if (!token.text.contains(QLatin1Char('z')))
+        {
+          token.timeCaching = Token::PerSecond;
+        }
+        else if (token.text.count(QLatin1Char('z')) == 3 && msecIndex != -1 && splittable)
+        {
+          token.timeCaching = Token::PerMillisecond;
+          token.timePrefix = token.text.left(msecIndex);
+          token.timeSuffix = token.text.mid(msecIndex + 3);
+        }
+      }
+
+      // Log level
+      else if (command == QLatin1String("type"))
+        token.opcode = Token::Type;
+
+      // Uppercased log level
+      else if (command == QLatin1String("Type"))
+        token.opcode = Token::TypeUpper;
+
+      // One letter log level
+      else if (command == QLatin1String("typeOne"))
+        token.opcode = Token::TypeOne;
+
+      // One uppercase letter log level
+      else if (command == QLatin1String("TypeOne"))
+        token.opcode = Token::TypeOneUpper;
+
+      // Filename
+      else if (command == QLatin1String("File"))
+        token.opcode = Token::File;
+
+      // Filename without a path
+      else if (command == QLatin1String("file"))
+        token.opcode = Token::FileName;
+
+      // Source line number
+      else if (command == QLatin1String("line"))
+        token.opcode = Token::Line;
+
+      // Function name, as returned by Q_FUNC_INFO
+      else if (command == QLatin1String("Function"))
+        token.opcode = Token::Function;
+
+      // Stripped function name
+      else if (command == QLatin1String("function"))
+        token.opcode = Token::StrippedFunction;
+
+      // Log message
+      else if (command == QLatin1String("message"))
+        token.opcode = Token::Message;
+
+      else if (command == QLatin1String("category"))
+        token.opcode = Token::Category;
+
+      // Application pid
+      else if (command == QLatin1String("pid"))
+        token.opcode = Token::Pid;
+
+      // Appplication name
+      else if (command == QLatin1String("appname"))
+        token.opcode = Token::AppName;
+
+      // Thread ID (duplicates Qt5 threadid debbuging way)
+      else if (command == QLatin1String("threadid"))
+        token.opcode = Token::ThreadId;
+
+      // We simply replace the double formatting marker (%) with one, unknown commands are written as is. Both of them
+      // are constant, so they are merged to the surrounding literal text.
+      else
+      {
+        QString chunk = (command == QString(formattingMarker)) ? QString(QLatin1Char(formattingMarker))
+                                                               : QString(formattingMarker) + command;
+        literal.append(QString(QLatin1String("%1")).arg(chunk, fieldWidth));
+        ++i;
+        continue;
+      }
+
+      appendLiteral(literal);
+      literal.clear();
+      tokens.append(token);
+    }
+
+    ++i;
+  }
+
+  appendLiteral(literal);
+}
+
+
+// Timestamps formatted by the current thread for each of the time tokens of the program. The cache holds the program,
+// so it can't be mistaken for the program of another appender allocated at the same address later.
+struct AbstractStringAppender::TimeCache
+{
+  struct Entry
+  {
+    Entry()
+      : second(std::numeric_limits<qint64>::min()),
+        timeSpec(-1)
+    {}
+
+    qint64 second;
+    int timeSpec;
+    QString text;   //!< Whole timestamp or the part before the milliseconds
+    QString suffix; //!< Part after the milliseconds
+  };
+
+  std::shared_ptr<const FormatProgram> program;
+  QVector<Entry> entries;
+};
+
+
+void AbstractStringAppender::FormatProgram::appendLiteral(const QString& literal)
+{
+  if (literal.isEmpty())
+    return;
+
+  Token token;
+  token.opcode = Token::Literal;
+  token.fieldWidth = 0;
+  token.timeCaching = Token::NotCached;
+  token.text = literal;
+  token.utf8Text = literal.toUtf8();
+  tokens.append(token);
+
+  literalSize += literal.size();
+}
+
+
 //! Constructs a new string appender object
 AbstractStringAppender::AbstractStringAppender()
   : m_format(QLatin1String("%{time}{yyyy-MM-ddTHH:mm:ss.zzz} [%{type:-7}] <%{function}> %{message}\n"))
+{
+  updateFormat();
+}
+
+
+//! Destroys the string appender object
+AbstractStringAppender::~AbstractStringAppender()
 {}
 
 
@@ -88,7 +379,8 @@ QString AbstractStringAppender::format() const
  *   \arg \c %{time} - timestamp. You may specify your custom timestamp format using the second {} brackets after the marker,
  *           timestamp format here will be similiar to those used in QDateTime::toString() function. For example,
  *           "%{time}{dd-MM-yyyy, HH:mm}" may be replaced with "17-12-2010, 20:17" depending on current date and time.
- *           The default format used here is "HH:mm:ss.zzz".
+ *           The default format used here is "HH:mm:ss.zzz". Formatted timestamps are cached per second, so the
+ *           time formats which don't use milliseconds or contain the single "zzz" and no quoted text are faster.
  *   \arg \c %{type} - Log level. Possible log levels are shown in the Logger::LogLevel enumerator.
  *   \arg \c %{Type} - Uppercased log level.
  *   \arg \c %{typeOne} - One letter log level.
@@ -100,7 +392,9 @@ QString AbstractStringAppender::format() const
  *   \arg \c %{Function} - Name of function that called on of the LOG_* macros. Uses the \c Q_FUNC_INFO macro provided with
  *           Qt.
  *   \arg \c %{function} - Similiar to the %{Function}, but the function name is stripped using stripFunctionName
- *   \arg \c %{message} - The log message sent by the caller.
+ *           (the name of the LOG_* macro call site is stripped only once, see LogSite::functionName())
+ *   \arg \c %{message} - The log message sent by the caller, followed by the key-value fields of the structured
+ *           record (see LOG_INFO_KV()) rendered as the "key=value" pairs.
  *   \arg \c %{category} - The log category.
  *   \arg \c %{appname} - Application name (returned by QCoreApplication::applicationName() function).
  *   \arg \c %{pid} - Application pid (returned by QCoreApplication::applicationPid() function).
@@ -109,14 +403,37 @@ QString AbstractStringAppender::format() const
  *
  * \note Format doesn't add \c '\\n' to the end of the format line. Please consider adding it manually.
  *
+ * The format string is parsed only once, when it is set. The log records are formatted using its compiled form
+ * without locking.
+ *
  * \sa format()
  * \sa stripFunctionName()
  * \sa Logger::LogLevel
  */
 void AbstractStringAppender::setFormat(const QString& format)
 {
-  QWriteLocker locker(&m_formatLock);
-  m_format = format;
+  {
+    QWriteLocker locker(&m_formatLock);
+    m_format = format;
+  }
+
+  updateFormat();
+}
+
+
+//! Recompiles the format used by formattedString().
+/**
+ * The format string is compiled when it is set using the setFormat() function. Subclasses reimplementing format()
+ * must call this function when the string returned by their format() implementation changes.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa format()
+ */
+void AbstractStringAppender::updateFormat()
+{
+  std::shared_ptr<const FormatProgram> program = std::make_shared<FormatProgram>(format());
+  std::atomic_store(&m_formatProgram, program);
 }
 
 
@@ -132,6 +449,161 @@ QString AbstractStringAppender::stripFunctionName(const char* name)
 }
 
 
+// Stripped function names keyed by the Q_FUNC_INFO pointers. The lock-free open addressing table is used for the
+// lookups, the entries are never removed. When the probe sequence is exhausted the names are moved to the mutex
+// protected hash.
+class FunctionNameCache
+{
+  public:
+    FunctionNameCache()
+    {}
+
+    ~FunctionNameCache()
+    {
+      for (int i = 0; i < Size; ++i)
+        delete m_slots[i].value.load();
+    }
+
+    QString lookup(const char* function)
+    {
+      const int start = slotIndex(function);
+
+      for (int probe = 0; probe < MaxProbes; ++probe)
+      {
+        Slot& slot = m_slots[(start + probe) & (Size - 1)];
+        const char* key = slot.key.loadAcquire();
+
+        if (key == nullptr)
+        {
+          // Free slot, try to claim it. If some other thread is faster, its key may still be the same as ours
+          if (!slot.key.testAndSetOrdered(nullptr, function, key))
+          {
+            if (key != function)
+              continue;
+            return valueOf(slot, function);
+          }
+
+          m_misses.fetchAndAddRelaxed(1);
+          QString* value = new QString(AbstractStringAppender::stripFunctionName(function));
+          slot.value.storeRelease(value);
+          return *value;
+        }
+
+        if (key == function)
+          return valueOf(slot, function);
+      }
+
+      QMutexLocker locker(&m_overflowMutex);
+      QHash<const char*, QString>::const_iterator it = m_overflow.constFind(function);
+      if (it != m_overflow.constEnd())
+      {
+        m_hits.fetchAndAddRelaxed(1);
+        return it.value();
+      }
+
+      m_misses.fetchAndAddRelaxed(1);
+      return *m_overflow.insert(function, AbstractStringAppender::stripFunctionName(function));
+    }
+
+    quint64 hits() const
+    {
+      return m_hits.loadAcquire();
+    }
+
+    quint64 misses() const
+    {
+      return m_misses.loadAcquire();
+    }
+
+  private:
+    enum
+    {
+      Size = 4096,
+      MaxProbes = 32
+    };
+
+    struct Slot
+    {
+      QAtomicPointer<const char> key;
+      QAtomicPointer<QString> value;
+    };
+
+    static int slotIndex(const char* function)
+    {
+      // Fibonacci hashing of the pointer value
+      const quint64 hash = quint64(quintptr(function)) * Q_UINT64_C(11400714819323198485);
+      return int(hash >> 52);
+    }
+
+    QString valueOf(Slot& slot, const char* function)
+    {
+      // The value may still be computed by the thread which claimed the slot
+      const QString* value = slot.value.loadAcquire();
+      if (value == nullptr)
+      {
+        m_misses.fetchAndAddRelaxed(1);
+        return AbstractStringAppender::stripFunctionName(function);
+      }
+
+      m_hits.fetchAndAddRelaxed(1);
+      return *value;
+    }
+
+    Slot m_slots[Size];
+    QAtomicInteger<quint64> m_hits;
+    QAtomicInteger<quint64> m_misses;
+
+    QMutex m_overflowMutex;
+    QHash<const char*, QString> m_overflow;
+};
+
+
+static FunctionNameCache* functionNameCache()
+{
+  static FunctionNameCache cache;
+  return &cache;
+}
+
+
+//! Returns the stripped function name, caching it by the \a function pointer.
+/**
+ * Unlike stripFunctionName() the result is cached, so the function signature is only parsed once for each call site.
+ * The \a function must point to the string that is never changed or freed, like the one provided by the \c Q_FUNC_INFO
+ * macro passed to the LOG_* macros.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa stripFunctionName(), functionNameCacheHits(), functionNameCacheMisses()
+ */
+QString AbstractStringAppender::cachedFunctionName(const char* function)
+{
+  if (function == nullptr)
+    return QString();
+
+  return functionNameCache()->lookup(function);
+}
+
+
+//! Returns the number of the cachedFunctionName() calls which used the previously stripped function name.
+/**
+ * \sa functionNameCacheMisses()
+ */
+quint64 AbstractStringAppender::functionNameCacheHits()
+{
+  return functionNameCache()->hits();
+}
+
+
+//! Returns the number of the cachedFunctionName() calls which had to strip the function name.
+/**
+ * \sa functionNameCacheHits()
+ */
+quint64 AbstractStringAppender::functionNameCacheMisses()
+{
+  return functionNameCache()->misses();
+}
+
+
 // The function was backported from Qt5 sources (qlogging.h)
 QByteArray AbstractStringAppender::qCleanupFuncinfo(const char* name)
 {
@@ -299,161 +771,690 @@ QByteArray AbstractStringAppender::qCleanupFuncinfo(const char* name)
 }
 
 
-//! Returns the string to record to the logging target, formatted according to the format().
-/**
- * \sa format()
- * \sa setFormat(const QString&)
- */
-QString AbstractStringAppender::formattedString(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file,
-                                                int line, const char* function, const QString& category, const QString& message) const
+static void appendPadding(QString& result, int padding)
 {
-  QString f = format();
-  const int size = f.size();
+  if (padding > 0)
+    result.append(QString(padding, QLatin1Char(' ')));
+}
 
-  QString result;
 
-  int i = 0;
-  while (i < f.size())
-  {
-    QChar c = f.at(i);
+// Appends the field padded the same way QString::arg() does it: positive field width means right-aligned text
+static void appendField(QString& result, const QChar* data, int size, int fieldWidth)
+{
+  const int padding = qAbs(fieldWidth) - size;
 
-    // We will silently ignore the broken % marker at the end of string
-    if (c != QLatin1Char(formattingMarker) || (i + 2) >= size)
-    {
-      result.append(c);
-    }
-    else
-    {
-      i += 2;
-      QChar currentChar = f.at(i);
-      QString command;
-      int fieldWidth = 0;
+  if (fieldWidth > 0)
+    appendPadding(result, padding);
 
-      if (currentChar.isLetter())
+  result.append(data, size);
+
+  if (fieldWidth < 0)
+    appendPadding(result, padding);
+}
+
+
+static void appendField(QString& result, const QString& field, int fieldWidth)
+{
+  appendField(result, field.constData(), field.size(), fieldWidth);
+}
+
+
+static void appendField(QString& result, const char* data, int size, int fieldWidth)
+{
+  const int padding = qAbs(fieldWidth) - size;
+
+  if (fieldWidth > 0)
+    appendPadding(result, padding);
+
+  result.append(QLatin1String(data, size));
+
+  if (fieldWidth < 0)
+    appendPadding(result, padding);
+}
+
+
+static void appendField(QString& result, const char* data, int fieldWidth)
+{
+  appendField(result, data, data ? int(strlen(data)) : 0, fieldWidth);
+}
+
+
+static void appendLiteral(QString& result, const QString& text, const QByteArray& utf8Text)
+{
+  Q_UNUSED(utf8Text);
+  result.append(text);
+}
+
+
+static void appendChar(QString& result, char c)
+{
+  result.append(QLatin1Char(c));
+}
+
+
+// The file and function names are treated as Latin-1, the same way the QString formatting does it
+static void encodeLatin1(QByteArray& buffer, const char* data, int size)
+{
+  const int offset = buffer.size();
+  buffer.resize(offset + size * 2);
+
+  char* out = buffer.data() + offset;
+  const char* in = data;
+  const char* const end = data + size;
+  while (in != end)
+  {
+#if defined(CUTELOGGER_SSE2)
+    if (end - in >= 16)
+    {
+      const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+      if (_mm_movemask_epi8(chars) == 0)
       {
-        command.append(currentChar);
-        int j = 1;
-        while ((i + j) < size && f.at(i + j).isLetter())
-        {
-          command.append(f.at(i+j));
-          j++;
-        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), chars);
+        in += 16;
+        out += 16;
+        continue;
+      }
+    }
+#endif
 
-        i+=j;
-        currentChar = f.at(i);
+    const uchar c = uchar(*in++);
+    if (c < 0x80)
+    {
+      *out++ = char(c);
+    }
+    else
+    {
+      *out++ = char(0xc0 | (c >> 6));
+      *out++ = char(0x80 | (c & 0x3f));
+    }
+  }
 
-        // Check for the padding instruction
-        if (currentChar == QLatin1Char(':'))
+  buffer.resize(int(out - buffer.constData()));
+}
+
+
+static void appendPadding(QByteArray& result, int padding)
+{
+  if (padding <= 0)
+    return;
+
+  const int offset = result.size();
+  result.resize(offset + padding);
+  memset(result.data() + offset, ' ', size_t(padding));
+}
+
+
+// The field width is counted in the UTF-16 characters, so the output is aligned the same way as the QString one
+static void appendField(QByteArray& result, const QChar* data, int size, int fieldWidth)
+{
+  const int padding = qAbs(fieldWidth) - size;
+
+  if (fieldWidth > 0)
+    appendPadding(result, padding);
+
+  appendUtf8(result, data, size);
+
+  if (fieldWidth < 0)
+    appendPadding(result, padding);
+}
+
+
+static void appendField(QByteArray& result, const QString& field, int fieldWidth)
+{
+  appendField(result, field.constData(), field.size(), fieldWidth);
+}
+
+
+static void appendField(QByteArray& result, const char* data, int size, int fieldWidth)
+{
+  const int padding = qAbs(fieldWidth) - size;
+
+  if (fieldWidth > 0)
+    appendPadding(result, padding);
+
+  encodeLatin1(result, data, size);
+
+  if (fieldWidth < 0)
+    appendPadding(result, padding);
+}
+
+
+static void appendField(QByteArray& result, const char* data, int fieldWidth)
+{
+  appendField(result, data, data ? int(strlen(data)) : 0, fieldWidth);
+}
+
+
+static void appendLiteral(QByteArray& result, const QString& text, const QByteArray& utf8Text)
+{
+  Q_UNUSED(text);
+  result.append(utf8Text);
+}
+
+
+static void appendChar(QByteArray& result, char c)
+{
+  result.append(c);
+}
+
+
+template <typename Buffer>
+static void appendNumber(Buffer& result, quint64 value, int base, const char* prefix, int fieldWidth)
+{
+  static const char digits[] = "0123456789abcdef";
+
+  char buffer[32];
+  char* end = buffer + sizeof(buffer);
+  char* begin = end;
+
+  do
+  {
+    *--begin = digits[value % base];
+    value /= base;
+  } while (value);
+
+  for (int i = int(strlen(prefix)) - 1; i >= 0; --i)
+    *--begin = prefix[i];
+
+  appendField(result, begin, int(end - begin), fieldWidth);
+}
+
+
+// Timestamps obtained in the Logger::CoarseUtcTimestamps mode are converted to the local time only when formatted
+static QDateTime localTimeStamp(const QDateTime& timeStamp)
+{
+  if (timeStamp.timeSpec() == Qt::UTC && Logger::timestampMode() == Logger::CoarseUtcTimestamps)
+    return timeStamp.toLocalTime();
+
+  return timeStamp;
+}
+
+
+// Returns the time cache of the current thread for the program, replacing the least recently used one if needed. The
+// caches are owned by the thread rather than by the appender, so they are freed when the thread exits.
+AbstractStringAppender::TimeCache* AbstractStringAppender::threadTimeCache(
+    const std::shared_ptr<const FormatProgram>& program)
+{
+  enum { CacheSize = 4 };
+  static thread_local TimeCache caches[CacheSize];
+
+  // Most recently used cache is kept first
+  for (int i = 0; i < CacheSize; ++i)
+  {
+    if (caches[i].program == program)
+    {
+      if (i > 0)
+        std::rotate(caches, caches + i, caches + i + 1);
+      return &caches[0];
+    }
+  }
+
+  std::rotate(caches, caches + CacheSize - 1, caches + CacheSize);
+  caches[0].program = program;
+  caches[0].entries = QVector<TimeCache::Entry>(program->tokens.size());
+  return &caches[0];
+}
+
+
+template <typename Buffer>
+void AbstractStringAppender::appendTimeStamp(Buffer& result, const std::shared_ptr<const FormatProgram>& program,
+                                             int tokenIndex, const QDateTime& timeStamp) const
+{
+  typedef FormatProgram::Token Token;
+  const Token& token = program->tokens.at(tokenIndex);
+
+  if (token.timeCaching == Token::NotCached || !timeStamp.isValid())
+  {
+    appendField(result, localTimeStamp(timeStamp).toString(token.text), token.fieldWidth);
+    return;
+  }
+
+  TimeCache* cache = threadTimeCache(program);
+
+  const qint64 msecsSinceEpoch = timeStamp.toMSecsSinceEpoch();
+  qint64 second = msecsSinceEpoch / 1000;
+  int msec = int(msecsSinceEpoch % 1000);
+  if (msec < 0)
+  {
+    msec += 1000;
+    --second;
+  }
+
+  TimeCache::Entry& entry = cache->entries[tokenIndex];
+  if (entry.second != second || entry.timeSpec != timeStamp.timeSpec())
+  {
+    const QDateTime local = localTimeStamp(timeStamp);
+    if (token.timeCaching == Token::PerSecond)
+    {
+      entry.text = local.toString(token.text);
+    }
+    else
+    {
+      entry.text = local.toString(token.timePrefix);
+      entry.suffix = local.toString(token.timeSuffix);
+    }
+
+    entry.second = second;
+    entry.timeSpec = timeStamp.timeSpec();
+  }
+
+  if (token.timeCaching == Token::PerSecond)
+  {
+    appendField(result, entry.text, token.fieldWidth);
+    return;
+  }
+
+  const int padding = qAbs(token.fieldWidth) - (entry.text.size() + 3 + entry.suffix.size());
+  if (token.fieldWidth > 0)
+    appendPadding(result, padding);
+
+  appendField(result, entry.text, 0);
+  appendChar(result, char('0' + msec / 100));
+  appendChar(result, char('0' + msec / 10 % 10));
+  appendChar(result, char('0' + msec % 10));
+  appendField(result, entry.suffix, 0);
+
+  if (token.fieldWidth < 0)
+    appendPadding(result, padding);
+}
+
+
+// Renders the structured record fields as the space separated key=value pairs, quoting the string values if needed
+static void appendFieldsText(QString& text, const LogFields& fields)
+{
+  for (const LogField& field : fields)
+  {
+    text += QLatin1Char(' ');
+    text += QString::fromUtf8(field.key());
+    text += QLatin1Char('=');
+
+    if (field.type() != LogField::String)
+    {
+      text += field.toString();
+      continue;
+    }
+
+    const QString& value = field.string();
+    bool quoted = value.isEmpty();
+    for (int i = 0; i < value.size() && !quoted; ++i)
+    {
+      const QChar c = value.at(i);
+      quoted = c.unicode() <= ' ' || c == QLatin1Char('"') || c == QLatin1Char('=') || c == QLatin1Char('\\');
+    }
+
+    if (!quoted)
+    {
+      text += value;
+      continue;
+    }
+
+    text += QLatin1Char('"');
+    for (const QChar c : value)
+    {
+      if (c == QLatin1Char('"') || c == QLatin1Char('\\'))
+        text += QLatin1Char('\\');
+      if (c == QLatin1Char('\n'))
+        text += QLatin1String("\\n");
+      else
+        text += c;
+    }
+    text += QLatin1Char('"');
+  }
+}
+
+
+template <typename Buffer>
+void AbstractStringAppender::formatRecord(Buffer& result, const QDateTime& timeStamp, Logger::LogLevel logLevel,
+                                          const char* file, int line, const char* function, const LogSite* site,
+                                          const QString& category, const QString& message,
+                                          const LogFields* fields) const
+{
+  static const char* const levelNames[] = { "Trace", "Debug", "Info", "Warning", "Error", "Fatal" };
+  static const char* const upperLevelNames[] = { "TRACE", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL" };
+  static const char levelLetters[] = "tdiwef";
+  static const char upperLevelLetters[] = "TDIWEF";
+
+  typedef FormatProgram::Token Token;
+
+  const std::shared_ptr<const FormatProgram> program = std::atomic_load(&m_formatProgram);
+
+  result.reserve(result.size() + program->literalSize + message.size() + 64 * program->tokens.size());
+
+  const QVector<Token>& tokens = program->tokens;
+  for (int i = 0; i < tokens.size(); ++i)
+  {
+    const Token& token = tokens.at(i);
+
+    switch (token.opcode)
+    {
+      case Token::Literal:
+        appendLiteral(result, token.text, token.utf8Text);
+        break;
+
+      case Token::Time:
+        appendTimeStamp(result, program, i, timeStamp);
+        break;
+
+      case Token::Type:
+        appendField(result, levelNames[logLevel], token.fieldWidth);
+        break;
+
+      case Token::TypeUpper:
+        appendField(result, upperLevelNames[logLevel], token.fieldWidth);
+        break;
+
+      case Token::TypeOne:
+        appendField(result, levelLetters + logLevel, 1, token.fieldWidth);
+        break;
+
+      case Token::TypeOneUpper:
+        appendField(result, upperLevelLetters + logLevel, 1, token.fieldWidth);
+        break;
+
+      case Token::File:
+        appendField(result, file, token.fieldWidth);
+        break;
+
+      case Token::FileName:
+      {
+        if (site)
         {
-          currentChar = f.at(++i);
-          if (currentChar.isDigit() || currentChar.category() == QChar::Punctuation_Dash)
-          {
-            int j = 1;
-            while ((i + j) < size && f.at(i + j).isDigit())
-              j++;
-            fieldWidth = f.mid(i, j).toInt();
+          appendField(result, site->fileName(), token.fieldWidth);
+          break;
+        }
 
-            i += j;
-          }
+        const char* fileName = file;
+        for (const char* c = file; c && *c; ++c)
+        {
+          if (*c == '/' || *c == '\\')
+            fileName = c + 1;
         }
+        appendField(result, fileName, token.fieldWidth);
+        break;
       }
 
-      // Log record chunk to insert instead of formatting instruction
-      QString chunk;
+      case Token::Line:
+        if (line < 0)
+          appendField(result, QString::number(line), token.fieldWidth);
+        else
+          appendNumber(result, quint64(line), 10, "", token.fieldWidth);
+        break;
 
-      // Time stamp
-      if (command == QLatin1String("time"))
-      {
-        if (f.at(i + 1) == QLatin1Char('{'))
-        {
-          int j = 1;
-          while ((i + 2 + j) < size && f.at(i + 2 + j) != QLatin1Char('}'))
-            j++;
+      case Token::Function:
+        appendField(result, function, token.fieldWidth);
+        break;
 
-          if ((i + 2 + j) < size)
-          {
-            chunk = timeStamp.toString(f.mid(i + 2, j));
+      case Token::StrippedFunction:
+        appendField(result, site ? site->functionName() : stripFunctionName(function), token.fieldWidth);
+        break;
 
-            i += j;
-            i += 2;
-          }
+      case Token::Message:
+        if (fields)
+        {
+          QString text = message;
+          appendFieldsText(text, *fields);
+          appendField(result, text, token.fieldWidth);
+        }
+        else
+        {
+          appendField(result, message, token.fieldWidth);
         }
+        break;
 
-        if (chunk.isNull())
-          chunk = timeStamp.toString(QLatin1String("HH:mm:ss.zzz"));
-      }
+      case Token::Category:
+        appendField(result, category, token.fieldWidth);
+        break;
 
-      // Log level
-      else if (command == QLatin1String("type"))
-        chunk = Logger::levelToString(logLevel);
+      case Token::Pid:
+        appendNumber(result, quint64(QCoreApplication::applicationPid()), 10, "", token.fieldWidth);
+        break;
 
-      // Uppercased log level
-      else if (command == QLatin1String("Type"))
-        chunk = Logger::levelToString(logLevel).toUpper();
+      case Token::AppName:
+        appendField(result, QCoreApplication::applicationName(), token.fieldWidth);
+        break;
 
-      // One letter log level
-      else if (command == QLatin1String("typeOne"))
-          chunk = Logger::levelToString(logLevel).left(1).toLower();
+      case Token::ThreadId:
+        appendNumber(result, quint64(quintptr(QThread::currentThread())), 16, "0x", token.fieldWidth);
+        break;
+    }
+  }
+}
 
-      // One uppercase letter log level
-      else if (command == QLatin1String("TypeOne"))
-          chunk = Logger::levelToString(logLevel).left(1).toUpper();
 
-      // Filename
-      else if (command == QLatin1String("File"))
-        chunk = QLatin1String(file);
+//! Returns the string to record to the logging target, formatted according to the format().
+/**
+ * \sa format()
+ * \sa setFormat(const QString&)
+ */
+QString AbstractStringAppender::formattedString(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file,
+                                                int line, const char* function, const QString& category, const QString& message) const
+{
+  QString result;
+  formatTo(result, timeStamp, logLevel, file, line, function, nullptr, category, message);
+  return result;
+}
 
-      // Filename without a path
-      else if (command == QLatin1String("file"))
-        chunk = QString(QLatin1String(file)).section(QRegExp("[/\\\\]"), -1);
 
-      // Source line number
-      else if (command == QLatin1String("line"))
-        chunk = QString::number(line);
+/**
+ * This is the overloaded function provided for the convinience. The file name and the stripped function name are
+ * taken from the call site \a site, where they are computed only once.
+ *
+ * \sa AbstractAppender::appendSite()
+ */
+QString AbstractStringAppender::formattedString(const QDateTime& timeStamp, const LogSite& site,
+                                                const QString& category, const QString& message) const
+{
+  QString result;
+  formatTo(result, timeStamp, site.level(), site.file(), site.line(), site.function(), &site, category, message);
+  return result;
+}
 
-      // Function name, as returned by Q_FUNC_INFO
-      else if (command == QLatin1String("Function"))
-        chunk = QString::fromLatin1(function);
 
-      // Stripped function name
-      else if (command == QLatin1String("function"))
-        chunk = stripFunctionName(function);
+/**
+ * This is the overloaded function provided for the convinience. It formats the \a record passed to
+ * AbstractAppender::appendBatch().
+ */
+QString AbstractStringAppender::formattedString(const LogRecord& record) const
+{
+  QString result;
+  formatTo(result, record);
+  return result;
+}
 
-      // Log message
-      else if (command == QLatin1String("message"))
-        chunk = message;
 
-      else if (command == QLatin1String("category"))
-        chunk = category;
+//! Appends the formatted log record to the \a result.
+/**
+ * Works like formattedString(), but doesn't allocate a new string for every record: the appenders may reuse the same
+ * buffer (see FormatBuffer). This function is thread safe and doesn't take any locks, so the appenders may format the
+ * records before locking their log target.
+ *
+ * The \a site may be null.
+ */
+void AbstractStringAppender::formatTo(QString& result, const QDateTime& timeStamp, Logger::LogLevel logLevel,
+                                      const char* file, int line, const char* function, const LogSite* site,
+                                      const QString& category, const QString& message) const
+{
+  formatRecord(result, timeStamp, logLevel, file, line, function, site, category, message, recordFields());
+}
 
-      // Application pid
-      else if (command == QLatin1String("pid"))
-        chunk = QString::number(QCoreApplication::applicationPid());
 
-      // Appplication name
-      else if (command == QLatin1String("appname"))
-        chunk = QCoreApplication::applicationName();
+/**
+ * This is the overloaded function provided for the convinience. It appends the formatted \a record passed to
+ * AbstractAppender::appendBatch().
+ */
+void AbstractStringAppender::formatTo(QString& result, const LogRecord& record) const
+{
+  formatRecord(result, record.timeStamp, record.logLevel, record.file, record.line, record.function, record.site,
+               record.category, record.message, record.fields.isEmpty() ? nullptr : &record.fields);
+}
 
-      // Thread ID (duplicates Qt5 threadid debbuging way)
-      else if (command == QLatin1String("threadid"))
-        chunk = QLatin1String("0x") + QString::number(qlonglong(QThread::currentThread()->currentThread()), 16);
 
-      // We simply replace the double formatting marker (%) with one
-      else if (command == QString(formattingMarker))
-        chunk = QLatin1Char(formattingMarker);
+//! Returns the log record formatted according to the format() and encoded to UTF-8.
+/**
+ * The result is the same as formattedString().toUtf8(), but the record is encoded while formatted: the literal
+ * text of the format is encoded only once, the ASCII parts of the source file and function names and of the message
+ * are copied in blocks (using SSE2 where available) and no intermediate formatted QString is created.
+ *
+ * \sa formatUtf8To()
+ */
+QByteArray AbstractStringAppender::formattedUtf8(const QDateTime& timeStamp, Logger::LogLevel logLevel,
+                                                 const char* file, int line, const char* function,
+                                                 const QString& category, const QString& message) const
+{
+  QByteArray result;
+  formatUtf8To(result, timeStamp, logLevel, file, line, function, nullptr, category, message);
+  return result;
+}
 
-      // Do not process any unknown commands
-      else
+
+//! Appends the log record formatted according to the format() and encoded to UTF-8 to the \a result.
+/**
+ * Works like formattedUtf8(), but reuses the \a result buffer (see FormatBuffer). This function is thread safe and
+ * doesn't take any locks.
+ *
+ * The \a site may be null.
+ */
+void AbstractStringAppender::formatUtf8To(QByteArray& result, const QDateTime& timeStamp, Logger::LogLevel logLevel,
+                                          const char* file, int line, const char* function, const LogSite* site,
+                                          const QString& category, const QString& message) const
+{
+  formatRecord(result, timeStamp, logLevel, file, line, function, site, category, message, recordFields());
+}
+
+
+/**
+ * This is the overloaded function provided for the convinience. It appends the formatted \a record passed to
+ * AbstractAppender::appendBatch().
+ */
+void AbstractStringAppender::formatUtf8To(QByteArray& result, const LogRecord& record) const
+{
+  formatRecord(result, record.timeStamp, record.logLevel, record.file, record.line, record.function, record.site,
+               record.category, record.message, record.fields.isEmpty() ? nullptr : &record.fields);
+}
+
+
+//! Appends the \a string encoded to UTF-8 to the \a buffer.
+/**
+ * Unlike QString::toUtf8() it doesn't create the temporary QByteArray. The unpaired surrogates are replaced with
+ * U+FFFD.
+ */
+void AbstractStringAppender::appendUtf8(QByteArray& buffer, const QString& string)
+{
+  ::appendUtf8(buffer, string.constData(), string.size());
+}
+
+
+// Escapes the JSON string started at the offset and closes it
+static void finishJsonString(QByteArray& buffer, int start)
+{
+  // The non-ASCII bytes never need escaping, most of the strings are copied as is
+  int escaped = start;
+
+#if defined(CUTELOGGER_SSE2)
+  // Sixteen bytes at a time are checked for the control characters, the quotes and the backslashes
+  const char* data = buffer.constData();
+  const int size = buffer.size();
+  while (size - escaped >= 16)
+  {
+    const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + escaped));
+    const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(chars, _mm_set1_epi8(0x1f)), chars);
+    const __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('"')),
+                                         _mm_cmpeq_epi8(chars, _mm_set1_epi8('\\')));
+    if (_mm_movemask_epi8(_mm_or_si128(control, special)) != 0)
+      break;
+    escaped += 16;
+  }
+#endif
+
+  while (escaped < buffer.size() && uchar(buffer.at(escaped)) >= 0x20 && buffer.at(escaped) != '"'
+         && buffer.at(escaped) != '\\')
+    ++escaped;
+
+  if (escaped < buffer.size())
+  {
+    static const char hexDigits[] = "0123456789abcdef";
+
+    const QByteArray tail = buffer.mid(escaped);
+    buffer.truncate(escaped);
+    for (char c : tail)
+    {
+      switch (c)
       {
-        chunk = QString(formattingMarker);
-        chunk.append(command);
+        case '"':  buffer.append("\\\"", 2); break;
+        case '\\': buffer.append("\\\\", 2); break;
+        case '\n': buffer.append("\\n", 2); break;
+        case '\r': buffer.append("\\r", 2); break;
+        case '\t': buffer.append("\\t", 2); break;
+        default:
+          if (uchar(c) < 0x20)
+          {
+            buffer.append("\\u00", 4);
+            buffer.append(hexDigits[uchar(c) >> 4]);
+            buffer.append(hexDigits[uchar(c) & 0xf]);
+          }
+          else
+          {
+            buffer.append(c);
+          }
       }
-
-      result.append(QString(QLatin1String("%1")).arg(chunk, fieldWidth));
     }
-
-    ++i;
   }
 
-  return result;
+  buffer.append('"');
+}
+
+
+//! Appends the \a string to the \a buffer as the quoted and escaped JSON string in the UTF-8 encoding.
+void AbstractStringAppender::appendJsonString(QByteArray& buffer, const QString& string)
+{
+  buffer.append('"');
+  const int start = buffer.size();
+  ::appendUtf8(buffer, string.constData(), string.size());
+  finishJsonString(buffer, start);
+}
+
+
+/**
+ * This is the overloaded function provided for the convinience. It appends the null-terminated UTF-8 \a string,
+ * e.g. the file or the function name of the record. Null \a string is appended as the empty one.
+ */
+void AbstractStringAppender::appendJsonString(QByteArray& buffer, const char* string)
+{
+  buffer.append('"');
+  const int start = buffer.size();
+  if (string)
+    buffer.append(string);
+  finishJsonString(buffer, start);
+}
+
+
+//! Returns a free format buffer of the current thread or null if all of them are in use.
+/**
+ * The buffer is empty, but keeps the capacity it grew to while formatting the previous records. Every thread has a
+ * few buffers, so the records written while formatting another record (e.g. from the operator<< of the logged object)
+ * don't allocate either. Use the FormatBuffer class instead of calling this function directly.
+ *
+ * \sa releaseFormatBuffer()
+ */
+AbstractStringAppender::FormatBufferData* AbstractStringAppender::acquireFormatBuffer()
+{
+  FormatBufferData* data = threadBufferPool<FormatBufferData>().acquire();
+  if (!data)
+    return nullptr;
+
+  resetPooledBuffer(data->string);
+  resetPooledBuffer(data->bytes);
+  return data;
+}
+
+
+//! Returns the \a buffer acquired by acquireFormatBuffer().
+void AbstractStringAppender::releaseFormatBuffer(FormatBufferData* buffer)
+{
+  if (!buffer)
+    return;
+
+  trimPooledBuffer(buffer->string);
+  trimPooledBuffer(buffer->bytes);
+  threadBufferPool<FormatBufferData>().release(buffer);
 }
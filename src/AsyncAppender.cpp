@@ -0,0 +1,409 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Local
+#include "AsyncAppender.h"
+
+#include "StripedCounter.h"
+
+// Qt
+#include <QMutexLocker>
+#include <QThread>
+#include <QVector>
+
+// STL
+#include <utility>
+
+
+/**
+ * \class AsyncAppender
+ *
+ * \brief AsyncAppender writes the log records to another appender from a dedicated background thread.
+ *
+ * AsyncAppender is a decorator for any other appender. The logging threads only copy the log record into a bounded
+ * lock-free queue and return immediately, while the background writer thread takes the records from the queue and
+ * passes them to the wrapped appender. This way a slow log target (like a file on a busy disk) doesn't stall the
+ * threads writing the log records. The writer thread passes the queued records to the wrapped appender in batches (see
+ * AbstractAppender::writeBatch()), so the wrapped appender takes its locks and writes to its target once per batch.
+ *
+ * \code
+ * FileAppender* fileAppender = new FileAppender("app.log");
+ * cuteLogger->registerAppender(new AsyncAppender(fileAppender));
+ * \endcode
+ *
+ * When the queue is full the record is handled according to the overflowPolicy(): the logging thread either waits for
+ * the writer thread to free some space or the record is dropped. The number of the dropped records is available through
+ * the droppedRecords() function.
+ *
+ * AsyncAppender takes ownership of the wrapped appender, so it must not be registered in Logger by itself. All the
+ * queued records are written out when AsyncAppender is destroyed (e.g. in the Logger destructor), when flush() is called
+ * and before the application is aborted by the Logger::Fatal record.
+ *
+ * \note The details level of AsyncAppender is initialized with the details level of the wrapped appender. Records are
+ * filtered by both of them: before queuing and before writing.
+ *
+ * \sa AbstractAppender
+ */
+
+
+class AsyncAppenderThread : public QThread
+{
+  public:
+    explicit AsyncAppenderThread(AsyncAppender* appender)
+      : m_appender(appender)
+    {}
+
+  protected:
+    virtual void run()
+    {
+      m_appender->processQueue();
+    }
+
+  private:
+    AsyncAppender* m_appender;
+};
+
+
+//! Constructs the asynchronous appender writing to the \a appender.
+/**
+ * The \a queueSize is the maximum number of the records waiting to be written. It is rounded up to the power of two.
+ */
+AsyncAppender::AsyncAppender(AbstractAppender* appender, int queueSize)
+  : m_appender(appender),
+    m_thread(nullptr),
+    m_head(0),
+    m_overflowPolicy(Block),
+    m_dropLevel(Logger::Warning)
+{
+  Q_ASSERT_X(appender, "AsyncAppender::AsyncAppender()", "Wrapped appender is null");
+
+  quint64 capacity = 2;
+  while (capacity < quint64(queueSize))
+    capacity <<= 1;
+
+  m_slots = new Slot[capacity];
+  for (quint64 i = 0; i < capacity; ++i)
+    m_slots[i].sequence.store(i);
+  m_mask = capacity - 1;
+
+  setDetailsLevel(appender->detailsLevel());
+
+  // The records are queued by the lock-free code, there is no need to hold the append() mutex
+  setAppendSerialized(false);
+
+  m_thread = new AsyncAppenderThread(this);
+  m_thread->start();
+}
+
+
+//! Writes all the queued records, stops the writer thread and destroys the wrapped appender.
+AsyncAppender::~AsyncAppender()
+{
+  {
+    QMutexLocker locker(&m_wakeMutex);
+    m_stopRequested.storeRelease(1);
+    m_wakeCondition.wakeOne();
+  }
+
+  m_thread->wait();
+  delete m_thread;
+
+  m_appender->flush();
+  delete m_appender;
+
+  delete[] m_slots;
+}
+
+
+//! Returns the appender the records are written to.
+AbstractAppender* AsyncAppender::appender() const
+{
+  return m_appender;
+}
+
+
+//! Returns the maximum number of records waiting to be written.
+int AsyncAppender::queueSize() const
+{
+  return int(m_mask + 1);
+}
+
+
+//! Returns the current overflow policy.
+/**
+ * \sa setOverflowPolicy()
+ */
+AsyncAppender::OverflowPolicy AsyncAppender::overflowPolicy() const
+{
+  return OverflowPolicy(m_overflowPolicy.loadAcquire());
+}
+
+
+//! Sets what to do with the log record when the queue is full.
+/**
+ * Default policy is AsyncAppender::Block.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa overflowPolicy(), setDropLevel()
+ */
+void AsyncAppender::setOverflowPolicy(OverflowPolicy policy)
+{
+  m_overflowPolicy.storeRelease(policy);
+}
+
+
+//! Returns the log level the records are never dropped from with the AsyncAppender::DropBelowLevel policy.
+/**
+ * \sa setDropLevel()
+ */
+Logger::LogLevel AsyncAppender::dropLevel() const
+{
+  return Logger::LogLevel(m_dropLevel.loadAcquire());
+}
+
+
+//! Sets the log level for the AsyncAppender::DropBelowLevel overflow policy.
+/**
+ * With the AsyncAppender::DropBelowLevel policy the records with the log level lower than \a level are dropped when the
+ * queue is full, while the rest are waiting for the free space. Default drop level is Logger::Warning.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa setOverflowPolicy()
+ */
+void AsyncAppender::setDropLevel(Logger::LogLevel level)
+{
+  m_dropLevel.storeRelease(level);
+}
+
+
+//! Returns the number of the records dropped because of the queue overflow.
+quint64 AsyncAppender::droppedRecords() const
+{
+  return m_dropped.loadAcquire();
+}
+
+
+//! Waits until all the records queued before the call are written and flushes the wrapped appender.
+/**
+ * \note This function is thread safe.
+ */
+bool AsyncAppender::flush()
+{
+  const qint64 start = monotonicNSecs();
+
+  // Wrapped appender may be flushed from inside of its own write() call, we can't wait for ourselves in this case
+  if (QThread::currentThread() != m_thread)
+  {
+    const quint64 target = m_tail.loadAcquire();
+
+    QMutexLocker locker(&m_wakeMutex);
+    while (m_written.loadAcquire() < target)
+    {
+      m_wakeCondition.wakeOne();
+      m_writtenCondition.wait(&m_wakeMutex, 100);
+    }
+  }
+
+  const bool result = m_appender->flush();
+  addFlushTime(quint64(monotonicNSecs() - start));
+  return result;
+}
+
+
+//! Reports the queue depth, the dropped records and the flush latency.
+void AsyncAppender::updateStatistics(AppenderStatistics& statistics) const
+{
+  statistics.queueDepth = qint64(m_tail.loadAcquire() - m_written.loadAcquire());
+  statistics.dropped = m_dropped.loadAcquire();
+}
+
+
+//! Puts the log record to the queue.
+/**
+ * \sa AbstractAppender::append()
+ */
+void AsyncAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                           const char* function, const QString& category, const QString& message)
+{
+  queueRecord(timeStamp, logLevel, file, line, function, nullptr, category, message, recordFields());
+}
+
+
+//! Puts the log record coming from the logging macro call site to the queue.
+/**
+ * The sites are never destroyed, so only the pointer to the site is queued.
+ *
+ * \sa AbstractAppender::appendSite()
+ */
+void AsyncAppender::appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                               const QString& message)
+{
+  queueRecord(timeStamp, site.level(), site.file(), site.line(), site.function(), &site, category, message,
+              recordFields());
+}
+
+
+void AsyncAppender::queueRecord(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                                const char* function, const LogSite* site, const QString& category,
+                                const QString& message, const LogFields* fields)
+{
+  if (enqueue(timeStamp, logLevel, file, line, function, site, category, message, fields))
+  {
+    wakeWriter();
+    return;
+  }
+
+  // The queue is full. Waiting for the free space is not an option if the wrapped appender logs something by itself.
+  const OverflowPolicy policy = overflowPolicy();
+  if (policy == DropNewest || (policy == DropBelowLevel && logLevel < dropLevel()) || QThread::currentThread() == m_thread)
+  {
+    m_dropped.fetchAndAddRelaxed(1);
+    return;
+  }
+
+  forever
+  {
+    QMutexLocker locker(&m_wakeMutex);
+    m_wakeCondition.wakeOne();
+    m_writtenCondition.wait(&m_wakeMutex, 10);
+    locker.unlock();
+
+    if (enqueue(timeStamp, logLevel, file, line, function, site, category, message, fields))
+      break;
+  }
+
+  wakeWriter();
+}
+
+
+// Bounded multi-producer queue (see D. Vyukov's bounded MPMC queue). Every slot has a sequence number showing if it
+// is free for the writing in the current lap of the ring or contains the record ready to be read.
+bool AsyncAppender::enqueue(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                            const char* function, const LogSite* site, const QString& category,
+                            const QString& message, const LogFields* fields)
+{
+  quint64 position = m_tail.loadAcquire();
+
+  forever
+  {
+    Slot& slot = m_slots[position & m_mask];
+    const qint64 difference = qint64(slot.sequence.loadAcquire() - position);
+
+    if (difference == 0)
+    {
+      if (m_tail.testAndSetRelaxed(position, position + 1, position))
+      {
+        LogRecord& record = slot.record;
+        record.timeStamp = timeStamp;
+        record.logLevel = logLevel;
+        record.file = file;
+        record.line = line;
+        record.function = function;
+        record.site = site;
+        record.category = category;
+        record.message = message;
+        if (fields)
+          record.fields = *fields;
+        else
+          record.fields.clear();
+
+        slot.sequence.storeRelease(position + 1);
+        return true;
+      }
+    }
+    else if (difference < 0)
+    {
+      // The slot from the previous lap is still not read, the queue is full
+      return false;
+    }
+    else
+    {
+      position = m_tail.loadAcquire();
+    }
+  }
+}
+
+
+// Only called from the writer thread
+bool AsyncAppender::dequeue(LogRecord& record)
+{
+  Slot& slot = m_slots[m_head & m_mask];
+  if (slot.sequence.loadAcquire() != m_head + 1)
+    return false;
+
+  record = std::move(slot.record);
+  slot.sequence.storeRelease(m_head + m_mask + 1);
+  ++m_head;
+
+  return true;
+}
+
+
+void AsyncAppender::wakeWriter()
+{
+  if (m_writerSleeping.testAndSetOrdered(1, 0))
+  {
+    QMutexLocker locker(&m_wakeMutex);
+    m_wakeCondition.wakeOne();
+  }
+}
+
+
+void AsyncAppender::processQueue()
+{
+  // The records are passed to the wrapped appender in batches, so it takes its locks once per batch
+  static const int maxBatchSize = 256;
+  QVector<LogRecord> batch(maxBatchSize);
+  LogRecord* records = batch.data();
+
+  forever
+  {
+    bool wasWritten = false;
+    forever
+    {
+      int count = 0;
+      while (count < maxBatchSize && dequeue(records[count]))
+        ++count;
+
+      if (count == 0)
+        break;
+
+      m_appender->writeBatch(records, size_t(count));
+      m_written.fetchAndAddRelease(count);
+      wasWritten = true;
+
+      if (count < maxBatchSize)
+        break;
+    }
+
+    QMutexLocker locker(&m_wakeMutex);
+    if (wasWritten)
+      m_writtenCondition.wakeAll();
+
+    if (m_stopRequested.loadAcquire() && m_head == m_tail.loadAcquire())
+      break;
+
+    // Logging threads wake us up only when we announce we're going to sleep, so we have to recheck the queue after that
+    m_writerSleeping.fetchAndStoreOrdered(1);
+    if (m_slots[m_head & m_mask].sequence.loadAcquire() == m_head + 1 || m_stopRequested.loadAcquire())
+    {
+      m_writerSleeping.storeRelease(0);
+      continue;
+    }
+
+    m_wakeCondition.wait(&m_wakeMutex, 100);
+    m_writerSleeping.storeRelease(0);
+  }
+}
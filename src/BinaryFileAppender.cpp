@@ -0,0 +1,228 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Local
+#include "BinaryFileAppender.h"
+
+// Qt
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QtEndian>
+
+// STL
+#include <iostream>
+
+
+/**
+ * \class BinaryFileAppender
+ *
+ * \brief BinaryFileAppender writes the log records to the file in the compact binary form.
+ *
+ * Building the text of the log record (formatting the timestamp, stripping the function name, padding the fields and
+ * converting the result to the 8-bit encoding) takes most of the CPU time spent by the text appenders. BinaryFileAppender
+ * skips all of it: it writes the record fields as is, while the file and function names are written only once for each
+ * call site. The file is later converted to text by the \c cutelog-decode tool, using any AbstractStringAppender
+ * format string:
+ *
+ * \code
+ * cutelog-decode --format "%{time}{yyyy-MM-ddTHH:mm:ss.zzz} [%{type:-7}] <%{function}> %{message}" app.clog
+ * \endcode
+ *
+ * The file starts with the 8 bytes of fileMagic followed by the 32-bit fileVersion. Then the entries follow, each one
+ * starting with the one byte EntryType:
+ *   \arg \c CallSiteEntry - 32-bit call site id, 32-bit line, file name and function name;
+ *   \arg \c CategoryEntry - 32-bit category id and category name;
+ *   \arg \c RecordEntry - 64-bit timestamp, 8-bit Logger::LogLevel, 32-bit call site id, 32-bit category id
+ *        (\c 0xFFFFFFFF for no category) and the message.
+ *
+ * The timestamp is the number of milliseconds since the Unix epoch. It is the resolution of the QDateTime the records
+ * are stamped with, so storing the nanoseconds would only multiply the same value.
+ *
+ * Strings are written as the 32-bit length followed by the UTF-8 (or Latin-1 for the file and function names) bytes.
+ * All the integers are little endian. Dictionary entries are written before the first record using them, and the
+ * dictionaries are restarted when the file is reopened, so the ids are only valid until they are redefined.
+ *
+ * \note The records are written through the file buffer, which is flushed for the Logger::Error and higher records and
+ * when flush() is called (e.g. before the Logger::Fatal record aborts the application).
+ */
+
+
+const char* const BinaryFileAppender::fileMagic = "CUTELOGB";
+
+
+template <typename T>
+static void appendInteger(QByteArray& buffer, T value)
+{
+  const T littleEndian = qToLittleEndian(value);
+  buffer.append(reinterpret_cast<const char*>(&littleEndian), int(sizeof(T)));
+}
+
+
+static void appendString(QByteArray& buffer, const char* data, int size)
+{
+  appendInteger(buffer, quint32(size));
+  buffer.append(data, size);
+}
+
+
+static void appendString(QByteArray& buffer, const char* string)
+{
+  appendString(buffer, string ? string : "", string ? int(qstrlen(string)) : 0);
+}
+
+
+static void appendString(QByteArray& buffer, const QString& string)
+{
+  const QByteArray utf8 = string.toUtf8();
+  appendString(buffer, utf8.constData(), utf8.size());
+}
+
+
+//! Constructs the new binary file appender assigned to file with the given name.
+BinaryFileAppender::BinaryFileAppender(const QString& fileName)
+{
+  setFileName(fileName);
+}
+
+
+BinaryFileAppender::~BinaryFileAppender()
+{
+  QMutexLocker locker(&m_fileMutex);
+  closeFile();
+}
+
+
+//! Returns the name set by setFileName() or to the BinaryFileAppender constructor.
+/**
+ * \sa setFileName()
+ */
+QString BinaryFileAppender::fileName() const
+{
+  QMutexLocker locker(&m_fileMutex);
+  return m_file.fileName();
+}
+
+
+//! Sets the name of the file. The name can have no path, a relative path, or an absolute path.
+/**
+ * \sa fileName()
+ */
+void BinaryFileAppender::setFileName(const QString& fileName)
+{
+  if (fileName.isEmpty())
+    std::cerr << "<BinaryFileAppender::BinaryFileAppender> File name is empty. The appender will do nothing" << std::endl;
+
+  QMutexLocker locker(&m_fileMutex);
+  closeFile();
+  m_file.setFileName(fileName);
+}
+
+
+//! Writes the buffered records to the file.
+bool BinaryFileAppender::flush()
+{
+  QMutexLocker locker(&m_fileMutex);
+  return !m_file.isOpen() || m_file.flush();
+}
+
+
+//! Writes the log record to the file.
+/**
+ * \sa fileName()
+ */
+void BinaryFileAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                                const char* function, const QString& category, const QString& message)
+{
+  QMutexLocker locker(&m_fileMutex);
+
+  if (!openFile())
+    return;
+
+  // Keeps the allocated capacity
+  m_buffer.resize(0);
+
+  const CallSite callSite = { file, function, line };
+  QHash<CallSite, quint32>::const_iterator site = m_callSites.constFind(callSite);
+  if (site == m_callSites.constEnd())
+  {
+    site = m_callSites.insert(callSite, quint32(m_callSites.size()));
+
+    m_buffer.append(char(CallSiteEntry));
+    appendInteger(m_buffer, site.value());
+    appendInteger(m_buffer, qint32(line));
+    appendString(m_buffer, file);
+    appendString(m_buffer, function);
+  }
+
+  quint32 categoryId = 0xFFFFFFFF;
+  if (!category.isNull())
+  {
+    QHash<QString, quint32>::const_iterator it = m_categories.constFind(category);
+    if (it == m_categories.constEnd())
+    {
+      it = m_categories.insert(category, quint32(m_categories.size()));
+
+      m_buffer.append(char(CategoryEntry));
+      appendInteger(m_buffer, it.value());
+      appendString(m_buffer, category);
+    }
+    categoryId = it.value();
+  }
+
+  m_buffer.append(char(RecordEntry));
+  appendInteger(m_buffer, qint64(timeStamp.toMSecsSinceEpoch()));
+  appendInteger(m_buffer, quint8(logLevel));
+  appendInteger(m_buffer, site.value());
+  appendInteger(m_buffer, categoryId);
+  appendString(m_buffer, message);
+
+  m_file.write(m_buffer);
+  addBytesWritten(quint64(m_buffer.size()));
+  if (logLevel >= Logger::Error)
+    m_file.flush();
+}
+
+
+// Should be called with the m_fileMutex locked
+bool BinaryFileAppender::openFile()
+{
+  if (m_file.isOpen())
+    return true;
+
+  if (m_file.fileName().isEmpty())
+    return false;
+
+  if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append))
+  {
+    std::cerr << "<BinaryFileAppender::append> Cannot open the log file " << qPrintable(m_file.fileName()) << std::endl;
+    return false;
+  }
+
+  if (m_file.size() == 0)
+  {
+    QByteArray header(fileMagic);
+    appendInteger(header, fileVersion);
+    m_file.write(header);
+  }
+
+  return true;
+}
+
+
+// Should be called with the m_fileMutex locked
+void BinaryFileAppender::closeFile()
+{
+  m_file.close();
+  m_callSites.clear();
+  m_categories.clear();
+}
@@ -14,14 +14,23 @@
 // Local
 #include "ConsoleAppender.h"
 
+// Qt
+#include <QThread>
+
 // STL
-#include <iostream>
+#include <cerrno>
+
+#if defined(Q_OS_WIN)
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
 
 
 /**
  * \class ConsoleAppender
  *
- * \brief ConsoleAppender is the simple appender that writes the log records to the std::cerr output stream.
+ * \brief ConsoleAppender is the simple appender that writes the log records to the standard error output.
  *
  * ConsoleAppender uses "[%{type:-7}] <%{function}> %{message}\n" as a default output format. It is similar to the
  * AbstractStringAppender but doesn't show a timestamp.
@@ -29,36 +38,306 @@
  * You can modify ConsoleAppender output format without modifying your code by using \c QT_MESSAGE_PATTERN environment
  * variable. If you need your application to ignore this environment variable you can call
  * ConsoleAppender::ignoreEnvironmentPattern(true)
+ *
+ * The records are encoded to UTF-8 and every record is written with a single system call, so the lines written by
+ * the different processes sharing the same output are not mixed up. Like the FileAppender, ConsoleAppender may also
+ * collect the records in the buffer and write them together (see setBufferSize()).
+ *
+ * \note The environment variable is read once, when the appender is created.
  */
 
 
+class ConsoleAppenderFlusher : public QThread
+{
+  public:
+    explicit ConsoleAppenderFlusher(ConsoleAppender* appender)
+      : m_appender(appender)
+    {}
+
+  protected:
+    virtual void run()
+    {
+      m_appender->runFlusher();
+    }
+
+  private:
+    ConsoleAppender* m_appender;
+};
+
+
 ConsoleAppender::ConsoleAppender()
   : AbstractStringAppender()
   , m_ignoreEnvPattern(false)
+  , m_envPattern(QString::fromLocal8Bit(qgetenv("QT_MESSAGE_PATTERN")))
+  , m_bufferSize(0)
+  , m_maxLatency(50)
+  , m_immediateFlushLevel(Logger::Error)
+  , m_flusher(nullptr)
+  , m_stopFlusher(false)
 {
+  // Records are formatted with no lock held, only the output buffer is protected by m_bufferMutex
+  setAppendSerialized(false);
+
   setFormat("[%{type:-7}] <%{function}> %{message}\n");
 }
 
 
+//! Writes out the buffered records.
+ConsoleAppender::~ConsoleAppender()
+{
+  if (m_flusher)
+  {
+    {
+      QMutexLocker locker(&m_bufferMutex);
+      m_stopFlusher = true;
+      m_flusherCondition.wakeAll();
+    }
+
+    m_flusher->wait();
+    delete m_flusher;
+  }
+
+  QMutexLocker locker(&m_bufferMutex);
+  writeBuffer();
+}
+
+
 QString ConsoleAppender::format() const
 {
-  const QString envPattern = QString::fromLocal8Bit(qgetenv("QT_MESSAGE_PATTERN"));
-  return (m_ignoreEnvPattern || envPattern.isEmpty()) ? AbstractStringAppender::format() : (envPattern + "\n");
+  return (m_ignoreEnvPattern || m_envPattern.isEmpty()) ? AbstractStringAppender::format() : (m_envPattern + "\n");
 }
 
 
 void ConsoleAppender::ignoreEnvironmentPattern(bool ignore)
 {
   m_ignoreEnvPattern = ignore;
+  updateFormat();
 }
 
 
-//! Writes the log record to the std::cerr stream.
+//! Returns the size of the buffer the records are collected in, in bytes.
+/**
+ * \sa setBufferSize()
+ */
+int ConsoleAppender::bufferSize() const
+{
+  QMutexLocker locker(&m_bufferMutex);
+  return m_bufferSize;
+}
+
+
+//! Sets the size of the buffer the records are collected in before writing them to the output.
+/**
+ * Default value is 0: every record is written immediately. Positive \a size enables the buffered mode, the buffer is
+ * written when it holds \a size bytes or more, when the oldest record in it is older than maxLatency(), when the record
+ * of the immediateFlushLevel() or higher is appended and when flush() is called.
+ *
+ * \sa FileAppender::setBufferSize()
+ */
+void ConsoleAppender::setBufferSize(int size)
+{
+  QMutexLocker locker(&m_bufferMutex);
+
+  m_bufferSize = qMax(size, 0);
+  if (m_bufferSize > 0)
+    startFlusher();
+  else
+    writeBuffer();
+}
+
+
+//! Returns the maximum time the record may wait in the buffer, in milliseconds.
+/**
+ * \sa setMaxLatency()
+ */
+int ConsoleAppender::maxLatency() const
+{
+  QMutexLocker locker(&m_bufferMutex);
+  return m_maxLatency;
+}
+
+
+//! Sets the maximum time the record may wait in the buffer before it is written to the output.
+/**
+ * Default value is 50 ms. It only makes sense in the buffered mode (see setBufferSize()).
+ */
+void ConsoleAppender::setMaxLatency(int msecs)
+{
+  QMutexLocker locker(&m_bufferMutex);
+  m_maxLatency = qMax(msecs, 1);
+  m_flusherCondition.wakeAll();
+}
+
+
+//! Returns the lowest log level of the records written immediately in the buffered mode.
+/**
+ * \sa setImmediateFlushLevel()
+ */
+Logger::LogLevel ConsoleAppender::immediateFlushLevel() const
+{
+  QMutexLocker locker(&m_bufferMutex);
+  return m_immediateFlushLevel;
+}
+
+
+//! Sets the lowest log level of the records which are written together with the buffer immediately.
+/**
+ * Default value is Logger::Error.
+ */
+void ConsoleAppender::setImmediateFlushLevel(Logger::LogLevel level)
+{
+  QMutexLocker locker(&m_bufferMutex);
+  m_immediateFlushLevel = level;
+}
+
+
+//! Writes out the buffered records.
+bool ConsoleAppender::flush()
+{
+  QMutexLocker locker(&m_bufferMutex);
+  writeBuffer();
+  return true;
+}
+
+
+//! Writes the log record to the standard error output.
 /**
  * \sa AbstractStringAppender::format()
  */
 void ConsoleAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
                              const char* function, const QString& category, const QString& message)
 {
-  std::cerr << qPrintable(formattedString(timeStamp, logLevel, file, line, function, category, message));
+  FormatBuffer buffer;
+  formatUtf8To(buffer.bytes(), timeStamp, logLevel, file, line, function, nullptr, category, message);
+  writeFormatted(buffer.bytes(), logLevel);
+}
+
+
+//! Writes the log record coming from the logging macro call site to the standard error output.
+/**
+ * \sa AbstractAppender::appendSite()
+ */
+void ConsoleAppender::appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                                 const QString& message)
+{
+  FormatBuffer buffer;
+  formatUtf8To(buffer.bytes(), timeStamp, site.level(), site.file(), site.line(), site.function(), &site, category,
+               message);
+  writeFormatted(buffer.bytes(), site.level());
+}
+
+
+//! Writes the log records to the standard error output at once.
+/**
+ * All the records are formatted first and then written by a single system call (unless buffered, see setBufferSize()).
+ *
+ * \sa AbstractAppender::appendBatch()
+ */
+void ConsoleAppender::appendBatch(const LogRecord* records, size_t count)
+{
+  FormatBuffer buffer;
+  Logger::LogLevel maxLevel = Logger::Trace;
+  for (size_t i = 0; i < count; ++i)
+  {
+    formatUtf8To(buffer.bytes(), records[i]);
+    maxLevel = qMax(maxLevel, records[i].logLevel);
+  }
+
+  writeFormatted(buffer.bytes(), maxLevel);
+}
+
+
+void ConsoleAppender::writeFormatted(const QByteArray& formatted, Logger::LogLevel logLevel)
+{
+  QMutexLocker locker(&m_bufferMutex);
+
+  // Nothing to merge the record with, it is written as is
+  if (m_buffer.isEmpty() && m_bufferSize == 0)
+  {
+    writeData(formatted.constData(), formatted.size());
+    return;
+  }
+
+  if (m_buffer.isEmpty() && m_bufferSize > 0)
+  {
+    m_bufferTimer.start();
+    m_flusherCondition.wakeAll();
+  }
+
+  m_buffer.append(formatted);
+  if (m_buffer.size() >= m_bufferSize || logLevel >= m_immediateFlushLevel)
+    writeBuffer();
+}
+
+
+// Should be called with the m_bufferMutex locked
+void ConsoleAppender::writeBuffer()
+{
+  writeData(m_buffer.constData(), m_buffer.size());
+
+  // Keeps the allocated capacity
+  m_buffer.reserve(qMax(m_bufferSize, m_buffer.capacity()));
+  m_buffer.resize(0);
+}
+
+
+// Should be called with the m_bufferMutex locked
+void ConsoleAppender::writeData(const char* data, qint64 remaining)
+{
+  while (remaining > 0)
+  {
+#if defined(Q_OS_WIN)
+    const int written = ::_write(2, data, unsigned(qMin<qint64>(remaining, 0x7fffffff)));
+#else
+    const ssize_t written = ::write(STDERR_FILENO, data, size_t(remaining));
+#endif
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      // Nothing we could do if stderr is broken
+      break;
+    }
+
+    data += written;
+    remaining -= written;
+    addBytesWritten(quint64(written));
+  }
+}
+
+
+// Should be called with the m_bufferMutex locked
+void ConsoleAppender::startFlusher()
+{
+  if (m_flusher)
+  {
+    m_flusherCondition.wakeAll();
+    return;
+  }
+
+  m_flusher = new ConsoleAppenderFlusher(this);
+  m_flusher->start();
+}
+
+
+// Writes the buffer when it gets too old
+void ConsoleAppender::runFlusher()
+{
+  QMutexLocker locker(&m_bufferMutex);
+
+  while (!m_stopFlusher)
+  {
+    if (m_buffer.isEmpty())
+    {
+      m_flusherCondition.wait(&m_bufferMutex);
+      continue;
+    }
+
+    const qint64 remaining = m_maxLatency - m_bufferTimer.elapsed();
+    if (remaining <= 0)
+      writeBuffer();
+    else
+      m_flusherCondition.wait(&m_bufferMutex, static_cast<unsigned long>(remaining));
+  }
 }
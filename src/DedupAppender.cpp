@@ -0,0 +1,244 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Local
+#include "DedupAppender.h"
+
+// Qt
+#include <QHash>
+#include <QMutexLocker>
+
+
+/**
+ * \class DedupAppender
+ *
+ * \brief DedupAppender collapses the consecutive identical log records before writing them to another appender.
+ *
+ * DedupAppender is a decorator for any other appender. When the record has the same log level, category, function,
+ * message and structured fields (see LOG_INFO_KV) as the previous one, it is not written. Instead, when the different
+ * record comes, the single "last message repeated N times" record is written before it:
+ *
+ * \code
+ * cuteLogger->registerAppender(new DedupAppender(new FileAppender("app.log")));
+ * \endcode
+ *
+ * The records are compared by their hashes first, so the full comparison of the strings only happens for the real
+ * duplicates. The window() is measured from the first suppressed repeat, so even the endless storm of the repeats is
+ * summarised: when the repeat comes after the window has elapsed, the summary is written and the repeated record
+ * starts a new series. The pending summary is also written when flush() is called and when DedupAppender is destroyed.
+ *
+ * DedupAppender takes ownership of the wrapped appender, so it must not be registered in Logger by itself.
+ *
+ * \note The details level of DedupAppender is initialized with the details level of the wrapped appender.
+ *
+ * \sa AsyncAppender
+ */
+
+
+static inline void combineHash(uint& hash, uint value)
+{
+  hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+}
+
+
+static uint fieldHash(const LogField& field)
+{
+  uint hash = qHash(QByteArray::fromRawData(field.key(), int(qstrlen(field.key()))));
+
+  switch (field.type())
+  {
+    case LogField::Bool:
+    case LogField::Int:
+      combineHash(hash, qHash(field.toInt()));
+      break;
+    case LogField::UInt:
+      combineHash(hash, qHash(field.toUInt()));
+      break;
+    case LogField::Double:
+      combineHash(hash, qHash(field.toDouble()));
+      break;
+    case LogField::String:
+      combineHash(hash, qHash(field.string()));
+      break;
+  }
+
+  return hash ^ uint(field.type());
+}
+
+
+// The file and the function names of the records not coming from the LOG_* macros may be the temporary buffers, so they
+// are hashed, copied and compared by the content
+static inline QByteArray rawString(const char* string)
+{
+  return QByteArray::fromRawData(string, string ? int(qstrlen(string)) : 0);
+}
+
+
+static uint recordHash(Logger::LogLevel logLevel, const char* function, const QString& category, const QString& message,
+                       const LogFields* fields)
+{
+  uint hash = qHash(message);
+  combineHash(hash, qHash(category));
+  combineHash(hash, qHash(rawString(function)));
+
+  if (fields)
+  {
+    for (const LogField& field : *fields)
+      combineHash(hash, fieldHash(field));
+  }
+
+  return hash ^ uint(logLevel);
+}
+
+
+static bool sameFields(const LogFields* fields, const LogFields& lastFields)
+{
+  if (!fields)
+    return lastFields.isEmpty();
+
+  return *fields == lastFields;
+}
+
+
+//! Constructs the appender collapsing the repeats coming within \a window milliseconds and writing to the \a appender.
+DedupAppender::DedupAppender(AbstractAppender* appender, int window)
+  : m_appender(appender),
+    m_window(window),
+    m_hasLast(false),
+    m_lastHash(0),
+    m_lastLevel(Logger::Trace),
+    m_lastLine(0),
+    m_repeats(0),
+    m_suppressed(0)
+{
+  Q_ASSERT_X(appender, "DedupAppender::DedupAppender()", "Wrapped appender is null");
+
+  setDetailsLevel(appender->detailsLevel());
+
+  // The state of the last record is protected by our own mutex, shared with flush()
+  setAppendSerialized(false);
+}
+
+
+//! Writes the pending summary and destroys the wrapped appender.
+DedupAppender::~DedupAppender()
+{
+  flush();
+  delete m_appender;
+}
+
+
+//! Returns the appender the records are written to.
+AbstractAppender* DedupAppender::appender() const
+{
+  return m_appender;
+}
+
+
+//! Returns the maximum interval between the collapsed repeats, in milliseconds.
+/**
+ * \sa setWindow()
+ */
+int DedupAppender::window() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_window;
+}
+
+
+//! Sets the maximum interval between the repeats of the record which are collapsed together.
+/**
+ * Default value is 10000 ms. Zero or negative \a msecs means the interval is not limited.
+ */
+void DedupAppender::setWindow(int msecs)
+{
+  QMutexLocker locker(&m_mutex);
+  m_window = msecs;
+}
+
+
+//! Returns the total number of the records not written because they repeated the previous one.
+quint64 DedupAppender::suppressedRecords() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_suppressed;
+}
+
+
+//! Writes the pending summary and flushes the wrapped appender.
+bool DedupAppender::flush()
+{
+  {
+    QMutexLocker locker(&m_mutex);
+    writeRepeats();
+  }
+
+  return m_appender->flush();
+}
+
+
+//! Writes the log record to the wrapped appender unless it repeats the previous one.
+/**
+ * \sa AbstractAppender::append()
+ */
+void DedupAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                           const char* function, const QString& category, const QString& message)
+{
+  const LogFields* fields = recordFields();
+  const uint hash = recordHash(logLevel, function, category, message, fields);
+
+  QMutexLocker locker(&m_mutex);
+
+  if (m_hasLast && hash == m_lastHash && logLevel == m_lastLevel && rawString(function) == m_lastFunction
+      && (m_window <= 0 || (m_repeats ? m_firstRepeatTime : m_lastTime).msecsTo(timeStamp) <= m_window)
+      && message == m_lastMessage && category == m_lastCategory && sameFields(fields, m_lastFields))
+  {
+    if (m_repeats == 0)
+      m_firstRepeatTime = timeStamp;
+
+    ++m_repeats;
+    ++m_suppressed;
+    m_lastRepeatTime = timeStamp;
+    return;
+  }
+
+  writeRepeats();
+
+  m_appender->write(timeStamp, logLevel, file, line, function, category, message, fields);
+
+  m_hasLast = true;
+  m_lastHash = hash;
+  m_lastLevel = logLevel;
+  m_lastFile = QByteArray(file);
+  m_lastLine = line;
+  m_lastFunction = QByteArray(function);
+  m_lastCategory = category;
+  m_lastMessage = message;
+  if (fields)
+    m_lastFields = *fields;
+  else
+    m_lastFields.clear();
+  m_lastTime = timeStamp;
+}
+
+
+// Should be called with the m_mutex locked
+void DedupAppender::writeRepeats()
+{
+  if (m_repeats == 0)
+    return;
+
+  m_appender->write(m_lastRepeatTime, m_lastLevel, m_lastFile.constData(), m_lastLine, m_lastFunction.constData(),
+                    m_lastCategory, QStringLiteral("last message repeated %1 times").arg(m_repeats), &m_lastFields);
+  m_repeats = 0;
+}
@@ -14,26 +14,88 @@
 // Local
 #include "FileAppender.h"
 
+// Qt
+#include <QThread>
+
 // STL
 #include <iostream>
 
+#if defined(Q_OS_WIN)
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+
 /**
  * \class FileAppender
  *
  * \brief Simple appender that writes the log records to the plain text file.
+ *
+ * By default every record is written to the file as soon as it is appended. When writing lots of records this ends up
+ * in a system call per record, so FileAppender may collect the records in the buffer instead (see setBufferSize()).
+ * The buffer is written to the file when it is full, when the oldest record in it is older than maxLatency(), when
+ * the record of the immediateFlushLevel() or higher is appended, when the file is closed or rolled over and when
+ * flush() is called (e.g. before the Logger::Fatal record aborts the application).
+ *
+ * Synchronizing the written data to the storage device is configured separately, using setSyncPolicy().
+ *
+ * The records are written to the file encoded to UTF-8 (see AbstractStringAppender::formattedUtf8()), whatever the
+ * locale of the application is. The earlier versions wrote the file through QTextStream, using the codec of the
+ * locale, so the files of the applications running with a non-UTF-8 locale are encoded differently now.
  */
 
 
+class FileAppenderFlusher : public QThread
+{
+  public:
+    explicit FileAppenderFlusher(FileAppender* appender)
+      : m_appender(appender)
+    {}
+
+  protected:
+    virtual void run()
+    {
+      m_appender->runFlusher();
+    }
+
+  private:
+    FileAppender* m_appender;
+};
+
+
 //! Constructs the new file appender assigned to file with the given name.
 FileAppender::FileAppender(const QString& fileName)
-  : m_flushOnWrite(false)
+  : m_flushOnWrite(false),
+    m_bufferSize(0),
+    m_maxLatency(50),
+    m_immediateFlushLevel(Logger::Error),
+    m_syncPolicy(NeverSync),
+    m_syncInterval(1000),
+    m_syncNeeded(false),
+    m_flusher(nullptr),
+    m_stopFlusher(false)
 {
+  // Records are formatted with no lock held, only the file access is protected by m_logFileMutex
+  setAppendSerialized(false);
+
   setFileName(fileName);
 }
 
 
 FileAppender::~FileAppender()
 {
+  if (m_flusher)
+  {
+    {
+      QMutexLocker locker(&m_logFileMutex);
+      m_stopFlusher = true;
+      m_flusherCondition.wakeAll();
+    }
+
+    m_flusher->wait();
+    delete m_flusher;
+  }
+
   closeFile();
 }
 
@@ -60,7 +122,10 @@ void FileAppender::setFileName(const QString& s)
 
   QMutexLocker locker(&m_logFileMutex);
   if (m_logFile.isOpen())
+  {
+    flushBuffer();
     m_logFile.close();
+  }
 
   m_logFile.setFileName(s);
 }
@@ -79,6 +144,8 @@ bool FileAppender::flushOnWrite() const
  * written.
  *
  * Leaving this as is may result in some log data not being written if the application crashes.
+ *
+ * When the records are buffered (see setBufferSize()), the file is flushed every time the buffer is written to it.
  */
 void FileAppender::setFlushOnWrite(bool flush)
 {
@@ -86,12 +153,145 @@ void FileAppender::setFlushOnWrite(bool flush)
 }
 
 
+//! Returns the size of the records buffer in bytes.
+/**
+ * \sa setBufferSize()
+ */
+int FileAppender::bufferSize() const
+{
+  QMutexLocker locker(&m_logFileMutex);
+  return m_bufferSize;
+}
+
+
+//! Sets the size of the buffer the records are collected in before writing them to the file.
+/**
+ * Default value is 0: every record is written to the file immediately. Positive \a size enables the buffered mode,
+ * the buffer is written to the file when it holds \a size bytes or more (and in the other cases listed in the
+ * FileAppender description).
+ *
+ * \sa setMaxLatency(), setImmediateFlushLevel()
+ */
+void FileAppender::setBufferSize(int size)
+{
+  QMutexLocker locker(&m_logFileMutex);
+
+  m_bufferSize = qMax(size, 0);
+  if (m_bufferSize > 0)
+  {
+    m_buffer.reserve(m_bufferSize);
+    startFlusher();
+  }
+  else
+  {
+    flushBuffer();
+  }
+}
+
+
+//! Returns the maximum time the record may wait in the buffer, in milliseconds.
+/**
+ * \sa setMaxLatency()
+ */
+int FileAppender::maxLatency() const
+{
+  QMutexLocker locker(&m_logFileMutex);
+  return m_maxLatency;
+}
+
+
+//! Sets the maximum time the record may wait in the buffer before it is written to the file.
+/**
+ * The buffer is written by the background thread when its oldest record is \a msecs milliseconds old. Default value
+ * is 50 ms. It only makes sense in the buffered mode (see setBufferSize()).
+ */
+void FileAppender::setMaxLatency(int msecs)
+{
+  QMutexLocker locker(&m_logFileMutex);
+  m_maxLatency = qMax(msecs, 1);
+  m_flusherCondition.wakeAll();
+}
+
+
+//! Returns the lowest log level of the records written to the file immediately in the buffered mode.
+/**
+ * \sa setImmediateFlushLevel()
+ */
+Logger::LogLevel FileAppender::immediateFlushLevel() const
+{
+  QMutexLocker locker(&m_logFileMutex);
+  return m_immediateFlushLevel;
+}
+
+
+//! Sets the lowest log level of the records which are written to the file together with the buffer immediately.
+/**
+ * Default value is Logger::Error, so the errors are not lost if the application crashes right after logging them.
+ */
+void FileAppender::setImmediateFlushLevel(Logger::LogLevel level)
+{
+  QMutexLocker locker(&m_logFileMutex);
+  m_immediateFlushLevel = level;
+}
+
+
+//! Returns the current synchronization policy.
+/**
+ * \sa setSyncPolicy()
+ */
+FileAppender::SyncPolicy FileAppender::syncPolicy() const
+{
+  QMutexLocker locker(&m_logFileMutex);
+  return m_syncPolicy;
+}
+
+
+//! Sets when the written data is forced to the storage device.
+/**
+ * Default policy is FileAppender::NeverSync. The synchronization doesn't depend on the buffering: it only affects the
+ * records already written to the file.
+ *
+ * \sa setSyncInterval()
+ */
+void FileAppender::setSyncPolicy(SyncPolicy policy)
+{
+  QMutexLocker locker(&m_logFileMutex);
+
+  m_syncPolicy = policy;
+  if (m_syncPolicy == SyncPeriodically)
+  {
+    m_syncTimer.start();
+    startFlusher();
+  }
+}
+
+
+//! Returns the synchronization interval of the FileAppender::SyncPeriodically policy in milliseconds.
+int FileAppender::syncInterval() const
+{
+  QMutexLocker locker(&m_logFileMutex);
+  return m_syncInterval;
+}
+
+
+//! Sets the synchronization interval of the FileAppender::SyncPeriodically policy. Default value is 1000 ms.
+void FileAppender::setSyncInterval(int msecs)
+{
+  QMutexLocker locker(&m_logFileMutex);
+  m_syncInterval = qMax(msecs, 1);
+  m_flusherCondition.wakeAll();
+}
+
+
 //! Force-flush any remaining buffers to file system. Returns true if successful, otherwise returns false.
 bool FileAppender::flush()
 {
   QMutexLocker locker(&m_logFileMutex);
   if (m_logFile.isOpen())
+  {
+    flushBuffer();
     return m_logFile.flush();
+  }
   else
     return true;
 }
@@ -112,10 +312,9 @@ bool FileAppender::openFile()
   bool isOpen = m_logFile.isOpen();
   if (!isOpen)
   {
-    isOpen = m_logFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
-    if (isOpen)
-      m_logStream.setDevice(&m_logFile);
-    else
+    // The records are already encoded and buffered (if needed) by us, so they are written directly to the file
+    isOpen = m_logFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text | QIODevice::Unbuffered);
+    if (!isOpen)
       std::cerr << "<FileAppender::append> Cannot open the log file " << qPrintable(m_logFile.fileName()) << std::endl;
   }
   return isOpen;
@@ -129,15 +328,82 @@ bool FileAppender::openFile()
  */
 void FileAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
                           const char* function, const QString& category, const QString& message)
+{
+  FormatBuffer buffer;
+  formatUtf8To(buffer.bytes(), timeStamp, logLevel, file, line, function, nullptr, category, message);
+  writeFormatted(buffer.bytes(), logLevel);
+}
+
+
+//! Write the log record coming from the logging macro call site to the file.
+/**
+ * \sa AbstractAppender::appendSite()
+ */
+void FileAppender::appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                              const QString& message)
+{
+  FormatBuffer buffer;
+  formatUtf8To(buffer.bytes(), timeStamp, site.level(), site.file(), site.line(), site.function(), &site, category,
+               message);
+  writeFormatted(buffer.bytes(), site.level());
+}
+
+
+//! Write the log records to the file at once.
+/**
+ * All the records are formatted first and then written to the file, so the file lock is taken only once.
+ *
+ * \sa AbstractAppender::appendBatch()
+ */
+void FileAppender::appendBatch(const LogRecord* records, size_t count)
+{
+  FormatBuffer buffer;
+  Logger::LogLevel maxLevel = Logger::Trace;
+  for (size_t i = 0; i < count; ++i)
+  {
+    formatUtf8To(buffer.bytes(), records[i]);
+    maxLevel = qMax(maxLevel, records[i].logLevel);
+  }
+
+  writeFormatted(buffer.bytes(), maxLevel);
+}
+
+
+//! Writes the already formatted records to the file.
+/**
+ * Called by append(), appendSite() and appendBatch() after the records are formatted and encoded to UTF-8. The
+ * \a logLevel is the highest level of the records, it decides if the buffer is to be flushed immediately (see
+ * setImmediateFlushLevel()).
+ *
+ * The function is called concurrently from the different threads, the file access is protected by the internal mutex.
+ */
+void FileAppender::writeFormatted(const QByteArray& formatted, Logger::LogLevel logLevel)
 {
   QMutexLocker locker(&m_logFileMutex);
 
   if (openFile())
   {
-    m_logStream << formattedString(timeStamp, logLevel, file, line, function, category, message);
-    m_logStream.flush();
-    if (m_flushOnWrite)
-      m_logFile.flush();
+    if (m_bufferSize > 0)
+    {
+      if (m_buffer.isEmpty())
+      {
+        m_bufferTimer.start();
+        m_flusherCondition.wakeAll();
+      }
+
+      m_buffer.append(formatted);
+      if (m_buffer.size() >= m_bufferSize || logLevel >= m_immediateFlushLevel)
+        flushBuffer();
+    }
+    else
+    {
+      const qint64 position = m_logFile.pos();
+      m_logFile.write(formatted);
+      addBytesWritten(quint64(m_logFile.pos() - position));
+      if (m_flushOnWrite)
+        m_logFile.flush();
+      m_syncNeeded = true;
+    }
   }
 }
 
@@ -145,5 +411,117 @@ void FileAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel,
 void FileAppender::closeFile()
 {
   QMutexLocker locker(&m_logFileMutex);
+
+  if (m_logFile.isOpen())
+  {
+    flushBuffer();
+    if (m_syncPolicy != NeverSync)
+      syncFile();
+  }
+
   m_logFile.close();
 }
+
+
+//! Returns the size of the log file including the records in the buffer, or 0 if the file is not open.
+/**
+ * The size is tracked by the opened file, so this function doesn't make any system calls.
+ */
+qint64 FileAppender::fileSize() const
+{
+  QMutexLocker locker(&m_logFileMutex);
+  if (!m_logFile.isOpen())
+    return 0;
+
+  return m_logFile.pos() + m_buffer.size();
+}
+
+
+// Should be called with the m_logFileMutex locked
+void FileAppender::flushBuffer()
+{
+  if (m_buffer.isEmpty())
+    return;
+
+  if (m_logFile.isOpen())
+  {
+    const qint64 position = m_logFile.pos();
+    m_logFile.write(m_buffer);
+    addBytesWritten(quint64(m_logFile.pos() - position));
+    if (m_flushOnWrite)
+      m_logFile.flush();
+    m_syncNeeded = true;
+  }
+
+  // Keeps the allocated capacity
+  m_buffer.resize(0);
+}
+
+
+// Should be called with the m_logFileMutex locked
+void FileAppender::syncFile()
+{
+  m_syncTimer.start();
+  if (!m_syncNeeded || !m_logFile.isOpen())
+    return;
+
+  m_logFile.flush();
+#if defined(Q_OS_WIN)
+  _commit(m_logFile.handle());
+#else
+  ::fsync(m_logFile.handle());
+#endif
+  m_syncNeeded = false;
+}
+
+
+// Should be called with the m_logFileMutex locked
+void FileAppender::startFlusher()
+{
+  if (m_flusher)
+  {
+    m_flusherCondition.wakeAll();
+    return;
+  }
+
+  m_flusher = new FileAppenderFlusher(this);
+  m_flusher->start();
+}
+
+
+// Writes the buffer when it gets too old and synchronizes the file periodically
+void FileAppender::runFlusher()
+{
+  QMutexLocker locker(&m_logFileMutex);
+
+  while (!m_stopFlusher)
+  {
+    qint64 timeout = -1;
+
+    if (!m_buffer.isEmpty())
+    {
+      const qint64 remaining = m_maxLatency - m_bufferTimer.elapsed();
+      if (remaining <= 0)
+        flushBuffer();
+      else
+        timeout = remaining;
+    }
+
+    if (m_syncPolicy == SyncPeriodically)
+    {
+      qint64 remaining = m_syncInterval - m_syncTimer.elapsed();
+      if (remaining <= 0)
+      {
+        syncFile();
+        remaining = m_syncInterval;
+      }
+
+      timeout = (timeout < 0) ? remaining : qMin(timeout, remaining);
+    }
+
+    if (timeout < 0)
+      m_flusherCondition.wait(&m_logFileMutex);
+    else
+      m_flusherCondition.wait(&m_logFileMutex, static_cast<unsigned long>(timeout));
+  }
+}
@@ -0,0 +1,153 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Local
+#include "JournaldAppender.h"
+#include "AbstractStringAppender.h"
+
+#include "ThreadBufferPool.h"
+
+// STL
+#include <cstdio>
+
+// systemd
+// Without this sd_journal_sendv() would add the CODE_ fields pointing to this file
+#define SD_JOURNAL_SUPPRESS_LOCATION
+#include <systemd/sd-journal.h>
+#include <sys/uio.h>
+#include <syslog.h>
+
+
+/**
+ * \class JournaldAppender
+ *
+ * \brief JournaldAppender writes the log records to the systemd journal.
+ *
+ * The records are passed to journald as the structured entries, so the journal doesn't have to parse the text of the
+ * record. Every entry has the following fields:
+ * - \c MESSAGE - the log message as is, no format is applied;
+ * - \c PRIORITY - the syslog priority of the record (see journaldPriority());
+ * - \c CODE_FILE, \c CODE_LINE and \c CODE_FUNC - the source location of the record;
+ * - \c CUTELOGGER_CATEGORY - the log category, only for the records written to a category.
+ *
+ * \code
+ * cuteLogger->registerAppender(new JournaldAppender);
+ * \endcode
+ *
+ * The timestamp of the entry is assigned by journald. The fields are put to the reusable buffer of the current thread,
+ * so writing the entry doesn't allocate memory in the steady state.
+ *
+ * \note JournaldAppender needs libsystemd, so it is only built when enabled: with \c -DENABLE_JOURNALD=ON in CMake,
+ * \c CONFIG+=cutelogger_journald in qmake or \c journald:true in qbs.
+ */
+
+
+//! Constructs the journald appender.
+JournaldAppender::JournaldAppender()
+{
+  // sd_journal_sendv() is thread safe
+  setAppendSerialized(false);
+}
+
+
+//! Returns the syslog priority of the journal entry for the \a logLevel.
+int JournaldAppender::journaldPriority(Logger::LogLevel logLevel)
+{
+  switch (logLevel)
+  {
+    case Logger::Trace:
+    case Logger::Debug:
+      return LOG_DEBUG;
+    case Logger::Info:
+      return LOG_INFO;
+    case Logger::Warning:
+      return LOG_WARNING;
+    case Logger::Error:
+      return LOG_ERR;
+    case Logger::Fatal:
+      return LOG_CRIT;
+  }
+
+  // Just in case
+  return LOG_NOTICE;
+}
+
+
+//! Writes the log record to the journal.
+/**
+ * \sa AbstractAppender::append()
+ */
+void JournaldAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                              const char* function, const QString& category, const QString& message)
+{
+  Q_UNUSED(timeStamp)
+
+  enum { MaxFields = 6 };
+
+  QByteArray* pooled = threadBufferPool<QByteArray>().acquire();
+  QByteArray local;
+  QByteArray& buffer = pooled ? *pooled : local;
+  resetPooledBuffer(buffer);
+
+  // Every field is the "NAME=value" string. The fields are written to the single buffer one after another and only
+  // then pointed to by the iovecs, as the buffer may be reallocated while it grows.
+  int fieldEnds[MaxFields];
+  int fieldCount = 0;
+
+  buffer.append("MESSAGE=");
+  AbstractStringAppender::appendUtf8(buffer, message);
+  fieldEnds[fieldCount++] = buffer.size();
+
+  char number[16];
+  std::snprintf(number, sizeof(number), "%d", journaldPriority(logLevel));
+  buffer.append("PRIORITY=");
+  buffer.append(number);
+  fieldEnds[fieldCount++] = buffer.size();
+
+  buffer.append("CODE_FILE=");
+  buffer.append(file ? file : "");
+  fieldEnds[fieldCount++] = buffer.size();
+
+  std::snprintf(number, sizeof(number), "%d", line);
+  buffer.append("CODE_LINE=");
+  buffer.append(number);
+  fieldEnds[fieldCount++] = buffer.size();
+
+  buffer.append("CODE_FUNC=");
+  buffer.append(function ? function : "");
+  fieldEnds[fieldCount++] = buffer.size();
+
+  if (!category.isEmpty())
+  {
+    buffer.append("CUTELOGGER_CATEGORY=");
+    AbstractStringAppender::appendUtf8(buffer, category);
+    fieldEnds[fieldCount++] = buffer.size();
+  }
+
+  struct iovec fields[MaxFields];
+  int fieldStart = 0;
+  for (int i = 0; i < fieldCount; ++i)
+  {
+    fields[i].iov_base = buffer.data() + fieldStart;
+    fields[i].iov_len = size_t(fieldEnds[i] - fieldStart);
+    fieldStart = fieldEnds[i];
+  }
+
+  sd_journal_sendv(fields, fieldCount);
+
+  if (pooled)
+  {
+    trimPooledBuffer(buffer);
+    threadBufferPool<QByteArray>().release(pooled);
+  }
+}
@@ -0,0 +1,271 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Local
+#include "JsonAppender.h"
+
+// Qt
+#include <QDate>
+#include <QLocale>
+#include <QTime>
+
+// STL
+#include <cmath>
+#include <cstring>
+
+
+/**
+ * \class JsonAppender
+ *
+ * \brief Writes the log records to the file as JSON lines
+ *
+ * Every record is written as a single line holding one JSON object:
+ * \code
+ * {"time":"2026-01-20T10:15:42.517Z","level":"Info","category":"net","file":"main.cpp","line":42,
+ *  "function":"main","message":"req done","fields":{"ms":12,"status":"ok"}}
+ * \endcode
+ *
+ * The timestamp is always written in UTC. The \c category is omitted for the records of the default category and
+ * the \c fields object is only written for the structured records (see LOG_INFO_KV()). The integer and boolean
+ * fields keep their JSON types, the non-finite floating point values are written as \c null.
+ *
+ * The records are encoded directly to UTF-8 and written through the FileAppender buffering, format() is not used.
+ * Note the file is not rolled over, use the logrotate \c copytruncate or FileAppender::reopenFile() for that.
+ *
+ * \sa FileAppender
+ */
+namespace
+{
+  void appendUnsigned(QByteArray& result, quint64 value)
+  {
+    char digits[20];
+    char* end = digits + sizeof(digits);
+    char* begin = end;
+    do
+    {
+      *--begin = char('0' + value % 10);
+      value /= 10;
+    }
+    while (value);
+    result.append(begin, int(end - begin));
+  }
+
+
+  void appendSigned(QByteArray& result, qint64 value)
+  {
+    if (value < 0)
+    {
+      result.append('-');
+      appendUnsigned(result, quint64(0) - quint64(value));
+    }
+    else
+    {
+      appendUnsigned(result, quint64(value));
+    }
+  }
+
+
+  void appendTwoDigits(char* target, int value)
+  {
+    target[0] = char('0' + value / 10);
+    target[1] = char('0' + value % 10);
+  }
+
+
+  // Date and time down to the second ("2026-01-20T10:15:42"), recently formatted by the current thread
+  struct UtcTimeCache
+  {
+    qint64 second = -1;
+    char text[19];
+  };
+
+
+  void appendUtcTime(QByteArray& result, const QDateTime& timeStamp)
+  {
+    if (!timeStamp.isValid())
+    {
+      result.append("null");
+      return;
+    }
+
+    static thread_local UtcTimeCache cache;
+
+    const qint64 msecs = timeStamp.toMSecsSinceEpoch();
+    qint64 second = msecs / 1000;
+    int msec = int(msecs % 1000);
+    if (msec < 0)
+    {
+      --second;
+      msec += 1000;
+    }
+
+    if (cache.second != second)
+    {
+      const QDateTime utc = QDateTime::fromMSecsSinceEpoch(second * 1000, Qt::UTC);
+      const QDate date = utc.date();
+      const QTime time = utc.time();
+      const int year = qBound(0, date.year(), 9999);
+      appendTwoDigits(cache.text, year / 100);
+      appendTwoDigits(cache.text + 2, year % 100);
+      cache.text[4] = '-';
+      appendTwoDigits(cache.text + 5, date.month());
+      cache.text[7] = '-';
+      appendTwoDigits(cache.text + 8, date.day());
+      cache.text[10] = 'T';
+      appendTwoDigits(cache.text + 11, time.hour());
+      cache.text[13] = ':';
+      appendTwoDigits(cache.text + 14, time.minute());
+      cache.text[16] = ':';
+      appendTwoDigits(cache.text + 17, time.second());
+      cache.second = second;
+    }
+
+    char text[26];
+    text[0] = '"';
+    memcpy(text + 1, cache.text, sizeof(cache.text));
+    text[20] = '.';
+    text[21] = char('0' + msec / 100);
+    appendTwoDigits(text + 22, msec % 100);
+    text[24] = 'Z';
+    text[25] = '"';
+    result.append(text, int(sizeof(text)));
+  }
+
+
+  void appendField(QByteArray& result, const LogField& field)
+  {
+    switch (field.type())
+    {
+      case LogField::Bool:
+        result.append(field.toBool() ? "true" : "false");
+        break;
+      case LogField::Int:
+        appendSigned(result, field.toInt());
+        break;
+      case LogField::UInt:
+        appendUnsigned(result, field.toUInt());
+        break;
+      case LogField::Double:
+        if (std::isfinite(field.toDouble()))
+#if QT_VERSION >= 0x050700
+          result.append(QByteArray::number(field.toDouble(), 'g', QLocale::FloatingPointShortest));
+#else
+          result.append(QByteArray::number(field.toDouble(), 'g', 17));
+#endif
+        else
+          result.append("null");
+        break;
+      case LogField::String:
+        AbstractStringAppender::appendJsonString(result, field.string());
+        break;
+    }
+  }
+}
+
+
+//! Constructs the new JSON lines appender writing to the \a fileName
+JsonAppender::JsonAppender(const QString& fileName)
+  : FileAppender(fileName)
+{}
+
+
+//! Encodes the \a record as the JSON object, terminated with the new line, and appends it to the \a result
+void JsonAppender::encodeRecord(QByteArray& result, const LogRecord& record)
+{
+  encode(result, record.timeStamp, record.logLevel, record.file, record.line,
+         record.site ? record.site->functionName() : stripFunctionName(record.function), record.category,
+         record.message, record.fields.isEmpty() ? nullptr : &record.fields);
+}
+
+
+void JsonAppender::encode(QByteArray& result, const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file,
+                          int line, const QString& functionName, const QString& category, const QString& message,
+                          const LogFields* fields)
+{
+  result.append("{\"time\":");
+  appendUtcTime(result, timeStamp);
+
+  result.append(",\"level\":\"");
+  result.append(Logger::levelToString(logLevel).toLatin1());
+  result.append('"');
+
+  if (!category.isEmpty())
+  {
+    result.append(",\"category\":");
+    appendJsonString(result, category);
+  }
+
+  result.append(",\"file\":");
+  appendJsonString(result, file ? file : "");
+  result.append(",\"line\":");
+  appendSigned(result, line);
+  result.append(",\"function\":");
+  appendJsonString(result, functionName);
+
+  result.append(",\"message\":");
+  appendJsonString(result, message);
+
+  if (fields && !fields->isEmpty())
+  {
+    result.append(",\"fields\":{");
+    for (int i = 0; i < fields->size(); ++i)
+    {
+      const LogField& field = fields->at(i);
+      if (i)
+        result.append(',');
+      appendJsonString(result, field.key());
+      result.append(':');
+      appendField(result, field);
+    }
+    result.append('}');
+  }
+
+  result.append("}\n");
+}
+
+
+//! Write the log record to the file as the JSON line
+void JsonAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                          const char* function, const QString& category, const QString& message)
+{
+  FormatBuffer buffer;
+  encode(buffer.bytes(), timeStamp, logLevel, file, line, stripFunctionName(function), category, message,
+         recordFields());
+  writeFormatted(buffer.bytes(), logLevel);
+}
+
+
+//! Write the log record coming from the logging macro call site to the file as the JSON line
+void JsonAppender::appendSite(const QDateTime& timeStamp, const LogSite& site, const QString& category,
+                              const QString& message)
+{
+  FormatBuffer buffer;
+  encode(buffer.bytes(), timeStamp, site.level(), site.file(), site.line(), site.functionName(), category, message,
+         recordFields());
+  writeFormatted(buffer.bytes(), site.level());
+}
+
+
+//! Write the log records to the file at once, see FileAppender::appendBatch()
+void JsonAppender::appendBatch(const LogRecord* records, size_t count)
+{
+  FormatBuffer buffer;
+  Logger::LogLevel maxLevel = Logger::Trace;
+  for (size_t i = 0; i < count; ++i)
+  {
+    encodeRecord(buffer.bytes(), records[i]);
+    maxLevel = qMax(maxLevel, records[i].logLevel);
+  }
+
+  writeFormatted(buffer.bytes(), maxLevel);
+}
@@ -15,6 +15,8 @@
 #include "Logger.h"
 #include "AbstractAppender.h"
 #include "AbstractStringAppender.h"
+#include "StripedCounter.h"
+#include "ThreadBufferPool.h"
 
 // Qt
 #include <QCoreApplication>
@@ -23,6 +25,15 @@
 #include <QDateTime>
 #include <QIODevice>
 #include <QTextCodec>
+#include <QThread>
+#include <QWaitCondition>
+#include <QVector>
+#include <QHash>
+#include <QLocale>
+
+#if QT_VERSION >= 0x050200
+#  include <QLoggingCategory>
+#endif
 
 #if defined(Q_OS_ANDROID)
 #  include <android/log.h>
@@ -30,8 +41,16 @@
 #endif
 
 // STL
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 
+#if defined(Q_OS_LINUX)
+#  include <time.h>
+#endif
+
 
 /**
  * \file Logger.h
@@ -127,8 +146,17 @@
  * instance). Not all compilers will support this. Please, consider reviewing your compiler documentation to ensure
  * it support __VA_ARGS__ macro.
  *
+ * \note Records with a log level lower than any of the appenders details level are dropped before the message is built,
+ * so the arguments of the macro (including the ones streamed to the returned QDebug object) are not evaluated at all.
+ * Please, don't rely on side effects of the logging statements.
+ *
+ * \note Every statement has its own static LogSite keeping these parameters. The site is created the first time the
+ * statement is executed and may be disabled at runtime using LogSite::setSitesEnabled().
+ *
  * \sa Logger::LogLevel
  * \sa Logger::write()
+ * \sa Logger::isEnabledFor()
+ * \sa LogSite
  */
 
 
@@ -212,7 +240,7 @@
  * This macro is the similar to the LOG_TRACE() macro, but has a category parameter
  * to write only to the category appenders (registered using Logger::registerCategoryAppender() method).
  *
- * \param category category name string
+ * \param category category name string or the LoggerCategory handle returned by Logger::category()
  *
  * \sa LOG_TRACE()
  * \sa Logger::LogLevel
@@ -292,11 +320,12 @@
  *
  * This macro is used to pass all log messages inside your custom class to the specific category.
  * You must include this macro inside your class declaration (similarly to the Q_OBJECT macro).
- * Internally, this macro redefines cuteLoggerInstance() function, creates the local Logger object inside your class and
- * sets the default category to the specified parameter.
+ * Internally, this macro creates the local Logger object inside your class, sets its default category to the specified
+ * parameter and declares the cuteLoggerInstance accessor (a trivial inline function object) returning it.
  *
  * Thus, any call to cuteLoggerInstance() (for example, inside LOG_TRACE() macro) will return the local Logger object,
- * so any logging message will be directed to the default category.
+ * so any logging message will be directed to the default category. The records are forwarded to the parent logger
+ * (see Logger::parent()), the global instance by default.
  *
  * \note This macro does not register any appender to the newly created logger instance. You should register
  * logger appenders manually, inside your class.
@@ -415,8 +444,12 @@
  * // Function bar finished in <time2> ms.
  * \endcode
  *
- * \note Macro switches to logging the seconds instead of milliseconds when the execution time reaches 10000 ms.
- * \sa LOG_DEBUG_TIME, LOG_INFO_TIME
+ * \note Macro switches to logging the seconds instead of milliseconds when the execution time reaches 10000 ms. The time
+ * is measured with the monotonic clock, Logger::TimingPrecise mode shows it with up to nanosecond resolution:
+ * \code
+ * LOG_TRACE_TIME(Logger::TimingPrecise, "Foo");
+ * \endcode
+ * \sa LOG_DEBUG_TIME, LOG_INFO_TIME, LOG_TRACE_TIME_STATS
  */
 
 
@@ -444,6 +477,109 @@
  */
 
 
+/**
+ * \def LOG_TRACE_TIME_STATS
+ *
+ * \brief Aggregates the processing time of current function / code block
+ *
+ * This macro measures the function or code of block execution time like LOG_TRACE_TIME() does, but doesn't write a
+ * record for every call. Instead, the call site accumulates the statistics and periodically writes the Logger::Trace
+ * level summary record with the number of calls and the percentiles of the time (see LoggerTimingStats). So it may be
+ * used in the code called thousands of times per second.
+ *
+ * \code
+ * void Parser::parse(const QByteArray& data)
+ * {
+ *   LOG_TRACE_TIME_STATS();
+ *   ...
+ * } // Outputs once a minute: Function Parser::parse timing: 52114 calls, min 310 ns, avg 2 us, p50 1535 ns, ...
+ * \endcode
+ *
+ * The name of the block must be a string literal:
+ * \code
+ *   LOG_TRACE_TIME_STATS("Checksum");
+ * \endcode
+ *
+ * \sa LOG_DEBUG_TIME_STATS, LOG_INFO_TIME_STATS, LoggerTimingStats::writeSummaries()
+ */
+
+
+/**
+ * \def LOG_DEBUG_TIME_STATS
+ *
+ * \brief Aggregates the processing time of current function / code block
+ *
+ * This macro works similar to LOG_TRACE_TIME_STATS() macro, but writes the Logger::Debug level summary records.
+ *
+ * \sa LOG_TRACE_TIME_STATS
+ */
+
+
+/**
+ * \def LOG_INFO_TIME_STATS
+ *
+ * \brief Aggregates the processing time of current function / code block
+ *
+ * This macro works similar to LOG_TRACE_TIME_STATS() macro, but writes the Logger::Info level summary records.
+ *
+ * \sa LOG_TRACE_TIME_STATS
+ */
+
+
+/**
+ * \def LOG_INFO_EVERY_N(n)
+ *
+ * \brief Writes the first and then every \a n-th record of the call site
+ *
+ * This macro is used the same way as LOG_INFO(), with the limit given in the first parentheses:
+ * \code
+ * LOG_INFO_EVERY_N(1000)("Processed the packet %d", packetId);
+ * LOG_INFO_EVERY_N(1000)() << "Processed the packet" << packetId;
+ * \endcode
+ *
+ * The arguments of the suppressed records are not evaluated. The next written record reports the number of the
+ * records suppressed before it. The limit state is kept per call site, shared by all the threads and doesn't need any
+ * locks. Only the records with the log level enabled (see Logger::isEnabledFor()) are counted.
+ *
+ * The same macro exists for every log level: LOG_TRACE_EVERY_N(), LOG_DEBUG_EVERY_N(), LOG_WARNING_EVERY_N(),
+ * LOG_ERROR_EVERY_N() and LOG_FATAL_EVERY_N().
+ *
+ * \sa LOG_INFO_FIRST_N(), LOG_INFO_EVERY_MS(), LOG_INFO_RATE()
+ */
+
+
+/**
+ * \def LOG_INFO_FIRST_N(n)
+ *
+ * \brief Writes only the first \a n records of the call site
+ *
+ * \sa LOG_INFO_EVERY_N()
+ */
+
+
+/**
+ * \def LOG_INFO_EVERY_MS(msecs)
+ *
+ * \brief Writes at most one record of the call site in \a msecs milliseconds
+ *
+ * \sa LOG_INFO_EVERY_N()
+ */
+
+
+/**
+ * \def LOG_INFO_RATE(perSecond, burst)
+ *
+ * \brief Writes at most \a perSecond records of the call site per second on average, allowing the bursts up to
+ * \a burst records
+ *
+ * \code
+ * LOG_WARNING_RATE(10, 100)("Connection to %s failed, retrying", qPrintable(host));
+ * \endcode
+ *
+ * \sa LOG_INFO_EVERY_N()
+ */
+
+
 /**
  * \class Logger
  *
@@ -460,7 +596,8 @@
  */
 
 // Forward declarations
-static void cleanupLoggerGlobalInstance();
+struct LoggerRouting;
+static void flushAppenders(const LoggerRouting& routing);
 
 #if QT_VERSION >= 0x050000
 static void qtLoggerMessageHandler(QtMsgType, const QMessageLogContext& context, const QString& msg);
@@ -471,41 +608,475 @@ static void qtLoggerMessageHandler(QtMsgType type, const char* msg);
 /**
  * \internal
  *
- * LoggerPrivate class implements the Singleton pattern in a thread-safe way. It contains a static pointer to the
- * global logger instance protected by QReadWriteLock
+ * LoggerRouting is the immutable snapshot of the appenders registered in the Logger. Logger::write() uses the current
+ * snapshot without any locking, while the functions changing the logger configuration publish the modified copy. The
+ * replaced snapshots are deleted when no LoggerReadSection may use them anymore.
+ */
+struct LoggerRouting
+{
+  QList<AbstractAppender*> appenders;
+  QVector<QList<AbstractAppender*> > categoryAppenders; //<! Indexed by the LoggerCategory::id()
+  QVector<bool> categories;                             //<! Categories linked to the global instance appenders
+  LoggerCategory defaultCategory;
+
+  QList<AbstractAppender*> allCategoryAppenders() const
+  {
+    QList<AbstractAppender*> result;
+    foreach (const QList<AbstractAppender*>& appenders, categoryAppenders)
+      result.append(appenders);
+    return result;
+  }
+};
+
+
+// Signalled whenever the last reader leaves the read section, see LoggerReadSection::waitForReaders()
+static QMutex* retiredMutex()
+{
+  static QMutex mutex;
+  return &mutex;
+}
+
+
+static QWaitCondition* retiredCondition()
+{
+  static QWaitCondition condition;
+  return &condition;
+}
+
+
+/**
+ * \internal
+ *
+ * LoggerReadSection guards the code using the routing snapshots and the parent loggers published as the plain atomic
+ * pointers. The readers are counted in the striped counters of the current phase, so entering and leaving the section
+ * doesn't touch the cache lines shared with the other threads (unless they share the stripe). The replaced snapshot is
+ * deleted when isIdle() sees no readers at all, or after waitForReaders() has seen the readers of both phases drained,
+ * and the parent logger destructor waits for the readers the same way. The readers entering the section after the
+ * phase flip count in the other phase, so the wait isn't starved by the records coming all the time.
+ */
+class LoggerReadSection
+{
+  public:
+    LoggerReadSection()
+      : m_counter(&counters[(phase.loadAcquire() & 1) * StripedCounter::Stripes + StripedCounter::stripeIndex()].value)
+    {
+      // The ordered increment is the full barrier, so the pointers read after it are at least as new as the ones
+      // published before the counters were checked
+      m_counter->fetchAndAddOrdered(1);
+    }
+
+    ~LoggerReadSection()
+    {
+      if (m_counter->fetchAndAddRelease(-1) == 1 && waiters.loadAcquire())
+      {
+        QMutexLocker locker(retiredMutex());
+        retiredCondition()->wakeAll();
+      }
+    }
+
+    static bool isIdle();
+    static void waitForReaders();
+
+  private:
+    Q_DISABLE_COPY(LoggerReadSection)
+
+    // Padded instead of aligned, the same way StripedCounter is
+    struct Counter
+    {
+      Q_DECL_CONSTEXPR Counter()
+        : value(0),
+          padding()
+      {}
+
+      QAtomicInt value;
+      char padding[64 - sizeof(QAtomicInt)];
+    };
+
+    static bool isDrained(int drainedPhase);
+
+    static Counter counters[2 * StripedCounter::Stripes];
+    static QAtomicInt phase;
+    static QAtomicInt waiters;
+
+    QAtomicInt* m_counter;
+};
+
+
+LoggerReadSection::Counter LoggerReadSection::counters[2 * StripedCounter::Stripes];
+QAtomicInt LoggerReadSection::phase;
+QAtomicInt LoggerReadSection::waiters;
+
+
+bool LoggerReadSection::isDrained(int drainedPhase)
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  for (int i = drainedPhase * StripedCounter::Stripes; i < (drainedPhase + 1) * StripedCounter::Stripes; ++i)
+  {
+    if (counters[i].value.loadAcquire() != 0)
+      return false;
+  }
+  return true;
+}
+
+
+// Returns true if none of the threads is inside of the read section right now. The reader entering the section after
+// the check reads the pointers published before it, so the objects retired earlier may be deleted.
+bool LoggerReadSection::isIdle()
+{
+  return isDrained(0) && isDrained(1);
+}
+
+
+// Waits until all the readers entered the section before the call leave it. The wait flips the phase twice: the reader
+// which has read the phase right before the flip may count itself in the already checked phase. It reads the newly
+// published pointers then, and it is waited for by the second flip of the next wait.
+//
+// Should be called without holding the logger mutexes, so the writers blocked in the appenders don't hold back the
+// other configuration changes, and never from inside of the read section, as the thread can't wait for itself.
+void LoggerReadSection::waitForReaders()
+{
+  static QMutex waitMutex;
+  QMutexLocker waitLocker(&waitMutex);
+
+  waiters.ref();
+  for (int flip = 0; flip < 2; ++flip)
+  {
+    const int drainedPhase = phase.fetchAndAddOrdered(1) & 1;
+
+    // The readers wake the waiter up when leaving, the timeout only guards against the reader missing the waiter
+    QMutexLocker locker(retiredMutex());
+    while (!isDrained(drainedPhase))
+      retiredCondition()->wait(retiredMutex(), 1);
+  }
+  waiters.deref();
+}
+
+
+// Number of the Logger::write() calls the current thread is inside of. Such a thread is inside of the read section
+// itself, so it can't wait for the other readers.
+static thread_local int loggerWriteDepth = 0;
+
+
+/**
+ * \internal
+ *
+ * LoggerPrivate class contains the routing snapshot and the position of the logger in the hierarchy. The records of the
+ * local logger instances are forwarded to the parent logger, which is the global instance unless set explicitly.
  */
 class LoggerPrivate
 {
   public:
-    static Logger* globalInstance;
-    static QReadWriteLock globalInstanceLock;
+    LoggerPrivate()
+      : routing(new LoggerRouting),
+        writeDefaultCategoryToGlobalInstance(false),
+        isGlobalInstance(false),
+        parentData(nullptr)
+    {}
+
+    static QAtomicInt timestampMode;
 
-    QList<AbstractAppender*> appenders;
-    QMutex loggerMutex;
+    QAtomicPointer<const LoggerRouting> routing; //<! Read inside of LoggerReadSection or with the loggerMutex locked
+    QList<const LoggerRouting*> retiredRoutings; //<! Replaced snapshots possibly used by the writers
+    mutable QMutex loggerMutex; //<! Serializes the routing modifications
 
-    QMap<QString, bool> categories;
-    QMultiMap<QString, AbstractAppender*> categoryAppenders;
-    QStringList noAppendersCategories; //<! Categories without appenders that was already warned about
-    QString defaultCategory;
+    QMutex noAppendersMutex;
+    QSet<int> noAppendersCategories; //<! Categories without appenders that was already warned about
     bool writeDefaultCategoryToGlobalInstance;
+    bool isGlobalInstance;
+
+    // The hierarchy is modified with the loggerHierarchyMutex() locked, the parent is read without locking
+    mutable QAtomicPointer<Logger> parent; //<! Read inside of LoggerReadSection. Null for the global instance and until
+                                           //<! the implicit parent is resolved.
+    mutable LoggerPrivate* parentData;
+    mutable QList<LoggerPrivate*> children;
+
+    Logger* resolveParent() const;
+
+    // The snapshot is valid until the LoggerReadSection is left or the loggerMutex is unlocked
+    const LoggerRouting* currentRouting() const
+    {
+      return routing.loadAcquire();
+    }
+
+    // Should be called with the loggerMutex locked
+    void publishRouting(const LoggerRouting& newRouting)
+    {
+      retiredRoutings.append(routing.fetchAndStoreOrdered(new LoggerRouting(newRouting)));
+
+      if (LoggerReadSection::isIdle())
+      {
+        qDeleteAll(retiredRoutings);
+        retiredRoutings.clear();
+      }
+    }
+
+
+    StripedCounter levelRecords[Logger::Fatal + 1];
+
+    mutable QAtomicInt minimumLevel;           //<! Lowest details level of all the appenders registered in the logger
+    mutable QAtomicInt minimumLevelGeneration; //<! Value of AbstractAppender::s_detailsLevelGeneration minimumLevel is valid for
+};
+
+
+/**
+ * \internal
+ *
+ * LoggerCategoryRegistry interns the category names into the small integer ids. Names are stored in the chunks which
+ * are never moved or freed, so the name of a known id is read without locking.
+ *
+ * The registry also counts the records written to every category. The counters are striped the same way the
+ * StripedCounter is, every stripe having its own lazily allocated chunks.
+ *
+ * The names over the registry limit get the refusedCategoryId. Logger::write() doesn't treat the refused category as
+ * the default one, its records are written to std::cerr only.
+ */
+static const int refusedCategoryId = -2;
+
+class LoggerCategoryRegistry
+{
+  public:
+    LoggerCategoryRegistry()
+      : m_count(0),
+        m_limitReported(false)
+    {}
+
+    int find(const char* name, int size)
+    {
+      const QByteArray key = QByteArray::fromRawData(name, size);
+      {
+        QReadLocker locker(&m_lock);
+        QHash<QByteArray, int>::const_iterator it = m_ids.constFind(key);
+        if (it != m_ids.constEnd())
+          return it.value();
+      }
+
+      QWriteLocker locker(&m_lock);
+      QHash<QByteArray, int>::const_iterator it = m_ids.constFind(key);
+      if (it != m_ids.constEnd())
+        return it.value();
+
+      const int id = m_count;
+      if (id >= MaxChunks * ChunkSize)
+      {
+        if (!m_limitReported)
+        {
+          std::cerr << "The limit of " << MaxChunks * ChunkSize << " log categories is reached, the records of the "
+                    << "following categories will be written to std::cerr only" << std::endl;
+          m_limitReported = true;
+        }
+        return refusedCategoryId;
+      }
+
+      QString* chunk = m_chunks[id >> ChunkBits].loadAcquire();
+      if (!chunk)
+      {
+        chunk = new QString[ChunkSize];
+        m_chunks[id >> ChunkBits].storeRelease(chunk);
+      }
+      chunk[id & (ChunkSize - 1)] = QString::fromLatin1(name, size);
+
+      // Deep copy of the key, the name may be a temporary buffer
+      m_ids.insert(QByteArray(name, size), id);
+      ++m_count;
+
+      return id;
+    }
+
+    const QString& name(int id) const
+    {
+      return m_chunks[id >> ChunkBits].loadAcquire()[id & (ChunkSize - 1)];
+    }
+
+    int size()
+    {
+      QReadLocker locker(&m_lock);
+      return m_count;
+    }
+
+    void addRecord(int id)
+    {
+      QAtomicPointer<CounterChunk>& chunkPointer = m_counters[StripedCounter::stripeIndex()][id >> ChunkBits];
+      CounterChunk* chunk = chunkPointer.loadAcquire();
+      if (!chunk)
+      {
+        CounterChunk* newChunk = new CounterChunk;
+        if (chunkPointer.testAndSetOrdered(nullptr, newChunk, chunk))
+          chunk = newChunk;
+        else
+          delete newChunk;
+      }
+
+      chunk->counts[id & (ChunkSize - 1)].fetchAndAddRelaxed(1);
+    }
+
+    quint64 records(int id) const
+    {
+      quint64 result = 0;
+      for (int i = 0; i < StripedCounter::Stripes; ++i)
+      {
+        const CounterChunk* chunk = m_counters[i][id >> ChunkBits].loadAcquire();
+        if (chunk)
+          result += chunk->counts[id & (ChunkSize - 1)].load();
+      }
+      return result;
+    }
+
+  private:
+    enum
+    {
+      ChunkBits = 8,
+      ChunkSize = 1 << ChunkBits,
+      MaxChunks = 256
+    };
+
+    struct CounterChunk
+    {
+      QAtomicInteger<quint64> counts[ChunkSize];
+    };
+
+    QReadWriteLock m_lock;
+    QHash<QByteArray, int> m_ids;
+    QAtomicPointer<QString> m_chunks[MaxChunks];
+    int m_count;
+    bool m_limitReported;
+
+    QAtomicPointer<CounterChunk> m_counters[StripedCounter::Stripes][MaxChunks];
+};
+
+
+static LoggerCategoryRegistry* categoryRegistry()
+{
+  // Never destroyed, as category handles may be used until the very end of the application
+  static LoggerCategoryRegistry* registry = new LoggerCategoryRegistry;
+  return registry;
+}
+
+
+struct LogSiteRule
+{
+  QString file;
+  int line;      //!< Zero or negative for the whole file
+  bool enabled;
+};
+
+
+struct LogSiteRegistry
+{
+  QMutex mutex;
+  QList<LogSite*> sites;
+  QList<LogSiteRule> rules; //!< Applied in order to every registered site, also to the ones registered later
 };
 
 
+static LogSiteRegistry* logSiteRegistry()
+{
+  // Never destroyed, the sites are registered until the very end of the application
+  static LogSiteRegistry* registry = new LogSiteRegistry;
+  return registry;
+}
+
+
+static bool logSiteMatches(const LogSite* site, const QString& file, int line)
+{
+  if (line > 0 && site->line() != line)
+    return false;
+
+  const QString siteFile = QString::fromLocal8Bit(site->file());
+  if (!siteFile.endsWith(file))
+    return false;
+
+  if (siteFile.size() == file.size())
+    return true;
+
+  const QChar separator = siteFile.at(siteFile.size() - file.size() - 1);
+  return separator == QLatin1Char('/') || separator == QLatin1Char('\\');
+}
+
+
+static void writeToAppender(AbstractAppender* appender, const QDateTime& timeStamp, Logger::LogLevel logLevel,
+                            const char* file, int line, const char* function, const LogSite* site,
+                            const QString& category, const QString& message, const LogFields* fields)
+{
+  if (site)
+    appender->write(timeStamp, *site, category, message, fields);
+  else
+    appender->write(timeStamp, logLevel, file, line, function, category, message, fields);
+}
+
+
 // Static fields initialization
-Logger* LoggerPrivate::globalInstance = nullptr;
-QReadWriteLock LoggerPrivate::globalInstanceLock;
+QAtomicPointer<Logger> Logger::s_globalInstance;
+
+#if QT_VERSION >= 0x050200
+// The filter installed before ours, recorded once on the first install. The install mutex keeps the concurrent
+// updateQtCategoryFilter() calls from seeing each other's filter as the previous one.
+static std::atomic<QLoggingCategory::CategoryFilter> previousQtCategoryFilter(nullptr);
+static bool qtCategoryFilterInstalled = false;
+static QMutex qtCategoryFilterMutex;
+#endif
+QAtomicInt LoggerPrivate::timestampMode(Logger::LocalTimestamps);
+
+
+static QMutex* loggerHierarchyMutex()
+{
+  static QMutex mutex;
+  return &mutex;
+}
 
 
-static void cleanupLoggerGlobalInstance()
+// Should be called with the loggerHierarchyMutex() locked
+static void setLoggerParent(LoggerPrivate* child, Logger* parent, LoggerPrivate* parentData)
 {
-  QWriteLocker locker(&LoggerPrivate::globalInstanceLock);
+  if (child->parentData)
+    child->parentData->children.removeOne(child);
+
+  child->parentData = parentData;
+  if (parentData)
+    parentData->children.append(child);
+
+  child->parent.storeRelease(parentData ? parent : nullptr);
+}
+
 
-  delete LoggerPrivate::globalInstance;
-  LoggerPrivate::globalInstance = nullptr;
+static void flushAppenders(const LoggerRouting& routing)
+{
+  foreach (AbstractAppender* appender, routing.appenders)
+    appender->flush();
+  foreach (AbstractAppender* appender, routing.allCategoryAppenders())
+    appender->flush();
 }
 
 
 #if QT_VERSION >= 0x050000
+// QLoggingCategory names are mostly string literals, so the category handles are cached by the name pointer. The names
+// are still compared, as the dynamically allocated name may be freed and its memory reused for another one.
+static LoggerCategory qtMessageCategory(const char* name)
+{
+  if (!name)
+    return LoggerCategory();
+
+  struct CacheEntry
+  {
+    const char* name;
+    LoggerCategory category;
+    bool isDefault;
+  };
+  static thread_local CacheEntry cache[16];
+
+  CacheEntry& entry = cache[(quintptr(name) >> 4) & 15];
+  if (entry.name == name)
+  {
+    if (entry.isDefault ? qstrcmp(name, "default") == 0 : entry.category.name() == QLatin1String(name))
+      return entry.category;
+  }
+
+  entry.isDefault = qstrcmp(name, "default") == 0;
+  entry.category = entry.isDefault ? LoggerCategory() : Logger::category(name);
+  entry.name = entry.isDefault || entry.category.isValid() ? name : nullptr;
+  return entry.category;
+}
+
+
 static void qtLoggerMessageHandler(QtMsgType type, const QMessageLogContext& context, const QString& msg)
 {
   Logger::LogLevel level = Logger::Debug;
@@ -530,8 +1101,8 @@ static void qtLoggerMessageHandler(QtMsgType type, const QMessageLogContext& con
       break;
   }
 
-  bool isDefaultCategory = QString::fromLatin1(context.category) == "default";
-  Logger::globalInstance()->write(level, context.file, context.line, context.function, isDefaultCategory ? nullptr : context.category, msg);
+  Logger::globalInstance()->write(level, context.file, context.line, context.function,
+                                  qtMessageCategory(context.category), msg);
 }
 
 #else
@@ -566,7 +1137,7 @@ Logger::Logger()
   : d_ptr(new LoggerPrivate)
 {
   Q_D(Logger);
-  d->writeDefaultCategoryToGlobalInstance = false;
+  d->minimumLevelGeneration.store(-1);
 }
 
 
@@ -584,6 +1155,7 @@ Logger::Logger(const QString& defaultCategory, bool writeToGlobalInstance)
 {
   Q_D(Logger);
   d->writeDefaultCategoryToGlobalInstance = writeToGlobalInstance;
+  d->minimumLevelGeneration.store(-1);
 
   setDefaultCategory(defaultCategory);
 }
@@ -598,14 +1170,40 @@ Logger::~Logger()
 {
   Q_D(Logger);
 
+  // The children fall back to the global instance
+  {
+    QMutexLocker locker(loggerHierarchyMutex());
+    foreach (LoggerPrivate* child, d->children)
+    {
+      child->parentData = nullptr;
+      child->parent.storeRelease(nullptr);
+    }
+    d->children.clear();
+    setLoggerParent(d, nullptr, nullptr);
+  }
+
+  // The children writing at the moment (including the ones moved to another parent since) may still forward the
+  // records here. The thread destroying the logger from inside of a write() call can't wait for itself.
+  if (loggerWriteDepth == 0)
+    LoggerReadSection::waitForReaders();
+
   // Cleanup appenders
   QMutexLocker appendersLocker(&d->loggerMutex);
-  QSet<AbstractAppender*> deleteList(QSet<AbstractAppender*>::fromList(d->appenders));
-  deleteList.unite(QSet<AbstractAppender*>::fromList(d->categoryAppenders.values()));
+  const LoggerRouting* routing = d->currentRouting();
+  QSet<AbstractAppender*> deleteList(QSet<AbstractAppender*>::fromList(routing->appenders));
+  deleteList.unite(QSet<AbstractAppender*>::fromList(routing->allCategoryAppenders()));
   qDeleteAll(deleteList);
 
   appendersLocker.unlock();
 
+  // The snapshots are left to the thread destroying the logger from inside of a write() call, it may still use them.
+  // The readers are already waited for otherwise.
+  if (loggerWriteDepth == 0)
+  {
+    delete routing;
+    qDeleteAll(d->retiredRoutings);
+  }
+
   delete d_ptr;
 }
 
@@ -672,32 +1270,552 @@ Logger::LogLevel Logger::levelFromString(const QString& s)
 }
 
 
-//! Returns the global instance of Logger
+//! Sets the way the timestamps of the log records are obtained
 /**
- * In a most cases you shouldn't use this function directly. Consider using [cuteLogger](@ref cuteLogger) macro instead.
+ * Default mode is Logger::LocalTimestamps: every log record gets the result of \c QDateTime::currentDateTime(), which
+ * involves the conversion to the local time.
  *
- * \sa cuteLogger
- */
-Logger* Logger::globalInstance()
+ * In the Logger::CoarseUtcTimestamps mode the record timestamps are UTC times read from the coarse system clock
+ * (\c CLOCK_REALTIME_COARSE on Linux, having the resolution of a few milliseconds). This is much cheaper, while
+ * AbstractStringAppender based appenders convert the timestamps to the local time only when the second changes.
+ * Custom appenders get the UTC \c QDateTime and may call \c QDateTime::toLocalTime() by themselves if needed.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa timestampMode(), currentTimestamp()
+ */
+void Logger::setTimestampMode(TimestampMode mode)
+{
+  LoggerPrivate::timestampMode.storeRelease(mode);
+}
+
+
+//! Returns the current timestamp mode
+/**
+ * \sa setTimestampMode()
+ */
+Logger::TimestampMode Logger::timestampMode()
+{
+  return TimestampMode(LoggerPrivate::timestampMode.loadAcquire());
+}
+
+
+//! Returns the timestamp for the log record written now, according to the timestampMode()
+/**
+ * \sa setTimestampMode()
+ */
+QDateTime Logger::currentTimestamp()
+{
+  if (timestampMode() == LocalTimestamps)
+    return QDateTime::currentDateTime();
+
+#if defined(Q_OS_LINUX) && defined(CLOCK_REALTIME_COARSE)
+  timespec now;
+  if (clock_gettime(CLOCK_REALTIME_COARSE, &now) == 0)
+    return QDateTime::fromMSecsSinceEpoch(qint64(now.tv_sec) * 1000 + now.tv_nsec / 1000000, Qt::UTC);
+#endif
+
+  return QDateTime::currentDateTimeUtc();
+}
+
+
+/**
+ * \fn static Logger* Logger::globalInstance()
+ *
+ * \brief Returns the global instance of Logger
+ *
+ * The instance is created by the first call. Further calls only read the atomic pointer, without any locking.
+ *
+ * In a most cases you shouldn't use this function directly. Consider using [cuteLogger](@ref cuteLogger) macro instead.
+ *
+ * \sa cuteLogger
+ */
+
+
+Logger* Logger::createGlobalInstance()
 {
-  Logger* result = nullptr;
+  static QMutex creationMutex;
+  QMutexLocker locker(&creationMutex);
+
+  Logger* result = s_globalInstance.loadAcquire();
+  if (result)
+    return result;
+
+  result = new Logger;
+  result->d_func()->isGlobalInstance = true;
+  s_globalInstance.storeRelease(result);
+
+#if QT_VERSION >= 0x050000
+  qInstallMessageHandler(qtLoggerMessageHandler);
+#else
+  qInstallMsgHandler(qtLoggerMessageHandler);
+#endif
+  qAddPostRoutine(destroyGlobalInstance);
+
+  updateQtCategoryFilter();
+
+  return result;
+}
+
+
+void Logger::destroyGlobalInstance()
+{
+  delete s_globalInstance.fetchAndStoreOrdered(nullptr);
+
+#if QT_VERSION >= 0x050200
+  QMutexLocker locker(&qtCategoryFilterMutex);
+  if (!qtCategoryFilterInstalled)
+    return;
+
+  // Previous filter re-enables the categories disabled by us
+  QLoggingCategory::CategoryFilter previous = previousQtCategoryFilter.load();
+  QLoggingCategory::CategoryFilter current = QLoggingCategory::installFilter(previous);
+  if (current != qtCategoryFilter)
   {
-    QReadLocker locker(&LoggerPrivate::globalInstanceLock);
-    result = LoggerPrivate::globalInstance;
+    // The filter installed after ours still chains to it, so it stays active and ours keeps forwarding to the previous
+    // one, enabling everything now the global instance is gone
+    QLoggingCategory::installFilter(current);
+    return;
   }
 
-  if (!result)
+  qtCategoryFilterInstalled = false;
+  previousQtCategoryFilter.store(nullptr);
+#endif
+}
+
+
+//! Updates the Qt logging categories according to the appenders of the global instance
+/**
+ * Logger installs the QLoggingCategory filter disabling the Qt logging categories and the message types the global
+ * instance is not going to write: the categories neither having the appenders nor linked to the global instance
+ * appenders (see logToGlobalInstance()) and the levels lower than the details level of these appenders. The disabled
+ * qCDebug() and other Qt logging macros skip building the message at all. The filter installed before is applied first,
+ * so the rules set with QLoggingCategory::setFilterRules() or the \c QT_LOGGING_RULES variable are respected as well.
+ * The previous filter is recorded only once, when the filter is installed for the first time. A filter installed by
+ * the application later on top of ours is kept active (and so it should call the filter it replaced).
+ *
+ * While the global instance has no appenders at all every category is enabled, so the records are written to the
+ * \c std::cerr as a fallback.
+ *
+ * This function is called automatically when the appenders of any logger are registered or removed, when their details
+ * level changes and when the category settings of the global instance change.
+ *
+ * \note This function is thread safe.
+ */
+void Logger::updateQtCategoryFilter()
+{
+#if QT_VERSION >= 0x050200
+  if (!s_globalInstance.loadAcquire())
+    return;
+
+  QMutexLocker locker(&qtCategoryFilterMutex);
+
+  // Installing the filter once again applies it to all the existing categories
+  QLoggingCategory::CategoryFilter current = QLoggingCategory::installFilter(qtCategoryFilter);
+  if (!qtCategoryFilterInstalled)
+  {
+    previousQtCategoryFilter.store(current);
+    qtCategoryFilterInstalled = true;
+  }
+  else if (current != qtCategoryFilter)
+  {
+    // The application installed its own filter after ours, chaining to it. It is put back, which applies the whole
+    // chain to the existing categories again.
+    QLoggingCategory::installFilter(current);
+  }
+#endif
+}
+
+
+void Logger::qtCategoryFilter(QLoggingCategory* category)
+{
+#if QT_VERSION >= 0x050200
+  QLoggingCategory::CategoryFilter previous = previousQtCategoryFilter.load();
+  if (previous)
+    previous(category);
+
+  // Don't bring the global instance back while it is destroyed
+  Logger* global = s_globalInstance.loadAcquire();
+  if (!global)
+    return;
+
+  const LoggerCategory logCategory = qtMessageCategory(category->categoryName());
+
+  static const struct
   {
-    QWriteLocker locker(&LoggerPrivate::globalInstanceLock);
-    LoggerPrivate::globalInstance = new Logger;
+    QtMsgType type;
+    LogLevel level;
+  } levels[] = {
+    { QtDebugMsg, Debug },
+#if QT_VERSION >= 0x050500
+    { QtInfoMsg, Info },
+#endif
+    { QtWarningMsg, Warning },
+    { QtCriticalMsg, Error }
+  };
 
-#if QT_VERSION >= 0x050000
-    qInstallMessageHandler(qtLoggerMessageHandler);
+  for (const auto& level : levels)
+  {
+    if (category->isEnabled(level.type) && !global->isCategoryEnabledFor(logCategory, level.level))
+      category->setEnabled(level.type, false);
+  }
+#else
+  Q_UNUSED(category)
+#endif
+}
+
+
+//! Returns the logger the records of this logger are forwarded to
+/**
+ * The records of the local logger instances (see LOG_CATEGORY()) are forwarded to the parent logger: the category
+ * records always and the default category records if the logger was created with the \c writeToGlobalInstance flag.
+ * The parent forwards them further up to its own parent, so the records finally reach the global instance.
+ *
+ * Unless set with setParent(), the parent is the global instance. It is looked up once and cached. The global instance
+ * has no parent and returns null.
+ *
+ * The parent destructor waits until the children forwarding the records at the moment stop writing to it. The pointer
+ * returned here is not guarded this way, it should not be kept when the parent may be destroyed.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa setParent()
+ */
+Logger* Logger::parent() const
+{
+  Q_D(const Logger);
+
+  return d->resolveParent();
+}
+
+
+// Returns the parent, resolving the implicit one. The parent is not destroyed until the LoggerReadSection is left.
+Logger* LoggerPrivate::resolveParent() const
+{
+  Logger* result = parent.loadAcquire();
+  if (result || isGlobalInstance)
+    return result;
+
+  Logger* global = Logger::globalInstance();
+
+  QMutexLocker locker(loggerHierarchyMutex());
+  result = parent.loadAcquire();
+  if (!result && global->d_func() != this)
+  {
+    setLoggerParent(const_cast<LoggerPrivate*>(this), global, global->d_func());
+    result = parent.loadAcquire();
+  }
+
+  return result;
+}
+
+
+//! Sets the logger the records of this logger are forwarded to
+/**
+ * Null \a parent restores the default parent, the global instance. Destroying the parent logger also restores it. The
+ * parent of the global instance can't be changed.
+ *
+ * \note The loops in the hierarchy are not detected.
+ *
+ * \sa parent()
+ */
+void Logger::setParent(Logger* parent)
+{
+  Q_D(Logger);
+
+  if (d->isGlobalInstance || parent == this)
+    return;
+
+  QMutexLocker locker(loggerHierarchyMutex());
+  setLoggerParent(d, parent, parent ? parent->d_func() : nullptr);
+}
+
+
+//! Returns the handle of the log category with the specified \a name
+/**
+ * Category names are interned: every distinct name gets the small integer id once, when it is used for the first time,
+ * and Logger routes the records using these ids. Obtaining the handle once and passing it to the LOG_CDEBUG() and the
+ * other category macros saves the name lookup for every record:
+ *
+ * \code
+ * static const LoggerCategory network = Logger::category("network");
+ * LOG_CDEBUG(network) << "Connected";
+ * \endcode
+ *
+ * Null \a name returns the invalid handle, meaning the default category. The registry holds up to 65536 category
+ * names. The names over this limit get the invalid handle too, but their records are written to std::cerr instead of
+ * the default category appenders.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa LoggerCategory
+ */
+LoggerCategory Logger::category(const char* name)
+{
+  if (!name)
+    return LoggerCategory();
+
+  return LoggerCategory(categoryRegistry()->find(name, int(qstrlen(name))));
+}
+
+
+/**
+ * This is the overloaded function provided for the convinience. Category names are stored as Latin-1 strings.
+ */
+LoggerCategory Logger::category(const QString& name)
+{
+  if (name.isNull())
+    return LoggerCategory();
+
+  const QByteArray latin1Name = name.toLatin1();
+  return LoggerCategory(categoryRegistry()->find(latin1Name.constData(), latin1Name.size()));
+}
+
+
+//! Returns the category name
+/**
+ * Invalid handle returns the null string.
+ */
+const QString& LoggerCategory::name() const
+{
+  static const QString nullName;
+  return m_id >= 0 ? categoryRegistry()->name(m_id) : nullName;
+}
+
+
+/**
+ * \class LoggerCategoryCache
+ *
+ * \brief Category of the single LOG_CDEBUG() (and the similar macros) call site, interned on its first use.
+ *
+ * The category name passed to the macro is usually the string literal, so the name pointer is remembered with the
+ * category handle and the following records skip the Logger::category() lookup. The name is compared to the copy kept
+ * by the cache as well, so the name computed at runtime (which may get the same address as its predecessor) is still
+ * looked up every time it differs.
+ */
+
+
+LoggerCategory LoggerCategoryCache::intern(const char* name)
+{
+  const LoggerCategory result = Logger::category(name);
+
+  // Only the first name is remembered, so the name and the id are never seen mismatched by the other threads
+  if (result.isValid() && m_claimed.testAndSetRelaxed(0, 1))
+  {
+    m_id = result.id();
+    m_internedName = qstrdup(name);
+    m_name.storeRelease(name);
+  }
+
+  return result;
+}
+
+
+/**
+ * \class LogField
+ *
+ * \brief Typed key-value field of the structured log record.
+ *
+ * The fields are attached to the record by the LOG_INFO_KV() and the similar macros:
+ * \code
+ * LOG_INFO_KV("Request done", "ms", timer.elapsed(), "status", status, "path", request.path());
+ * \endcode
+ *
+ * The values are kept unformatted and passed to the appenders along with the record (see
+ * AbstractAppender::recordFields()). JsonAppender writes them as the JSON values of the proper type, while the text
+ * appenders render them after the message as the "key=value" pairs.
+ *
+ * \sa Logger::write(const LogSite&, LoggerCategory, const QString&, const LogFields&)
+ */
+
+
+//! Returns the value converted to the string, "true" or "false" for the boolean one.
+QString LogField::toString() const
+{
+  switch (m_type)
+  {
+    case Bool:
+      return m_int ? QStringLiteral("true") : QStringLiteral("false");
+    case Int:
+      return QString::number(m_int);
+    case UInt:
+      return QString::number(m_uint);
+    case Double:
+#if QT_VERSION >= 0x050700
+      return QString::number(m_double, 'g', QLocale::FloatingPointShortest);
 #else
-    qInstallMsgHandler(qtLoggerMessageHandler);
+      return QString::number(m_double, 'g', 17);
 #endif
-    qAddPostRoutine(cleanupLoggerGlobalInstance);
-    result = LoggerPrivate::globalInstance;
+    case String:
+      return m_string;
+  }
+
+  // Just in case
+  return QString();
+}
+
+
+//! Returns true if the fields have the same key, type and value.
+bool LogField::operator==(const LogField& other) const
+{
+  if (m_type != other.m_type || (m_key != other.m_key && qstrcmp(m_key, other.m_key) != 0))
+    return false;
+
+  switch (m_type)
+  {
+    case Bool:
+    case Int:
+      return m_int == other.m_int;
+    case UInt:
+      return m_uint == other.m_uint;
+    case Double:
+      return m_double == other.m_double;
+    case String:
+      return m_string == other.m_string;
+  }
+
+  return false;
+}
+
+
+//! Checks if the records of the specified log level would be written by any of the appenders
+/**
+ * Logger caches the lowest details level of all the appenders registered in it (both general and category ones),
+ * updating it when the appenders are registered or removed and when their AbstractAppender::setDetailsLevel() is called.
+ * This function only compares the \a logLevel with the cached value, so it is cheap enough to be called for every log
+ * record. LOG_DEBUG() and the other macros use it to skip building the records nobody is going to write.
+ *
+ * Local logger instances also take the appenders of the global instance into account, because they pass the category
+ * records to it. Logger::Fatal records are always enabled, as well as any records of a logger having no appenders at
+ * all (such records are written to the \c std::cerr as a fallback).
+ *
+ * \note This function is thread safe.
+ *
+ * \sa AbstractAppender::detailsLevel()
+ */
+bool Logger::isEnabledFor(LogLevel logLevel) const
+{
+  Q_D(const Logger);
+
+  const int generation = AbstractAppender::s_detailsLevelGeneration.loadAcquire();
+  if (d->minimumLevelGeneration.loadAcquire() != generation)
+    updateMinimumLevel(generation);
+
+  if (logLevel >= d->minimumLevel.loadAcquire())
+    return true;
+
+  LoggerReadSection readSection;
+  Logger* parent = d->resolveParent();
+  return parent && parent->isEnabledFor(logLevel);
+}
+
+
+// Checks if the record of the category would be written by any appender. Used by the Qt category filter, so the
+// routing is inspected directly instead of using the cached minimum level.
+bool Logger::isCategoryEnabledFor(LoggerCategory category, LogLevel logLevel) const
+{
+  Q_D(const Logger);
+
+  LoggerReadSection readSection;
+  const LoggerRouting* routing = d->currentRouting();
+  if (!category.isValid() || category == routing->defaultCategory)
+    return isEnabledFor(logLevel);
+
+  // Without any appenders the records are written to std::cerr
+  const QList<AbstractAppender*> categoryAppenders = routing->allCategoryAppenders();
+  if (routing->appenders.isEmpty() && categoryAppenders.isEmpty())
+    return true;
+
+  const int id = category.id();
+  if (id < routing->categoryAppenders.size())
+  {
+    foreach (AbstractAppender* appender, routing->categoryAppenders.at(id))
+    {
+      if (logLevel >= appender->detailsLevel())
+        return true;
+    }
+  }
+
+  if (id < routing->categories.size() && routing->categories.at(id))
+  {
+    foreach (AbstractAppender* appender, routing->appenders)
+    {
+      if (logLevel >= appender->detailsLevel())
+        return true;
+    }
+  }
+
+  return false;
+}
+
+
+void Logger::updateMinimumLevel(int generation) const
+{
+  Q_D(const Logger);
+
+  QMutexLocker locker(&d->loggerMutex);
+  const LoggerRouting* routing = d->currentRouting();
+
+  int level = Fatal;
+  foreach (AbstractAppender* appender, routing->appenders)
+    level = qMin(level, int(appender->detailsLevel()));
+  const QList<AbstractAppender*> categoryAppenders = routing->allCategoryAppenders();
+  foreach (AbstractAppender* appender, categoryAppenders)
+    level = qMin(level, int(appender->detailsLevel()));
+
+  // Records of the default category of local logger instances are passed to the global instance, the rest are written
+  // to std::cerr if there are no appenders to write them
+  bool hasAppenders = !routing->appenders.isEmpty() || !categoryAppenders.isEmpty();
+  if (!hasAppenders && (d->isGlobalInstance || !routing->defaultCategory.isValid()))
+    level = Trace;
+
+  d->minimumLevel.storeRelease(level);
+  d->minimumLevelGeneration.storeRelease(generation);
+}
+
+
+//! Returns the snapshot of the logger self-metrics.
+/**
+ * The snapshot contains the number of the records written by this logger for every log level, the number of the
+ * records written to every category (by all the loggers) and the statistics of all the appenders registered in this
+ * logger (see AbstractAppender::statistics()). The counters are updated without any locking, so this function may be
+ * polled by the metrics exporter as often as needed without slowing the logging down.
+ *
+ * The lockWaitTime is the total time the writing threads waited for the appenders of this logger to become free.
+ *
+ * \note This function is thread safe.
+ */
+LoggerStatistics Logger::statistics() const
+{
+  Q_D(const Logger);
+
+  LoggerStatistics result;
+  for (int level = Trace; level <= Fatal; ++level)
+    result.records[level] = d->levelRecords[level].sum();
+
+  LoggerCategoryRegistry* registry = categoryRegistry();
+  const int categories = registry->size();
+  for (int id = 0; id < categories; ++id)
+  {
+    const quint64 records = registry->records(id);
+    if (records)
+      result.categoryRecords.insert(registry->name(id), records);
+  }
+
+  LoggerReadSection readSection;
+  const LoggerRouting* routing = d->currentRouting();
+  QList<AbstractAppender*> appenders = routing->appenders;
+  foreach (AbstractAppender* appender, routing->allCategoryAppenders())
+  {
+    if (!appenders.contains(appender))
+      appenders.append(appender);
+  }
+
+  foreach (AbstractAppender* appender, appenders)
+  {
+    const AppenderStatistics statistics = appender->statistics();
+    result.lockWaitTime += statistics.lockWaitTime;
+    result.appenders.append(statistics);
   }
 
   return result;
@@ -726,10 +1844,20 @@ void Logger::registerAppender(AbstractAppender* appender)
 
   QMutexLocker locker(&d->loggerMutex);
 
-  if (!d->appenders.contains(appender))
-    d->appenders.append(appender);
+  LoggerRouting routing = *d->currentRouting();
+  if (!routing.appenders.contains(appender))
+  {
+    routing.appenders.append(appender);
+    d->publishRouting(routing);
+  }
   else
     std::cerr << "Trying to register appender that was already registered" << std::endl;
+
+  AbstractAppender::s_detailsLevelGeneration.ref();
+
+  locker.unlock();
+  if (d->isGlobalInstance)
+    updateQtCategoryFilter();
 }
 
 //! Registers the appender to write the log records to the specific category
@@ -762,10 +1890,26 @@ void Logger::registerCategoryAppender(const QString& category, AbstractAppender*
 
   QMutexLocker locker(&d->loggerMutex);
 
-  if (!d->categoryAppenders.values().contains(appender))
-    d->categoryAppenders.insert(category, appender);
+  LoggerRouting routing = *d->currentRouting();
+  const LoggerCategory logCategory = Logger::category(category);
+  if (logCategory.isValid() && !routing.allCategoryAppenders().contains(appender))
+  {
+    if (routing.categoryAppenders.size() <= logCategory.id())
+      routing.categoryAppenders.resize(logCategory.id() + 1);
+    routing.categoryAppenders[logCategory.id()].append(appender);
+    d->publishRouting(routing);
+  }
+  else if (!logCategory.isValid())
+    std::cerr << "Cannot register the appender for the category " << qPrintable(category)
+              << ": the limit of the log categories is reached" << std::endl;
   else
     std::cerr << "Trying to register appender that was already registered" << std::endl;
+
+  AbstractAppender::s_detailsLevelGeneration.ref();
+
+  locker.unlock();
+  if (d->isGlobalInstance)
+    updateQtCategoryFilter();
 }
 
 
@@ -773,6 +1917,11 @@ void Logger::registerCategoryAppender(const QString& category, AbstractAppender*
 /**
  * After calling this function logger stops writing any of the records to the appender.
  *
+ * The function returns when none of the threads writes to the appender anymore, so it may be destroyed right after
+ * that. The wait doesn't block the other threads registering or removing the appenders. When called from inside of
+ * an appender write() call (e.g. by the appender removing itself), the function can't wait for its own thread and
+ * returns right away, so the appender must not be destroyed before that write() call returns.
+ *
  * \param appender Pointer to appender to remove from logger
  * \note Removed appender will not be deleted on the application shutdown and you will need to destroy the object
  *       yourself.
@@ -784,14 +1933,33 @@ void Logger::removeAppender(AbstractAppender* appender)
 
   QMutexLocker locker(&d->loggerMutex);
 
-  d->appenders.removeAll(appender);
-  for (QMultiMap<QString,AbstractAppender*>::iterator it = d->categoryAppenders.begin(); it != d->categoryAppenders.end();)
+  LoggerRouting routing = *d->currentRouting();
+  routing.appenders.removeAll(appender);
+  for (int i = 0; i < routing.categoryAppenders.size(); ++i)
+    routing.categoryAppenders[i].removeAll(appender);
+
+  d->publishRouting(routing);
+
+  AbstractAppender::s_detailsLevelGeneration.ref();
+
+  // All the older snapshots may still hold the appender. The thread removing it from inside of a write() call leaves
+  // them to be deleted later, with the following configuration changes.
+  if (loggerWriteDepth == 0)
   {
-    if (it.value() == appender)
-      it = d->categoryAppenders.erase(it);
-    else
-      ++it;
+    QList<const LoggerRouting*> retired;
+    retired.swap(d->retiredRoutings);
+    locker.unlock();
+
+    LoggerReadSection::waitForReaders();
+    qDeleteAll(retired);
+  }
+  else
+  {
+    locker.unlock();
   }
+
+  if (d->isGlobalInstance)
+    updateQtCategoryFilter();
 }
 
 
@@ -819,8 +1987,24 @@ void Logger::setDefaultCategory(const QString& category)
 
   QMutexLocker locker(&d->loggerMutex);
 
-  d->defaultCategory = category;
-}
+  const LoggerCategory logCategory = Logger::category(category);
+  if (logCategory.id() == refusedCategoryId)
+  {
+    std::cerr << "Cannot set the default category " << qPrintable(category)
+              << ": the limit of the log categories is reached" << std::endl;
+    return;
+  }
+
+  LoggerRouting routing = *d->currentRouting();
+  routing.defaultCategory = logCategory;
+  d->publishRouting(routing);
+
+  AbstractAppender::s_detailsLevelGeneration.ref();
+
+  locker.unlock();
+  if (d->isGlobalInstance)
+    updateQtCategoryFilter();
+}
 
 //! Returns default logging category name
 /**
@@ -829,7 +2013,9 @@ void Logger::setDefaultCategory(const QString& category)
 QString Logger::defaultCategory() const
 {
   Q_D(const Logger);
-  return d->defaultCategory;
+
+  LoggerReadSection readSection;
+  return d->currentRouting()->defaultCategory.name();
 }
 
 //! Links some logging category with the global logger instance appenders.
@@ -851,10 +2037,22 @@ void Logger::logToGlobalInstance(const QString& category, bool logToGlobal)
 {
   Q_D(Logger);
 
-  if (this == globalInstance())
+  if (d->isGlobalInstance)
   {
     QMutexLocker locker(&d->loggerMutex);
-    d->categories.insert(category, logToGlobal);
+
+    const LoggerCategory logCategory = Logger::category(category);
+    if (!logCategory.isValid())
+      return;
+
+    LoggerRouting routing = *d->currentRouting();
+    if (routing.categories.size() <= logCategory.id())
+      routing.categories.resize(logCategory.id() + 1);
+    routing.categories[logCategory.id()] = logToGlobal;
+    d->publishRouting(routing);
+
+    locker.unlock();
+    updateQtCategoryFilter();
   }
   else
   {
@@ -863,48 +2061,77 @@ void Logger::logToGlobalInstance(const QString& category, bool logToGlobal)
 }
 
 
-void Logger::write(const QDateTime& timeStamp, LogLevel logLevel, const char* file, int line, const char* function, const char* category,
-                   const QString& message, bool fromLocalInstance)
+void Logger::write(const QDateTime& timeStamp, LogLevel logLevel, const char* file, int line, const char* function,
+                   LoggerCategory category, const QString& message, bool fromLocalInstance, const LogSite* site,
+                   const LogFields* fields, const QString* recordCategoryName)
 {
   Q_D(Logger);
 
-  QMutexLocker locker(&d->loggerMutex);
+  struct WriteDepthGuard
+  {
+    WriteDepthGuard() { ++loggerWriteDepth; }
+    ~WriteDepthGuard() { --loggerWriteDepth; }
+  } writeDepthGuard;
+
+  // The snapshot is never modified, concurrency control is left to the appenders
+  LoggerReadSection readSection;
+  const LoggerRouting* routing = d->currentRouting();
+
+  // The category refused by the registry is neither the default one nor passed to the parent logger, so its records
+  // end up in the std::cerr fallback instead of the default category appenders
+  const bool isRefusedCategory = category.id() == refusedCategoryId;
 
-  QString logCategory = QString::fromLatin1(category);
-  if (logCategory.isNull() && !d->defaultCategory.isNull())
-    logCategory = d->defaultCategory;
+  LoggerCategory logCategory = category;
+  if (!logCategory.isValid() && !isRefusedCategory)
+    logCategory = routing->defaultCategory;
+
+  const QString& categoryName = recordCategoryName ? *recordCategoryName : logCategory.name();
+  const int categoryId = logCategory.id();
+
+  // The records passed from the local instances are already counted there
+  if (!fromLocalInstance)
+  {
+    d->levelRecords[qBound(int(Trace), int(logLevel), int(Fatal))].add(1);
+    if (categoryId >= 0)
+      categoryRegistry()->addRecord(categoryId);
+  }
 
   bool wasWritten = false;
-  bool isGlobalInstance = this == globalInstance();
-  bool linkedToGlobal = isGlobalInstance && d->categories.value(logCategory, false);
+  bool isGlobalInstance = d->isGlobalInstance;
+  bool isDefaultCategory = logCategory == routing->defaultCategory;
+  bool linkedToGlobal = isGlobalInstance && categoryId >= 0 && categoryId < routing->categories.size()
+                        && routing->categories.at(categoryId);
 
-  if (!logCategory.isNull())
+  if (logCategory.isValid())
   {
-    QList<AbstractAppender*> appenders = d->categoryAppenders.values(logCategory);
-    if (appenders.length() == 0)
+    if (categoryId >= routing->categoryAppenders.size() || routing->categoryAppenders.at(categoryId).isEmpty())
     {
-      if (logCategory != d->defaultCategory && !linkedToGlobal && !fromLocalInstance && !d->noAppendersCategories.contains(logCategory))
+      if (!isDefaultCategory && !linkedToGlobal && !fromLocalInstance)
       {
-        std::cerr << "No appenders associated with category " << qPrintable(logCategory) << std::endl;
-        d->noAppendersCategories.append(logCategory);
+        QMutexLocker locker(&d->noAppendersMutex);
+        if (!d->noAppendersCategories.contains(categoryId))
+        {
+          std::cerr << "No appenders associated with category " << qPrintable(categoryName) << std::endl;
+          d->noAppendersCategories.insert(categoryId);
+        }
       }
     }
     else
     {
-      foreach (AbstractAppender* appender, appenders)
-        appender->write(timeStamp, logLevel, file, line, function, logCategory, message);
+      foreach (AbstractAppender* appender, routing->categoryAppenders.at(categoryId))
+        writeToAppender(appender, timeStamp, logLevel, file, line, function, site, categoryName, message, fields);
       wasWritten = true;
     }
   }
 
   // the default category is linked to the main logger appenders
   // global logger instance also writes all linked categories to the main appenders
-  if (logCategory.isNull() || logCategory == d->defaultCategory || linkedToGlobal)
+  if ((!logCategory.isValid() && !isRefusedCategory) || isDefaultCategory || linkedToGlobal)
   {
-    if (!d->appenders.isEmpty())
+    if (!routing->appenders.isEmpty())
     {
-      foreach (AbstractAppender* appender, d->appenders)
-        appender->write(timeStamp, logLevel, file, line, function, logCategory, message);
+      foreach (AbstractAppender* appender, routing->appenders)
+        writeToAppender(appender, timeStamp, logLevel, file, line, function, site, categoryName, message, fields);
       wasWritten = true;
     }
     else
@@ -922,18 +2149,22 @@ void Logger::write(const QDateTime& timeStamp, LogLevel logLevel, const char* fi
     }
   }
 
-  // local logger instances send category messages to the global instance
-  if (!isGlobalInstance)
+  // local logger instances send category messages to the parent logger, up to the global instance. The parent keeps
+  // the category name of the record instead of labelling it with its own default category.
+  Logger* parentLogger = isGlobalInstance ? nullptr : d->resolveParent();
+  if (parentLogger)
   {
-    if (!logCategory.isNull())
+    if (logCategory.isValid())
     {
-      globalInstance()->write(timeStamp, logLevel, file, line, function, logCategory.toLatin1(), message, true);
+      parentLogger->write(timeStamp, logLevel, file, line, function, logCategory, message, true, site, fields,
+                          &categoryName);
       wasWritten = true;
     }
 
-    if (d->writeDefaultCategoryToGlobalInstance && logCategory == d->defaultCategory)
+    if (d->writeDefaultCategoryToGlobalInstance && isDefaultCategory)
     {
-      globalInstance()->write(timeStamp, logLevel, file, line, function, nullptr, message, true);
+      parentLogger->write(timeStamp, logLevel, file, line, function, LoggerCategory(), message, true, site, fields,
+                          &categoryName);
       wasWritten = true;
     }
   }
@@ -941,18 +2172,27 @@ void Logger::write(const QDateTime& timeStamp, LogLevel logLevel, const char* fi
   if (!wasWritten && !fromLocalInstance)
   {
     // Fallback
+    const QString functionName = site ? site->functionName() : AbstractStringAppender::stripFunctionName(function);
 #if defined(Q_OS_ANDROID)
-    QString result = QString(QLatin1String("<%2> %3")).arg(AbstractStringAppender::stripFunctionName(function)).arg(message);
+    QString result = QString(QLatin1String("<%2> %3")).arg(functionName).arg(message);
     __android_log_write(AndroidAppender::androidLogPriority(logLevel), "Logger", qPrintable(result));
 #else
     QString result = QString(QLatin1String("[%1] <%2> %3")).arg(levelToString(logLevel), -7)
-                     .arg(AbstractStringAppender::stripFunctionName(function)).arg(message);
+                     .arg(functionName).arg(message);
     std::cerr << qPrintable(result) << std::endl;
 #endif
   }
 
-  if (logLevel == Logger::Fatal)
+  // Local logger instance aborts by itself after the global one have written the record
+  if (logLevel == Logger::Fatal && !fromLocalInstance)
+  {
+    // Give the buffering appenders (like AsyncAppender) a chance to write out the records before crashing
+    flushAppenders(*routing);
+    for (Logger* ancestor = parentLogger; ancestor; ancestor = ancestor->d_func()->resolveParent())
+      flushAppenders(*ancestor->d_func()->currentRouting());
+
     abort();
+  }
 }
 
 
@@ -960,6 +2200,11 @@ void Logger::write(const QDateTime& timeStamp, LogLevel logLevel, const char* fi
 /**
  * Writes the log records with the supplied arguments to all the registered appenders.
  *
+ * The function doesn't lock the logger: it uses the snapshot of the appenders list published by the last
+ * registerAppender(), registerCategoryAppender(), removeAppender() or logToGlobalInstance() call. Several threads may
+ * write the records concurrently, the appenders are responsible for their own synchronization (see
+ * AbstractAppender::write()).
+ *
  * \note It is not recommended to call this function directly. Instead of this you can just call one of the macros
  *       (LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR, LOG_FATAL) that will supply all the needed
  *       information to this function.
@@ -969,11 +2214,12 @@ void Logger::write(const QDateTime& timeStamp, LogLevel logLevel, const char* fi
  * \param file - the name of the source file that requested the log record
  * \param line - the line of the code of source file that requested the log record
  * \param function - name of the function that requested the log record
- * \param category - logging category (0 for default category)
+ * \param category - logging category (0 for default category), see also category()
  * \param message - log message
  *
  * \note Recording of the log record using the Logger::Fatal log level will lead to calling the STL abort()
- *       function, which will interrupt the running of your software and begin the writing of the core dump.
+ *       function, which will interrupt the running of your software and begin the writing of the core dump. All the
+ *       appenders are flushed (see AbstractAppender::flush()) before that.
  *
  * \sa LogLevel
  * \sa LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR, LOG_FATAL
@@ -982,20 +2228,89 @@ void Logger::write(const QDateTime& timeStamp, LogLevel logLevel, const char* fi
 void Logger::write(const QDateTime& timeStamp, LogLevel logLevel, const char* file, int line, const char* function, const char* category,
                    const QString& message)
 {
-  write(timeStamp, logLevel, file, line, function, category, message, /* fromLocalInstance = */ false);
+  write(timeStamp, logLevel, file, line, function, Logger::category(category), message, /* fromLocalInstance = */ false,
+        nullptr, nullptr);
 }
 
 /**
  * This is the overloaded function provided for the convinience. It behaves similar to the above function.
  *
- * This function uses the current timestamp obtained with \c QDateTime::currentDateTime().
+ * This function uses the current timestamp obtained with currentTimestamp().
  *
- * \sa write()
+ * \sa write(), setTimestampMode()
  */
 void Logger::write(LogLevel logLevel, const char* file, int line, const char* function, const char* category,
                    const QString& message)
 {
-  write(QDateTime::currentDateTime(), logLevel, file, line, function, category, message);
+  write(currentTimestamp(), logLevel, file, line, function, Logger::category(category), message);
+}
+
+
+/**
+ * This is the overloaded function provided for the convinience. It takes the interned category handle returned by
+ * the category() function instead of the category name, so the name isn't looked up for every record.
+ *
+ * \sa category()
+ */
+void Logger::write(const QDateTime& timeStamp, LogLevel logLevel, const char* file, int line, const char* function,
+                   LoggerCategory category, const QString& message)
+{
+  write(timeStamp, logLevel, file, line, function, category, message, /* fromLocalInstance = */ false, nullptr, nullptr);
+}
+
+
+/**
+ * This is the overloaded function provided for the convinience. It behaves similar to the above function.
+ *
+ * This function uses the current timestamp obtained with currentTimestamp().
+ *
+ * \sa write(), category()
+ */
+void Logger::write(LogLevel logLevel, const char* file, int line, const char* function, LoggerCategory category,
+                   const QString& message)
+{
+  write(currentTimestamp(), logLevel, file, line, function, category, message);
+}
+
+
+/**
+ * This is the overloaded function provided for the convinience. It takes the level, the source file, the line and
+ * the function of the record from the call site \a site, so the appenders may use the values cached there (see
+ * AbstractAppender::appendSite()).
+ *
+ * \sa LogSite
+ */
+void Logger::write(const QDateTime& timeStamp, const LogSite& site, LoggerCategory category, const QString& message)
+{
+  write(timeStamp, site.level(), site.file(), site.line(), site.function(), category, message,
+        /* fromLocalInstance = */ false, &site, nullptr);
+}
+
+
+/**
+ * This is the overloaded function provided for the convinience. It behaves similar to the above function.
+ *
+ * This function uses the current timestamp obtained with currentTimestamp().
+ *
+ * \sa write(), LogSite
+ */
+void Logger::write(const LogSite& site, LoggerCategory category, const QString& message)
+{
+  write(currentTimestamp(), site, category, message);
+}
+
+
+/**
+ * This is the overloaded function provided for the convinience. It writes the structured record carrying the key-value
+ * \a fields along with the message. The fields are passed to the appenders as is (see AbstractAppender::recordFields()),
+ * the text appenders render them after the message as the "key=value" pairs.
+ *
+ * \sa LOG_INFO_KV(), LogField
+ */
+void Logger::write(const LogSite& site, LoggerCategory category, const QString& message, const LogFields& fields)
+{
+  write(currentTimestamp(), site.level(), site.file(), site.line(), site.function(), category, message,
+        /* fromLocalInstance = */ false, &site, fields.isEmpty() ? nullptr : &fields);
 }
 
 
@@ -1028,60 +2343,579 @@ Logger* cuteLoggerInstance()
 
 
 
+// Formats the duration using the largest unit keeping the value below 10000
+static QString formatDuration(qint64 nsecs)
+{
+  if (nsecs < 10000)
+    return QString(QLatin1String("%1 ns")).arg(nsecs);
+  if (nsecs < Q_INT64_C(10000000))
+    return QString(QLatin1String("%1 us")).arg(nsecs / 1000);
+  if (nsecs < Q_INT64_C(10000000000))
+    return QString(QLatin1String("%1 ms")).arg(nsecs / 1000000);
+  return QString(QLatin1String("%1 s")).arg(nsecs / 1000000000);
+}
+
+
+/**
+ * \class LoggerTimingHelper
+ *
+ * \brief Measures the scope for the LOG_TRACE_TIME(), LOG_DEBUG_TIME() and LOG_INFO_TIME() macros.
+ *
+ * The time is measured with the monotonic QElapsedTimer, so it is not affected by the system clock adjustments. If the
+ * record of the log level wouldn't be written (see Logger::isEnabledFor()), the block name is not formatted and nothing
+ * is measured.
+ */
+
+
 void LoggerTimingHelper::start(const char* msg, ...)
 {
+  if (!m_logger->isEnabledFor(m_logLevel))
+  {
+    m_logger = nullptr;
+    return;
+  }
+
   va_list va;
   va_start(va, msg);
-  m_block = QString().vsprintf(msg, va);
+  m_block = QString::vasprintf(msg, va);
   va_end(va);
 
-  m_time.start();
+  m_timer.start();
 }
 
 
 void LoggerTimingHelper::start(const QString& block)
 {
+  if (!m_logger->isEnabledFor(m_logLevel))
+  {
+    m_logger = nullptr;
+    return;
+  }
+
   m_block = block;
-  m_time.start();
+  m_timer.start();
 }
 
 
 void LoggerTimingHelper::start(Logger::TimingMode mode, const QString& block)
 {
   m_timingMode = mode;
-  m_block = block;
-  m_time.start();
+  start(block);
 }
 
 
 LoggerTimingHelper::~LoggerTimingHelper()
 {
+  if (!m_logger)
+    return;
+
+  const qint64 elapsed = m_timer.nsecsElapsed();
+
   QString message;
   if (m_block.isEmpty())
-    message = QString(QLatin1String("Function %1 finished in ")).arg(AbstractStringAppender::stripFunctionName(m_function));
+    message = QString(QLatin1String("Function %1 finished in ")).arg(AbstractStringAppender::cachedFunctionName(m_function));
   else
     message = QString(QLatin1String("\"%1\" finished in ")).arg(m_block);
 
-  int elapsed = m_time.elapsed();
-  if (elapsed >= 10000 && m_timingMode == Logger::TimingAuto)
-    message += QString(QLatin1String("%1 s.")).arg(elapsed / 1000);
+  const qint64 elapsedMs = elapsed / 1000000;
+  if (m_timingMode == Logger::TimingPrecise)
+    message += formatDuration(elapsed) + QLatin1Char('.');
+  else if (elapsedMs >= 10000 && m_timingMode == Logger::TimingAuto)
+    message += QString(QLatin1String("%1 s.")).arg(elapsedMs / 1000);
   else
-    message += QString(QLatin1String("%1 ms.")).arg(elapsed);
+    message += QString(QLatin1String("%1 ms.")).arg(elapsedMs);
 
-  m_logger->write(m_logLevel, m_file, m_line, m_function, nullptr, message);
+  m_logger->write(m_logLevel, m_file, m_line, m_function, LoggerCategory(), message);
+}
+
+
+/**
+ * \class LoggerTimingStats
+ *
+ * \brief Aggregated timing of the single LOG_TRACE_TIME_STATS(), LOG_DEBUG_TIME_STATS() or LOG_INFO_TIME_STATS() call site.
+ *
+ * Instead of writing a record for every measured scope, the call site accumulates the number of calls, the minimum,
+ * the maximum and the total time and the histogram of the durations. The measurements of the different threads go to
+ * the different stripes updated with the atomic operations only, so the scope may be measured in the hot code.
+ *
+ * The summary record with the percentiles is written every summaryInterval() (checked when the site measures the next
+ * scope) and by writeSummaries(), then the statistics starts over. The histogram buckets are log-linear, four per
+ * every power of two, so the percentiles are accurate within 25%.
+ *
+ * The periodic summary is written to the logger of the scope which completed the interval. The site doesn't keep the
+ * logger, so the function scope LOG_CATEGORY() logger may be destroyed at any time. writeSummaries() writes to the
+ * global logger instance.
+ *
+ * \sa LOG_TRACE_TIME_STATS()
+ */
+
+
+class LoggerTimingStatsData
+{
+  public:
+    enum
+    {
+      Stripes = 8,
+      SubBucketBits = 2,
+      SubBuckets = 1 << SubBucketBits,
+      Buckets = (64 - SubBucketBits + 1) * SubBuckets
+    };
+
+    struct Stripe
+    {
+      Stripe()
+        : min(~Q_UINT64_C(0))
+      {}
+
+      QAtomicInteger<quint64> count;
+      QAtomicInteger<quint64> sum;
+      QAtomicInteger<quint64> min;
+      QAtomicInteger<quint64> max;
+      QAtomicInteger<quint64> buckets[Buckets];
+    };
+
+    Logger::LogLevel logLevel;
+    const char* file;
+    int line;
+    const char* function;
+    const char* block;
+
+    Stripe stripes[Stripes];
+
+    static int highestBit(quint64 value)
+    {
+#if defined(Q_CC_GNU)
+      return 63 - __builtin_clzll(value);
+#else
+      int result = 0;
+      while (value >>= 1)
+        ++result;
+      return result;
+#endif
+    }
+
+    static int bucket(quint64 value)
+    {
+      if (value < SubBuckets)
+        return int(value);
+
+      const int exponent = highestBit(value);
+      return (exponent - SubBucketBits + 1) * SubBuckets
+             + int((value >> (exponent - SubBucketBits)) & (SubBuckets - 1));
+    }
+
+    // The highest value going to the bucket
+    static quint64 bucketLimit(int bucket)
+    {
+      if (bucket < SubBuckets)
+        return quint64(bucket);
+
+      const int shift = bucket / SubBuckets - 1;
+      const quint64 lowest = quint64(SubBuckets + bucket % SubBuckets) << shift;
+      return lowest + ((Q_UINT64_C(1) << shift) - 1);
+    }
+};
+
+
+struct LoggerTimingStatsRegistry
+{
+  QMutex mutex;
+  QList<LoggerTimingStats*> stats;
+};
+
+
+static LoggerTimingStatsRegistry* timingStatsRegistry()
+{
+  // Never destroyed, as the call sites may measure the time until the very end of the application
+  static LoggerTimingStatsRegistry* registry = new LoggerTimingStatsRegistry;
+  return registry;
+}
+
+
+static QAtomicInt timingSummaryInterval(60000);
+
+
+static void updateMaximum(QAtomicInteger<quint64>& maximum, quint64 value)
+{
+  quint64 current = maximum.load();
+  while (value > current && !maximum.testAndSetRelaxed(current, value, current))
+    ;
+}
+
+
+static void updateMinimum(QAtomicInteger<quint64>& minimum, quint64 value)
+{
+  quint64 current = minimum.load();
+  while (value < current && !minimum.testAndSetRelaxed(current, value, current))
+    ;
+}
+
+
+//! Accounts the single measured scope of \a nsecs nanoseconds.
+/**
+ * The location of the first measurement is used for the summary records. Writes the summary to the \a logger if the
+ * summaryInterval() has passed since the previous one.
+ */
+void LoggerTimingStats::add(Logger* logger, Logger::LogLevel logLevel, const char* file, int line,
+                            const char* function, const char* block, qint64 nsecs)
+{
+  LoggerTimingStatsData* data = m_data.loadAcquire();
+  if (!data)
+  {
+    LoggerTimingStatsData* newData = new LoggerTimingStatsData;
+    newData->logLevel = logLevel;
+    newData->file = file;
+    newData->line = line;
+    newData->function = function;
+    newData->block = block;
+
+    m_lastSummary.store(monotonicNSecs());
+    if (m_data.testAndSetOrdered(nullptr, newData, data))
+    {
+      data = newData;
+
+      LoggerTimingStatsRegistry* registry = timingStatsRegistry();
+      QMutexLocker locker(&registry->mutex);
+      registry->stats.append(this);
+    }
+    else
+    {
+      delete newData;
+    }
+  }
+
+  const quint64 value = quint64(qMax(nsecs, Q_INT64_C(0)));
+  LoggerTimingStatsData::Stripe& stripe = data->stripes[StripedCounter::stripeIndex() % LoggerTimingStatsData::Stripes];
+  stripe.count.fetchAndAddRelaxed(1);
+  stripe.sum.fetchAndAddRelaxed(value);
+  updateMinimum(stripe.min, value);
+  updateMaximum(stripe.max, value);
+  stripe.buckets[LoggerTimingStatsData::bucket(value)].fetchAndAddRelaxed(1);
+
+  const int interval = timingSummaryInterval.loadAcquire();
+  if (interval > 0)
+  {
+    const qint64 now = monotonicNSecs();
+    qint64 last = m_lastSummary.load();
+    if (now - last >= qint64(interval) * 1000000 && m_lastSummary.testAndSetRelaxed(last, now, last))
+      writeSummary(logger);
+  }
+}
+
+
+//! Writes the summary record and starts the statistics over.
+/**
+ * The summary is written to the \a logger, or to the global logger instance if it is null. Returns false if no scopes
+ * were measured since the previous summary. The summary looks like:
+ * \code
+ * Function foo timing: 1200 calls, min 850 ns, avg 1 us, p50 959 ns, p90 1535 ns, p99 3071 ns, max 12 us
+ * \endcode
+ *
+ * \note This function is thread safe. The scopes measured concurrently with it may go to either of the summaries.
+ */
+bool LoggerTimingStats::writeSummary(Logger* logger)
+{
+  LoggerTimingStatsData* data = m_data.loadAcquire();
+  if (!data)
+    return false;
+
+  quint64 count = 0;
+  quint64 sum = 0;
+  quint64 min = ~Q_UINT64_C(0);
+  quint64 max = 0;
+  quint64 buckets[LoggerTimingStatsData::Buckets];
+  std::memset(buckets, 0, sizeof(buckets));
+
+  for (LoggerTimingStatsData::Stripe& stripe : data->stripes)
+  {
+    count += stripe.count.fetchAndStoreRelaxed(0);
+    sum += stripe.sum.fetchAndStoreRelaxed(0);
+    min = qMin(min, quint64(stripe.min.fetchAndStoreRelaxed(~Q_UINT64_C(0))));
+    max = qMax(max, quint64(stripe.max.fetchAndStoreRelaxed(0)));
+    for (int i = 0; i < LoggerTimingStatsData::Buckets; ++i)
+    {
+      if (stripe.buckets[i].load())
+        buckets[i] += stripe.buckets[i].fetchAndStoreRelaxed(0);
+    }
+  }
+
+  if (count == 0)
+    return false;
+
+  // Bucket counts may be slightly out of sync with the count, the percentiles are taken from the buckets themselves
+  quint64 bucketTotal = 0;
+  for (int i = 0; i < LoggerTimingStatsData::Buckets; ++i)
+    bucketTotal += buckets[i];
+
+  const double fractions[] = { 0.5, 0.9, 0.99 };
+  qint64 percentiles[3] = { 0, 0, 0 };
+  quint64 seen = 0;
+  int next = 0;
+  for (int i = 0; i < LoggerTimingStatsData::Buckets && next < 3; ++i)
+  {
+    seen += buckets[i];
+    while (next < 3 && seen > 0 && double(seen) >= fractions[next] * double(bucketTotal))
+      percentiles[next++] = qint64(qMin(LoggerTimingStatsData::bucketLimit(i), max));
+  }
+
+  QString message;
+  if (data->block)
+    message = QString(QLatin1String("\"%1\" timing: ")).arg(QLatin1String(data->block));
+  else
+    message = QString(QLatin1String("Function %1 timing: ")).arg(AbstractStringAppender::cachedFunctionName(data->function));
+
+  message += QString(QLatin1String("%1 calls, min %2, avg %3, p50 %4, p90 %5, p99 %6, max %7"))
+             .arg(count).arg(formatDuration(qint64(min))).arg(formatDuration(qint64(sum / count)))
+             .arg(formatDuration(percentiles[0])).arg(formatDuration(percentiles[1]))
+             .arg(formatDuration(percentiles[2])).arg(formatDuration(qint64(max)));
+
+  if (!logger)
+    logger = cuteLoggerGlobalInstance();
+  logger->write(data->logLevel, data->file, data->line, data->function, LoggerCategory(), message);
+  return true;
+}
+
+
+//! Returns the interval of the periodic summary records in milliseconds.
+/**
+ * \sa setSummaryInterval()
+ */
+int LoggerTimingStats::summaryInterval()
+{
+  return timingSummaryInterval.loadAcquire();
+}
+
+
+//! Sets the interval of the periodic summary records of all the call sites.
+/**
+ * Default interval is one minute. Zero or negative \a msecs disables the periodic summaries, so they are only written by
+ * writeSummaries().
+ *
+ * \note This function is thread safe.
+ */
+void LoggerTimingStats::setSummaryInterval(int msecs)
+{
+  timingSummaryInterval.storeRelease(msecs);
+}
+
+
+//! Writes the summary records of all the call sites having the scopes measured since their previous summary.
+/**
+ * The summaries are written to the global logger instance, as the loggers of the sites may be already destroyed.
+ *
+ * \note This function is thread safe.
+ *
+ * \sa writeSummary()
+ */
+void LoggerTimingStats::writeSummaries()
+{
+  QList<LoggerTimingStats*> stats;
+  {
+    LoggerTimingStatsRegistry* registry = timingStatsRegistry();
+    QMutexLocker locker(&registry->mutex);
+    stats = registry->stats;
+  }
+
+  foreach (LoggerTimingStats* site, stats)
+  {
+    site->m_lastSummary.store(monotonicNSecs());
+    site->writeSummary();
+  }
+}
+
+
+//! Starts measuring the scope. The \a block name must be a string literal, it is stored by the pointer.
+void LoggerTimingScope::start(const char* block)
+{
+  if (!m_logger->isEnabledFor(m_logLevel))
+    return;
+
+  m_block = block;
+  m_start = monotonicNSecs();
+}
+
+
+LoggerTimingScope::~LoggerTimingScope()
+{
+  if (m_start >= 0)
+    m_stats->add(m_logger, m_logLevel, m_file, m_line, m_function, m_block, monotonicNSecs() - m_start);
+}
+
+
+// Checks if vsnprintf() formats the string exactly like QString::vasprintf() does. This is true for the integer and
+// plain string conversions. Floating point numbers depend on the C locale, while %p, %c, %ls and %lc are handled by
+// Qt differently. The width and the precision of %s are counted in QChars by Qt, but in bytes by vsnprintf().
+static bool isPlainPrintfFormat(const char* format)
+{
+  const char* p = format;
+  while (*p)
+  {
+    if (*p++ != '%')
+      continue;
+
+    if (*p == '%')
+    {
+      ++p;
+      continue;
+    }
+
+    while (*p && std::strchr("-+ #0", *p))
+      ++p;
+
+    bool hasWidth = false;
+    if (*p == '*')
+    {
+      ++p;
+      hasWidth = true;
+    }
+    while (*p >= '0' && *p <= '9')
+    {
+      ++p;
+      hasWidth = true;
+    }
+
+    if (*p == '.')
+    {
+      ++p;
+      hasWidth = true;
+      if (*p == '*')
+        ++p;
+      while (*p >= '0' && *p <= '9')
+        ++p;
+    }
+
+    bool hasLength = false;
+    while (*p && std::strchr("hljzt", *p))
+    {
+      ++p;
+      hasLength = true;
+    }
+
+    switch (*p)
+    {
+      case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+        break;
+      case 's':
+        if (hasLength || hasWidth)
+          return false;
+        break;
+      default:
+        return false;
+    }
+    ++p;
+  }
+
+  return true;
+}
+
+
+// Decodes the vsnprintf() output to the reused string. Most of the messages are ASCII and are simply widened in place.
+static void assignPrintfOutput(QString& result, const char* data, int size)
+{
+  result.resize(size);
+  QChar* out = result.data();
+  for (int i = 0; i < size; ++i)
+  {
+    const uchar c = uchar(data[i]);
+    if (c >= 0x80)
+    {
+      result = QString::fromUtf8(data, size);
+      return;
+    }
+    out[i] = QLatin1Char(char(c));
+  }
+}
+
+
+// Formats the message into the reused string without the temporary allocations. Returns false if the format string is
+// not supported, the va list is left untouched in this case.
+static bool formatPrintf(QString& result, const char* format, va_list va)
+{
+  if (!isPlainPrintfFormat(format))
+    return false;
+
+  char stackBuffer[1024];
+  va_list copy;
+  va_copy(copy, va);
+  const int size = std::vsnprintf(stackBuffer, sizeof(stackBuffer), format, copy);
+  va_end(copy);
+
+  if (size < 0)
+    return false;
+
+  if (size < int(sizeof(stackBuffer)))
+  {
+    assignPrintfOutput(result, stackBuffer, size);
+    return true;
+  }
+
+  QByteArray localBuffer;
+  QByteArray* buffer = threadBufferPool<QByteArray>().acquire();
+  if (!buffer)
+    buffer = &localBuffer;
+
+  buffer->resize(size + 1);
+  va_copy(copy, va);
+  std::vsnprintf(buffer->data(), size_t(size) + 1, format, copy);
+  va_end(copy);
+  assignPrintfOutput(result, buffer->constData(), size);
+
+  if (buffer != &localBuffer)
+  {
+    trimPooledBuffer(*buffer);
+    buffer->resize(0);
+    threadBufferPool<QByteArray>().release(buffer);
+  }
+
+  return true;
 }
 
 
 CuteMessageLogger::~CuteMessageLogger()
 {
-  m_l->write(m_level, m_file, m_line, m_function, m_category, m_message);
+  QString& message = m_pooledMessage ? *m_pooledMessage : m_message;
+
+  if (m_suppressed)
+    message += QStringLiteral(" (%1 similar records suppressed)").arg(m_suppressed);
+
+  if (m_site && !m_fields.isEmpty())
+    m_l->write(*m_site, m_category, message, m_fields);
+  else if (m_site)
+    m_l->write(*m_site, m_category, message);
+  else
+    m_l->write(m_level, m_file, m_line, m_function, m_category, message);
+
+  if (m_pooledMessage)
+  {
+    trimPooledBuffer(*m_pooledMessage);
+    threadBufferPool<QString>().release(m_pooledMessage);
+  }
 }
 
+
+/**
+ * The message is formatted into the buffer reused by the records written from the current thread. The integer and the
+ * plain string conversions are formatted without the heap allocations, other formats fall back to QString::vasprintf().
+ */
 void CuteMessageLogger::write(const char* msg, ...)
 {
   va_list va;
   va_start(va, msg);
-  m_message = QString::vasprintf(msg, va);
+
+  if (!m_pooledMessage)
+    m_pooledMessage = threadBufferPool<QString>().acquire();
+
+  if (m_pooledMessage)
+  {
+    resetPooledBuffer(*m_pooledMessage);
+    if (!formatPrintf(*m_pooledMessage, msg, va))
+      *m_pooledMessage = QString::vasprintf(msg, va);
+  }
+  else
+  {
+    m_message = QString::vasprintf(msg, va);
+  }
+
   va_end(va);
 }
 
@@ -1092,8 +2926,275 @@ void CuteMessageLogger::write(const QString& msg)
 }
 
 
+/**
+ * The stream writes to the reused buffer of the current thread, but QDebug still allocates its own state for every
+ * record.
+ */
 QDebug CuteMessageLogger::write()
 {
+  if (!m_pooledMessage)
+    m_pooledMessage = threadBufferPool<QString>().acquire();
+
+  if (m_pooledMessage)
+  {
+    resetPooledBuffer(*m_pooledMessage);
+    QDebug d(m_pooledMessage);
+    return d;
+  }
+
   QDebug d(&m_message);
   return d;
 }
+
+
+/**
+ * \class LoggerRateLimiter
+ *
+ * \brief Lock-free state of the single rate limited logging macro call site.
+ *
+ * Every check function returns true if the record is to be written. The suppressed records are counted and the
+ * counter is taken (and reset) by the next written record, so it can mention how many records were suppressed.
+ *
+ * \sa LOG_INFO_EVERY_N(), LOG_INFO_FIRST_N(), LOG_INFO_EVERY_MS(), LOG_INFO_RATE()
+ */
+
+
+bool LoggerRateLimiter::suppress()
+{
+  m_suppressed.fetchAndAddRelaxed(1);
+  return false;
+}
+
+
+//! Allows the first record and then every \a n-th one.
+bool LoggerRateLimiter::everyN(int n)
+{
+  const qint64 count = m_state.fetchAndAddRelaxed(1);
+  return (n <= 1 || count % n == 0) ? true : suppress();
+}
+
+
+//! Allows the first \a n records only.
+bool LoggerRateLimiter::firstN(int n)
+{
+  // The counter is not modified when the limit is reached, so the call site doesn't stay contended forever
+  if (m_state.load() >= n || m_state.fetchAndAddRelaxed(1) >= n)
+    return suppress();
+
+  return true;
+}
+
+
+//! Allows at most one record in \a msecs milliseconds.
+bool LoggerRateLimiter::everyMs(int msecs)
+{
+  // Zero state means nothing was written yet
+  const qint64 now = monotonicNSecs() / 1000000 + 1;
+  const qint64 last = m_state.load();
+  if (last != 0 && now - last < msecs)
+    return suppress();
+
+  // Somebody else has written the record in between
+  if (!m_state.testAndSetRelaxed(last, now))
+    return suppress();
+
+  return true;
+}
+
+
+//! Allows \a perSecond records per second on average and at most \a burst records at once (token bucket).
+bool LoggerRateLimiter::rate(double perSecond, int burst)
+{
+  if (perSecond <= 0)
+    return suppress();
+
+  // Generic cell rate algorithm: the token bucket represented by a single timestamp, the theoretical arrival time of
+  // the next record
+  const qint64 interval = qint64(1e9 / perSecond);
+  const qint64 tolerance = interval * (qMax(burst, 1) - 1);
+  const qint64 now = monotonicNSecs();
+
+  qint64 arrival = m_state.load();
+  forever
+  {
+    const qint64 start = qMax(arrival, now);
+    if (start - now > tolerance)
+      return suppress();
+
+    if (m_state.testAndSetRelaxed(arrival, start + interval, arrival))
+      return true;
+  }
+}
+
+
+/**
+ * \class LogSite
+ *
+ * \brief Static metadata of the single logging macro call site.
+ *
+ * Every LOG_TRACE(), LOG_DEBUG() etc. macro (and their LOG_CTRACE() category counterparts) creates a static LogSite
+ * the first time the statement is executed. The site keeps the level, the source file, the line and the function of
+ * the statement, so they are not passed through the Logger and appenders one by one. The values derived from them,
+ * the file name without the directory and the stripped function name, are computed once per site and then reused by
+ * all the records (see AbstractAppender::appendSite()).
+ *
+ * All the sites are registered and may be enabled or disabled at runtime:
+ * \code
+ * // Silence a single chatty statement
+ * LogSite::setSitesEnabled("network/connection.cpp", 120, false);
+ *
+ * // ...or the whole file
+ * LogSite::setSitesEnabled("network/connection.cpp", 0, false);
+ * \endcode
+ *
+ * The arguments of the records written by the disabled sites are not evaluated.
+ *
+ * \note The category is not a part of the site: the category of LOG_CDEBUG() may be any expression, evaluated for
+ * every record. The literal category names are interned once per call site by LoggerCategoryCache.
+ */
+
+
+//! Constructs the call site and registers it.
+/**
+ * The \a file and \a function strings must stay valid until the site is destroyed (like the __FILE__ and Q_FUNC_INFO
+ * literals of the logging macros do for their static sites). The rules set by setSitesEnabled() before the site was
+ * constructed are applied to it.
+ */
+LogSite::LogSite(Logger::LogLevel level, const char* file, int line, const char* function)
+  : m_level(level),
+    m_file(file),
+    m_line(line),
+    m_function(function),
+    m_enabled(1)
+{
+  LogSiteRegistry* registry = logSiteRegistry();
+  QMutexLocker locker(&registry->mutex);
+
+  foreach (const LogSiteRule& rule, registry->rules)
+  {
+    if (logSiteMatches(this, rule.file, rule.line))
+      m_enabled.store(rule.enabled);
+  }
+
+  registry->sites.append(this);
+}
+
+
+//! Unregisters the call site.
+/**
+ * The static sites of a plugin are destroyed when it is unloaded, so registeredSites() and setSitesEnabled() never
+ * see the sites of the unloaded code.
+ */
+LogSite::~LogSite()
+{
+  {
+    LogSiteRegistry* registry = logSiteRegistry();
+    QMutexLocker locker(&registry->mutex);
+    // The static destructors run in the reverse order, so the site is usually the last one
+    const int index = registry->sites.lastIndexOf(this);
+    if (index >= 0)
+      registry->sites.removeAt(index);
+  }
+
+  // Reset, so the statement executed by the static destructors running later just computes the name again
+  delete m_functionName.fetchAndStoreOrdered(nullptr);
+}
+
+
+//! Returns the name of the source file without the directory.
+const char* LogSite::fileName() const
+{
+  const char* result = m_fileName.loadAcquire();
+  if (!result)
+  {
+    // Concurrent callers compute the same pointer, there's nothing to synchronize
+    result = m_file ? m_file : "";
+    for (const char* c = result; *c; ++c)
+    {
+      if (*c == '/' || *c == '\\')
+        result = c + 1;
+    }
+    m_fileName.storeRelease(result);
+  }
+
+  return result;
+}
+
+
+//! Returns the function name stripped by AbstractStringAppender::stripFunctionName().
+const QString& LogSite::functionName() const
+{
+  QString* result = m_functionName.loadAcquire();
+  if (!result)
+  {
+    // Stripped without the cache keyed by the function pointer, as the string is freed with the unloaded plugin
+    QString* name = new QString(AbstractStringAppender::stripFunctionName(m_function));
+    if (m_functionName.testAndSetOrdered(nullptr, name, result))
+      result = name;
+    else
+      delete name;
+  }
+
+  return *result;
+}
+
+
+//! Enables or disables writing the records from this call site.
+/**
+ * \note This function is thread safe.
+ *
+ * \sa setSitesEnabled()
+ */
+void LogSite::setEnabled(bool enabled)
+{
+  m_enabled.store(enabled);
+}
+
+
+//! Returns all the call sites executed so far.
+QList<LogSite*> LogSite::registeredSites()
+{
+  LogSiteRegistry* registry = logSiteRegistry();
+  QMutexLocker locker(&registry->mutex);
+  return registry->sites;
+}
+
+
+//! Enables or disables the call sites at the \a line of the source \a file.
+/**
+ * The \a file matches the sites which source file is the same or ends with the \a file following the directory
+ * separator. The \a line equal to zero (or negative) matches every line of the file.
+ *
+ * The setting is applied to the already registered sites and stored to also apply to the sites registered later, so
+ * it may be called before the statement is executed for the first time. The stored setting replaces the earlier one
+ * for the same \a file and \a line, and the setting for the whole file replaces the earlier ones of its lines.
+ *
+ * \note This function is thread safe.
+ */
+void LogSite::setSitesEnabled(const QString& file, int line, bool enabled)
+{
+  LogSiteRegistry* registry = logSiteRegistry();
+  QMutexLocker locker(&registry->mutex);
+
+  // Only the latest setting for the same file and line matters, and the whole file setting overrides the ones of its
+  // lines, so the number of the rules is limited by the number of the distinct patterns used
+  const int ruleLine = qMax(line, 0);
+  for (int i = registry->rules.size() - 1; i >= 0; --i)
+  {
+    const LogSiteRule& previous = registry->rules.at(i);
+    if (previous.file == file && (ruleLine == 0 || previous.line == ruleLine))
+      registry->rules.removeAt(i);
+  }
+
+  LogSiteRule rule;
+  rule.file = file;
+  rule.line = ruleLine;
+  rule.enabled = enabled;
+  registry->rules.append(rule);
+
+  foreach (LogSite* site, registry->sites)
+  {
+    if (logSiteMatches(site, file, line))
+      site->setEnabled(enabled);
+  }
+}
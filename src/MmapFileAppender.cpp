@@ -0,0 +1,404 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Local
+#include "MmapFileAppender.h"
+
+// Qt
+#include <QAtomicInteger>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QThread>
+
+// STL
+#include <cstring>
+#include <iostream>
+
+#if defined(Q_OS_UNIX)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+
+/**
+ * \class MmapFileAppender
+ *
+ * \brief MmapFileAppender writes the log records to the plain text file through the memory mapping.
+ *
+ * MmapFileAppender preallocates the region of the file (256 MB by default, see setRegionSize()) and maps it into the
+ * memory. The logging threads claim the space for the record with a single atomic operation and copy its UTF-8 text
+ * straight to the mapping, so there is neither a system call nor a lock per record. When the region is full, the next
+ * one is mapped right after the written data, and the writing back of the full one is started asynchronously.
+ *
+ * The records are appended to the existing file, like FileAppender does. When the file is closed it is truncated to the
+ * length of the written data, so it stays a plain text file. If maxFileSize() is set, the file is rolled over when it
+ * grows larger: it is renamed, getting the current date and time suffix (".yyyy-MM-dd-hh-mm-ss-zzz"), and the new
+ * file is started.
+ *
+ * \note The written records are visible to the other processes reading the file right away, but until the file is
+ * closed its size includes the preallocated zero-filled tail. The data survives the application crash, but not the
+ * crash of the operating system unless it was written back. The tail left by the crash is cut off when the file is
+ * opened again, so the new records follow the old ones.
+ *
+ * \sa FileAppender
+ */
+
+
+struct MmapFileAppender::Region
+{
+  uchar* data;
+  qint64 fileOffset;               //!< File offset of data[0]
+  qint64 size;
+  QAtomicInteger<qint64> claimed;  //!< Bytes claimed by the writers, including the ones that didn't fit
+  QAtomicInteger<qint64> used;     //!< Position of the first record that didn't fit
+  QAtomicInt writers;              //!< Writers that may be using the region right now
+};
+
+
+//! Constructs the new memory mapped file appender assigned to file with the given name.
+MmapFileAppender::MmapFileAppender(const QString& fileName)
+  : m_dataEnd(0),
+    m_regionSize(Q_INT64_C(256) * 1024 * 1024),
+    m_maxFileSize(0)
+{
+  // Writers only synchronize on the atomic region offset
+  setAppendSerialized(false);
+
+  setFileName(fileName);
+}
+
+
+//! Closes the file, truncating it to the length of the written data.
+MmapFileAppender::~MmapFileAppender()
+{
+  QMutexLocker locker(&m_fileMutex);
+  closeFile();
+
+  qDeleteAll(m_retiredRegions);
+}
+
+
+//! Returns the name set by setFileName() or to the MmapFileAppender constructor.
+/**
+ * \sa setFileName()
+ */
+QString MmapFileAppender::fileName() const
+{
+  QMutexLocker locker(&m_fileMutex);
+  return m_file.fileName();
+}
+
+
+//! Sets the name of the file. The name can have no path, a relative path, or an absolute path.
+/**
+ * The currently open file is closed.
+ *
+ * \sa fileName()
+ */
+void MmapFileAppender::setFileName(const QString& fileName)
+{
+  if (fileName.isEmpty())
+    std::cerr << "<MmapFileAppender::MmapFileAppender> File name is empty. The appender will do nothing" << std::endl;
+
+  QMutexLocker locker(&m_fileMutex);
+  closeFile();
+  m_file.setFileName(fileName);
+}
+
+
+//! Returns the size of the file region mapped at once.
+/**
+ * \sa setRegionSize()
+ */
+qint64 MmapFileAppender::regionSize() const
+{
+  QMutexLocker locker(&m_fileMutex);
+  return m_regionSize;
+}
+
+
+//! Sets the size of the file region preallocated and mapped at once.
+/**
+ * Default size is 256 MB. Smaller regions are recommended on the 32-bit systems, having the limited address space.
+ * The size change takes effect when the next region is mapped.
+ */
+void MmapFileAppender::setRegionSize(qint64 size)
+{
+  QMutexLocker locker(&m_fileMutex);
+  m_regionSize = qMax(size, qint64(64 * 1024));
+}
+
+
+//! Returns the size of the file the rollover is made after.
+/**
+ * \sa setMaxFileSize()
+ */
+qint64 MmapFileAppender::maxFileSize() const
+{
+  QMutexLocker locker(&m_fileMutex);
+  return m_maxFileSize;
+}
+
+
+//! Sets the size of the file the rollover is made after.
+/**
+ * Default value is 0, meaning the file is never rolled over.
+ */
+void MmapFileAppender::setMaxFileSize(qint64 size)
+{
+  QMutexLocker locker(&m_fileMutex);
+  m_maxFileSize = qMax(size, qint64(0));
+}
+
+
+//! Starts writing the current region data back to the file without waiting for it.
+/**
+ * The data copied to the mapping doesn't need any flushing to be seen by the file readers or to survive the
+ * application crash.
+ */
+bool MmapFileAppender::flush()
+{
+  QMutexLocker locker(&m_fileMutex);
+
+  Region* region = m_region.loadAcquire();
+  if (region)
+    syncRegion(region, qMin(region->claimed.loadAcquire(), region->size));
+
+  return true;
+}
+
+
+//! Copies the log record to the file mapping.
+/**
+ * \sa AbstractStringAppender::format()
+ */
+void MmapFileAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                              const char* function, const QString& category, const QString& message)
+{
+  FormatBuffer buffer;
+  QByteArray& record = buffer.bytes();
+  formatUtf8To(record, timeStamp, logLevel, file, line, function, nullptr, category, message);
+  const qint64 size = record.size();
+
+  forever
+  {
+    Region* region = m_region.loadAcquire();
+    if (region)
+    {
+      // Announce we're using the region before checking it is still the current one. Both the writers counter and
+      // the region pointer are modified with the ordered operations, so the thread replacing the region either sees
+      // us or we see the new region.
+      region->writers.ref();
+      if (m_region.loadAcquire() == region)
+      {
+        const qint64 position = region->claimed.fetchAndAddOrdered(size);
+        if (position + size <= region->size)
+        {
+          memcpy(region->data + position, record.constData(), size_t(size));
+          region->writers.deref();
+          addBytesWritten(quint64(size));
+          return;
+        }
+
+        // The region is full. The valid data ends at the first record that didn't fit
+        qint64 used = region->used.loadAcquire();
+        while (position < used && !region->used.testAndSetOrdered(used, position, used))
+        {}
+      }
+      region->writers.deref();
+    }
+
+    QMutexLocker locker(&m_fileMutex);
+    if (m_region.loadAcquire() == region && !switchRegion(size))
+      return;
+  }
+}
+
+
+// Should be called with the m_fileMutex locked
+bool MmapFileAppender::switchRegion(qint64 recordSize)
+{
+  if (m_region.loadAcquire())
+    retireRegion();
+  else if (!openFile())
+    return false;
+
+  if (m_maxFileSize > 0 && m_dataEnd > 0 && m_dataEnd + recordSize > m_maxFileSize)
+  {
+    rollOver();
+    if (!m_file.isOpen())
+      return false;
+  }
+
+  return mapRegion(recordSize);
+}
+
+
+// Should be called with the m_fileMutex locked
+void MmapFileAppender::retireRegion()
+{
+  Region* region = m_region.fetchAndStoreOrdered(nullptr);
+  if (!region)
+    return;
+
+  // No one is going to write to the region after this
+  while (region->writers.loadAcquire() > 0)
+    QThread::yieldCurrentThread();
+
+  const qint64 used = qMin(region->used.loadAcquire(), region->claimed.loadAcquire());
+  m_dataEnd = region->fileOffset + used;
+
+  syncRegion(region, used);
+  m_file.unmap(region->data);
+  region->data = nullptr;
+
+  // Late writers may still check the region fields, so it is deleted along with the appender
+  m_retiredRegions.append(region);
+}
+
+
+// Should be called with the m_fileMutex locked
+bool MmapFileAppender::mapRegion(qint64 recordSize)
+{
+  qint64 size = m_regionSize;
+  if (m_maxFileSize > 0)
+    size = qMin(size, m_maxFileSize - m_dataEnd);
+  size = qMax(size, recordSize);
+
+  const qint64 end = m_dataEnd + size;
+  if (m_file.size() < end)
+  {
+    bool allocated = false;
+#if defined(Q_OS_LINUX)
+    // Allocate the real disk blocks, so the writers wouldn't get SIGBUS when the disk is full
+    allocated = posix_fallocate(m_file.handle(), m_dataEnd, size) == 0;
+#endif
+    if (!allocated && !m_file.resize(end))
+    {
+      std::cerr << "<MmapFileAppender::append> Cannot extend the log file " << qPrintable(m_file.fileName()) << std::endl;
+      return false;
+    }
+  }
+
+  uchar* data = m_file.map(m_dataEnd, size);
+  if (!data)
+  {
+    std::cerr << "<MmapFileAppender::append> Cannot map the log file " << qPrintable(m_file.fileName()) << std::endl;
+    return false;
+  }
+
+  Region* region = new Region;
+  region->data = data;
+  region->fileOffset = m_dataEnd;
+  region->size = size;
+  region->claimed.storeRelease(0);
+  region->used.storeRelease(size);
+  region->writers.storeRelease(0);
+
+  m_region.fetchAndStoreOrdered(region);
+  return true;
+}
+
+
+// Returns the length of the file without the zero-filled tail. The text records don't end with the zero bytes, so only
+// the preallocated space the appender didn't write to before the crash is dropped.
+static qint64 dataLength(QFile& file)
+{
+  const int chunkSize = 64 * 1024;
+  QByteArray chunk(chunkSize, Qt::Uninitialized);
+
+  qint64 end = file.size();
+  while (end > 0)
+  {
+    const qint64 start = qMax(end - chunkSize, qint64(0));
+    const int length = int(end - start);
+    if (!file.seek(start) || file.read(chunk.data(), length) != length)
+      return file.size();
+
+    for (int i = length; i > 0; --i)
+    {
+      if (chunk.at(i - 1) != '\0')
+        return start + i;
+    }
+    end = start;
+  }
+
+  return 0;
+}
+
+
+// Should be called with the m_fileMutex locked
+bool MmapFileAppender::openFile()
+{
+  if (m_file.isOpen())
+    return true;
+
+  if (m_file.fileName().isEmpty())
+    return false;
+
+  if (!m_file.open(QIODevice::ReadWrite))
+  {
+    std::cerr << "<MmapFileAppender::append> Cannot open the log file " << qPrintable(m_file.fileName()) << std::endl;
+    return false;
+  }
+
+  m_dataEnd = dataLength(m_file);
+  if (m_dataEnd < m_file.size() && !m_file.resize(m_dataEnd))
+    m_dataEnd = m_file.size();
+  return true;
+}
+
+
+// Should be called with the m_fileMutex locked
+void MmapFileAppender::closeFile()
+{
+  retireRegion();
+
+  if (m_file.isOpen())
+  {
+    m_file.resize(m_dataEnd);
+    m_file.close();
+  }
+}
+
+
+// Should be called with the m_fileMutex locked
+void MmapFileAppender::rollOver()
+{
+  closeFile();
+
+  const QString targetFileName = m_file.fileName()
+                                 + QDateTime::currentDateTime().toString(QLatin1String("'.'yyyy-MM-dd-hh-mm-ss-zzz"));
+  if (!QFile::rename(m_file.fileName(), targetFileName))
+    std::cerr << "<MmapFileAppender::append> Cannot rename the log file to " << qPrintable(targetFileName) << std::endl;
+
+  openFile();
+}
+
+
+void MmapFileAppender::syncRegion(const Region* region, qint64 length)
+{
+#if defined(Q_OS_UNIX)
+  if (!region->data || length <= 0)
+    return;
+
+  // msync() needs the page aligned address, while the mapping may start in the middle of the page
+  static const quintptr pageSize = quintptr(sysconf(_SC_PAGESIZE));
+  const quintptr start = quintptr(region->data) & ~(pageSize - 1);
+  msync(reinterpret_cast<void*>(start), size_t(quintptr(region->data) - start + quintptr(length)), MS_ASYNC);
+#else
+  Q_UNUSED(region);
+  Q_UNUSED(length);
+#endif
+}
@@ -0,0 +1,697 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Local
+#include "NetworkAppender.h"
+
+#include "StripedCounter.h"
+
+// Qt
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QMutexLocker>
+#include <QScopedPointer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QUdpSocket>
+#include <QVector>
+
+
+/**
+ * \class NetworkAppender
+ *
+ * \brief NetworkAppender sends the log records to the remote log collector using the syslog or the GELF protocol.
+ *
+ * The records are sent straight to the collector (rsyslog, syslog-ng, Graylog, Logstash and the like), so there is no
+ * need to write the log file and to tail it. The wire format and the transport are selected by the Protocol passed to
+ * the constructor:
+ * - NetworkAppender::SyslogUdp and NetworkAppender::SyslogTcp send the RFC 5424 messages, the category of the record
+ *   is sent as the MSGID;
+ * - NetworkAppender::GelfUdp and NetworkAppender::GelfTcp send the GELF 1.1 messages with the file, line, function
+ *   and category of the record in the additional fields.
+ *
+ * \code
+ * cuteLogger->registerAppender(new NetworkAppender("logs.example.com", 12201, NetworkAppender::GelfTcp));
+ * \endcode
+ *
+ * The message text is formatted using the format() (see AbstractStringAppender::setFormat()), the default format is
+ * "<%{function}> %{message}" as the time and the level of the record are sent separately.
+ *
+ * The logging threads only encode the record and put it to the bounded in-memory spool, the records are sent from the
+ * dedicated I/O thread, so neither the slow nor the unavailable collector blocks the logging. The records are sent in
+ * batches: the whole batch is written to the TCP connection at once, while the UDP protocols send every record in its
+ * own datagram as the protocols require. When the connection fails the I/O thread keeps the records in the spool and
+ * reconnects with the exponential backoff (from 100 ms up to 30 seconds). The records which don't fit the spool are
+ * dropped and counted by droppedRecords(), as are the datagrams failed to be sent.
+ *
+ * \note The batch interrupted by the TCP connection failure is sent again after the reconnect, so the collector may
+ * receive some of its records twice.
+ *
+ * \note NetworkAppender is only built when QtNetwork is available.
+ *
+ * \sa AsyncAppender
+ */
+
+
+class NetworkAppenderThread : public QThread
+{
+  public:
+    explicit NetworkAppenderThread(NetworkAppender* appender)
+      : m_appender(appender)
+    {}
+
+  protected:
+    virtual void run()
+    {
+      m_appender->processSpool();
+    }
+
+  private:
+    NetworkAppender* m_appender;
+};
+
+
+namespace
+{
+  enum
+  {
+    MaxBatchSize = 256,
+    ConnectTimeout = 5000,
+    StopPollInterval = 50,
+    WriteTimeout = 10000,
+    FlushTimeout = 5000,
+    MinReconnectDelay = 100,
+    MaxReconnectDelay = 30000,
+    GelfChunkSize = 8192,
+    GelfChunkHeaderSize = 12,
+    GelfMaxChunks = 128
+  };
+
+
+  // RFC 5424 header fields are printable ASCII without spaces of the limited length, "-" stands for the empty one
+  QByteArray syslogField(const QString& value, int maxLength)
+  {
+    QByteArray result = value.toUtf8().left(maxLength);
+    for (int i = 0; i < result.size(); ++i)
+    {
+      if (uchar(result.at(i)) < 33 || uchar(result.at(i)) > 126)
+        result[i] = '_';
+    }
+    return result.isEmpty() ? QByteArray("-") : result;
+  }
+
+
+  // QByteArray::number() has no zero padding
+  void appendPadded(QByteArray& result, qint64 value, int width)
+  {
+    const QByteArray digits = QByteArray::number(value);
+    for (int i = digits.size(); i < width; ++i)
+      result.append('0');
+    result.append(digits);
+  }
+
+
+  void chopNewLines(QByteArray& result, int start)
+  {
+    int size = result.size();
+    while (size > start && (result.at(size - 1) == '\n' || result.at(size - 1) == '\r'))
+      --size;
+    result.truncate(size);
+  }
+
+
+  QHostAddress resolveHost(const QString& host)
+  {
+    QHostAddress address;
+    if (address.setAddress(host))
+      return address;
+
+    const QList<QHostAddress> addresses = QHostInfo::fromName(host).addresses();
+    return addresses.isEmpty() ? QHostAddress() : addresses.first();
+  }
+
+
+  bool writeStream(QTcpSocket* socket, const QList<QByteArray>& frames)
+  {
+    QByteArray data;
+    for (const QByteArray& frame : frames)
+      data.append(frame);
+
+    if (socket->write(data) != data.size())
+      return false;
+
+    while (socket->bytesToWrite() > 0)
+    {
+      if (!socket->waitForBytesWritten(WriteTimeout))
+        return false;
+    }
+
+    return socket->state() == QAbstractSocket::ConnectedState;
+  }
+
+
+  // GELF datagrams longer than the chunk size are split to the chunks sharing the same message id
+  bool writeGelfChunks(QUdpSocket* socket, const QByteArray& frame, const QHostAddress& address, quint16 port)
+  {
+    const int chunkDataSize = GelfChunkSize - GelfChunkHeaderSize;
+    const int chunks = (frame.size() + chunkDataSize - 1) / chunkDataSize;
+    if (chunks > GelfMaxChunks)
+      return false;
+
+    static QAtomicInteger<quint64> messageCounter;
+    const quint64 messageId = (quint64(QCoreApplication::applicationPid()) << 40) ^ quint64(monotonicNSecs())
+                              ^ messageCounter.fetchAndAddRelaxed(1);
+
+    QByteArray chunk;
+    chunk.reserve(GelfChunkSize);
+    for (int i = 0; i < chunks; ++i)
+    {
+      chunk.resize(0);
+      chunk.append(char(0x1e));
+      chunk.append(char(0x0f));
+      for (int byte = 7; byte >= 0; --byte)
+        chunk.append(char((messageId >> (byte * 8)) & 0xff));
+      chunk.append(char(i));
+      chunk.append(char(chunks));
+      chunk.append(frame.constData() + i * chunkDataSize, qMin(chunkDataSize, frame.size() - i * chunkDataSize));
+
+      if (socket->writeDatagram(chunk, address, port) < 0)
+        return false;
+    }
+
+    return true;
+  }
+}
+
+
+//! Constructs the appender sending the records to the collector at the \a host and \a port using the \a protocol.
+/**
+ * The \a host is either the address or the host name, the name is resolved by the I/O thread every time it connects.
+ * The \a spoolSize is the maximum total size of the encoded records waiting to be sent, in bytes.
+ */
+NetworkAppender::NetworkAppender(const QString& host, quint16 port, Protocol protocol, int spoolSize)
+  : m_host(host),
+    m_port(port),
+    m_protocol(protocol),
+    m_spoolSize(spoolSize),
+    m_facility(1),
+    m_thread(nullptr),
+    m_spoolBytes(0),
+    m_spooled(0),
+    m_processed(0),
+    m_stopRequested(false)
+{
+  setFormat(QLatin1String("<%{function}> %{message}"));
+
+  m_syslogIdentity.append(' ');
+  m_syslogIdentity.append(syslogField(QHostInfo::localHostName(), 255));
+  m_syslogIdentity.append(' ');
+  m_syslogIdentity.append(syslogField(QCoreApplication::applicationName(), 48));
+  m_syslogIdentity.append(' ');
+  m_syslogIdentity.append(QByteArray::number(QCoreApplication::applicationPid()));
+  m_syslogIdentity.append(' ');
+
+  m_gelfIdentity = "\"version\":\"1.1\",\"host\":";
+  appendJsonString(m_gelfIdentity, QHostInfo::localHostName());
+  m_gelfIdentity += ",\"_application\":";
+  appendJsonString(m_gelfIdentity, QCoreApplication::applicationName());
+  m_gelfIdentity += ",\"_pid\":";
+  m_gelfIdentity += QByteArray::number(QCoreApplication::applicationPid());
+  m_gelfIdentity += ',';
+
+  // The records are only encoded and spooled, the spool has its own lock
+  setAppendSerialized(false);
+
+  m_thread = new NetworkAppenderThread(this);
+  m_thread->start();
+}
+
+
+//! Sends the spooled records if the collector is available and stops the I/O thread.
+/**
+ * The connection attempt and the reconnect delay in progress are interrupted, so the destructor doesn't wait for the
+ * unreachable collector. The records which can't be sent are dropped.
+ */
+NetworkAppender::~NetworkAppender()
+{
+  {
+    QMutexLocker locker(&m_spoolMutex);
+    m_stopRequested = true;
+    m_wakeCondition.wakeAll();
+  }
+
+  m_thread->wait();
+  delete m_thread;
+}
+
+
+//! Returns the host of the collector.
+QString NetworkAppender::host() const
+{
+  return m_host;
+}
+
+
+//! Returns the port of the collector.
+quint16 NetworkAppender::port() const
+{
+  return m_port;
+}
+
+
+//! Returns the wire format and the transport used to send the records.
+NetworkAppender::Protocol NetworkAppender::protocol() const
+{
+  return m_protocol;
+}
+
+
+//! Returns the maximum total size of the records waiting to be sent, in bytes.
+int NetworkAppender::spoolSize() const
+{
+  return m_spoolSize;
+}
+
+
+//! Returns the syslog facility of the records.
+/**
+ * \sa setFacility()
+ */
+int NetworkAppender::facility() const
+{
+  return m_facility.loadAcquire();
+}
+
+
+//! Sets the syslog \a facility code (0..23) of the records.
+/**
+ * Default facility is 1 (user-level messages). The facility is only sent with the syslog protocols.
+ *
+ * \note This function is thread safe.
+ */
+void NetworkAppender::setFacility(int facility)
+{
+  m_facility.storeRelease(qBound(0, facility, 23));
+}
+
+
+//! Returns the number of the records dropped because of the spool overflow or failed to be sent.
+quint64 NetworkAppender::droppedRecords() const
+{
+  return m_dropped.loadAcquire();
+}
+
+
+//! Returns true if the last attempt to connect or to send the records to the collector has failed.
+bool NetworkAppender::isCollectorDown() const
+{
+  return m_collectorDown.loadAcquire();
+}
+
+
+//! Waits until the records spooled before the call are sent.
+/**
+ * The wait is limited by five seconds and is skipped at all while the collector is down, so the application being
+ * aborted by the Logger::Fatal record is not delayed by the unavailable collector. Returns false if some of the records
+ * are still not sent.
+ *
+ * \note This function is thread safe.
+ */
+bool NetworkAppender::flush()
+{
+  const qint64 start = monotonicNSecs();
+
+  QMutexLocker locker(&m_spoolMutex);
+  const quint64 target = m_spooled;
+
+  // The collector failure may be logged from the I/O thread itself, it can't wait for itself
+  if (QThread::currentThread() != m_thread)
+  {
+    QElapsedTimer timer;
+    timer.start();
+    while (m_processed < target && !m_collectorDown.loadAcquire() && !timer.hasExpired(FlushTimeout))
+      m_sentCondition.wait(&m_spoolMutex, 100);
+  }
+
+  const bool result = m_processed >= target;
+  locker.unlock();
+
+  addFlushTime(quint64(monotonicNSecs() - start));
+  return result;
+}
+
+
+//! Returns the syslog severity of the \a logLevel.
+int NetworkAppender::syslogSeverity(Logger::LogLevel logLevel)
+{
+  switch (logLevel)
+  {
+    case Logger::Trace:
+    case Logger::Debug:
+      return 7;
+    case Logger::Info:
+      return 6;
+    case Logger::Warning:
+      return 4;
+    case Logger::Error:
+      return 3;
+    case Logger::Fatal:
+      return 2;
+  }
+
+  // Just in case
+  return 5;
+}
+
+
+//! Encodes the log record and puts it to the spool.
+/**
+ * \sa AbstractAppender::append()
+ */
+void NetworkAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                             const char* function, const QString& category, const QString& message)
+{
+  const LogFields* fields = recordFields();
+  const LogRecord record = { timeStamp, logLevel, file, line, function, nullptr, category, message,
+                             fields ? *fields : LogFields() };
+
+  QByteArray frame;
+  encodeRecord(frame, record);
+  spool(&frame, 1);
+}
+
+
+/**
+ * All the records are encoded first and then put to the spool, so the spool lock is taken only once.
+ *
+ * \sa AbstractAppender::appendBatch()
+ */
+void NetworkAppender::appendBatch(const LogRecord* records, size_t count)
+{
+  QVector<QByteArray> frames;
+  frames.resize(int(count));
+  for (size_t i = 0; i < count; ++i)
+    encodeRecord(frames[int(i)], records[i]);
+
+  spool(frames.constData(), frames.size());
+}
+
+
+//! Reports the spooled records and the records dropped.
+void NetworkAppender::updateStatistics(AppenderStatistics& statistics) const
+{
+  QMutexLocker locker(&m_spoolMutex);
+  statistics.queueDepth = qint64(m_spooled - m_processed);
+  statistics.dropped = m_dropped.loadAcquire();
+}
+
+
+// Encodes the record to the frame sent to the collector as is
+void NetworkAppender::encodeRecord(QByteArray& result, const LogRecord& record) const
+{
+  switch (m_protocol)
+  {
+    case SyslogUdp:
+      encodeSyslog(result, record);
+      break;
+
+    case SyslogTcp:
+      encodeSyslog(result, record);
+      result.prepend(QByteArray::number(result.size()) + ' ');
+      break;
+
+    case GelfUdp:
+      encodeGelf(result, record);
+      break;
+
+    case GelfTcp:
+      encodeGelf(result, record);
+      result.append('\0');
+      break;
+  }
+}
+
+
+// <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID - MSG
+void NetworkAppender::encodeSyslog(QByteArray& result, const LogRecord& record) const
+{
+  const QDateTime utc = record.timeStamp.toUTC();
+  const QDate date = utc.date();
+  const QTime time = utc.time();
+
+  result.append('<');
+  result.append(QByteArray::number(m_facility.loadAcquire() * 8 + syslogSeverity(record.logLevel)));
+  result.append(">1 ", 3);
+  appendPadded(result, date.year(), 4);
+  result.append('-');
+  appendPadded(result, date.month(), 2);
+  result.append('-');
+  appendPadded(result, date.day(), 2);
+  result.append('T');
+  appendPadded(result, time.hour(), 2);
+  result.append(':');
+  appendPadded(result, time.minute(), 2);
+  result.append(':');
+  appendPadded(result, time.second(), 2);
+  result.append('.');
+  appendPadded(result, time.msec(), 3);
+  result.append('Z');
+
+  result.append(m_syslogIdentity);
+  result.append(syslogField(record.category, 32));
+  result.append(" - ", 3);
+
+  const int messageStart = result.size();
+  formatUtf8To(result, record);
+  chopNewLines(result, messageStart);
+}
+
+
+void NetworkAppender::encodeGelf(QByteArray& result, const LogRecord& record) const
+{
+  const qint64 msecs = record.timeStamp.toMSecsSinceEpoch();
+
+  result.append('{');
+  result.append(m_gelfIdentity);
+
+  result.append("\"short_message\":");
+  {
+    FormatBuffer buffer;
+    QString& text = buffer.string();
+    formatTo(text, record);
+    int size = text.size();
+    while (size > 0 && (text.at(size - 1) == QLatin1Char('\n') || text.at(size - 1) == QLatin1Char('\r')))
+      --size;
+    text.truncate(size);
+    appendJsonString(result, text);
+  }
+
+  result.append(",\"timestamp\":");
+  result.append(QByteArray::number(msecs / 1000));
+  result.append('.');
+  appendPadded(result, qAbs(msecs % 1000), 3);
+
+  result.append(",\"level\":");
+  result.append(QByteArray::number(syslogSeverity(record.logLevel)));
+  result.append(",\"_file\":");
+  appendJsonString(result, record.file);
+  result.append(",\"_line\":");
+  result.append(QByteArray::number(record.line));
+  result.append(",\"_function\":");
+  appendJsonString(result, record.function);
+  if (!record.category.isEmpty())
+  {
+    result.append(",\"_category\":");
+    appendJsonString(result, record.category);
+  }
+  result.append('}');
+}
+
+
+void NetworkAppender::spool(const QByteArray* frames, int count)
+{
+  QMutexLocker locker(&m_spoolMutex);
+  const bool wasEmpty = m_spool.isEmpty();
+
+  for (int i = 0; i < count; ++i)
+  {
+    if (m_spoolBytes + frames[i].size() > m_spoolSize)
+    {
+      m_dropped.fetchAndAddRelaxed(1);
+      continue;
+    }
+
+    m_spool.append(frames[i]);
+    m_spoolBytes += frames[i].size();
+    ++m_spooled;
+  }
+
+  // The I/O thread only sleeps on the empty spool, otherwise it is busy sending or waiting to reconnect
+  if (wasEmpty && !m_spool.isEmpty())
+    m_wakeCondition.wakeOne();
+}
+
+
+bool NetworkAppender::isStopRequested() const
+{
+  QMutexLocker locker(&m_spoolMutex);
+  return m_stopRequested;
+}
+
+
+// Works like QAbstractSocket::waitForConnected(ConnectTimeout), but gives up as soon as the appender is destroyed, so
+// the destructor doesn't wait for the unreachable collector. Runs in the I/O thread.
+bool NetworkAppender::waitForConnected(QTcpSocket* socket) const
+{
+  const QAbstractSocket::SocketState state = socket->state();
+  if (state == QAbstractSocket::ConnectedState || state == QAbstractSocket::UnconnectedState)
+    return state == QAbstractSocket::ConnectedState;
+
+  QEventLoop loop;
+  QObject::connect(socket, &QAbstractSocket::stateChanged, &loop, [&loop](QAbstractSocket::SocketState state) {
+    if (state == QAbstractSocket::ConnectedState || state == QAbstractSocket::UnconnectedState)
+      loop.quit();
+  });
+
+  QElapsedTimer timer;
+  timer.start();
+  QTimer poll;
+  poll.setInterval(StopPollInterval);
+  QObject::connect(&poll, &QTimer::timeout, &loop, [this, &loop, &timer]() {
+    if (timer.hasExpired(ConnectTimeout) || isStopRequested())
+      loop.quit();
+  });
+  poll.start();
+
+  loop.exec();
+  return socket->state() == QAbstractSocket::ConnectedState;
+}
+
+
+// Runs in the I/O thread, the sockets are created and used by this thread only
+void NetworkAppender::processSpool()
+{
+  const bool stream = m_protocol == SyslogTcp || m_protocol == GelfTcp;
+
+  QScopedPointer<QTcpSocket> tcpSocket;
+  QScopedPointer<QUdpSocket> udpSocket;
+  QHostAddress address;
+  int reconnectDelay = MinReconnectDelay;
+
+  forever
+  {
+    QList<QByteArray> batch;
+    {
+      QMutexLocker locker(&m_spoolMutex);
+      while (m_spool.isEmpty() && !m_stopRequested)
+        m_wakeCondition.wait(&m_spoolMutex);
+
+      if (m_spool.isEmpty())
+        break;
+
+      // Frames are implicitly shared, the spool keeps them until they are sent
+      batch = m_spool.mid(0, MaxBatchSize);
+    }
+
+    // Connect to the collector if needed
+    bool ready = false;
+    if (stream)
+    {
+      if (!tcpSocket || tcpSocket->state() != QAbstractSocket::ConnectedState)
+      {
+        tcpSocket.reset(new QTcpSocket);
+        tcpSocket->connectToHost(m_host, m_port);
+        if (waitForConnected(tcpSocket.data()))
+          tcpSocket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+      }
+      ready = tcpSocket->state() == QAbstractSocket::ConnectedState;
+    }
+    else
+    {
+      if (!udpSocket)
+        udpSocket.reset(new QUdpSocket);
+      if (address.isNull())
+        address = resolveHost(m_host);
+      ready = !address.isNull();
+    }
+
+    // Send the batch
+    quint64 dropped = 0;
+    qint64 bytes = 0;
+    if (ready)
+    {
+      if (stream)
+      {
+        ready = writeStream(tcpSocket.data(), batch);
+      }
+      else
+      {
+        for (const QByteArray& frame : batch)
+        {
+          bool sent = false;
+          if (m_protocol == GelfUdp && frame.size() > GelfChunkSize)
+            sent = writeGelfChunks(udpSocket.data(), frame, address, m_port);
+          else
+            sent = udpSocket->writeDatagram(frame, address, m_port) == frame.size();
+
+          if (!sent)
+            ++dropped;
+        }
+      }
+    }
+
+    if (ready)
+    {
+      for (const QByteArray& frame : batch)
+        bytes += frame.size();
+      addBytesWritten(quint64(bytes));
+      if (dropped)
+        m_dropped.fetchAndAddRelaxed(dropped);
+
+      m_collectorDown.storeRelease(0);
+      reconnectDelay = MinReconnectDelay;
+
+      QMutexLocker locker(&m_spoolMutex);
+      for (int i = 0; i < batch.size(); ++i)
+        m_spool.removeFirst();
+      m_spoolBytes -= bytes;
+      m_processed += quint64(batch.size());
+      m_sentCondition.wakeAll();
+      continue;
+    }
+
+    // The collector is unavailable, keep the records in the spool and retry later
+    tcpSocket.reset();
+    address = QHostAddress();
+    m_collectorDown.storeRelease(1);
+
+    QMutexLocker locker(&m_spoolMutex);
+    m_sentCondition.wakeAll();
+    if (m_stopRequested)
+    {
+      m_dropped.fetchAndAddRelaxed(quint64(m_spool.size()));
+      m_processed += quint64(m_spool.size());
+      m_spool.clear();
+      m_spoolBytes = 0;
+      break;
+    }
+
+    m_wakeCondition.wait(&m_spoolMutex, ulong(reconnectDelay));
+    reconnectDelay = qMin(reconnectDelay * 2, int(MaxReconnectDelay));
+  }
+}
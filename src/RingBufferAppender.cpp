@@ -0,0 +1,660 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Local
+#include "RingBufferAppender.h"
+#include "Utf8Encoder.h"
+
+// Qt
+#include <QDateTime>
+#include <QMutexLocker>
+
+// STL
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <new>
+
+#if defined(Q_OS_WIN)
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+
+
+/**
+ * \class RingBufferAppender
+ *
+ * \brief RingBufferAppender keeps the most recent log records in memory and writes them out only when needed.
+ *
+ * RingBufferAppender is a flight recorder: the records are copied into a preallocated ring of fixed-size slots,
+ * overwriting the oldest ones, so the detailed context of the last moments is always available without paying for the
+ * I/O. The ring is written out:
+ * - to the dumpAppender() when the Logger::Fatal record (including the failed LOG_ASSERT()) comes, before the
+ *   application is aborted;
+ * - when dump() is called;
+ * - to the file descriptor passed to installCrashHandler() when the application crashes.
+ *
+ * \code
+ * RingBufferAppender* recorder = new RingBufferAppender(new FileAppender("postmortem.log"));
+ * cuteLogger->registerAppender(recorder);
+ * RingBufferAppender::installCrashHandler();
+ * \endcode
+ *
+ * The details level of RingBufferAppender is Logger::Trace. Note that the LOG_TRACE() records are built as long as any
+ * appender accepts them (see Logger::isEnabledFor()), so the gate of the other appenders doesn't help here.
+ *
+ * Writing a record takes no locks: the position in the ring is claimed with a single atomic increment and the slot is
+ * protected by its sequence number (a seqlock), so the dump never blocks the writers and may be done from a signal
+ * handler. A writer finding its slot still being written by another thread a whole ring ago drops the record, these
+ * are counted by droppedRecords(). The category and the message are stored as UTF-8 and truncated to fit the slot.
+ *
+ * RingBufferAppender takes ownership of the dump appender, so it must not be registered in Logger by itself.
+ *
+ * \sa AsyncAppender
+ */
+
+
+// Slot header, followed by the category and the message in the UTF-8 encoding. The sequence is odd while the record
+// of the position (sequence - 1) / 2 is written and even when the record of the position sequence / 2 - 1 is complete.
+struct RingBufferAppender::Slot
+{
+  Slot()
+    : timeStamp(0),
+      file(nullptr),
+      function(nullptr),
+      line(0),
+      logLevel(0),
+      categorySize(0),
+      messageSize(0)
+  {}
+
+  QAtomicInteger<quint64> sequence;
+  qint64 timeStamp;
+  const char* file;
+  const char* function;
+  qint32 line;
+  qint32 logLevel;
+  quint16 categorySize;
+  quint16 messageSize;
+
+  const char* text() const { return reinterpret_cast<const char*>(this + 1); }
+  char* text() { return reinterpret_cast<char*>(this + 1); }
+};
+
+
+namespace
+{
+  enum
+  {
+    MinRecordSize = 64,
+    MaxRecordSize = 4096,
+    MaxCrashRings = 16
+  };
+
+  // Rings dumped by the crash handler. Fixed array, so the handler may walk it without locking.
+  QAtomicPointer<RingBufferAppender> crashRings[MaxCrashRings];
+  QAtomicInt crashDumpFd(2);
+  QAtomicInt crashHandlerInstalled(0);
+
+  const int crashSignals[] = {
+    SIGSEGV,
+#if defined(SIGBUS)
+    SIGBUS,
+#endif
+    SIGILL,
+    SIGFPE,
+    SIGABRT
+  };
+
+  enum { CrashSignalCount = int(sizeof(crashSignals) / sizeof(crashSignals[0])) };
+
+  int crashSignalIndex(int signalNumber)
+  {
+    for (int i = 0; i < CrashSignalCount; ++i)
+    {
+      if (crashSignals[i] == signalNumber)
+        return i;
+    }
+    return -1;
+  }
+
+#if defined(Q_OS_UNIX)
+  // The dump takes about 13 KB of the stack, so it is done on the own stack, the overflowed one may have no room left
+  enum { CrashStackSize = 64 * 1024 };
+  char crashStack[CrashStackSize];
+
+  // Dispositions replaced by installCrashHandler(), the crash is passed to them after the dump
+  struct sigaction previousCrashActions[CrashSignalCount];
+
+  void chainCrashSignal(int signalNumber, siginfo_t* info, void* context)
+  {
+    const int index = crashSignalIndex(signalNumber);
+    if (index < 0)
+      return;
+
+    // Once the handler returns, the signal still blocked by it (or the repeated fault) comes to the old disposition
+    const struct sigaction& previous = previousCrashActions[index];
+    sigaction(signalNumber, &previous, nullptr);
+
+    if (previous.sa_flags & SA_SIGINFO)
+    {
+      if (previous.sa_sigaction)
+        previous.sa_sigaction(signalNumber, info, context);
+    }
+    else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+    {
+      previous.sa_handler(signalNumber);
+    }
+    else
+    {
+      raise(signalNumber);
+    }
+  }
+#else
+  typedef void (*SignalHandler)(int);
+  SignalHandler previousCrashHandlers[CrashSignalCount];
+
+  void chainCrashSignal(int signalNumber)
+  {
+    const int index = crashSignalIndex(signalNumber);
+    if (index < 0)
+      return;
+
+    const SignalHandler previous = previousCrashHandlers[index];
+    std::signal(signalNumber, previous);
+
+    if (previous != SIG_DFL && previous != SIG_IGN && previous != SIG_ERR)
+      previous(signalNumber);
+    else
+      std::raise(signalNumber);
+  }
+#endif
+
+
+  // Line of the crash dump, formatted without the heap allocations or the locale so it is async-signal-safe
+  class DumpLine
+  {
+    public:
+      DumpLine()
+        : m_size(0)
+      {}
+
+      void append(const char* data, int size)
+      {
+        size = qMin(size, int(sizeof(m_data)) - m_size);
+        if (size <= 0)
+          return;
+        std::memcpy(m_data + m_size, data, size_t(size));
+        m_size += size;
+      }
+
+      void append(const char* string)
+      {
+        if (string)
+          append(string, int(std::strlen(string)));
+      }
+
+      void appendNumber(qint64 value, int width)
+      {
+        char digits[24];
+        int count = 0;
+        const bool negative = value < 0;
+        quint64 magnitude = negative ? quint64(-(value + 1)) + 1 : quint64(value);
+        do
+        {
+          digits[sizeof(digits) - 1 - count++] = char('0' + magnitude % 10);
+          magnitude /= 10;
+        } while (magnitude && count < int(sizeof(digits)) - 1);
+
+        while (count < width && count < int(sizeof(digits)) - 1)
+          digits[sizeof(digits) - 1 - count++] = '0';
+        if (negative)
+          append("-", 1);
+        append(digits + sizeof(digits) - count, count);
+      }
+
+      // ISO 8601 UTC time, the local time zone can't be obtained safely from a signal handler
+      void appendTimeStamp(qint64 msecs)
+      {
+        qint64 days = msecs / 86400000;
+        qint64 dayMs = msecs % 86400000;
+        if (dayMs < 0)
+        {
+          dayMs += 86400000;
+          --days;
+        }
+
+        // Civil date from the days since the epoch (H. Hinnant's algorithm)
+        days += 719468;
+        const qint64 era = (days >= 0 ? days : days - 146096) / 146097;
+        const qint64 dayOfEra = days - era * 146097;
+        const qint64 yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        const qint64 dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        const qint64 monthIndex = (5 * dayOfYear + 2) / 153;
+        const qint64 day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+        const qint64 month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+        const qint64 year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+
+        appendNumber(year, 4);
+        append("-", 1);
+        appendNumber(month, 2);
+        append("-", 1);
+        appendNumber(day, 2);
+        append("T", 1);
+        appendNumber(dayMs / 3600000, 2);
+        append(":", 1);
+        appendNumber(dayMs / 60000 % 60, 2);
+        append(":", 1);
+        appendNumber(dayMs / 1000 % 60, 2);
+        append(".", 1);
+        appendNumber(dayMs % 1000, 3);
+        append("Z", 1);
+      }
+
+      void writeTo(int fd) const
+      {
+        const char* data = m_data;
+        int size = m_size;
+        while (size > 0)
+        {
+#if defined(Q_OS_WIN)
+          const int written = _write(fd, data, unsigned(size));
+#else
+          const ssize_t written = ::write(fd, data, size_t(size));
+#endif
+          if (written < 0 && errno == EINTR)
+            continue;
+          if (written <= 0)
+            return;
+          data += written;
+          size -= int(written);
+        }
+      }
+
+    private:
+      char m_data[MaxRecordSize + 512];
+      int m_size;
+  };
+
+
+  const char* fileName(const char* file)
+  {
+    if (!file)
+      return "";
+
+    const char* result = file;
+    for (const char* p = file; *p; ++p)
+    {
+      if (*p == '/' || *p == '\\')
+        result = p + 1;
+    }
+    return result;
+  }
+
+
+  const char* levelName(int logLevel)
+  {
+    static const char* const names[] = { "Trace  ", "Debug  ", "Info   ", "Warning", "Error  ", "Fatal  " };
+    return logLevel >= 0 && logLevel <= Logger::Fatal ? names[logLevel] : "Unknown";
+  }
+}
+
+
+//! Constructs the ring of \a capacity records of \a recordSize bytes, dumped to the \a dumpAppender.
+/**
+ * The \a capacity is rounded up to the power of two. The \a recordSize includes about 40 bytes of the record header
+ * and is limited to 64..4096 bytes, the longer messages are truncated. All the memory is allocated here.
+ *
+ * Without the dump appender the records are dumped to the standard error output.
+ */
+RingBufferAppender::RingBufferAppender(AbstractAppender* dumpAppender, int capacity, int recordSize)
+  : m_dumpAppender(dumpAppender)
+{
+  quint64 slotCount = 2;
+  while (slotCount < quint64(capacity))
+    slotCount <<= 1;
+  m_mask = slotCount - 1;
+
+  // Slot headers have to stay aligned
+  m_recordSize = qBound(int(MinRecordSize), recordSize, int(MaxRecordSize));
+  m_recordSize = (m_recordSize + int(alignof(Slot)) - 1) & ~(int(alignof(Slot)) - 1);
+  m_recordSize = qMax(m_recordSize, int(sizeof(Slot)) + 16);
+
+  m_storage = new char[slotCount * quint64(m_recordSize)];
+  for (quint64 i = 0; i < slotCount; ++i)
+    new (m_storage + i * quint64(m_recordSize)) Slot;
+
+  setDetailsLevel(Logger::Trace);
+
+  // The slots are claimed by the lock-free code, there is no need to hold the append() mutex
+  setAppendSerialized(false);
+
+  for (QAtomicPointer<RingBufferAppender>& ring : crashRings)
+  {
+    if (ring.testAndSetOrdered(nullptr, this))
+      break;
+  }
+}
+
+
+//! Destroys the ring and the dump appender. The records are not dumped.
+RingBufferAppender::~RingBufferAppender()
+{
+  for (QAtomicPointer<RingBufferAppender>& ring : crashRings)
+    ring.testAndSetOrdered(this, nullptr);
+
+  delete m_dumpAppender.loadAcquire();
+  delete[] m_storage;
+}
+
+
+//! Returns the maximum number of the records kept in memory.
+int RingBufferAppender::capacity() const
+{
+  return int(m_mask + 1);
+}
+
+
+//! Returns the size of the slot for the single record, in bytes.
+int RingBufferAppender::recordSize() const
+{
+  return m_recordSize;
+}
+
+
+//! Returns the appender the records are dumped to.
+AbstractAppender* RingBufferAppender::dumpAppender() const
+{
+  return m_dumpAppender.loadAcquire();
+}
+
+
+//! Sets the appender the records are dumped to, destroying the previous one.
+/**
+ * Null \a appender makes dump() write to the standard error output.
+ *
+ * \note This function is thread safe.
+ */
+void RingBufferAppender::setDumpAppender(AbstractAppender* appender)
+{
+  QMutexLocker locker(&m_dumpMutex);
+  delete m_dumpAppender.fetchAndStoreOrdered(appender);
+}
+
+
+//! Returns the number of the records dropped because their slot was still being written.
+quint64 RingBufferAppender::droppedRecords() const
+{
+  return m_dropped.loadAcquire();
+}
+
+
+//! Writes the records kept in memory to the dumpAppender(), oldest first.
+/**
+ * The ring is not cleared by the dump.
+ *
+ * \note This function is thread safe, the records are being written to the ring while it is dumped.
+ */
+void RingBufferAppender::dump()
+{
+  QMutexLocker locker(&m_dumpMutex);
+
+  AbstractAppender* appender = m_dumpAppender.loadAcquire();
+  if (appender)
+    dump(appender);
+  else
+    dumpTo(2);
+}
+
+
+//! Writes the records kept in memory to the \a appender, oldest first.
+void RingBufferAppender::dump(AbstractAppender* appender)
+{
+  quint64 buffer[MaxRecordSize / sizeof(quint64)];
+  Slot* copy = reinterpret_cast<Slot*>(buffer);
+
+  const quint64 head = m_head.loadAcquire();
+  for (quint64 position = firstPosition(head); position < head; ++position)
+  {
+    if (!readSlot(position, copy))
+      continue;
+
+    const char* text = copy->text();
+    appender->write(QDateTime::fromMSecsSinceEpoch(copy->timeStamp), Logger::LogLevel(copy->logLevel), copy->file,
+                    copy->line, copy->function, QString::fromUtf8(text, copy->categorySize),
+                    QString::fromUtf8(text + copy->categorySize, copy->messageSize));
+  }
+
+  appender->flush();
+}
+
+
+//! Writes the records kept in memory to the file descriptor \a fd, oldest first.
+/**
+ * The records are written as the lines of text in the fixed format with the UTC timestamps:
+ * \code
+ * 2010-12-17T17:20:01.005Z [Debug  ] main.cpp:42 <int main(int, char**)> [category] Message
+ * \endcode
+ *
+ * \note This function is async-signal-safe: it makes no heap allocations and takes no locks.
+ */
+void RingBufferAppender::dumpTo(int fd)
+{
+  quint64 buffer[MaxRecordSize / sizeof(quint64)];
+  Slot* copy = reinterpret_cast<Slot*>(buffer);
+
+  const quint64 head = m_head.loadAcquire();
+  const quint64 first = firstPosition(head);
+
+  DumpLine header;
+  header.append("--- Ring buffer dump: ");
+  header.appendNumber(qint64(head - first), 1);
+  header.append(" records ---\n");
+  header.writeTo(fd);
+
+  for (quint64 position = first; position < head; ++position)
+  {
+    if (!readSlot(position, copy))
+      continue;
+
+    DumpLine line;
+    line.appendTimeStamp(copy->timeStamp);
+    line.append(" [", 2);
+    line.append(levelName(copy->logLevel));
+    line.append("] ", 2);
+    line.append(fileName(copy->file));
+    line.append(":", 1);
+    line.appendNumber(copy->line, 1);
+    line.append(" <", 2);
+    line.append(copy->function);
+    line.append("> ", 2);
+    if (copy->categorySize)
+    {
+      line.append("[", 1);
+      line.append(copy->text(), copy->categorySize);
+      line.append("] ", 2);
+    }
+    line.append(copy->text() + copy->categorySize, copy->messageSize);
+    line.append("\n", 1);
+    line.writeTo(fd);
+  }
+}
+
+
+//! Forgets all the records kept in memory.
+void RingBufferAppender::clear()
+{
+  m_first.storeRelease(m_head.loadAcquire());
+}
+
+
+//! Dumps all the ring buffers to the file descriptor \a fd when the application crashes.
+/**
+ * The handler is installed for SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT (the ones available on the platform). After
+ * the dump the handlers installed before are restored and the signal is passed to them, so the handlers of the other
+ * crash reporters still run and the core dump is still generated with the default disposition. The handler is
+ * installed only once, the subsequent calls just change the file descriptor.
+ *
+ * On Unix the dump runs on the alternate signal stack, so the stack overflow is reported too. The alternate stack is
+ * set up for the thread calling this function (unless it has one already), other threads keep their own settings.
+ *
+ * The rings dumped because of the Logger::Fatal record are not dumped again if no records came after it, so the
+ * abort() following the fatal record doesn't repeat the dump.
+ *
+ * The file for the dump should be opened beforehand, as the signal handler can only use the async-signal-safe calls.
+ */
+void RingBufferAppender::installCrashHandler(int fd)
+{
+  crashDumpFd.storeRelease(fd);
+
+  if (!crashHandlerInstalled.testAndSetOrdered(0, 1))
+    return;
+
+#if defined(Q_OS_UNIX)
+  stack_t currentStack;
+  if (sigaltstack(nullptr, &currentStack) == 0 && (currentStack.ss_flags & SS_DISABLE))
+  {
+    stack_t stack;
+    std::memset(&stack, 0, sizeof(stack));
+    stack.ss_sp = crashStack;
+    stack.ss_size = sizeof(crashStack);
+    sigaltstack(&stack, nullptr);
+  }
+#endif
+
+  for (int i = 0; i < CrashSignalCount; ++i)
+  {
+#if defined(Q_OS_UNIX)
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = [](int signalNumber, siginfo_t* info, void* context) {
+      dumpCrashRings();
+      chainCrashSignal(signalNumber, info, context);
+    };
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigaction(crashSignals[i], &action, &previousCrashActions[i]);
+#else
+    previousCrashHandlers[i] = std::signal(crashSignals[i], [](int signalNumber) {
+      dumpCrashRings();
+      chainCrashSignal(signalNumber);
+    });
+#endif
+  }
+}
+
+
+// Called from the signal handler, must be async-signal-safe
+void RingBufferAppender::dumpCrashRings()
+{
+  const int savedErrno = errno;
+
+  const int fd = crashDumpFd.loadAcquire();
+  for (QAtomicPointer<RingBufferAppender>& ring : crashRings)
+  {
+    RingBufferAppender* appender = ring.loadAcquire();
+    if (appender && appender->m_fatalDumpHead.loadAcquire() != appender->m_head.loadAcquire())
+      appender->dumpTo(fd);
+  }
+
+  errno = savedErrno;
+}
+
+
+//! Copies the record into the ring, dumping the ring when the record is Logger::Fatal.
+/**
+ * \sa AbstractAppender::append()
+ */
+void RingBufferAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                                const char* function, const QString& category, const QString& message)
+{
+  const quint64 position = m_head.fetchAndAddRelaxed(1);
+  Slot* target = slot(position);
+
+  quint64 sequence = target->sequence.loadAcquire();
+  forever
+  {
+    // Still being written by the previous lap of the ring or already taken by the next one
+    if ((sequence & 1) || sequence > 2 * position)
+    {
+      m_dropped.fetchAndAddRelaxed(1);
+      return;
+    }
+
+    if (target->sequence.testAndSetAcquire(sequence, 2 * position + 1, sequence))
+      break;
+  }
+
+  target->timeStamp = timeStamp.toMSecsSinceEpoch();
+  target->file = file;
+  target->function = function;
+  target->line = line;
+  target->logLevel = logLevel;
+
+  const int textCapacity = m_recordSize - int(sizeof(Slot));
+  const int categorySize = encodeUtf8(category, target->text(), textCapacity);
+  target->categorySize = quint16(categorySize);
+  target->messageSize = quint16(encodeUtf8(message, target->text() + categorySize, textCapacity - categorySize));
+
+  target->sequence.storeRelease(2 * position + 2);
+
+  if (logLevel == Logger::Fatal)
+  {
+    m_fatalDumpHead.storeRelease(position + 1);
+    dump();
+  }
+}
+
+
+//! Reports the records dropped because of the slot contention.
+void RingBufferAppender::updateStatistics(AppenderStatistics& statistics) const
+{
+  statistics.dropped = m_dropped.loadAcquire();
+}
+
+
+RingBufferAppender::Slot* RingBufferAppender::slot(quint64 position) const
+{
+  return reinterpret_cast<Slot*>(m_storage + (position & m_mask) * quint64(m_recordSize));
+}
+
+
+// Copies the complete record of the position into the buffer of the MaxRecordSize bytes. Returns false if the slot was
+// overwritten by the newer record or is being written at the moment.
+bool RingBufferAppender::readSlot(quint64 position, Slot* copy) const
+{
+  const Slot* source = slot(position);
+  const quint64 expected = 2 * position + 2;
+  if (source->sequence.loadAcquire() != expected)
+    return false;
+
+  std::memcpy(static_cast<void*>(copy), static_cast<const void*>(source), size_t(m_recordSize));
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  if (source->sequence.loadAcquire() != expected)
+    return false;
+
+  // The sizes index the buffer, so they are checked anyway
+  const int textCapacity = m_recordSize - int(sizeof(Slot));
+  return copy->categorySize + copy->messageSize <= textCapacity;
+}
+
+
+quint64 RingBufferAppender::firstPosition(quint64 head) const
+{
+  const quint64 capacity = m_mask + 1;
+  const quint64 first = head > capacity ? head - capacity : 0;
+  return qMax(first, quint64(m_first.loadAcquire()));
+}
@@ -1,24 +1,214 @@
 #include <QDateTime>
 #include <QDir>
 #include <QFileInfo>
+#include <QPair>
+#include <QThread>
 
 #include "RollingFileAppender.h"
 
+#if defined(CUTELOGGER_ZLIB)
+#  include <zlib.h>
+#endif
+
+#if defined(CUTELOGGER_ZSTD)
+#  include <zstd.h>
+#endif
+
+#include <cstring>
+#include <iostream>
+
+
+class RollingFileAppenderWorker : public QThread
+{
+  public:
+    explicit RollingFileAppenderWorker(RollingFileAppender* appender)
+      : m_appender(appender)
+    {}
+
+  protected:
+    virtual void run()
+    {
+      m_appender->runWorker();
+    }
+
+  private:
+    RollingFileAppender* m_appender;
+};
+
+
+static const int compressionChunkSize = 64 * 1024;
+
+
+static QString compressedSuffix(RollingFileAppender::Compression compression)
+{
+  switch (compression)
+  {
+    case RollingFileAppender::GzipCompression:
+      return QStringLiteral(".gz");
+    case RollingFileAppender::ZstdCompression:
+      return QStringLiteral(".zst");
+    default:
+      return QString();
+  }
+}
+
+
+static bool rolledFileExists(const QString& fileName)
+{
+  return QFile::exists(fileName) || QFile::exists(fileName + compressedSuffix(RollingFileAppender::GzipCompression))
+      || QFile::exists(fileName + compressedSuffix(RollingFileAppender::ZstdCompression));
+}
+
+
+#if defined(CUTELOGGER_ZLIB)
+static bool gzipFile(QFile& source, QFile& target)
+{
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+
+  // 16 added to the window bits makes zlib write the gzip header instead of the zlib one
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+
+  QByteArray input(compressionChunkSize, Qt::Uninitialized);
+  QByteArray output(compressionChunkSize, Qt::Uninitialized);
+
+  bool ok = true;
+  int flush = Z_NO_FLUSH;
+  do
+  {
+    const qint64 read = source.read(input.data(), input.size());
+    if (read < 0)
+    {
+      ok = false;
+      break;
+    }
+
+    flush = source.atEnd() ? Z_FINISH : Z_NO_FLUSH;
+    stream.next_in = reinterpret_cast<Bytef*>(input.data());
+    stream.avail_in = uInt(read);
+
+    do
+    {
+      stream.next_out = reinterpret_cast<Bytef*>(output.data());
+      stream.avail_out = uInt(output.size());
+      deflate(&stream, flush);
+
+      const qint64 size = output.size() - stream.avail_out;
+      if (target.write(output.constData(), size) != size)
+      {
+        ok = false;
+        break;
+      }
+    }
+    while (stream.avail_out == 0);
+  }
+  while (ok && flush != Z_FINISH);
+
+  deflateEnd(&stream);
+  return ok;
+}
+#endif
+
+
+#if defined(CUTELOGGER_ZSTD)
+static bool zstdFile(QFile& source, QFile& target)
+{
+  ZSTD_CCtx* context = ZSTD_createCCtx();
+  if (!context)
+    return false;
+
+  QByteArray input(compressionChunkSize, Qt::Uninitialized);
+  QByteArray output(compressionChunkSize, Qt::Uninitialized);
+
+  bool ok = true;
+  bool last = false;
+  do
+  {
+    const qint64 read = source.read(input.data(), input.size());
+    if (read < 0)
+    {
+      ok = false;
+      break;
+    }
+
+    last = source.atEnd();
+    const ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+    ZSTD_inBuffer inBuffer = { input.constData(), size_t(read), 0 };
+
+    bool finished = false;
+    do
+    {
+      ZSTD_outBuffer outBuffer = { output.data(), size_t(output.size()), 0 };
+      const size_t remaining = ZSTD_compressStream2(context, &outBuffer, &inBuffer, mode);
+      if (ZSTD_isError(remaining) || target.write(output.constData(), qint64(outBuffer.pos)) != qint64(outBuffer.pos))
+      {
+        ok = false;
+        break;
+      }
+
+      finished = last ? (remaining == 0) : (inBuffer.pos == inBuffer.size);
+    }
+    while (!finished);
+  }
+  while (ok && !last);
+
+  ZSTD_freeCCtx(context);
+  return ok;
+}
+#endif
+
 
 RollingFileAppender::RollingFileAppender(const QString& fileName)
   : FileAppender(fileName)
   , m_frequency(DailyRollover)
+  , m_rollOverIndex(0)
   , m_logFilesLimit(0)
+  , m_logFilesSizeLimit(0)
+  , m_logFilesAgeLimit(0)
+  , m_maxFileSize(0)
+  , m_compression(NoCompression)
+  , m_worker(nullptr)
+  , m_workerBusy(false)
+  , m_stopWorker(false)
+  , m_rolledFilesSize(0)
+  , m_indexValid(false)
 {}
 
 
-void RollingFileAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
-    const char* function, const QString& category, const QString& message)
+//! Finishes the pending compression and old files removal and stops the background thread.
+RollingFileAppender::~RollingFileAppender()
 {
-  if (!m_rollOverTime.isNull() && QDateTime::currentDateTime() > m_rollOverTime)
-    rollOver();
+  if (m_worker)
+  {
+    {
+      QMutexLocker locker(&m_workerMutex);
+      m_stopWorker = true;
+      m_workerCondition.wakeAll();
+    }
 
-  FileAppender::append(timeStamp, logLevel, file, line, function, category, message);
+    m_worker->wait();
+    delete m_worker;
+  }
+}
+
+
+// The records are formatted by FileAppender with no lock held, only the writes are serialized
+void RollingFileAppender::writeFormatted(const QByteArray& formatted, Logger::LogLevel logLevel)
+{
+  QMutexLocker locker(&m_rollOverMutex);
+  checkRollOver();
+  FileAppender::writeFormatted(formatted, logLevel);
+}
+
+
+// Should be called with the m_rollOverMutex locked
+void RollingFileAppender::checkRollOver()
+{
+  if (!m_rollOverTime.isNull() && QDateTime::currentDateTime() > m_rollOverTime)
+    rollOver(false);
+  else if (m_maxFileSize > 0 && fileSize() >= m_maxFileSize)
+    rollOver(true);
 }
 
 
@@ -113,31 +303,122 @@ void RollingFileAppender::computeFrequency()
 }
 
 
-void RollingFileAppender::removeOldFiles()
+// Called from the background thread. Scans the log directory for the rolled over files if it wasn't done yet.
+void RollingFileAppender::indexRolledFiles()
 {
-  if (m_logFilesLimit <= 1)
+  const QString currentFileName = fileName();
+  const QString pattern = datePatternString();
+  if (m_indexValid && currentFileName == m_indexedFileName && pattern == m_indexedDatePattern)
     return;
 
-  QFileInfo fileInfo(fileName());
+  m_rolledFiles.clear();
+  m_rolledFileNames.clear();
+  m_rolledFilesSize = 0;
+  m_indexedFileName = currentFileName;
+  m_indexedDatePattern = pattern;
+  m_indexValid = true;
+
+  QFileInfo fileInfo(currentFileName);
   QDir logDirectory(fileInfo.absoluteDir());
   logDirectory.setFilter(QDir::Files);
   logDirectory.setNameFilters(QStringList() << fileInfo.fileName() + "*");
   QFileInfoList logFiles = logDirectory.entryInfoList();
 
-  QMap<QDateTime, QString> fileDates;
+  // Files rolled over by size within the same period are ordered by their sequence number
+  QMap<QPair<QDateTime, int>, int> fileDates;
   for (int i = 0; i < logFiles.length(); ++i)
   {
     QString name = logFiles[i].fileName();
     QString suffix = name.mid(name.indexOf(fileInfo.fileName()) + fileInfo.fileName().length());
-    QDateTime fileDateTime = QDateTime::fromString(suffix, datePatternString());
 
-    if (fileDateTime.isValid())
-      fileDates.insert(fileDateTime, logFiles[i].absoluteFilePath());
+    if (suffix.endsWith(compressedSuffix(GzipCompression)))
+      suffix.chop(compressedSuffix(GzipCompression).length());
+    else if (suffix.endsWith(compressedSuffix(ZstdCompression)))
+      suffix.chop(compressedSuffix(ZstdCompression).length());
+
+    QDateTime fileDateTime = QDateTime::fromString(suffix, pattern);
+    int index = 0;
+    if (!fileDateTime.isValid())
+    {
+      const int dot = suffix.lastIndexOf(QLatin1Char('.'));
+      bool isNumber = false;
+      index = suffix.mid(dot + 1).toInt(&isNumber);
+      if (dot < 0 || !isNumber)
+        continue;
+
+      suffix.truncate(dot);
+      fileDateTime = QDateTime::fromString(suffix, pattern);
+      if (!fileDateTime.isValid() && !(suffix.isEmpty() && pattern.isEmpty()))
+        continue;
+    }
+
+    fileDates.insert(qMakePair(fileDateTime, index), i);
+  }
+
+  for (QMap<QPair<QDateTime, int>, int>::const_iterator it = fileDates.constBegin(); it != fileDates.constEnd(); ++it)
+  {
+    const QFileInfo& info = logFiles.at(it.value());
+    RolledFile rolledFile = { info.absoluteFilePath(), info.size(), info.lastModified() };
+    m_rolledFiles.append(rolledFile);
+    m_rolledFileNames.insert(rolledFile.fileName);
+    m_rolledFilesSize += rolledFile.size;
+  }
+}
+
+
+// Called from the background thread. The rolledFileName is the name the file got at rollover, while fileName is the
+// name after the compression.
+void RollingFileAppender::addRolledFile(const QString& rolledFileName, const QString& fileName)
+{
+  const QString absoluteRolledFileName = QFileInfo(rolledFileName).absoluteFilePath();
+  const QFileInfo info(fileName);
+  RolledFile rolledFile = { info.absoluteFilePath(), info.size(), QDateTime::currentDateTime() };
+
+  // The file could be renamed before the directory was scanned, so it may be indexed already
+  if (m_rolledFileNames.contains(absoluteRolledFileName))
+  {
+    for (int i = m_rolledFiles.size() - 1; i >= 0; --i)
+    {
+      if (m_rolledFiles.at(i).fileName == absoluteRolledFileName)
+      {
+        m_rolledFilesSize -= m_rolledFiles.at(i).size;
+        m_rolledFiles.removeAt(i);
+        break;
+      }
+    }
+    m_rolledFileNames.remove(absoluteRolledFileName);
   }
 
-  QList<QString> fileDateNames = fileDates.values();
-  for (int i = 0; i < fileDateNames.length() - m_logFilesLimit + 1; ++i)
-    QFile::remove(fileDateNames[i]);
+  m_rolledFiles.append(rolledFile);
+  m_rolledFileNames.insert(rolledFile.fileName);
+  m_rolledFilesSize += rolledFile.size;
+}
+
+
+// Called from the background thread
+void RollingFileAppender::removeOldFiles()
+{
+  const int limit = logFilesLimit();
+  const qint64 sizeLimit = logFilesSizeLimit();
+  const int ageLimit = logFilesAgeLimit();
+  const QDateTime oldestAllowed = QDateTime::currentDateTime().addSecs(-ageLimit);
+
+  while (!m_rolledFiles.isEmpty())
+  {
+    const RolledFile& oldest = m_rolledFiles.first();
+
+    // The current log file is counted by the logFilesLimit too
+    const bool remove = (limit > 1 && m_rolledFiles.size() > limit - 1)
+                        || (sizeLimit > 0 && m_rolledFilesSize > sizeLimit)
+                        || (ageLimit > 0 && oldest.rolledOver < oldestAllowed);
+    if (!remove)
+      break;
+
+    QFile::remove(oldest.fileName);
+    m_rolledFilesSize -= oldest.size;
+    m_rolledFileNames.remove(oldest.fileName);
+    m_rolledFiles.removeFirst();
+  }
 }
 
 
@@ -211,27 +492,156 @@ void RollingFileAppender::computeRollOverTime()
 }
 
 
-void RollingFileAppender::rollOver()
+// Only renames the file and opens the new one, the rest is done by the background thread
+void RollingFileAppender::rollOver(bool sizeExceeded)
 {
-  Q_ASSERT_X(!m_datePatternString.isEmpty(), "DailyRollingFileAppender::rollOver()", "No active date pattern");
+  QString targetFileName;
+  if (sizeExceeded)
+  {
+    // Duplicate names are possible after the application restart
+    do
+      targetFileName = fileName() + m_rollOverSuffix + QLatin1Char('.') + QString::number(++m_rollOverIndex);
+    while (rolledFileExists(targetFileName));
+  }
+  else
+  {
+    Q_ASSERT_X(!m_datePatternString.isEmpty(), "DailyRollingFileAppender::rollOver()", "No active date pattern");
+
+    QString rollOverSuffix = m_rollOverSuffix;
+    const int rollOverIndex = m_rollOverIndex;
+    computeRollOverTime();
+    if (rollOverSuffix == m_rollOverSuffix)
+      return;
+
+    m_rollOverIndex = 0;
+    targetFileName = fileName() + rollOverSuffix;
+    if (rollOverIndex > 0)
+      targetFileName += QLatin1Char('.') + QString::number(rollOverIndex + 1);
+  }
 
-  QString rollOverSuffix = m_rollOverSuffix;
-  computeRollOverTime();
-  if (rollOverSuffix == m_rollOverSuffix)
+  closeFile();
+
+  if (!renameFile(targetFileName))
     return;
 
-  closeFile();
+  openFile();
+  scheduleBackgroundTasks(targetFileName);
+}
 
-  QString targetFileName = fileName() + rollOverSuffix;
+
+bool RollingFileAppender::renameFile(const QString& targetFileName)
+{
   QFile f(targetFileName);
   if (f.exists() && !f.remove())
-    return;
+    return false;
   f.setFileName(fileName());
-  if (!f.rename(targetFileName))
+  return f.rename(targetFileName);
+}
+
+
+void RollingFileAppender::scheduleBackgroundTasks(const QString& rolledFileName)
+{
+  QMutexLocker locker(&m_workerMutex);
+  m_pendingFiles.append(rolledFileName);
+
+  if (m_worker)
+  {
+    m_workerCondition.wakeAll();
     return;
+  }
 
-  openFile();
-  removeOldFiles();
+  m_worker = new RollingFileAppenderWorker(this);
+  m_worker->start(QThread::LowestPriority);
+}
+
+
+// Compresses the rolled over files and removes the old ones
+void RollingFileAppender::runWorker()
+{
+  QMutexLocker locker(&m_workerMutex);
+
+  forever
+  {
+    while (!m_pendingFiles.isEmpty())
+    {
+      const QStringList files = m_pendingFiles;
+      m_pendingFiles.clear();
+      m_workerBusy = true;
+      locker.unlock();
+
+      // The index is only kept while some retention limit is set
+      const bool retention = logFilesLimit() > 1 || logFilesSizeLimit() > 0 || logFilesAgeLimit() > 0;
+      if (retention)
+        indexRolledFiles();
+      else
+        m_indexValid = false;
+
+      const Compression fileCompression = compression();
+      for (int i = 0; i < files.size(); ++i)
+      {
+        QString compressedFileName = files.at(i);
+        if (fileCompression != NoCompression && compressFile(files.at(i), fileCompression))
+          compressedFileName += compressedSuffix(fileCompression);
+
+        if (retention)
+          addRolledFile(files.at(i), compressedFileName);
+      }
+
+      if (retention)
+        removeOldFiles();
+
+      locker.relock();
+      m_workerBusy = false;
+    }
+
+    m_workerIdleCondition.wakeAll();
+    if (m_stopWorker)
+      break;
+
+    m_workerCondition.wait(&m_workerMutex);
+  }
+}
+
+
+// Called from the background thread. The original file is removed when it is successfully compressed.
+bool RollingFileAppender::compressFile(const QString& fileName, Compression compression)
+{
+  if (!isCompressionSupported(compression) || compression == NoCompression)
+    return false;
+
+  const QString targetFileName = fileName + compressedSuffix(compression);
+  const QString partFileName = targetFileName + QStringLiteral(".part");
+
+  QFile source(fileName);
+  QFile target(partFileName);
+  if (!source.open(QIODevice::ReadOnly) || !target.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+
+  bool ok = false;
+#if defined(CUTELOGGER_ZLIB)
+  if (compression == GzipCompression)
+    ok = gzipFile(source, target);
+#endif
+#if defined(CUTELOGGER_ZSTD)
+  if (compression == ZstdCompression)
+    ok = zstdFile(source, target);
+#endif
+
+  source.close();
+  target.close();
+
+  if (ok)
+  {
+    QFile::remove(targetFileName);
+    ok = QFile::rename(partFileName, targetFileName);
+  }
+
+  if (ok)
+    QFile::remove(fileName);
+  else
+    QFile::remove(partFileName);
+
+  return ok;
 }
 
 
@@ -247,3 +657,140 @@ int RollingFileAppender::logFilesLimit() const
   QMutexLocker locker(&m_rollingMutex);
   return m_logFilesLimit;
 }
+
+
+//! Sets the maximum total size in bytes of the rolled over log files.
+/**
+ * When the rolled over files (not counting the current log file) take more than \a size bytes together, the oldest
+ * of them are deleted during rollover. Default value is 0, which means the total size is not limited.
+ *
+ * \sa logFilesSizeLimit(), setLogFilesLimit()
+ */
+void RollingFileAppender::setLogFilesSizeLimit(qint64 size)
+{
+  QMutexLocker locker(&m_rollingMutex);
+  m_logFilesSizeLimit = size;
+}
+
+
+//! Returns the maximum total size in bytes of the rolled over log files.
+/**
+ * \sa setLogFilesSizeLimit()
+ */
+qint64 RollingFileAppender::logFilesSizeLimit() const
+{
+  QMutexLocker locker(&m_rollingMutex);
+  return m_logFilesSizeLimit;
+}
+
+
+//! Sets the maximum age in seconds of the rolled over log files.
+/**
+ * The rolled over files older than \a seconds are deleted during rollover. The age of the files found in the log
+ * directory is taken from their modification time. Default value is 0, which means the age is not limited.
+ *
+ * \sa logFilesAgeLimit(), setLogFilesLimit()
+ */
+void RollingFileAppender::setLogFilesAgeLimit(int seconds)
+{
+  QMutexLocker locker(&m_rollingMutex);
+  m_logFilesAgeLimit = seconds;
+}
+
+
+//! Returns the maximum age in seconds of the rolled over log files.
+/**
+ * \sa setLogFilesAgeLimit()
+ */
+int RollingFileAppender::logFilesAgeLimit() const
+{
+  QMutexLocker locker(&m_rollingMutex);
+  return m_logFilesAgeLimit;
+}
+
+
+//! Sets the maximum size of the log file in bytes.
+/**
+ * When the file grows larger than \a size, it is rolled over regardless of the date pattern. Such files get the
+ * sequence number after the date suffix. Default value is 0, which means the size is not limited.
+ *
+ * \sa maxFileSize()
+ */
+void RollingFileAppender::setMaxFileSize(qint64 size)
+{
+  QMutexLocker locker(&m_rollingMutex);
+  m_maxFileSize = size;
+}
+
+
+//! Returns the maximum size of the log file in bytes.
+/**
+ * \sa setMaxFileSize()
+ */
+qint64 RollingFileAppender::maxFileSize() const
+{
+  QMutexLocker locker(&m_rollingMutex);
+  return m_maxFileSize;
+}
+
+
+//! Sets how the rolled over files are compressed.
+/**
+ * The files are compressed by the low priority background thread, which doesn't block the logging threads.
+ * Default value is RollingFileAppender::NoCompression. The compression methods not supported by this build
+ * (see isCompressionSupported()) are ignored.
+ *
+ * \sa compression()
+ */
+void RollingFileAppender::setCompression(Compression compression)
+{
+  if (!isCompressionSupported(compression))
+    std::cerr << "<RollingFileAppender::setCompression> Compression method is not supported by this build" << std::endl;
+
+  QMutexLocker locker(&m_rollingMutex);
+  m_compression = compression;
+}
+
+
+//! Returns how the rolled over files are compressed.
+/**
+ * \sa setCompression()
+ */
+RollingFileAppender::Compression RollingFileAppender::compression() const
+{
+  QMutexLocker locker(&m_rollingMutex);
+  return m_compression;
+}
+
+
+//! Returns true if the \a compression method is available in this build of the library.
+/**
+ * The gzip compression requires zlib and the zstd compression requires libzstd at the library build time.
+ */
+bool RollingFileAppender::isCompressionSupported(Compression compression)
+{
+  switch (compression)
+  {
+    case NoCompression:
+      return true;
+#if defined(CUTELOGGER_ZLIB)
+    case GzipCompression:
+      return true;
+#endif
+#if defined(CUTELOGGER_ZSTD)
+    case ZstdCompression:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+
+//! Waits until the background thread compresses the rolled over files and removes the old ones.
+void RollingFileAppender::waitForBackgroundTasks()
+{
+  QMutexLocker locker(&m_workerMutex);
+  while (m_workerBusy || !m_pendingFiles.isEmpty())
+    m_workerIdleCondition.wait(&m_workerMutex);
+}
@@ -0,0 +1,650 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// Local
+#include "SharedMemoryAppender.h"
+#include "Utf8Encoder.h"
+
+// Qt
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QVector>
+
+// STL
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+// POSIX
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * \class SharedMemoryAppender
+ *
+ * \brief SharedMemoryAppender passes the log records to the collector process through the POSIX shared memory.
+ *
+ * The appender creates the shared memory segment named "/<prefix>-<pid>-<n>" holding the ring of fixed-size slots
+ * (see capacity() and recordSize()) and copies every record there. The records are taken from the ring and written
+ * by SharedMemoryCollector running in the other process, e.g. by the \c cutelog-collector tool. So the processes using
+ * SharedMemoryAppender never do the file I/O themselves, and the records written to the ring are not lost when the
+ * process crashes: the collector takes them anyway.
+ *
+ * \code
+ * cuteLogger->registerAppender(new SharedMemoryAppender);
+ * \endcode
+ *
+ * Writing a record takes no locks: the slot is claimed with the compare-and-swap of the ring head and is released to
+ * the collector by its sequence number. When the ring is full (the collector is too slow or not running at all) the
+ * records are dropped, they are counted by droppedRecords() and reported by the collector. The file and function names,
+ * the category and the message are stored as UTF-8 and truncated to fit the slot. The structured fields of the record
+ * (LOG_INFO_KV()) are not passed.
+ *
+ * When the appender is destroyed, its segment is removed if the collector has already taken all the records from it
+ * (or nothing was written at all). Otherwise the segment is left in place and the collector removes it after taking
+ * the rest of the records. The segment is only accessible by the user the process is running as.
+ *
+ * \note SharedMemoryAppender is only available on the POSIX systems.
+ *
+ * \sa SharedMemoryCollector, RingBufferAppender
+ */
+
+
+// Segment header, followed by the slots. The separate cache lines keep the writers and the collector from invalidating
+// each other's head and tail.
+struct SharedMemoryAppender::Header
+{
+  Header()
+    : version(0),
+      capacity(0),
+      recordSize(0),
+      pid(0)
+  {}
+
+  QAtomicInteger<quint32> magic;    //!< Set after the segment is initialized
+  quint32 version;
+  quint32 capacity;
+  quint32 recordSize;
+  qint64 pid;                       //!< Process writing to the segment
+  QAtomicInt closed;                //!< Set when the appender is destroyed, no more records will come
+  QAtomicInteger<quint64> dropped;  //!< Records dropped because the ring was full
+
+  alignas(64) QAtomicInteger<quint64> head; //!< Position of the next record to be written
+  alignas(64) QAtomicInteger<quint64> tail; //!< Position of the next record to be taken by the collector
+};
+
+
+// Slot header, followed by the file name, the function name, the category and the message in the UTF-8 encoding. The
+// sequence of the slot is equal to the position when it is free to be written, to the position + 1 when the record is
+// complete and to the position + capacity when it is taken by the collector and free for the next lap of the ring.
+struct SharedMemoryAppender::Slot
+{
+  Slot()
+    : timeStamp(0),
+      line(0),
+      logLevel(0),
+      fileSize(0),
+      functionSize(0),
+      categorySize(0),
+      messageSize(0)
+  {}
+
+  QAtomicInteger<quint64> sequence;
+  qint64 timeStamp;
+  qint32 line;
+  qint32 logLevel;
+  quint16 fileSize;
+  quint16 functionSize;
+  quint16 categorySize;
+  quint16 messageSize;
+
+  const char* text() const { return reinterpret_cast<const char*>(this + 1); }
+  char* text() { return reinterpret_cast<char*>(this + 1); }
+};
+
+
+namespace
+{
+  enum
+  {
+    SegmentMagic = 0x4d534c43, // "CLSM"
+    SegmentVersion = 1,
+    MinRecordSize = 128,
+    MaxRecordSize = 65536
+  };
+
+  QAtomicInt segmentSerial;
+
+
+  // Copies the prefix of the string fitting the capacity, returns the number of bytes copied
+  int copyText(const char* string, char* out, int capacity)
+  {
+    if (!string)
+      return 0;
+
+    const int size = int(qMin(std::strlen(string), size_t(capacity)));
+    std::memcpy(out, string, size_t(size));
+    return size;
+  }
+
+
+  bool isProcessAlive(qint64 pid)
+  {
+    return ::kill(pid_t(pid), 0) == 0 || errno != ESRCH;
+  }
+}
+
+
+//! Constructs the appender creating the shared memory segment for the ring of \a capacity records of \a recordSize bytes.
+/**
+ * The \a capacity is rounded up to the power of two. The \a recordSize includes 32 bytes of the record header and is
+ * limited to 128..65536 bytes, the longer records are truncated. The file and function names take no more than a
+ * quarter of the record each.
+ *
+ * The \a prefix is the name of the segment family the collector looks for, see SharedMemoryCollector. If the segment
+ * can't be created, the error is printed to the standard error output and the appender does nothing.
+ */
+SharedMemoryAppender::SharedMemoryAppender(const QString& prefix, int capacity, int recordSize)
+  : m_header(nullptr),
+    m_slots(nullptr),
+    m_segmentSize(0)
+{
+  quint64 slotCount = 2;
+  while (slotCount < quint64(capacity))
+    slotCount <<= 1;
+  m_mask = slotCount - 1;
+
+  // Slot headers have to stay aligned
+  m_recordSize = qBound(int(MinRecordSize), recordSize, int(MaxRecordSize));
+  m_recordSize = (m_recordSize + int(alignof(Slot)) - 1) & ~(int(alignof(Slot)) - 1);
+
+  m_segmentName = QStringLiteral("/%1-%2-%3").arg(prefix).arg(QCoreApplication::applicationPid())
+                                             .arg(segmentSerial.fetchAndAddRelaxed(1));
+  m_segmentSize = sizeof(Header) + size_t(slotCount) * size_t(m_recordSize);
+
+  const QByteArray name = QFile::encodeName(m_segmentName);
+  int fd = ::shm_open(name.constData(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (fd < 0 && errno == EEXIST)
+  {
+    // Left by the crashed process with the same pid and never collected
+    ::shm_unlink(name.constData());
+    fd = ::shm_open(name.constData(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  }
+
+  void* data = MAP_FAILED;
+  int error = errno;
+  if (fd >= 0)
+  {
+    if (::ftruncate(fd, off_t(m_segmentSize)) == 0)
+      data = ::mmap(nullptr, m_segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    error = errno;
+    ::close(fd);
+  }
+
+  if (data == MAP_FAILED)
+  {
+    std::cerr << "<SharedMemoryAppender::SharedMemoryAppender> Cannot create the shared memory segment "
+              << qPrintable(m_segmentName) << ": " << std::strerror(error) << std::endl;
+    if (fd >= 0)
+      ::shm_unlink(name.constData());
+    return;
+  }
+
+  m_header = new (data) Header;
+  m_header->version = SegmentVersion;
+  m_header->capacity = quint32(slotCount);
+  m_header->recordSize = quint32(m_recordSize);
+  m_header->pid = QCoreApplication::applicationPid();
+
+  m_slots = static_cast<char*>(data) + sizeof(Header);
+  for (quint64 i = 0; i < slotCount; ++i)
+    (new (slot(i)) Slot)->sequence.storeRelease(i);
+
+  m_header->magic.storeRelease(SegmentMagic);
+
+  // The slots are claimed by the lock-free code, there is no need to hold the append() mutex
+  setAppendSerialized(false);
+}
+
+
+//! Detaches from the shared memory segment, leaving the records not taken yet to the collector.
+/**
+ * The segment is removed if there are no such records, so it doesn't stay in the system when no collector is running.
+ */
+SharedMemoryAppender::~SharedMemoryAppender()
+{
+  if (m_header)
+  {
+    m_header->closed.storeRelease(1);
+
+    // The collector mapping the segment keeps it until it sees the closed flag, its own unlink just fails then
+    if (m_header->tail.loadAcquire() == m_header->head.loadAcquire())
+      ::shm_unlink(QFile::encodeName(m_segmentName).constData());
+
+    ::munmap(m_header, m_segmentSize);
+  }
+}
+
+
+//! Returns the name of the shared memory segment, e.g. "/cutelogger-1234-0".
+QString SharedMemoryAppender::segmentName() const
+{
+  return m_segmentName;
+}
+
+
+//! Returns true if the shared memory segment was created successfully.
+bool SharedMemoryAppender::isValid() const
+{
+  return m_header != nullptr;
+}
+
+
+//! Returns the maximum number of the records in the ring.
+int SharedMemoryAppender::capacity() const
+{
+  return int(m_mask + 1);
+}
+
+
+//! Returns the size of the slot for the single record, in bytes.
+int SharedMemoryAppender::recordSize() const
+{
+  return m_recordSize;
+}
+
+
+//! Returns the number of the records dropped because the ring was full.
+quint64 SharedMemoryAppender::droppedRecords() const
+{
+  return m_header ? m_header->dropped.loadAcquire() : 0;
+}
+
+
+//! Returns the default prefix of the shared memory segment names, "cutelogger".
+QString SharedMemoryAppender::defaultPrefix()
+{
+  return QStringLiteral("cutelogger");
+}
+
+
+//! Copies the record into the shared memory ring, dropping it if the ring is full.
+/**
+ * \sa AbstractAppender::append()
+ */
+void SharedMemoryAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel, const char* file, int line,
+                                  const char* function, const QString& category, const QString& message)
+{
+  if (!m_header)
+    return;
+
+  quint64 position;
+  Slot* target;
+  forever
+  {
+    position = m_header->head.loadAcquire();
+    target = slot(position);
+
+    const quint64 sequence = target->sequence.loadAcquire();
+    if (sequence == position)
+    {
+      if (m_header->head.testAndSetRelaxed(position, position + 1))
+        break;
+    }
+    else if (sequence < position)
+    {
+      // The record of the previous lap is not taken by the collector yet
+      m_header->dropped.fetchAndAddRelaxed(1);
+      return;
+    }
+
+    // Otherwise the position is claimed by another thread, try the next one
+  }
+
+  target->timeStamp = timeStamp.toMSecsSinceEpoch();
+  target->line = line;
+  target->logLevel = logLevel;
+
+  char* text = target->text();
+  int textCapacity = m_recordSize - int(sizeof(Slot));
+  const int nameCapacity = textCapacity / 4;
+
+  const int fileSize = copyText(file, text, nameCapacity);
+  const int functionSize = copyText(function, text + fileSize, nameCapacity);
+  text += fileSize + functionSize;
+  textCapacity -= fileSize + functionSize;
+
+  const int categorySize = encodeUtf8(category, text, textCapacity);
+  const int messageSize = encodeUtf8(message, text + categorySize, textCapacity - categorySize);
+
+  target->fileSize = quint16(fileSize);
+  target->functionSize = quint16(functionSize);
+  target->categorySize = quint16(categorySize);
+  target->messageSize = quint16(messageSize);
+
+  target->sequence.storeRelease(position + 1);
+}
+
+
+//! Reports the records dropped because the ring was full.
+void SharedMemoryAppender::updateStatistics(AppenderStatistics& statistics) const
+{
+  statistics.dropped = droppedRecords();
+}
+
+
+SharedMemoryAppender::Slot* SharedMemoryAppender::slot(quint64 position) const
+{
+  return reinterpret_cast<Slot*>(m_slots + (position & m_mask) * quint64(m_recordSize));
+}
+
+
+/**
+ * \class SharedMemoryCollector
+ *
+ * \brief SharedMemoryCollector takes the records written by SharedMemoryAppender in the other processes.
+ *
+ * Every collect() call finds the new shared memory segments of the prefix() (see scanSegments()), takes all the records
+ * written to their rings since the last call and passes them to the target() appender in batches, using
+ * AbstractAppender::writeBatch(). It may be any appender, e.g. RollingFileAppender or NetworkAppender.
+ *
+ * The segment is removed after its appender is destroyed or its process has exited, and all its records are taken. The
+ * records being written when the process crashed are skipped. The number of the records the writers dropped because
+ * their ring was full is reported to the target as the warning record.
+ *
+ * \code
+ * RollingFileAppender appender("/var/log/workers.log");
+ * SharedMemoryCollector collector(&appender);
+ * forever
+ * {
+ *   if (collector.collect() == 0)
+ *     QThread::msleep(100);
+ * }
+ * \endcode
+ *
+ * The \c cutelog-collector tool is the daemon built on SharedMemoryCollector.
+ *
+ * \note The functions of SharedMemoryCollector should be called from the single thread only.
+ *
+ * \sa SharedMemoryAppender
+ */
+
+
+struct SharedMemoryCollector::Segment
+{
+  QString name;
+  SharedMemoryAppender::Header* header;
+  char* slotData;
+  size_t size;
+  quint64 mask;
+  int recordSize;
+  quint64 reportedDropped;
+
+  SharedMemoryAppender::Slot* slot(quint64 position) const
+  {
+    return reinterpret_cast<SharedMemoryAppender::Slot*>(slotData + (position & mask) * quint64(recordSize));
+  }
+};
+
+
+//! Constructs the collector passing the records from the segments of the \a prefix to the \a target appender.
+/**
+ * The collector doesn't take the ownership of the \a target appender.
+ */
+SharedMemoryCollector::SharedMemoryCollector(AbstractAppender* target, const QString& prefix)
+  : m_target(target),
+    m_prefix(prefix),
+    m_dropped(0)
+{}
+
+
+//! Detaches from all the segments. The records not taken yet are left in them.
+SharedMemoryCollector::~SharedMemoryCollector()
+{
+  foreach (Segment* segment, m_segments)
+  {
+    ::munmap(segment->header, segment->size);
+    delete segment;
+  }
+}
+
+
+//! Returns the appender the records are written to.
+AbstractAppender* SharedMemoryCollector::target() const
+{
+  return m_target;
+}
+
+
+//! Returns the prefix of the shared memory segment names collected, see SharedMemoryAppender::SharedMemoryAppender().
+QString SharedMemoryCollector::prefix() const
+{
+  return m_prefix;
+}
+
+
+//! Starts collecting the records from the shared memory segment with the \a name, e.g. "/cutelogger-1234-0".
+/**
+ * Returns false if there is no such segment or it is not initialized yet by its appender.
+ *
+ * \sa SharedMemoryAppender::segmentName()
+ */
+bool SharedMemoryCollector::addSegment(const QString& name)
+{
+  foreach (const Segment* segment, m_segments)
+  {
+    if (segment->name == name)
+      return true;
+  }
+
+  const QByteArray encodedName = QFile::encodeName(name);
+  const int fd = ::shm_open(encodedName.constData(), O_RDWR, 0);
+  if (fd < 0)
+    return false;
+
+  struct stat status;
+  void* data = MAP_FAILED;
+  if (::fstat(fd, &status) == 0 && size_t(status.st_size) >= sizeof(SharedMemoryAppender::Header))
+    data = ::mmap(nullptr, size_t(status.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (data == MAP_FAILED)
+    return false;
+
+  // The sizes index the mapping, so they are checked anyway
+  SharedMemoryAppender::Header* header = static_cast<SharedMemoryAppender::Header*>(data);
+  const quint64 capacity = header->capacity;
+  const quint64 recordSize = header->recordSize;
+  if (header->magic.loadAcquire() != SegmentMagic || header->version != SegmentVersion || capacity < 2
+      || (capacity & (capacity - 1)) || recordSize < sizeof(SharedMemoryAppender::Slot) || recordSize > MaxRecordSize
+      || sizeof(SharedMemoryAppender::Header) + capacity * recordSize > quint64(status.st_size))
+  {
+    ::munmap(data, size_t(status.st_size));
+    return false;
+  }
+
+  Segment* segment = new Segment;
+  segment->name = name;
+  segment->header = header;
+  segment->slotData = static_cast<char*>(data) + sizeof(SharedMemoryAppender::Header);
+  segment->size = size_t(status.st_size);
+  segment->mask = capacity - 1;
+  segment->recordSize = int(recordSize);
+  segment->reportedDropped = 0;
+  m_segments.append(segment);
+  return true;
+}
+
+
+//! Looks for the new segments of the prefix() in \c /dev/shm.
+/**
+ * Called by collect(). On the systems where the shared memory segments are not listed in the file system, the segments
+ * should be added by addSegment().
+ */
+void SharedMemoryCollector::scanSegments()
+{
+#if defined(Q_OS_LINUX)
+  const QStringList names = QDir(QStringLiteral("/dev/shm")).entryList(QStringList() << m_prefix + QStringLiteral("-*"),
+                                                                         QDir::Files);
+  foreach (const QString& name, names)
+    addSegment(QLatin1Char('/') + name);
+#endif
+}
+
+
+//! Returns the number of the segments the records are collected from.
+int SharedMemoryCollector::segmentCount() const
+{
+  return m_segments.size();
+}
+
+
+//! Takes the records from all the segments and writes them to the target() appender.
+/**
+ * The records are passed in the batches of up to \a maxBatchSize records. No more than the ring capacity of records
+ * is taken from each segment at once, so the busy writer doesn't hold the others back. Returns the number of the
+ * records written, zero meaning there was nothing to do.
+ *
+ * The segments of the exited processes are removed when all their records are taken.
+ */
+int SharedMemoryCollector::collect(int maxBatchSize)
+{
+  scanSegments();
+
+  int result = 0;
+  for (int i = 0; i < m_segments.size(); )
+  {
+    Segment* segment = m_segments.at(i);
+
+    // The closed flag is checked first, so no records come after the ring is drained
+    const bool finished = segment->header->closed.loadAcquire() || !isProcessAlive(segment->header->pid);
+    result += drain(segment, qMax(1, maxBatchSize));
+
+    if (finished && segment->header->tail.loadAcquire() == segment->header->head.loadAcquire())
+    {
+      ::munmap(segment->header, segment->size);
+      ::shm_unlink(QFile::encodeName(segment->name).constData());
+      delete segment;
+      m_segments.removeAt(i);
+      continue;
+    }
+
+    ++i;
+  }
+
+  return result;
+}
+
+
+//! Returns the number of the records dropped by the writers of all the segments collected.
+quint64 SharedMemoryCollector::droppedRecords() const
+{
+  return m_dropped;
+}
+
+
+int SharedMemoryCollector::drain(Segment* segment, int maxBatchSize)
+{
+  SharedMemoryAppender::Header* header = segment->header;
+  const quint64 capacity = segment->mask + 1;
+  const int textCapacity = segment->recordSize - int(sizeof(SharedMemoryAppender::Slot));
+
+  QVector<LogRecord> records;
+  records.reserve(qMin(maxBatchSize, int(capacity)));
+
+  int result = 0;
+  for (quint64 taken = 0; taken < capacity; ++taken)
+  {
+    const quint64 position = header->tail.loadAcquire();
+    SharedMemoryAppender::Slot* source = segment->slot(position);
+
+    const quint64 sequence = source->sequence.loadAcquire();
+    if (sequence != position + 1)
+    {
+      // The position was claimed, but the record was never completed because its process crashed
+      if (sequence == position && header->head.loadAcquire() > position && !isProcessAlive(header->pid))
+      {
+        source->sequence.storeRelease(position + capacity);
+        header->tail.storeRelease(position + 1);
+        continue;
+      }
+      break;
+    }
+
+    const int fileSize = source->fileSize;
+    const int functionSize = source->functionSize;
+    const int categorySize = source->categorySize;
+    const int messageSize = source->messageSize;
+    if (fileSize + functionSize + categorySize + messageSize <= textCapacity)
+    {
+      const char* text = source->text();
+      const LogRecord record = {
+        QDateTime::fromMSecsSinceEpoch(source->timeStamp),
+        Logger::LogLevel(qBound(int(Logger::Trace), int(source->logLevel), int(Logger::Fatal))),
+        internedString(text, fileSize), source->line, internedString(text + fileSize, functionSize), nullptr,
+        QString::fromUtf8(text + fileSize + functionSize, categorySize),
+        QString::fromUtf8(text + fileSize + functionSize + categorySize, messageSize), LogFields()
+      };
+      records.append(record);
+    }
+
+    source->sequence.storeRelease(position + capacity);
+    header->tail.storeRelease(position + 1);
+
+    if (records.size() >= maxBatchSize)
+    {
+      m_target->writeBatch(records.constData(), size_t(records.size()));
+      result += records.size();
+      records.clear();
+    }
+  }
+
+  if (!records.isEmpty())
+  {
+    m_target->writeBatch(records.constData(), size_t(records.size()));
+    result += records.size();
+  }
+
+  const quint64 dropped = header->dropped.loadAcquire();
+  if (dropped > segment->reportedDropped)
+  {
+    const quint64 count = dropped - segment->reportedDropped;
+    segment->reportedDropped = dropped;
+    m_dropped += count;
+    m_target->write(QDateTime::currentDateTime(), Logger::Warning, __FILE__, __LINE__, Q_FUNC_INFO, QString(),
+                    QStringLiteral("%1 records of the process %2 were dropped, the shared memory ring was full")
+                      .arg(count).arg(header->pid));
+  }
+
+  return result;
+}
+
+
+// The file and function names are passed to the appenders as the pointers, and the function names are cached by the
+// pointer, so the same string is always passed as the same pointer
+const char* SharedMemoryCollector::internedString(const char* data, int size)
+{
+  const QByteArray string(data, size);
+  QHash<QByteArray, QByteArray>::const_iterator it = m_strings.constFind(string);
+  if (it == m_strings.constEnd())
+    it = m_strings.insert(string, string);
+  return it.value().constData();
+}
@@ -0,0 +1,92 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef STRIPEDCOUNTER_H
+#define STRIPEDCOUNTER_H
+
+// Qt
+#include <QAtomicInt>
+#include <QAtomicInteger>
+
+// STL
+#include <chrono>
+
+
+/**
+ * \internal
+ *
+ * StripedCounter is the statistics counter updated by many threads at once. Every thread updates its own stripe (the
+ * threads are assigned to the stripes round robin), each stripe occupies its own cache line, so the threads don't
+ * contend for it. The stripes are summed up when the counter is read.
+ */
+class StripedCounter
+{
+  public:
+    enum { Stripes = 16 };
+
+    void add(quint64 value)
+    {
+      m_stripes[stripeIndex()].value.fetchAndAddRelaxed(value);
+    }
+
+    // Treats the stripes as the maximum of the values instead of the sum
+    void updateMax(quint64 value)
+    {
+      Stripe& stripe = m_stripes[stripeIndex()];
+      quint64 current = stripe.value.load();
+      while (value > current && !stripe.value.testAndSetRelaxed(current, value, current))
+        ;
+    }
+
+    quint64 sum() const
+    {
+      quint64 result = 0;
+      for (int i = 0; i < Stripes; ++i)
+        result += m_stripes[i].value.load();
+      return result;
+    }
+
+    quint64 max() const
+    {
+      quint64 result = 0;
+      for (int i = 0; i < Stripes; ++i)
+        result = qMax(result, quint64(m_stripes[i].value.load()));
+      return result;
+    }
+
+    static int stripeIndex()
+    {
+      static QAtomicInt nextStripe;
+      static thread_local int stripe = nextStripe.fetchAndAddRelaxed(1) % Stripes;
+      return stripe;
+    }
+
+  private:
+    // Padded instead of aligned, so the counters may be allocated with the plain operator new
+    struct Stripe
+    {
+      QAtomicInteger<quint64> value;
+      char padding[64 - sizeof(QAtomicInteger<quint64>)];
+    };
+
+    Stripe m_stripes[Stripes];
+};
+
+
+inline qint64 monotonicNSecs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // STRIPEDCOUNTER_H
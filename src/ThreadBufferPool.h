@@ -0,0 +1,89 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef THREADBUFFERPOOL_H
+#define THREADBUFFERPOOL_H
+
+// Internal header, not installed
+
+
+// Small fixed set of the buffers reused by the records written from the same thread. The buffers keep the capacity
+// they grew to, so the steady state logging doesn't touch the heap. Nested records (e.g. written from the operator<<
+// of the logged object) take the next free buffer, acquire() returns null when all of them are taken.
+template <typename T, int Size>
+class ThreadBufferPool
+{
+  public:
+    ThreadBufferPool()
+    {
+      for (int i = 0; i < Size; ++i)
+        m_inUse[i] = false;
+    }
+
+    T* acquire()
+    {
+      for (int i = 0; i < Size; ++i)
+      {
+        if (!m_inUse[i])
+        {
+          m_inUse[i] = true;
+          return &m_buffers[i];
+        }
+      }
+      return nullptr;
+    }
+
+    void release(T* buffer)
+    {
+      const int index = int(buffer - m_buffers);
+      if (index >= 0 && index < Size)
+        m_inUse[index] = false;
+    }
+
+  private:
+    T m_buffers[Size];
+    bool m_inUse[Size];
+};
+
+
+// Returns the pool of the current thread. Every buffer type has its own pool.
+template <typename T>
+ThreadBufferPool<T, 4>& threadBufferPool()
+{
+  static thread_local ThreadBufferPool<T, 4> pool;
+  return pool;
+}
+
+
+// Empties the buffer keeping its capacity. Qt keeps the capacity on resize(0) only if it was reserved explicitly.
+template <typename T>
+void resetPooledBuffer(T& buffer, int capacity = 1024)
+{
+  if (buffer.capacity() < capacity)
+    buffer.reserve(capacity);
+  buffer.resize(0);
+}
+
+
+// Don't keep the memory taken by a single huge record
+template <typename T>
+void trimPooledBuffer(T& buffer, int maxCapacity = 65536)
+{
+  if (buffer.capacity() > maxCapacity)
+  {
+    buffer.clear();
+    buffer.squeeze();
+  }
+}
+
+#endif // THREADBUFFERPOOL_H
@@ -0,0 +1,142 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+#ifndef UTF8ENCODER_H
+#define UTF8ENCODER_H
+
+// Internal header, not installed
+
+// Qt
+#include <QByteArray>
+#include <QString>
+
+// STL
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define CUTELOGGER_SSE2
+#endif
+
+
+// The only UTF-16 to UTF-8 encoder of the library. Unlike QString::toUtf8() it doesn't create the temporary QByteArray
+// and replaces the unpaired surrogates with U+FFFD.
+
+// Encodes the character at the position (the surrogate pair takes both of its positions) to no more than 4 bytes.
+// Returns the number of bytes written and moves the position past the character.
+inline int encodeUtf8Char(const ushort*& in, const ushort* end, char* out)
+{
+  uint c = *in++;
+  if (c < 0x80)
+  {
+    out[0] = char(c);
+    return 1;
+  }
+
+  if (QChar::isHighSurrogate(c) && in != end && QChar::isLowSurrogate(*in))
+  {
+    c = QChar::surrogateToUcs4(ushort(c), *in++);
+    out[0] = char(0xf0 | (c >> 18));
+    out[1] = char(0x80 | ((c >> 12) & 0x3f));
+    out[2] = char(0x80 | ((c >> 6) & 0x3f));
+    out[3] = char(0x80 | (c & 0x3f));
+    return 4;
+  }
+
+  if (QChar::isSurrogate(c))
+    c = QChar::ReplacementCharacter;
+
+  if (c < 0x800)
+  {
+    out[0] = char(0xc0 | (c >> 6));
+    out[1] = char(0x80 | (c & 0x3f));
+    return 2;
+  }
+
+  out[0] = char(0xe0 | (c >> 12));
+  out[1] = char(0x80 | ((c >> 6) & 0x3f));
+  out[2] = char(0x80 | (c & 0x3f));
+  return 3;
+}
+
+
+// Encodes the UTF-16 data and appends it to the buffer
+inline void appendUtf8(QByteArray& buffer, const QChar* data, int size)
+{
+  // Every UTF-16 position takes no more than 3 bytes, the surrogate pair takes 4 bytes for the two positions
+  const int offset = buffer.size();
+  buffer.resize(offset + size * 3);
+
+  char* out = buffer.data() + offset;
+  const ushort* in = reinterpret_cast<const ushort*>(data);
+  const ushort* const end = in + size;
+  while (in != end)
+  {
+#if defined(CUTELOGGER_SSE2)
+    // Most of the log text is ASCII, which is converted eight characters at a time
+    if (end - in >= 8)
+    {
+      const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+      const __m128i nonAscii = _mm_and_si128(chars, _mm_set1_epi16(short(0xff80)));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii, _mm_setzero_si128())) == 0xffff)
+      {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(chars, chars));
+        in += 8;
+        out += 8;
+        continue;
+      }
+    }
+#endif
+
+    if (*in < 0x80)
+      *out++ = char(*in++);
+    else
+      out += encodeUtf8Char(in, end, out);
+  }
+
+  buffer.resize(int(out - buffer.constData()));
+}
+
+
+// Encodes the string to the fixed size buffer without splitting the characters. Returns the number of bytes written.
+inline int encodeUtf8(const QString& string, char* out, int capacity)
+{
+  const ushort* in = reinterpret_cast<const ushort*>(string.constData());
+  const ushort* const end = in + string.size();
+
+  int written = 0;
+  while (in != end)
+  {
+    if (*in < 0x80)
+    {
+      if (written >= capacity)
+        break;
+      out[written++] = char(*in++);
+      continue;
+    }
+
+    char bytes[4];
+    const ushort* next = in;
+    const int count = encodeUtf8Char(next, end, bytes);
+    if (written + count > capacity)
+      break;
+
+    std::memcpy(out + written, bytes, size_t(count));
+    written += count;
+    in = next;
+  }
+
+  return written;
+}
+
+#endif // UTF8ENCODER_H
@@ -1,6 +1,29 @@
 #include <QtTest/QtTest>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <Logger.h>
 #include <AbstractAppender.h>
+#include <AbstractStringAppender.h>
+#include <AsyncAppender.h>
+#include <BinaryFileAppender.h>
+#include <ConsoleAppender.h>
+#include <DedupAppender.h>
+#include <FileAppender.h>
+#include <JsonAppender.h>
+#include <MmapFileAppender.h>
+#if defined(CUTELOGGER_NETWORK)
+#  include <NetworkAppender.h>
+#  include <QUdpSocket>
+#endif
+#include <RingBufferAppender.h>
+#include <RollingFileAppender.h>
+#if defined(Q_OS_UNIX) && !defined(Q_OS_ANDROID)
+#  include <SharedMemoryAppender.h>
+#endif
+#if defined(Q_OS_UNIX)
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
 
 
 class TestAppender : public AbstractAppender
@@ -32,6 +55,40 @@ void TestAppender::append(const QDateTime& timeStamp, Logger::LogLevel logLevel,
 }
 
 
+class TestStringAppender : public AbstractStringAppender
+{
+  protected:
+    void append(const QDateTime&, Logger::LogLevel, const char*, int, const char*, const QString&,
+                const QString&) override {}
+
+  public:
+    using AbstractStringAppender::formattedString;
+    using AbstractStringAppender::formattedUtf8;
+};
+
+
+class FileWriterThread : public QThread
+{
+  public:
+    explicit FileWriterThread(AbstractAppender* appender)
+      : m_appender(appender)
+    {}
+
+  protected:
+    void run() override
+    {
+      for (int i = 0; i < 1000; ++i)
+      {
+        m_appender->write(QDateTime::currentDateTime(), Logger::Info, __FILE__, __LINE__, Q_FUNC_INFO, QString(),
+                          QStringLiteral("Message %1").arg(i));
+      }
+    }
+
+  private:
+    AbstractAppender* m_appender;
+};
+
+
 class BasicTest : public QObject
 {
   Q_OBJECT
@@ -40,8 +97,39 @@ class BasicTest : public QObject
     void initTestCase();
 
     void testCString();
+    void testPrintfMessage();
     void testQDebug();
     void testRecursiveQDebug();
+    void testLevelGate();
+    void testRateLimit();
+    void testLogSite();
+    void testTimingStats();
+    void testStatistics();
+    void testAsyncAppender();
+    void testWriteBatch();
+    void testDedupAppender();
+    void testRingBufferAppender();
+    void testFormat();
+    void testFormatUtf8();
+    void testFunctionNameCache();
+    void testCategory();
+    void testLoggerParent();
+    void testQtCategoryFilter();
+    void testBufferedFileAppender();
+#if defined(Q_OS_UNIX)
+    void testConsoleAppender();
+#endif
+    void testConcurrentFileAppender();
+    void testMmapFileAppender();
+    void testRollingFileSize();
+    void testBinaryFileAppender();
+    void testStructuredFields();
+#if defined(Q_OS_UNIX) && !defined(Q_OS_ANDROID)
+    void testSharedMemoryAppender();
+#endif
+#if defined(CUTELOGGER_NETWORK)
+    void testNetworkAppender();
+#endif
 
     void cleanupTestCase();
 
@@ -49,6 +137,9 @@ class BasicTest : public QObject
     TestAppender appender;
 
     int testQDebugInt();
+    int countEvaluation();
+
+    int m_evaluations = 0;
 };
 
 
@@ -75,6 +166,25 @@ void BasicTest::testCString()
 }
 
 
+void BasicTest::testPrintfMessage()
+{
+  // Reused thread buffers: the short and the long messages, the non-ASCII strings and the fallback formats
+  const QByteArray longString(3000, 'a');
+  LOG_DEBUG("%d %5i %-4u|%x %#X %ld %s", -1, 2, 3u, 255, 255, 123456789L, "Caf\xc3\xa9");
+  LOG_DEBUG("%s %d", longString.constData(), 42);
+  LOG_DEBUG("%.2f %c %5s", 1.5, 'c', "str");
+  LOG_DEBUG("%d", 7);
+
+  QCOMPARE(appender.records.size(), 4);
+  QCOMPARE(appender.records.at(0).message,
+           QString::asprintf("%d %5i %-4u|%x %#X %ld %s", -1, 2, 3u, 255, 255, 123456789L, "Caf\xc3\xa9"));
+  QCOMPARE(appender.records.at(1).message, QString::fromLatin1(longString) + QStringLiteral(" 42"));
+  QCOMPARE(appender.records.at(2).message, QStringLiteral("1.50 c   str"));
+  QCOMPARE(appender.records.at(3).message, QStringLiteral("7"));
+  appender.clear();
+}
+
+
 void BasicTest::testQDebug()
 {
   LOG_DEBUG() << "Message" << 5;
@@ -107,6 +217,760 @@ void BasicTest::testRecursiveQDebug()
 }
 
 
+void BasicTest::testLevelGate()
+{
+  m_evaluations = 0;
+  appender.setDetailsLevel(Logger::Info);
+  QVERIFY(!cuteLogger->isEnabledFor(Logger::Debug));
+  QVERIFY(cuteLogger->isEnabledFor(Logger::Info));
+
+  LOG_DEBUG() << "Message" << countEvaluation();
+  LOG_DEBUG("Message %d", countEvaluation());
+  QCOMPARE(m_evaluations, 0);
+  QCOMPARE(appender.records.size(), 0);
+
+  LOG_INFO() << "Message" << countEvaluation();
+  QCOMPARE(m_evaluations, 1);
+  QCOMPARE(appender.records.size(), 1);
+  appender.clear();
+
+  appender.setDetailsLevel(Logger::Debug);
+  QVERIFY(cuteLogger->isEnabledFor(Logger::Debug));
+}
+
+
+void BasicTest::testRateLimit()
+{
+  m_evaluations = 0;
+  for (int i = 0; i < 10; ++i)
+    LOG_DEBUG_EVERY_N(3)("Message %d", countEvaluation());
+
+  // Suppressed records don't evaluate the arguments
+  QCOMPARE(m_evaluations, 4);
+  QCOMPARE(appender.records.size(), 4);
+  QCOMPARE(appender.records.at(0).message, QStringLiteral("Message 1"));
+  QCOMPARE(appender.records.at(1).message, QStringLiteral("Message 2 (2 similar records suppressed)"));
+  appender.clear();
+
+  for (int i = 0; i < 10; ++i)
+    LOG_DEBUG_FIRST_N(2)() << "Message";
+  QCOMPARE(appender.records.size(), 2);
+  appender.clear();
+
+  for (int i = 0; i < 10; ++i)
+    LOG_DEBUG_RATE(1, 3)("Message");
+  QCOMPARE(appender.records.size(), 3);
+  appender.clear();
+}
+
+
+void BasicTest::testLogSite()
+{
+  m_evaluations = 0;
+  LogSite::setSitesEnabled(QStringLiteral("basictest.cpp"), __LINE__ + 2, false);
+  for (int i = 0; i < 3; ++i)
+    LOG_DEBUG("Message %d", countEvaluation());
+
+  // Disabled sites don't evaluate the arguments
+  QCOMPARE(m_evaluations, 0);
+  QCOMPARE(appender.records.size(), 0);
+
+  LogSite::setSitesEnabled(QStringLiteral("basictest.cpp"), 0, true);
+  LOG_DEBUG("Message");
+  QCOMPARE(appender.records.size(), 1);
+  appender.clear();
+
+  // The destroyed sites (like the ones of an unloaded plugin) are unregistered
+  {
+    LogSite scopedSite(Logger::Info, "/path/to/plugin.cpp", 7, Q_FUNC_INFO);
+    QVERIFY(LogSite::registeredSites().contains(&scopedSite));
+  }
+  foreach (LogSite* registeredSite, LogSite::registeredSites())
+    QVERIFY(qstrcmp(registeredSite->file(), "/path/to/plugin.cpp") != 0);
+
+  // Sites are registered for the whole lifetime of the application
+  static LogSite site(Logger::Info, "/path/to/file.cpp", 42, Q_FUNC_INFO);
+  QVERIFY(LogSite::registeredSites().contains(&site));
+  QCOMPARE(site.fileName(), "file.cpp");
+  QCOMPARE(site.functionName(), QStringLiteral("BasicTest::testLogSite"));
+
+  TestStringAppender stringAppender;
+  stringAppender.setFormat(QStringLiteral("%{file}:%{line} %{function} %{message}"));
+  QCOMPARE(stringAppender.formattedString(QDateTime::currentDateTime(), site, QString(), QStringLiteral("Message")),
+           QStringLiteral("file.cpp:42 BasicTest::testLogSite Message"));
+}
+
+
+void BasicTest::testTimingStats()
+{
+  LoggerTimingStats::setSummaryInterval(0);
+
+  for (int i = 0; i < 3; ++i)
+  {
+    LOG_DEBUG_TIME_STATS("Stats block");
+  }
+  QCOMPARE(appender.records.size(), 0);
+
+  LoggerTimingStats::writeSummaries();
+  QCOMPARE(appender.records.size(), 1);
+  QVERIFY(appender.records.last().message.startsWith(QStringLiteral("\"Stats block\" timing: 3 calls, min ")));
+  appender.clear();
+
+  // Statistics starts over after the summary
+  LoggerTimingStats::writeSummaries();
+  QCOMPARE(appender.records.size(), 0);
+
+  LoggerTimingStats::setSummaryInterval(60000);
+}
+
+
+void BasicTest::testStatistics()
+{
+  const LoggerStatistics before = cuteLogger->statistics();
+  LOG_INFO("Message");
+  LOG_CINFO("statistics") << "Message";
+  const LoggerStatistics after = cuteLogger->statistics();
+  appender.clear();
+
+  QCOMPARE(after.records[Logger::Info], before.records[Logger::Info] + 2);
+  QCOMPARE(after.categoryRecords.value(QStringLiteral("statistics")), quint64(1));
+
+  QCOMPARE(after.appenders.size(), 1);
+  QVERIFY(after.appenders.at(0).appender == &appender);
+  // The category has no appenders, so only the first record reaches the appender
+  QCOMPARE(after.appenders.at(0).accepted, before.appenders.at(0).accepted + 1);
+}
+
+
+void BasicTest::testAsyncAppender()
+{
+  TestAppender* target = new TestAppender;
+  AsyncAppender* asyncAppender = new AsyncAppender(target, 16);
+  cuteLogger->registerAppender(asyncAppender);
+
+  for (int i = 0; i < 100; ++i)
+    LOG_DEBUG("Message %d", i);
+  QVERIFY(asyncAppender->flush());
+
+  QCOMPARE(target->records.size(), 100);
+  QCOMPARE(target->records.last().message, QStringLiteral("Message 99"));
+  QCOMPARE(asyncAppender->droppedRecords(), quint64(0));
+
+  cuteLogger->removeAppender(asyncAppender);
+  delete asyncAppender;
+  appender.clear();
+}
+
+
+void BasicTest::testWriteBatch()
+{
+  TestAppender batchAppender;
+  batchAppender.setDetailsLevel(Logger::Info);
+
+  const QDateTime timeStamp = QDateTime::currentDateTime();
+  const LogRecord records[] = {
+    { timeStamp, Logger::Info, __FILE__, __LINE__, Q_FUNC_INFO, nullptr, QString(), QStringLiteral("First"), LogFields() },
+    { timeStamp, Logger::Debug, __FILE__, __LINE__, Q_FUNC_INFO, nullptr, QString(), QStringLiteral("Filtered"), LogFields() },
+    { timeStamp, Logger::Error, __FILE__, __LINE__, Q_FUNC_INFO, nullptr, QString(), QStringLiteral("Second"), LogFields() }
+  };
+  batchAppender.writeBatch(records, 3);
+
+  QCOMPARE(batchAppender.records.size(), 2);
+  QCOMPARE(batchAppender.records.at(0).message, QStringLiteral("First"));
+  QCOMPARE(batchAppender.records.at(1).message, QStringLiteral("Second"));
+
+  const AppenderStatistics statistics = batchAppender.statistics();
+  QCOMPARE(statistics.accepted, quint64(2));
+  QCOMPARE(statistics.filtered, quint64(1));
+}
+
+
+void BasicTest::testDedupAppender()
+{
+  TestAppender* testAppender = new TestAppender;
+  DedupAppender* dedupAppender = new DedupAppender(testAppender);
+  cuteLogger->registerAppender(dedupAppender);
+
+  for (int i = 0; i < 5; ++i)
+    LOG_DEBUG("Repeated");
+  LOG_DEBUG("Different");
+
+  QCOMPARE(testAppender->records.size(), 3);
+  QCOMPARE(testAppender->records.at(0).message, QStringLiteral("Repeated"));
+  QCOMPARE(testAppender->records.at(1).message, QStringLiteral("last message repeated 4 times"));
+  QCOMPARE(testAppender->records.at(2).message, QStringLiteral("Different"));
+  QCOMPARE(dedupAppender->suppressedRecords(), quint64(4));
+
+  // The storm of the repeats is summarised once the window passes since the first suppressed repeat
+  testAppender->clear();
+  dedupAppender->setWindow(1000);
+  const QDateTime start = QDateTime::currentDateTime();
+  for (int i = 0; i < 30; ++i)
+    dedupAppender->write(start.addMSecs(i * 100), Logger::Debug, __FILE__, __LINE__, Q_FUNC_INFO, QString(),
+                         QStringLiteral("Storm"));
+  QVERIFY(testAppender->records.size() > 2);
+  QCOMPARE(testAppender->records.at(0).message, QStringLiteral("Storm"));
+  QCOMPARE(testAppender->records.at(1).message, QStringLiteral("last message repeated 11 times"));
+
+  // The function names of the records written directly are compared by the content, not by the pointer
+  dedupAppender->flush();
+  testAppender->clear();
+  dedupAppender->setWindow(0);
+  for (int i = 0; i < 3; ++i)
+  {
+    const QByteArray function("void handler()");
+    dedupAppender->write(start, Logger::Debug, __FILE__, __LINE__, function.constData(), QString(),
+                         QStringLiteral("Temporary"));
+  }
+  dedupAppender->flush();
+  QCOMPARE(testAppender->records.size(), 2);
+  QCOMPARE(testAppender->records.at(1).message, QStringLiteral("last message repeated 2 times"));
+
+  cuteLogger->removeAppender(dedupAppender);
+  delete dedupAppender;
+  appender.clear();
+}
+
+
+void BasicTest::testRingBufferAppender()
+{
+  TestAppender* testAppender = new TestAppender;
+  testAppender->setDetailsLevel(Logger::Trace);
+  RingBufferAppender* ringAppender = new RingBufferAppender(testAppender, 8);
+  cuteLogger->registerAppender(ringAppender);
+
+  for (int i = 0; i < 20; ++i)
+    LOG_TRACE("Record %d", i);
+
+  // Nothing is written until the dump
+  QVERIFY(testAppender->records.isEmpty());
+  QCOMPARE(ringAppender->capacity(), 8);
+
+  ringAppender->dump();
+  QCOMPARE(testAppender->records.size(), 8);
+  for (int i = 0; i < 8; ++i)
+  {
+    QCOMPARE(testAppender->records.at(i).message, QStringLiteral("Record %1").arg(12 + i));
+    QCOMPARE(testAppender->records.at(i).logLevel, Logger::Trace);
+  }
+
+  testAppender->clear();
+  ringAppender->clear();
+  LOG_DEBUG(QString(1000, QLatin1Char('x')));
+  ringAppender->dump();
+  QCOMPARE(testAppender->records.size(), 1);
+  QVERIFY(testAppender->records.at(0).message.size() < 256);
+  QCOMPARE(ringAppender->droppedRecords(), quint64(0));
+
+  cuteLogger->removeAppender(ringAppender);
+  delete ringAppender;
+  appender.clear();
+}
+
+
+void BasicTest::testFormat()
+{
+  TestStringAppender stringAppender;
+  stringAppender.setFormat(QStringLiteral("%{time}{yyyy} [%{type:-7}] [%{Type:7}] %{typeOne}%{TypeOne} %{file}:%{line} "
+                                          "%{category} %{message} %{unknown}"));
+
+  const QDateTime timeStamp(QDate(2010, 12, 17), QTime(20, 17));
+  QCOMPARE(stringAppender.formattedString(timeStamp, Logger::Info, "/path/to/file.cpp", 42, Q_FUNC_INFO,
+                                          QStringLiteral("test"), QStringLiteral("Message")),
+           QStringLiteral("2010 [Info   ] [   INFO] iI file.cpp:42 test Message %unknown"));
+
+  // Only the milliseconds are changed within the second
+  stringAppender.setFormat(QStringLiteral("%{time}{HH:mm:ss.zzz}"));
+  QCOMPARE(stringAppender.formattedString(timeStamp.addMSecs(5), Logger::Info, __FILE__, __LINE__, Q_FUNC_INFO,
+                                          QString(), QString()), QStringLiteral("20:17:00.005"));
+  QCOMPARE(stringAppender.formattedString(timeStamp.addMSecs(250), Logger::Info, __FILE__, __LINE__, Q_FUNC_INFO,
+                                          QString(), QString()), QStringLiteral("20:17:00.250"));
+  QCOMPARE(stringAppender.formattedString(timeStamp.addSecs(1), Logger::Info, __FILE__, __LINE__, Q_FUNC_INFO,
+                                          QString(), QString()), QStringLiteral("20:17:01.000"));
+
+  // The AM/PM marker changes the hours, so such a format is not split around the milliseconds
+  const QString twelveHourFormat = QStringLiteral("hh:mm:ss.zzz AP");
+  stringAppender.setFormat(QStringLiteral("%{time}{") + twelveHourFormat + QStringLiteral("}"));
+  QCOMPARE(stringAppender.formattedString(timeStamp.addMSecs(5), Logger::Info, __FILE__, __LINE__, Q_FUNC_INFO,
+                                          QString(), QString()), timeStamp.addMSecs(5).toString(twelveHourFormat));
+  QVERIFY(stringAppender.formattedString(timeStamp.addMSecs(5), Logger::Info, __FILE__, __LINE__, Q_FUNC_INFO,
+                                         QString(), QString()).startsWith(QLatin1String("08:17:00.005")));
+}
+
+
+void BasicTest::testFormatUtf8()
+{
+  TestStringAppender stringAppender;
+  stringAppender.setFormat(QStringLiteral("%{time}{HH:mm:ss.zzz} [%{type:-7}] %{file}:%{line} <%{function:20}> "
+                                          "[%{category:-6}] %{message} \u00e9\n"));
+
+  // ASCII blocks, Latin-1 names, multibyte and surrogate pair characters
+  const QString messages[] = {
+    QStringLiteral("Plain ASCII message, long enough to be encoded in blocks"),
+    QStringLiteral("Caf\u00e9 \u041f\u0440\u0438\u0432\u0435\u0442 \u20ac and more ASCII after it \U0001F600")
+  };
+
+  const QDateTime timeStamp(QDate(2010, 12, 17), QTime(20, 17, 1, 5));
+  for (const QString& message : messages)
+  {
+    const QString expected = stringAppender.formattedString(timeStamp, Logger::Warning, "/path/to/fil\xe9.cpp", 42,
+                                                            Q_FUNC_INFO, QStringLiteral("utf8"), message);
+    QCOMPARE(stringAppender.formattedUtf8(timeStamp, Logger::Warning, "/path/to/fil\xe9.cpp", 42, Q_FUNC_INFO,
+                                          QStringLiteral("utf8"), message), expected.toUtf8());
+  }
+}
+
+
+void BasicTest::testFunctionNameCache()
+{
+  const QString stripped = AbstractStringAppender::stripFunctionName(Q_FUNC_INFO);
+  QCOMPARE(stripped, QStringLiteral("BasicTest::testFunctionNameCache"));
+
+  QCOMPARE(AbstractStringAppender::cachedFunctionName(Q_FUNC_INFO), stripped);
+  const quint64 hits = AbstractStringAppender::functionNameCacheHits();
+  QCOMPARE(AbstractStringAppender::cachedFunctionName(Q_FUNC_INFO), stripped);
+  QCOMPARE(AbstractStringAppender::functionNameCacheHits(), hits + 1);
+}
+
+
+void BasicTest::testCategory()
+{
+  TestAppender* categoryAppender = new TestAppender;
+  cuteLogger->registerCategoryAppender(QStringLiteral("test_category"), categoryAppender);
+
+  const LoggerCategory category = Logger::category("test_category");
+  QVERIFY(category.isValid());
+  QCOMPARE(Logger::category(QStringLiteral("test_category")), category);
+  QCOMPARE(category.name(), QStringLiteral("test_category"));
+
+  LOG_CDEBUG(category) << "Handle";
+  LOG_CDEBUG("test_category") << "Name";
+
+  QCOMPARE(categoryAppender->records.size(), 2);
+  QCOMPARE(categoryAppender->records.first().category, QStringLiteral("test_category"));
+  QCOMPARE(categoryAppender->records.last().message, QStringLiteral("Name"));
+  QCOMPARE(appender.records.size(), 0);
+
+  // The same buffer holding the different names at the same call site
+  char name[32];
+  const char* const names[] = { "test_category", "other_category" };
+  for (const char* categoryName : names)
+  {
+    qstrcpy(name, categoryName);
+    LOG_CDEBUG(name) << "Buffer";
+  }
+  QCOMPARE(categoryAppender->records.size(), 3);
+  QCOMPARE(categoryAppender->records.last().message, QStringLiteral("Buffer"));
+
+  cuteLogger->removeAppender(categoryAppender);
+  delete categoryAppender;
+  appender.clear();
+}
+
+
+void BasicTest::testLoggerParent()
+{
+  QVERIFY(!cuteLogger->parent());
+
+  Logger parentLogger(QStringLiteral("parent_category"));
+  TestAppender* parentAppender = new TestAppender;
+  parentLogger.registerCategoryAppender(QStringLiteral("child_category"), parentAppender);
+
+  {
+    LOG_CATEGORY(QStringLiteral("child_category"));
+    QCOMPARE(cuteLogger->parent(), Logger::globalInstance());
+
+    cuteLogger->setParent(&parentLogger);
+    QCOMPARE(cuteLogger->parent(), &parentLogger);
+    LOG_INFO("Forwarded");
+  }
+
+  QCOMPARE(parentAppender->records.size(), 1);
+  QCOMPARE(parentAppender->records.last().category, QStringLiteral("child_category"));
+  QCOMPARE(parentAppender->records.last().message, QStringLiteral("Forwarded"));
+  QCOMPARE(appender.records.size(), 0);
+
+  // Destroyed parent is replaced with the global instance
+  Logger child(QStringLiteral("child_category"));
+  {
+    Logger temporaryParent;
+    child.setParent(&temporaryParent);
+    QCOMPARE(child.parent(), &temporaryParent);
+  }
+  QCOMPARE(child.parent(), Logger::globalInstance());
+}
+
+
+void BasicTest::testQtCategoryFilter()
+{
+  // No appenders for the category, disabled at the source
+  QLoggingCategory qtCategory("qt_test_category");
+  QVERIFY(!qtCategory.isDebugEnabled());
+  QVERIFY(!qtCategory.isWarningEnabled());
+
+  TestAppender* categoryAppender = new TestAppender;
+  categoryAppender->setDetailsLevel(Logger::Warning);
+  cuteLogger->registerCategoryAppender(QStringLiteral("qt_test_category"), categoryAppender);
+  QVERIFY(!qtCategory.isDebugEnabled());
+  QVERIFY(qtCategory.isWarningEnabled());
+
+  qCWarning(qtCategory) << "Qt message";
+  qCWarning(qtCategory) << "Qt message";
+  QCOMPARE(categoryAppender->records.size(), 2);
+  QCOMPARE(categoryAppender->records.last().category, QStringLiteral("qt_test_category"));
+  QCOMPARE(appender.records.size(), 0);
+
+  cuteLogger->removeAppender(categoryAppender);
+  delete categoryAppender;
+  QVERIFY(!qtCategory.isWarningEnabled());
+}
+
+
+void BasicTest::testBufferedFileAppender()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const QString fileName = dir.path() + QStringLiteral("/buffered.log");
+
+  FileAppender* fileAppender = new FileAppender(fileName);
+  fileAppender->setFormat(QStringLiteral("%{message}\n"));
+  fileAppender->setBufferSize(1024 * 1024);
+  fileAppender->setMaxLatency(60 * 1000);
+  cuteLogger->registerAppender(fileAppender);
+
+  LOG_DEBUG("Buffered");
+  QCOMPARE(QFileInfo(fileName).size(), qint64(0));
+
+  // Errors are written immediately, together with the buffered records
+  LOG_ERROR("Error");
+  QFile file(fileName);
+  QVERIFY(file.open(QIODevice::ReadOnly | QIODevice::Text));
+  QCOMPARE(QString::fromUtf8(file.readAll()), QStringLiteral("Buffered\nError\n"));
+
+  cuteLogger->removeAppender(fileAppender);
+  delete fileAppender;
+  appender.clear();
+}
+
+
+#if defined(Q_OS_UNIX)
+void BasicTest::testConsoleAppender()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const QString fileName = dir.path() + QStringLiteral("/console.log");
+
+  // ConsoleAppender writes to stderr, redirect it to the file for the time of the test. The guard restores it even if
+  // the test fails halfway.
+  const int output = ::open(QFile::encodeName(fileName).constData(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  QVERIFY(output >= 0);
+  struct StderrGuard
+  {
+    int saved;
+    ~StderrGuard() { ::dup2(saved, STDERR_FILENO); ::close(saved); }
+  } stderrGuard = { ::dup(STDERR_FILENO) };
+  QVERIFY(stderrGuard.saved >= 0);
+  ::dup2(output, STDERR_FILENO);
+  ::close(output);
+
+  auto readOutput = [&fileName]() -> QString
+  {
+    QFile file(fileName);
+    return file.open(QIODevice::ReadOnly) ? QString::fromUtf8(file.readAll()) : QString();
+  };
+
+  // The environment pattern is read once, when the appender is created
+  qputenv("QT_MESSAGE_PATTERN", "env %{message}");
+  ConsoleAppender consoleAppender;
+  qunsetenv("QT_MESSAGE_PATTERN");
+  consoleAppender.setFormat(QStringLiteral("%{message}\n"));
+
+  auto writeRecord = [&consoleAppender](Logger::LogLevel logLevel, const QString& message)
+  {
+    consoleAppender.write(QDateTime::currentDateTime(), logLevel, __FILE__, __LINE__, Q_FUNC_INFO, QString(), message);
+  };
+
+  writeRecord(Logger::Info, QStringLiteral("Environment"));
+
+  // Ignoring the pattern recompiles the format
+  consoleAppender.ignoreEnvironmentPattern(true);
+  writeRecord(Logger::Info, QStringLiteral("Own"));
+  QCOMPARE(readOutput(), QStringLiteral("env Environment\nOwn\n"));
+
+  // Buffered records are written when the oldest one gets older than the latency
+  consoleAppender.setBufferSize(1024 * 1024);
+  consoleAppender.setMaxLatency(200);
+  writeRecord(Logger::Info, QStringLiteral("Buffered"));
+  QCOMPARE(readOutput(), QStringLiteral("env Environment\nOwn\n"));
+  QTRY_COMPARE_WITH_TIMEOUT(readOutput(), QStringLiteral("env Environment\nOwn\nBuffered\n"), 5000);
+
+  // Errors are written immediately, together with the buffered records
+  consoleAppender.setMaxLatency(60 * 1000);
+  writeRecord(Logger::Info, QStringLiteral("Pending"));
+  QCOMPARE(readOutput(), QStringLiteral("env Environment\nOwn\nBuffered\n"));
+  writeRecord(Logger::Error, QStringLiteral("Error"));
+  QCOMPARE(readOutput(), QStringLiteral("env Environment\nOwn\nBuffered\nPending\nError\n"));
+}
+#endif
+
+
+void BasicTest::testConcurrentFileAppender()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const QString fileName = dir.path() + QStringLiteral("/concurrent.log");
+
+  // Records are formatted concurrently, but every line is written as a whole
+  RollingFileAppender fileAppender(fileName);
+  fileAppender.setFormat(QStringLiteral("[%{type}] %{message}\n"));
+
+  QList<FileWriterThread*> threads;
+  for (int i = 0; i < 4; ++i)
+    threads.append(new FileWriterThread(&fileAppender));
+  foreach (FileWriterThread* thread, threads)
+    thread->start();
+  foreach (FileWriterThread* thread, threads)
+    thread->wait();
+  qDeleteAll(threads);
+
+  QFile file(fileName);
+  QVERIFY(file.open(QIODevice::ReadOnly | QIODevice::Text));
+  const QStringList lines = QString::fromUtf8(file.readAll()).split(QLatin1Char('\n'), QString::SkipEmptyParts);
+  QCOMPARE(lines.size(), 4000);
+  foreach (const QString& line, lines)
+    QVERIFY(line.startsWith(QStringLiteral("[Info] Message ")));
+}
+
+
+void BasicTest::testMmapFileAppender()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const QString fileName = dir.path() + QStringLiteral("/mmap.log");
+
+  // Small regions make the records cross the region boundaries
+  MmapFileAppender* mmapAppender = new MmapFileAppender(fileName);
+  mmapAppender->setFormat(QStringLiteral("%{message}\n"));
+  mmapAppender->setRegionSize(64 * 1024);
+  cuteLogger->registerAppender(mmapAppender);
+
+  QString expected;
+  for (int i = 0; i < 10000; ++i)
+  {
+    LOG_DEBUG("Record %d", i);
+    expected += QStringLiteral("Record %1\n").arg(i);
+  }
+
+  cuteLogger->removeAppender(mmapAppender);
+  delete mmapAppender;
+  appender.clear();
+
+  QFile file(fileName);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QCOMPARE(QString::fromUtf8(file.readAll()), expected);
+  file.close();
+
+  // The preallocated tail left by the crash is cut off before appending
+  QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+  file.write(QByteArray(100000, '\0'));
+  file.close();
+
+  MmapFileAppender reopenedAppender(fileName);
+  reopenedAppender.setFormat(QStringLiteral("%{message}\n"));
+  reopenedAppender.write(QDateTime::currentDateTime(), Logger::Info, __FILE__, __LINE__, Q_FUNC_INFO, QString(),
+                         QStringLiteral("After crash"));
+  reopenedAppender.flush();
+  reopenedAppender.setFileName(QString());
+
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QCOMPARE(QString::fromUtf8(file.readAll()), expected + QStringLiteral("After crash\n"));
+}
+
+
+void BasicTest::testRollingFileSize()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const QString fileName = dir.path() + QStringLiteral("/rolling.log");
+
+  // Left from the previous run, found by the directory scan
+  QFile oldFile(fileName + QStringLiteral(".0"));
+  QVERIFY(oldFile.open(QIODevice::WriteOnly));
+  oldFile.close();
+
+  RollingFileAppender* rollingAppender = new RollingFileAppender(fileName);
+  rollingAppender->setFormat(QStringLiteral("%{message}\n"));
+  rollingAppender->setMaxFileSize(100);
+  rollingAppender->setLogFilesLimit(3);
+  if (RollingFileAppender::isCompressionSupported(RollingFileAppender::GzipCompression))
+    rollingAppender->setCompression(RollingFileAppender::GzipCompression);
+  cuteLogger->registerAppender(rollingAppender);
+
+  // Every record is 10 bytes long, so the file is rolled over on every tenth record
+  for (int i = 0; i < 35; ++i)
+    LOG_DEBUG("Record %02d", i);
+
+  cuteLogger->removeAppender(rollingAppender);
+  rollingAppender->waitForBackgroundTasks();
+  const QString compressedSuffix = (rollingAppender->compression() == RollingFileAppender::GzipCompression)
+                                   ? QStringLiteral(".gz") : QString();
+  delete rollingAppender;
+  appender.clear();
+
+  // Only the current file and two most recent rolled over files are left
+  QVERIFY(QFile::exists(fileName));
+  QVERIFY(!QFile::exists(fileName + QStringLiteral(".0")));
+  QVERIFY(!QFile::exists(fileName + QStringLiteral(".1") + compressedSuffix));
+  QVERIFY(QFile::exists(fileName + QStringLiteral(".2") + compressedSuffix));
+  QVERIFY(QFile::exists(fileName + QStringLiteral(".3") + compressedSuffix));
+  QCOMPARE(QFileInfo(fileName).size(), qint64(50));
+}
+
+
+void BasicTest::testBinaryFileAppender()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const QString fileName = dir.path() + QStringLiteral("/binary.clog");
+
+  BinaryFileAppender* binaryAppender = new BinaryFileAppender(fileName);
+  cuteLogger->registerAppender(binaryAppender);
+
+  for (int i = 0; i < 3; ++i)
+    LOG_DEBUG("Binary record");
+
+  cuteLogger->removeAppender(binaryAppender);
+  delete binaryAppender;
+  appender.clear();
+
+  QFile file(fileName);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  const QByteArray data = file.readAll();
+
+  // The call site is written once, while every record carries its own message
+  QVERIFY(data.startsWith(BinaryFileAppender::fileMagic));
+  QCOMPARE(data.count(QByteArray(__FILE__)), 1);
+  QCOMPARE(data.count(QByteArray("Binary record")), 3);
+}
+
+
+void BasicTest::testStructuredFields()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const QString textFileName = dir.path() + QStringLiteral("/fields.log");
+  const QString jsonFileName = dir.path() + QStringLiteral("/fields.json");
+
+  FileAppender* textAppender = new FileAppender(textFileName);
+  textAppender->setFormat(QStringLiteral("%{message}\n"));
+  JsonAppender* jsonAppender = new JsonAppender(jsonFileName);
+  cuteLogger->registerAppender(textAppender);
+  cuteLogger->registerAppender(jsonAppender);
+
+  LOG_INFO_KV("req done", "ms", 12, "status", "ok go", "cached", false, "ratio", 0.5);
+
+  cuteLogger->removeAppender(textAppender);
+  cuteLogger->removeAppender(jsonAppender);
+  delete textAppender;
+  delete jsonAppender;
+  appender.clear();
+
+  QFile textFile(textFileName);
+  QVERIFY(textFile.open(QIODevice::ReadOnly | QIODevice::Text));
+  QCOMPARE(QString::fromUtf8(textFile.readAll()), QStringLiteral("req done ms=12 status=\"ok go\" cached=false ratio=0.5\n"));
+
+  QFile jsonFile(jsonFileName);
+  QVERIFY(jsonFile.open(QIODevice::ReadOnly | QIODevice::Text));
+  const QByteArray line = jsonFile.readAll();
+  QVERIFY(line.endsWith('\n'));
+  const QJsonObject record = QJsonDocument::fromJson(line).object();
+  QCOMPARE(record.value(QStringLiteral("level")).toString(), QStringLiteral("Info"));
+  QCOMPARE(record.value(QStringLiteral("message")).toString(), QStringLiteral("req done"));
+  QVERIFY(record.value(QStringLiteral("time")).toString().endsWith(QLatin1Char('Z')));
+  const QJsonObject fields = record.value(QStringLiteral("fields")).toObject();
+  QCOMPARE(fields.value(QStringLiteral("ms")).toInt(), 12);
+  QCOMPARE(fields.value(QStringLiteral("status")).toString(), QStringLiteral("ok go"));
+  QCOMPARE(fields.value(QStringLiteral("cached")).toBool(true), false);
+  QCOMPARE(fields.value(QStringLiteral("ratio")).toDouble(), 0.5);
+}
+
+
+#if defined(Q_OS_UNIX) && !defined(Q_OS_ANDROID)
+void BasicTest::testSharedMemoryAppender()
+{
+  TestAppender collected;
+  collected.setDetailsLevel(Logger::Trace);
+
+  const QString prefix = QStringLiteral("cuteloggertest");
+  SharedMemoryAppender* writer = new SharedMemoryAppender(prefix, 16);
+  QVERIFY(writer->isValid());
+
+  SharedMemoryCollector collector(&collected, prefix);
+  QVERIFY(collector.addSegment(writer->segmentName()));
+
+  cuteLogger->registerAppender(writer);
+  LOG_INFO("Through the shared memory");
+  for (int i = 0; i < 20; ++i)
+    LOG_DEBUG("Record %d", i);
+  cuteLogger->removeAppender(writer);
+
+  // Nothing is taken from the ring yet, so the last records don't fit
+  QCOMPARE(writer->droppedRecords(), quint64(5));
+  delete writer;
+  appender.clear();
+
+  // The records are still there after the appender is gone
+  QCOMPARE(collector.collect(), 16);
+  QCOMPARE(collected.records.size(), 17);
+  QCOMPARE(collected.records.first().logLevel, Logger::Info);
+  QCOMPARE(collected.records.first().message, QStringLiteral("Through the shared memory"));
+  QCOMPARE(QByteArray(collected.records.first().file), QByteArray(__FILE__));
+  QCOMPARE(collected.records.at(15).message, QStringLiteral("Record 14"));
+  QCOMPARE(collected.records.last().logLevel, Logger::Warning);
+  QCOMPARE(collector.droppedRecords(), quint64(5));
+
+  // The segment of the closed appender is removed
+  QCOMPARE(collector.segmentCount(), 0);
+
+  // Nothing is left to collect, so the appender removes its segment itself
+  SharedMemoryAppender* idle = new SharedMemoryAppender(prefix, 16);
+  QVERIFY(idle->isValid());
+  const QString idleName = idle->segmentName();
+  delete idle;
+  QVERIFY(!collector.addSegment(idleName));
+}
+#endif
+
+
+#if defined(CUTELOGGER_NETWORK)
+void BasicTest::testNetworkAppender()
+{
+  QUdpSocket collector;
+  QVERIFY(collector.bind(QHostAddress::LocalHost, 0));
+
+  NetworkAppender* networkAppender = new NetworkAppender(QStringLiteral("127.0.0.1"), collector.localPort(),
+                                                         NetworkAppender::GelfUdp);
+  networkAppender->setFormat(QStringLiteral("%{message}"));
+  cuteLogger->registerAppender(networkAppender);
+
+  LOG_WARNING("Quoted \"message\"");
+  QVERIFY(networkAppender->flush());
+
+  QVERIFY(collector.hasPendingDatagrams() || collector.waitForReadyRead(5000));
+  QByteArray datagram(int(collector.pendingDatagramSize()), Qt::Uninitialized);
+  collector.readDatagram(datagram.data(), datagram.size());
+
+  QVERIFY(datagram.contains("\"short_message\":\"Quoted \\\"message\\\"\""));
+  QVERIFY(datagram.contains("\"level\":4"));
+  QCOMPARE(networkAppender->droppedRecords(), quint64(0));
+
+  cuteLogger->removeAppender(networkAppender);
+  delete networkAppender;
+  appender.clear();
+}
+#endif
+
+
 void BasicTest::cleanupTestCase()
 {
   cuteLogger->removeAppender(&appender);
@@ -120,5 +984,11 @@ int BasicTest::testQDebugInt()
 }
 
 
+int BasicTest::countEvaluation()
+{
+  return ++m_evaluations;
+}
+
+
 QTEST_MAIN(BasicTest)
 #include "basictest.moc"
@@ -0,0 +1,115 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// cutelog-collector: writes the records of the processes using SharedMemoryAppender to the single log file
+
+// Local
+#include <RollingFileAppender.h>
+#include <SharedMemoryAppender.h>
+
+// Qt
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QThread>
+
+// STL
+#include <csignal>
+#include <cstdio>
+
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+
+static void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName(QStringLiteral("cutelog-collector"));
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(QStringLiteral("Collects the records written by the CuteLogger SharedMemoryAppender"));
+  parser.addHelpOption();
+
+  RollingFileAppender appender;
+  QCommandLineOption prefixOption(QStringList() << QStringLiteral("p") << QStringLiteral("prefix"),
+                                  QStringLiteral("Prefix of the shared memory segment names."),
+                                  QStringLiteral("prefix"), SharedMemoryAppender::defaultPrefix());
+  QCommandLineOption formatOption(QStringList() << QStringLiteral("f") << QStringLiteral("format"),
+                                  QStringLiteral("AbstractStringAppender format of the records."),
+                                  QStringLiteral("format"), appender.format());
+  QCommandLineOption intervalOption(QStringList() << QStringLiteral("i") << QStringLiteral("interval"),
+                                    QStringLiteral("Milliseconds to wait when there are no records."),
+                                    QStringLiteral("msecs"), QStringLiteral("100"));
+  QCommandLineOption batchOption(QStringList() << QStringLiteral("b") << QStringLiteral("batch"),
+                                 QStringLiteral("Maximum number of the records written at once."),
+                                 QStringLiteral("records"), QStringLiteral("1024"));
+  QCommandLineOption maxSizeOption(QStringList() << QStringLiteral("s") << QStringLiteral("max-size"),
+                                   QStringLiteral("Rolls the file over when it grows larger than the size."),
+                                   QStringLiteral("bytes"), QStringLiteral("0"));
+  QCommandLineOption filesOption(QStringList() << QStringLiteral("n") << QStringLiteral("files"),
+                                 QStringLiteral("Number of the rolled over files to keep."),
+                                 QStringLiteral("count"), QStringLiteral("0"));
+  parser.addOption(prefixOption);
+  parser.addOption(formatOption);
+  parser.addOption(intervalOption);
+  parser.addOption(batchOption);
+  parser.addOption(maxSizeOption);
+  parser.addOption(filesOption);
+  parser.addPositionalArgument(QStringLiteral("file"), QStringLiteral("Log file to write the records to."));
+  parser.process(app);
+
+  if (parser.positionalArguments().size() != 1)
+    parser.showHelp(1);
+
+  // Format is given in a single line, so allow the escaped new line at its end
+  QString format = parser.value(formatOption);
+  format.replace(QLatin1String("\\n"), QLatin1String("\n"));
+  if (!format.endsWith(QLatin1Char('\n')))
+    format.append(QLatin1Char('\n'));
+  appender.setFormat(format);
+
+  // The records come in batches anyway, so the file is written in the large chunks
+  appender.setFileName(parser.positionalArguments().first());
+  appender.setDetailsLevel(Logger::Trace);
+  appender.setBufferSize(256 * 1024);
+  appender.setMaxLatency(1000);
+  appender.setMaxFileSize(parser.value(maxSizeOption).toLongLong());
+  appender.setLogFilesLimit(parser.value(filesOption).toInt());
+
+  const int interval = qMax(1, parser.value(intervalOption).toInt());
+  const int batchSize = qMax(1, parser.value(batchOption).toInt());
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  SharedMemoryCollector collector(&appender, parser.value(prefixOption));
+  while (!stopRequested)
+  {
+    if (collector.collect(batchSize) == 0)
+      QThread::msleep(interval);
+  }
+
+  // Take what was written before the stop
+  collector.collect(batchSize);
+  appender.flush();
+
+  if (collector.droppedRecords())
+    std::fprintf(stderr, "%llu records were dropped by the writers\n", qulonglong(collector.droppedRecords()));
+
+  return 0;
+}
@@ -0,0 +1,210 @@
+/*
+  Copyright (c) 2010 Boris Moiseev (cyberbobs at gmail dot com)
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1
+  as published by the Free Software Foundation and appearing in the file
+  LICENSE.LGPL included in the packaging of this file.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+*/
+// cutelog-decode: renders the files written by BinaryFileAppender as text
+
+// Local
+#include <AbstractStringAppender.h>
+#include <BinaryFileAppender.h>
+
+// Qt
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QTextStream>
+
+// STL
+#include <cstdio>
+
+
+// Only used to format the records
+class DecodeAppender : public AbstractStringAppender
+{
+  public:
+    using AbstractStringAppender::formattedString;
+
+  protected:
+    virtual void append(const QDateTime&, Logger::LogLevel, const char*, int, const char*, const QString&,
+                        const QString&)
+    {}
+};
+
+
+struct CallSite
+{
+  int line;
+  QByteArray file;
+  QByteArray function;
+};
+
+
+static QByteArray readString(QDataStream& stream)
+{
+  quint32 size = 0;
+  stream >> size;
+  if (stream.status() != QDataStream::Ok)
+    return QByteArray();
+
+  // The size comes from the file, so it is checked before allocating anything
+  const qint64 available = stream.device()->size() - stream.device()->pos();
+  if (qint64(size) > available)
+  {
+    stream.setStatus(QDataStream::ReadCorruptData);
+    return QByteArray();
+  }
+
+  QByteArray result(int(size), Qt::Uninitialized);
+  if (stream.readRawData(result.data(), int(size)) != int(size))
+    return QByteArray();
+
+  return result;
+}
+
+
+static bool decodeFile(const QString& fileName, const DecodeAppender& appender, QTextStream& output)
+{
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    std::fprintf(stderr, "Cannot open %s\n", qPrintable(fileName));
+    return false;
+  }
+
+  QDataStream stream(&file);
+  stream.setByteOrder(QDataStream::LittleEndian);
+
+  const int magicSize = int(qstrlen(BinaryFileAppender::fileMagic));
+  QByteArray magic(magicSize, Qt::Uninitialized);
+  quint32 version = 0;
+  stream.readRawData(magic.data(), magicSize);
+  stream >> version;
+  if (magic != BinaryFileAppender::fileMagic || version != BinaryFileAppender::fileVersion)
+  {
+    std::fprintf(stderr, "%s is not a CuteLogger binary log file\n", qPrintable(fileName));
+    return false;
+  }
+
+  QHash<quint32, CallSite> callSites;
+  QHash<quint32, QString> categories;
+
+  while (!stream.atEnd())
+  {
+    quint8 type = 0;
+    stream >> type;
+
+    switch (type)
+    {
+      case BinaryFileAppender::CallSiteEntry:
+      {
+        quint32 id = 0;
+        qint32 line = 0;
+        stream >> id >> line;
+        const QByteArray siteFile = readString(stream);
+        const QByteArray function = readString(stream);
+
+        CallSite site = { line, siteFile, function };
+        callSites.insert(id, site);
+        break;
+      }
+
+      case BinaryFileAppender::CategoryEntry:
+      {
+        quint32 id = 0;
+        stream >> id;
+        categories.insert(id, QString::fromUtf8(readString(stream)));
+        break;
+      }
+
+      case BinaryFileAppender::RecordEntry:
+      {
+        qint64 timeStamp = 0;
+        quint8 level = 0;
+        quint32 siteId = 0;
+        quint32 categoryId = 0;
+        stream >> timeStamp >> level >> siteId >> categoryId;
+        const QString message = QString::fromUtf8(readString(stream));
+
+        if (stream.status() != QDataStream::Ok)
+          break;
+
+        // The function names of the records without the LogSite are stripped without caching them by the pointer, so
+        // the names of the call sites may be freed with the dictionary of the file
+        const CallSite site = callSites.value(siteId, CallSite { 0, QByteArray(), QByteArray() });
+        output << appender.formattedString(QDateTime::fromMSecsSinceEpoch(timeStamp),
+                                           Logger::LogLevel(qMin(int(level), int(Logger::Fatal))),
+                                           site.file.constData(), site.line, site.function.constData(),
+                                           categories.value(categoryId), message);
+        break;
+      }
+
+      default:
+        std::fprintf(stderr, "%s: unknown entry type %d, the file is corrupted\n", qPrintable(fileName), int(type));
+        return false;
+    }
+
+    if (stream.status() == QDataStream::ReadCorruptData)
+    {
+      std::fprintf(stderr, "%s: string is longer than the rest of the file, the file is corrupted\n",
+                   qPrintable(fileName));
+      return false;
+    }
+    else if (stream.status() != QDataStream::Ok)
+    {
+      std::fprintf(stderr, "%s: unexpected end of file\n", qPrintable(fileName));
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName(QStringLiteral("cutelog-decode"));
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(QStringLiteral("Renders the CuteLogger binary log files as text"));
+  parser.addHelpOption();
+
+  DecodeAppender appender;
+  QCommandLineOption formatOption(QStringList() << QStringLiteral("f") << QStringLiteral("format"),
+                                  QStringLiteral("AbstractStringAppender format of the records."),
+                                  QStringLiteral("format"), appender.format());
+  parser.addOption(formatOption);
+  parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("Binary log files to decode."),
+                               QStringLiteral("files..."));
+  parser.process(app);
+
+  if (parser.positionalArguments().isEmpty())
+    parser.showHelp(1);
+
+  // Format is given in a single line, so allow the escaped new line at its end
+  QString format = parser.value(formatOption);
+  format.replace(QLatin1String("\\n"), QLatin1String("\n"));
+  if (!format.endsWith(QLatin1Char('\n')))
+    format.append(QLatin1Char('\n'));
+  appender.setFormat(format);
+
+  QTextStream output(stdout);
+
+  bool ok = true;
+  foreach (const QString& fileName, parser.positionalArguments())
+    ok = decodeFile(fileName, appender, output) && ok;
+
+  return ok ? 0 : 1;
+}